@@ -52,12 +52,7 @@ class ReadThread : public Thread {
           mCommandMQ(commandMQ),
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
-          mEfGroup(efGroup),
-          mBuffer(nullptr) {}
-    bool init() {
-        mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
-        return mBuffer != nullptr;
-    }
+          mEfGroup(efGroup) {}
     virtual ~ReadThread() {}
 
    private:
@@ -67,7 +62,6 @@ class ReadThread : public Thread {
     StreamIn::DataMQ* mDataMQ;
     StreamIn::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
-    std::unique_ptr<uint8_t[]> mBuffer;
     IStreamIn::ReadParameters mParameters;
     IStreamIn::ReadStatus mStatus;
 
@@ -87,11 +81,21 @@ void ReadThread::doRead() {
             (int32_t)requestedToRead, (int32_t)availableToWrite);
         requestedToRead = availableToWrite;
     }
-    ssize_t readResult = mStream->read(mStream, &mBuffer[0], requestedToRead);
+    // The legacy HAL writes the data straight into the queue.
+    StreamIn::DataMQ::MemTransaction tx;
+    if (!mDataMQ->beginWrite(requestedToRead, &tx)) {
+        ALOGW("data message queue write failed");
+        mStatus.retval = Result::INVALID_STATE;
+        return;
+    }
+    ssize_t readResult =
+            util::transferInPlace(tx, requestedToRead, [this](uint8_t* data, size_t size) {
+                return mStream->read(mStream, data, size);
+            });
     mStatus.retval = Result::OK;
     if (readResult >= 0) {
         mStatus.reply.read = readResult;
-        if (!mDataMQ->write(&mBuffer[0], readResult)) {
+        if (!mDataMQ->commitWrite(readResult)) {
             ALOGW("data message queue write failed");
         }
     } else {
@@ -415,11 +419,6 @@ Return<void> StreamIn::prepareForReading(uint32_t frameSize, uint32_t framesCoun
     auto tempReadThread =
         std::make_unique<ReadThread>(&mStopReadThread, mStream, tempCommandMQ.get(),
                                      tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
-    if (!tempReadThread->init()) {
-        ALOGW("failed to start reader thread: %s", strerror(-status));
-        sendError(Result::INVALID_ARGUMENTS);
-        return Void();
-    }
     status = tempReadThread->run("reader", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start reader thread: %s", strerror(-status));
@@ -55,12 +55,7 @@ class WriteThread : public Thread {
           mCommandMQ(commandMQ),
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
-          mEfGroup(efGroup),
-          mBuffer(nullptr) {}
-    bool init() {
-        mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
-        return mBuffer != nullptr;
-    }
+          mEfGroup(efGroup) {}
     virtual ~WriteThread() {}
 
    private:
@@ -70,7 +65,6 @@ class WriteThread : public Thread {
     StreamOut::DataMQ* mDataMQ;
     StreamOut::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
-    std::unique_ptr<uint8_t[]> mBuffer;
     IStreamOut::WriteStatus mStatus;
 
     bool threadLoop() override;
@@ -84,8 +78,15 @@ void WriteThread::doWrite() {
     const size_t availToRead = mDataMQ->availableToRead();
     mStatus.retval = Result::OK;
     mStatus.reply.written = 0;
-    if (mDataMQ->read(&mBuffer[0], availToRead)) {
-        ssize_t writeResult = mStream->write(mStream, &mBuffer[0], availToRead);
+    // The legacy HAL reads the data straight out of the queue. The whole contents are consumed
+    // regardless of how much of it the HAL accepts, as the client resends what was not written.
+    StreamOut::DataMQ::MemTransaction tx;
+    if (mDataMQ->beginRead(availToRead, &tx)) {
+        ssize_t writeResult =
+                util::transferInPlace(tx, availToRead, [this](uint8_t* data, size_t size) {
+                    return mStream->write(mStream, data, size);
+                });
+        mDataMQ->commitRead(availToRead);
         if (writeResult >= 0) {
             mStatus.reply.written = writeResult;
         } else {
@@ -401,11 +402,6 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize, uint32_t framesCou
     auto tempWriteThread =
         std::make_unique<WriteThread>(&mStopWriteThread, mStream, tempCommandMQ.get(),
                                       tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
-    if (!tempWriteThread->init()) {
-        ALOGW("failed to start writer thread: %s", strerror(-status));
-        sendError(Result::INVALID_ARGUMENTS);
-        return Void();
-    }
     status = tempWriteThread->run("writer", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start writer thread: %s", strerror(-status));
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <log/log.h>
+
+#include "core/default/Util.h"
+
+#include <string.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <fmq/MessageQueue.h>
+#include <hardware/audio.h>
+
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::audio::CPP_VERSION::implementation::util::transferInPlace;
+
+namespace {
+
+using DataMQ = MessageQueue<uint8_t, kSynchronizedReadWrite>;
+
+// Each benchmark iteration moves one second of 48 kHz, 8 channel, 16-bit PCM through the data
+// queue in 20 ms bursts, so the reported CPU time is the cost per second of audio played.
+constexpr size_t kSampleRate = 48000;
+constexpr size_t kFrameSize = 8 * sizeof(int16_t);
+constexpr size_t kBurstFrames = kSampleRate / 50;
+constexpr size_t kBurstSize = kBurstFrames * kFrameSize;
+constexpr size_t kBurstsPerSecond = kSampleRate / kBurstFrames;
+// Not a multiple of the burst size, so every other burst wraps around the end of the queue.
+constexpr size_t kQueueSize = kBurstSize * 3 / 2;
+
+// A legacy output stream that copies whatever it is given into its own buffer, as a HAL handing
+// the data to the hardware would.
+struct StubStreamOut {
+    audio_stream_out_t stream;  // Must be first, the HAL functions receive a pointer to it.
+    std::vector<uint8_t> sink;
+};
+
+ssize_t stubWrite(audio_stream_out_t* stream, const void* buffer, size_t bytes) {
+    auto* stub = reinterpret_cast<StubStreamOut*>(stream);
+    memcpy(stub->sink.data(), buffer, bytes);
+    return bytes;
+}
+
+// Runs the client side of the loopback, and `doWrite` for each burst in place of the HAL's
+// WriteThread.
+template <typename DoWrite>
+void runLoopback(benchmark::State& state, const DoWrite& doWrite) {
+    DataMQ dataMQ(kQueueSize, false /* EventFlag */);
+    StubStreamOut stub = {};
+    stub.stream.write = stubWrite;
+    stub.sink.resize(kBurstSize);
+    const std::vector<uint8_t> source(kBurstSize, 0x55);
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < kBurstsPerSecond; ++i) {
+            if (!dataMQ.write(source.data(), kBurstSize)) {
+                state.SkipWithError("data message queue write failed");
+                return;
+            }
+            const ssize_t written = doWrite(&dataMQ, &stub.stream);
+            if (written != static_cast<ssize_t>(kBurstSize)) {
+                state.SkipWithError("stream write failed");
+                return;
+            }
+            benchmark::ClobberMemory();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * kBurstsPerSecond * kBurstSize);
+}
+
+// The stream reads straight out of the queue, as StreamOut's WriteThread does.
+void BM_WriteInPlace(benchmark::State& state) {
+    runLoopback(state, [](DataMQ* dataMQ, audio_stream_out_t* stream) -> ssize_t {
+        const size_t availToRead = dataMQ->availableToRead();
+        DataMQ::MemTransaction tx;
+        if (!dataMQ->beginRead(availToRead, &tx)) {
+            return -1;
+        }
+        const ssize_t written =
+                transferInPlace(tx, availToRead, [stream](uint8_t* data, size_t size) {
+                    return stream->write(stream, data, size);
+                });
+        dataMQ->commitRead(availToRead);
+        return written;
+    });
+}
+
+// The data is first copied out of the queue into a staging buffer, for comparison with
+// BM_WriteInPlace.
+void BM_WriteStaged(benchmark::State& state) {
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[kQueueSize]);
+    runLoopback(state, [&buffer](DataMQ* dataMQ, audio_stream_out_t* stream) -> ssize_t {
+        const size_t availToRead = dataMQ->availableToRead();
+        if (!dataMQ->read(&buffer[0], availToRead)) {
+            return -1;
+        }
+        return stream->write(stream, &buffer[0], availToRead);
+    });
+}
+
+BENCHMARK(BM_WriteInPlace)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_WriteStaged)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
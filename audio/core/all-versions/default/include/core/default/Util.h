@@ -19,6 +19,7 @@
 
 #include PATH(android/hardware/audio/FILE_VERSION/types.h)
 
+#include <sys/types.h>
 #include <algorithm>
 #include <vector>
 
@@ -70,6 +71,29 @@ static inline Result analyzeStatus(const char* className, const char* funcName,
     return analyzeStatus(status);
 }
 
+/**
+ * Calls `transfer(address, length)` on the regions of an FMQ transaction that cover its first
+ * `size` bytes, so the legacy HAL can read from or write to the queue memory directly. This takes
+ * one call, or two when the bytes wrap around the end of the queue.
+ *
+ * @return the total byte count transferred, or the error from the first call. The second region is
+ *     only attempted if the first one was transferred completely, and an error from it is not
+ *     reported since part of the data has already been transferred.
+ */
+template <typename MemTransaction, typename Transfer>
+ssize_t transferInPlace(const MemTransaction& tx, size_t size, const Transfer& transfer) {
+    const auto& first = tx.getFirstRegion();
+    const size_t firstLength = std::min(size, first.getLength());
+    const ssize_t firstResult = transfer(first.getAddress(), firstLength);
+    if (firstResult < 0 || static_cast<size_t>(firstResult) < firstLength ||
+        firstLength == size) {
+        return firstResult;
+    }
+    const ssize_t secondResult =
+            transfer(tx.getSecondRegion().getAddress(), size - firstLength);
+    return secondResult < 0 ? firstResult : firstResult + secondResult;
+}
+
 }  // namespace util
 }  // namespace implementation
 }  // namespace CPP_VERSION
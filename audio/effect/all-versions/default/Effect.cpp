@@ -53,7 +53,8 @@ class ProcessThread : public Thread {
     // ProcessThread's lifespan never exceeds Effect's lifespan.
     ProcessThread(std::atomic<bool>* stop, effect_handle_t effect,
                   std::atomic<audio_buffer_t*>* inBuffer, std::atomic<audio_buffer_t*>* outBuffer,
-                  Effect::StatusMQ* statusMQ, EventFlag* efGroup)
+                  Effect::StatusMQ* statusMQ, EventFlag* efGroup, EffectChain* chain,
+                  EffectChain::Member* chainMember)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mEffect(effect),
@@ -61,7 +62,9 @@ class ProcessThread : public Thread {
           mInBuffer(inBuffer),
           mOutBuffer(outBuffer),
           mStatusMQ(statusMQ),
-          mEfGroup(efGroup) {}
+          mEfGroup(efGroup),
+          mChain(chain),
+          mChainMember(chainMember) {}
     virtual ~ProcessThread() {}
 
    private:
@@ -72,6 +75,8 @@ class ProcessThread : public Thread {
     std::atomic<audio_buffer_t*>* mOutBuffer;
     Effect::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
+    EffectChain* mChain;  // nullptr unless the effect is chained.
+    EffectChain::Member* mChainMember;
 
     bool threadLoop() override;
 };
@@ -86,6 +91,13 @@ bool ProcessThread::threadLoop() {
             (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_QUIT))) {
             continue;  // Nothing to do or time to quit.
         }
+        if (mChain != nullptr &&
+            (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS))) {
+            if (EffectChain::consumeRanAhead(mChainMember)) {
+                continue;  // Already processed by the chain, and the client has been notified.
+            }
+            mChain->onRequest(mChainMember);
+        }
         Result retval = Result::OK;
         if (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS_REVERSE) &&
             !mHasProcessReverse) {
@@ -111,23 +123,15 @@ bool ProcessThread::threadLoop() {
                 ALOGE("processing buffers were not set before calling 'process'");
                 processResult = -ENODEV;
             }
-            switch (processResult) {
-                case 0:
-                    retval = Result::OK;
-                    break;
-                case -ENODATA:
-                    retval = Result::INVALID_STATE;
-                    break;
-                case -EINVAL:
-                    retval = Result::INVALID_ARGUMENTS;
-                    break;
-                default:
-                    retval = Result::NOT_INITIALIZED;
-            }
+            retval = EffectChain::processResultToResult(processResult);
         }
         if (!mStatusMQ->write(&retval)) {
             ALOGW("status message queue write failed");
         }
+        if (mChain != nullptr && retval == Result::OK &&
+            (efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS))) {
+            mChain->runAhead(mChainMember);
+        }
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING));
     }
 
@@ -356,9 +360,18 @@ Return<void> Effect::prepareForProcessing(prepareForProcessing_cb _hidl_cb) {
         return Void();
     }
 
+    // Join the chain of the session, if the effect was registered for chained processing.
+    mChain = EffectChain::getForEffect(mHandle);
+    mChainMember.handle = mHandle;
+    mChainMember.inBuffer = &mHalInBufferPtr;
+    mChainMember.outBuffer = &mHalOutBufferPtr;
+    mChainMember.statusMQ = tempStatusMQ.get();
+    mChainMember.efGroup = mEfGroup;
+
     // Create and launch the thread.
-    mProcessThread = new ProcessThread(&mStopProcessThread, mHandle, &mHalInBufferPtr,
-                                       &mHalOutBufferPtr, tempStatusMQ.get(), mEfGroup);
+    mProcessThread =
+            new ProcessThread(&mStopProcessThread, mHandle, &mHalInBufferPtr, &mHalOutBufferPtr,
+                              tempStatusMQ.get(), mEfGroup, mChain.get(), &mChainMember);
     status = mProcessThread->run("effect", PRIORITY_URGENT_AUDIO);
     if (status != OK) {
         ALOGW("failed to start effect processing thread: %s", strerror(-status));
@@ -367,6 +380,9 @@ Return<void> Effect::prepareForProcessing(prepareForProcessing_cb _hidl_cb) {
     }
 
     mStatusMQ = std::move(tempStatusMQ);
+    if (mChain != nullptr) {
+        mChain->attach(&mChainMember);
+    }
     _hidl_cb(Result::OK, *mStatusMQ->getDesc());
     return Void();
 }
@@ -416,6 +432,24 @@ Result Effect::sendCommandReturningData(int commandCode, const char* commandName
     return analyzeCommandStatus(commandName, sContextCallToCommand, status);
 }
 
+bool Effect::sendEnableCommand(uint32_t commandId, const SendEnableCommand& send) {
+    auto setChainMemberEnabled = [this](bool enabled) {
+        if (mChainMember.enabled.exchange(enabled, std::memory_order_relaxed) != enabled &&
+            mChain != nullptr) {
+            mChain->reset();
+        }
+    };
+    if (commandId == EFFECT_CMD_DISABLE) {
+        // Stop processing the effect ahead before the HAL sees it disabled.
+        setChainMemberEnabled(false);
+    }
+    const bool succeeded = send();
+    if (commandId == EFFECT_CMD_ENABLE && succeeded) {
+        setChainMemberEnabled(true);
+    }
+    return succeeded;
+}
+
 Result Effect::sendCommandReturningStatus(int commandCode, const char* commandName) {
     return sendCommandReturningStatus(commandCode, commandName, 0, NULL);
 }
@@ -486,11 +520,21 @@ Return<Result> Effect::reset() {
 }
 
 Return<Result> Effect::enable() {
-    return sendCommandReturningStatus(EFFECT_CMD_ENABLE, "ENABLE");
+    Result retval;
+    sendEnableCommand(EFFECT_CMD_ENABLE, [&] {
+        retval = sendCommandReturningStatus(EFFECT_CMD_ENABLE, "ENABLE");
+        return retval == Result::OK;
+    });
+    return retval;
 }
 
 Return<Result> Effect::disable() {
-    return sendCommandReturningStatus(EFFECT_CMD_DISABLE, "DISABLE");
+    Result retval;
+    sendEnableCommand(EFFECT_CMD_DISABLE, [&] {
+        retval = sendCommandReturningStatus(EFFECT_CMD_DISABLE, "DISABLE");
+        return retval == Result::OK;
+    });
+    return retval;
 }
 
 Return<Result> Effect::setAudioSource(
@@ -661,8 +705,19 @@ Return<void> Effect::command(uint32_t commandId, const hidl_vec<uint8_t>& data,
 
     void* dataPtr = halDataSize > 0 ? &halData[0] : NULL;
     void* resultPtr = halResultSize > 0 ? &halResult[0] : NULL;
-    status_t status =
-        (*mHandle)->command(mHandle, commandId, halDataSize, dataPtr, &halResultSize, resultPtr);
+    status_t status;
+    auto sendToHal = [&] {
+        status = (*mHandle)->command(mHandle, commandId, halDataSize, dataPtr, &halResultSize,
+                                     resultPtr);
+        // Commands that reply with a status report a failure there.
+        return status == OK && (resultPtr == NULL || halResultSize < sizeof(int32_t) ||
+                                *static_cast<int32_t*>(resultPtr) == 0);
+    };
+    if (commandId == EFFECT_CMD_ENABLE || commandId == EFFECT_CMD_DISABLE) {
+        sendEnableCommand(commandId, sendToHal);
+    } else {
+        sendToHal();
+    }
     hidl_vec<uint8_t> result;
     if (status == OK && resultPtr != NULL) {
         result.setToExternal(&halResult[0], halResultSize);
@@ -732,6 +787,10 @@ Return<Result> Effect::close() {
     if (mEfGroup) {
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_QUIT));
     }
+    if (mChain != nullptr) {
+        mChain->detach(&mChainMember);
+    }
+    EffectChain::unregisterEffect(mHandle);
 #if MAJOR_VERSION <= 5
     return Result::OK;
 #elif MAJOR_VERSION >= 6
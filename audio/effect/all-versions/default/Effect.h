@@ -20,6 +20,7 @@
 #include PATH(android/hardware/audio/effect/FILE_VERSION/IEffect.h)
 
 #include "AudioBufferManager.h"
+#include "EffectChain.h"
 
 #include <atomic>
 #include <memory>
@@ -173,6 +174,7 @@ struct Effect : public IEffect {
     friend struct VisualizerEffect;   // to allow executing commands
 
     using CommandSuccessCallback = std::function<void()>;
+    using SendEnableCommand = std::function<bool()>;
     using GetConfigCallback = std::function<void(Result retval, const EffectConfig& config)>;
     using GetCurrentConfigSuccessCallback = std::function<void(void* configData)>;
     using GetSupportedConfigsSuccessCallback =
@@ -192,6 +194,9 @@ struct Effect : public IEffect {
     EventFlag* mEfGroup;
     std::atomic<bool> mStopProcessThread;
     sp<Thread> mProcessThread;
+    // Set if the effect was registered for chained processing.
+    sp<EffectChain> mChain;
+    EffectChain::Member mChainMember;
 
     virtual ~Effect();
 
@@ -220,6 +225,9 @@ struct Effect : public IEffect {
                                     void* replyData);
     Result sendCommandReturningData(int commandCode, const char* commandName, uint32_t size,
                                     void* data, uint32_t* replySize, void* replyData);
+    // Sends EFFECT_CMD_ENABLE or EFFECT_CMD_DISABLE through `send`, which returns whether the
+    // HAL accepted it, keeping the chain member in step with the effect.
+    bool sendEnableCommand(uint32_t commandId, const SendEnableCommand& send);
     Result sendCommandReturningStatus(int commandCode, const char* commandName);
     Result sendCommandReturningStatus(int commandCode, const char* commandName, uint32_t size,
                                       void* data);
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EffectHAL"
+
+#include "EffectChain.h"
+
+#include <algorithm>
+#include <map>
+
+#include <android/log.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+struct Registry {
+    std::mutex lock;
+    std::map<effect_handle_t, int32_t> sessions;
+    std::map<int32_t, wp<EffectChain>> chains;
+};
+
+Registry& getRegistry() {
+    // Intentionally leaked, effects may outlive static destructors.
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+// How many times longer than before any other request the chain must have been idle before the
+// first request of a buffer for the chain to tell where buffers start.
+constexpr int kMinBufferIdleRatio = 4;
+
+constexpr uint32_t kRequestOrDone = static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS) |
+                                    static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING);
+
+}  // namespace
+
+// static
+bool EffectChain::isEnabled() {
+    static const bool enabled = property_get_bool("ro.vendor.audio.effect.chained_processing",
+                                                  false /* default_value */);
+    return enabled;
+}
+
+// static
+void EffectChain::registerEffect(effect_handle_t handle, int32_t session) {
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.lock);
+    registry.sessions[handle] = session;
+}
+
+// static
+void EffectChain::unregisterEffect(effect_handle_t handle) {
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.lock);
+    auto it = registry.sessions.find(handle);
+    if (it == registry.sessions.end()) {
+        return;
+    }
+    const int32_t session = it->second;
+    registry.sessions.erase(it);
+    if (std::none_of(registry.sessions.begin(), registry.sessions.end(),
+                     [session](const auto& entry) { return entry.second == session; })) {
+        registry.chains.erase(session);
+    }
+}
+
+// static
+sp<EffectChain> EffectChain::getForEffect(effect_handle_t handle) {
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.lock);
+    auto it = registry.sessions.find(handle);
+    if (it == registry.sessions.end()) {
+        return nullptr;
+    }
+    wp<EffectChain>& weakChain = registry.chains[it->second];
+    sp<EffectChain> chain = weakChain.promote();
+    if (chain == nullptr) {
+        chain = new EffectChain();
+        weakChain = chain;
+    }
+    return chain;
+}
+
+// static
+Result EffectChain::processResultToResult(int32_t processResult) {
+    switch (processResult) {
+        case 0:
+            return Result::OK;
+        case -ENODATA:
+            return Result::INVALID_STATE;
+        case -EINVAL:
+            return Result::INVALID_ARGUMENTS;
+        default:
+            return Result::NOT_INITIALIZED;
+    }
+}
+
+void EffectChain::attach(Member* member) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mMembers.push_back(member);
+    resetLocked();
+}
+
+void EffectChain::detach(Member* member) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mMembers.erase(std::remove(mMembers.begin(), mMembers.end(), member), mMembers.end());
+    resetLocked();
+}
+
+void EffectChain::reset() {
+    std::lock_guard<std::mutex> lock(mLock);
+    resetLocked();
+}
+
+void EffectChain::resetLocked() {
+    mOrder.clear();
+    mCandidateOrder.clear();
+    mRound.clear();
+}
+
+void EffectChain::onRequest(Member* member) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mOrder.empty()) {
+        // The client requests the first member once it is done with the previous buffer, so a
+        // result processed ahead that is still pending belongs to a member the client skipped.
+        if (member != mOrder.front() || !retractOthersLocked(member)) {
+            return;
+        }
+        ALOGV("%s: a member was skipped, learning the order again", __func__);
+        resetLocked();
+    }
+    if (std::any_of(mRound.begin(), mRound.end(),
+                    [member](const Request& request) { return request.member == member; })) {
+        // Every member the client processes has been requested since the round started.
+        retractOthersLocked(member);
+        learnLocked();
+        mRound.clear();
+    }
+    mRound.push_back({member, std::chrono::steady_clock::now() - mLastDone});
+}
+
+bool EffectChain::retractOthersLocked(Member* member) {
+    bool retracted = false;
+    for (Member* other : mMembers) {
+        if (other != member && retract(other)) {
+            retracted = true;
+        }
+    }
+    return retracted;
+}
+
+void EffectChain::learnLocked() {
+    auto first = std::max_element(
+            mRound.begin(), mRound.end(),
+            [](const Request& lhs, const Request& rhs) { return lhs.idle < rhs.idle; });
+    if (std::any_of(mRound.begin(), mRound.end(), [&first](const Request& request) {
+            return &request != &*first && request.idle * kMinBufferIdleRatio > first->idle;
+        })) {
+        // The client did not pause between buffers long enough to tell where they start.
+        mCandidateOrder.clear();
+        return;
+    }
+    std::vector<Member*> order;
+    for (size_t i = 0; i < mRound.size(); ++i) {
+        order.push_back(mRound[(first - mRound.begin() + i) % mRound.size()].member);
+    }
+    if (order == mCandidateOrder) {
+        mOrder = std::move(order);
+        mCandidateOrder.clear();
+    } else {
+        mCandidateOrder = std::move(order);
+    }
+}
+
+// static
+bool EffectChain::canRunAhead(Member* member, audio_buffer_t* buffer) {
+    if (member->inBuffer->load(std::memory_order_relaxed) != buffer ||
+        member->outBuffer->load(std::memory_order_relaxed) != buffer) {
+        return false;
+    }
+    if (member->ranAhead.load(std::memory_order_acquire)) {
+        // The processing thread of the member has not picked up the request for the previous
+        // buffer yet. Pick it up here instead, so that it is not merged with the next one.
+        uint32_t efState = 0;
+        member->efGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS),
+                              &efState, 1 /* timeoutNanoSeconds */);
+        if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS)) ||
+            !consumeRanAhead(member)) {
+            return false;
+        }
+    }
+    return member->statusMQ->availableToWrite() > 0;
+}
+
+// static
+bool EffectChain::retract(Member* member) {
+    if (!member->ranAhead.load(std::memory_order_acquire)) {
+        return false;
+    }
+    // Only called while the client waits for another member, so the result is still pending if
+    // the client has neither requested nor taken it.
+    uint32_t efState = 0;
+    member->efGroup->wait(kRequestOrDone, &efState, 1 /* timeoutNanoSeconds */);
+    if ((efState & static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS)) ||
+        !(efState & static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING)) ||
+        !consumeRanAhead(member)) {
+        if (efState != 0) {
+            member->efGroup->wake(efState);
+        }
+        return false;
+    }
+    Result staleRetval;
+    member->statusMQ->read(&staleRetval);
+    return true;
+}
+
+void EffectChain::runAhead(Member* member) {
+    // Never block the processing thread. If the chain is being reconfigured, the members that
+    // follow will be processed on their own threads.
+    std::unique_lock<std::mutex> lock(mLock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    mLastDone = std::chrono::steady_clock::now();
+    auto it = std::find(mOrder.begin(), mOrder.end(), member);
+    if (it == mOrder.end()) {
+        return;
+    }
+    audio_buffer_t* buffer = member->outBuffer->load(std::memory_order_relaxed);
+    // Each member processes the output of the one before it, so stop at the first one that can't.
+    // This includes disabled members: the client keeps processing an effect while it ramps down
+    // after being disabled, and the members that follow must see its output.
+    for (++it; it != mOrder.end(); ++it) {
+        Member* next = *it;
+        if (!next->enabled.load(std::memory_order_relaxed) || !canRunAhead(next, buffer)) {
+            break;
+        }
+        Result retval =
+                processResultToResult((*next->handle)->process(next->handle, buffer, buffer));
+        next->ranAhead.store(true, std::memory_order_release);
+        if (!next->statusMQ->write(&retval)) {
+            ALOGW("status message queue write failed");
+        }
+        next->efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING));
+        if (retval != Result::OK) {
+            break;
+        }
+    }
+}
+
+// static
+bool EffectChain::consumeRanAhead(Member* member) {
+    return member->ranAhead.exchange(false, std::memory_order_acq_rel);
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
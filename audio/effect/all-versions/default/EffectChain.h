@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+#define ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
+
+#include PATH(android/hardware/audio/effect/FILE_VERSION/types.h)
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <fmq/EventFlag.h>
+#include <fmq/MessageQueue.h>
+#include <hardware/audio_effect.h>
+#include <utils/RefBase.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace effect {
+namespace CPP_VERSION {
+namespace implementation {
+
+using namespace ::android::hardware::audio::effect::CPP_VERSION;
+
+/**
+ * Chained processing of the effects of one audio session.
+ *
+ * The client processes the effects of a session one after another, and each process request is a
+ * round trip to the processing thread of that effect. In a chain, the processing thread of an
+ * effect also processes the effects that follow it, in place over its output buffer, and posts
+ * their results before acknowledging its own request. The requests the client then sends to those
+ * effects complete without waiting for another thread, so processing a buffer through the whole
+ * chain takes a single round trip.
+ *
+ * The chain learns the order in which the client processes its members by observing the requests
+ * while each member is processed on its own thread. The client processes the members of a buffer
+ * back to back and is then idle until the next buffer, so a buffer starts with the request that
+ * follows the longest idle time. Once two buffers in a row have been processed in the same order,
+ * the chain processes members ahead in that order. It drops back to learning whenever a member is
+ * attached, detached, enabled or disabled, and when the client skips a member that was processed
+ * ahead, whose result is then withdrawn before the client could take it for a later buffer.
+ *
+ * The chain stops at the first disabled effect, and an enabled effect is only processed ahead if
+ * both of its buffers are the output buffer of the effect that starts the chain. Since this relies
+ * on the client processing a session in a steady order, which is how the framework uses it, it is
+ * opt-in through the ro.vendor.audio.effect.chained_processing property.
+ */
+class EffectChain : public RefBase {
+   public:
+    typedef MessageQueue<Result, kSynchronizedReadWrite> StatusMQ;
+
+    // The parts of an Effect the chain needs to process it and to post its results.
+    struct Member {
+        effect_handle_t handle = nullptr;
+        std::atomic<audio_buffer_t*>* inBuffer = nullptr;
+        std::atomic<audio_buffer_t*>* outBuffer = nullptr;
+        StatusMQ* statusMQ = nullptr;
+        EventFlag* efGroup = nullptr;
+        std::atomic<bool> enabled{false};
+        // Set while the results of a buffer processed ahead have not been requested yet.
+        std::atomic<bool> ranAhead{false};
+    };
+
+    /** @return true if the ro.vendor.audio.effect.chained_processing property is set. */
+    static bool isEnabled();
+
+    /** Records the audio session of an effect, making it join the chain of that session. */
+    static void registerEffect(effect_handle_t handle, int32_t session);
+    static void unregisterEffect(effect_handle_t handle);
+    /** @return the chain of the session of the effect, or nullptr if it was not registered. */
+    static sp<EffectChain> getForEffect(effect_handle_t handle);
+
+    /** Maps a status returned by the process functions of the HAL to a Result. */
+    static Result processResultToResult(int32_t processResult);
+
+    /** Adds a member that has been prepared for processing. */
+    void attach(Member* member);
+    /** Removes a member. Once this returns, the chain no longer accesses it. */
+    void detach(Member* member);
+    /**
+     * Processes every member on its own thread until the order of the client has been learned
+     * again. Called when a member is enabled or disabled.
+     */
+    void reset();
+
+    /**
+     * Called by the processing thread of `member` when it picks up a request of the client that
+     * has not been processed ahead, before processing it.
+     */
+    void onRequest(Member* member);
+
+    /**
+     * Called by the processing thread of `member` after it has processed a buffer and posted the
+     * result, but before waking the client. Processes the members that follow it.
+     */
+    void runAhead(Member* member);
+    /**
+     * Called by the processing thread of `member` when the client requests processing.
+     *
+     * @return true if the buffer has already been processed ahead and its result posted.
+     */
+    static bool consumeRanAhead(Member* member);
+
+   private:
+    // A request observed while learning the order, and how long the chain had been idle before.
+    struct Request {
+        Member* member;
+        std::chrono::steady_clock::duration idle;
+    };
+
+    // Returns true if `member` is ready to have `buffer` processed ahead.
+    static bool canRunAhead(Member* member, audio_buffer_t* buffer);
+    // Withdraws the result of a buffer processed ahead if the client did not request it.
+    // Returns true if a result was withdrawn.
+    static bool retract(Member* member);
+
+    void resetLocked();
+    // Withdraws the results the client did not request from the members other than `member`.
+    bool retractOthersLocked(Member* member);
+    // Learns the order of the client from the requests of a complete round.
+    void learnLocked();
+
+    std::mutex mLock;
+    std::vector<Member*> mMembers;
+    // The order in which the client processes the members, empty while it is being learned.
+    std::vector<Member*> mOrder;
+    // The order seen in the previous round, adopted if the next round confirms it.
+    std::vector<Member*> mCandidateOrder;
+    // The requests of the round being observed, one per member.
+    std::vector<Request> mRound;
+    // When a processing thread last completed a request of the client.
+    std::chrono::steady_clock::time_point mLastDone;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace effect
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_EFFECT_EFFECT_CHAIN_H
@@ -21,6 +21,7 @@
 #include "BassBoostEffect.h"
 #include "DownmixEffect.h"
 #include "Effect.h"
+#include "EffectChain.h"
 #include "EnvironmentalReverbEffect.h"
 #include "EqualizerEffect.h"
 #include "LoudnessEnhancerEffect.h"
@@ -190,6 +191,9 @@ Return<void> EffectsFactory::createEffectImpl(const Uuid& uuid, int32_t session,
         if (status == OK) {
             effect = dispatchEffectInstanceCreation(halDescriptor, handle);
             effectId = EffectMap::getInstance().add(handle);
+            if (session != AUDIO_SESSION_DEVICE && EffectChain::isEnabled()) {
+                EffectChain::registerEffect(handle, session);
+            }
         } else {
             ALOGE("Error querying effect descriptor for %s: %s",
                   UuidUtils::uuidToString(halUuid).c_str(), strerror(-status));
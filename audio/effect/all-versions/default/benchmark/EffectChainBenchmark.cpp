@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Effect.h"
+#include "EffectChain.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <android/hidl/allocator/1.0/IAllocator.h>
+#include <benchmark/benchmark.h>
+#include <hidl/MQDescriptor.h>
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_memory;
+using ::android::hardware::MQDescriptorSync;
+using ::android::hardware::audio::effect::CPP_VERSION::AudioBuffer;
+using ::android::hardware::audio::effect::CPP_VERSION::MessageQueueFlagBits;
+using ::android::hardware::audio::effect::CPP_VERSION::Result;
+using ::android::hardware::audio::effect::CPP_VERSION::implementation::Effect;
+using ::android::hardware::audio::effect::CPP_VERSION::implementation::EffectChain;
+using ::android::hidl::allocator::V1_0::IAllocator;
+
+namespace {
+
+// 10 ms of 16-bit stereo audio at 48 kHz, the buffer size of a typical capture chain.
+constexpr uint32_t kFrameCount = 480;
+constexpr uint32_t kChannelCount = 2;
+constexpr uint64_t kBufferId = 1;
+constexpr int32_t kSession = 1;
+// The client is idle between buffers, which is also how the chain tells where a buffer starts.
+// Shorter than the 10 ms of a real buffer to keep the benchmark short.
+constexpr auto kBufferPeriod = std::chrono::milliseconds(1);
+// Enough buffers for the chain to learn the order of the effects before measuring.
+constexpr int kWarmUpBuffers = 10;
+
+// A legacy effect that applies a small attenuation in place, standing in for AEC, NS, AGC, etc.
+int32_t stubProcess(effect_handle_t /*self*/, audio_buffer_t* in, audio_buffer_t* out) {
+    for (size_t i = 0; i < in->frameCount * kChannelCount; ++i) {
+        out->s16[i] = in->s16[i] - (in->s16[i] >> 4);
+    }
+    return 0;
+}
+
+int32_t stubCommand(effect_handle_t /*self*/, uint32_t /*cmdCode*/, uint32_t /*cmdSize*/,
+                    void* /*pCmdData*/, uint32_t* replySize, void* pReplyData) {
+    if (replySize != nullptr && *replySize >= sizeof(int32_t) && pReplyData != nullptr) {
+        *static_cast<int32_t*>(pReplyData) = 0;
+    }
+    return 0;
+}
+
+int32_t stubGetDescriptor(effect_handle_t /*self*/, effect_descriptor_t* /*pDescriptor*/) {
+    return 0;
+}
+
+struct effect_interface_s kStubInterface = {
+        .process = stubProcess,
+        .command = stubCommand,
+        .get_descriptor = stubGetDescriptor,
+        .process_reverse = nullptr,
+};
+
+// An effect as the client sees it.
+struct ClientEffect {
+    sp<Effect> effect;
+    std::unique_ptr<Effect::StatusMQ> statusMQ;
+    EventFlag* efGroup = nullptr;
+};
+
+hidl_memory allocateBuffer() {
+    hidl_memory memory;
+    IAllocator::getService("ashmem")->allocate(
+            kFrameCount * kChannelCount * sizeof(int16_t),
+            [&memory](bool success, const hidl_memory& allocated) {
+                if (success) memory = allocated;
+            });
+    return memory;
+}
+
+// Processes one buffer through `numEffects` effects of the same session per iteration, the way
+// the framework does, in place over a single buffer.
+void runChain(benchmark::State& state, bool chained) {
+    const size_t numEffects = state.range(0);
+    const AudioBuffer buffer = {
+            .id = kBufferId, .frameCount = kFrameCount, .data = allocateBuffer()};
+    if (buffer.data.size() == 0) {
+        state.SkipWithError("could not allocate the audio buffer");
+        return;
+    }
+
+    // Each effect needs a handle of its own, as the chain registry is keyed by handle.
+    std::vector<struct effect_interface_s*> interfaces(numEffects, &kStubInterface);
+    std::vector<ClientEffect> effects(numEffects);
+    for (size_t i = 0; i < numEffects; ++i) {
+        effect_handle_t handle = &interfaces[i];
+        if (chained) {
+            EffectChain::registerEffect(handle, kSession);
+        }
+        ClientEffect& client = effects[i];
+        client.effect = new Effect(true /*isInput*/, handle);
+        client.effect->prepareForProcessing(
+                [&client](Result retval, const MQDescriptorSync<Result>& statusMQ) {
+                    if (retval == Result::OK) {
+                        client.statusMQ = std::make_unique<Effect::StatusMQ>(statusMQ);
+                    }
+                });
+        if (client.statusMQ == nullptr ||
+            EventFlag::createEventFlag(client.statusMQ->getEventFlagWord(), &client.efGroup) !=
+                    android::OK ||
+            client.effect->setProcessBuffers(buffer, buffer) != Result::OK ||
+            client.effect->enable() != Result::OK) {
+            state.SkipWithError("could not set up the effect");
+            return;
+        }
+    }
+
+    auto processBuffer = [&effects]() {
+        for (ClientEffect& client : effects) {
+            client.efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS));
+            uint32_t efState = 0;
+            while (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING))) {
+                client.efGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING),
+                                     &efState);
+            }
+            Result retval = Result::NOT_INITIALIZED;
+            if (!client.statusMQ->read(&retval) || retval != Result::OK) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for (int i = 0; i < kWarmUpBuffers; ++i) {
+        if (!processBuffer()) {
+            state.SkipWithError("processing failed");
+            break;
+        }
+        std::this_thread::sleep_for(kBufferPeriod);
+    }
+
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    for (auto _ : state) {
+        auto start = std::chrono::steady_clock::now();
+        if (!processBuffer()) {
+            state.SkipWithError("processing failed");
+            break;
+        }
+        state.SetIterationTime(
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        std::this_thread::sleep_for(kBufferPeriod);
+    }
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    // Context switches of the whole process, that is of the client and all processing threads,
+    // not counting the one of the client going idle after each buffer.
+    state.counters["ctxsw_per_buffer"] = benchmark::Counter(
+            (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw) -
+                    static_cast<double>(state.iterations()),
+            benchmark::Counter::kAvgIterations);
+
+    for (ClientEffect& client : effects) {
+        client.effect->close();
+        EventFlag::deleteEventFlag(&client.efGroup);
+    }
+}
+
+// Each effect is processed by its own thread, one round trip per effect.
+void BM_ProcessSeparately(benchmark::State& state) {
+    runChain(state, false /*chained*/);
+}
+
+// The effects are processed ahead by the thread of the first one, one round trip per buffer.
+void BM_ProcessChained(benchmark::State& state) {
+    runChain(state, true /*chained*/);
+}
+
+BENCHMARK(BM_ProcessSeparately)->DenseRange(1, 6)->UseManualTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ProcessChained)->DenseRange(1, 6)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define LOG_TAG "EffectChain_Test"
+#include <log/log.h>
+
+#include <android/hidl/allocator/1.0/IAllocator.h>
+#include <android/hidl/memory/1.0/IMemory.h>
+#include <hidl/MQDescriptor.h>
+#include <hidlmemory/mapping.h>
+
+#include "Effect.h"
+#include "EffectChain.h"
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_memory;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::mapMemory;
+using ::android::hardware::MQDescriptorSync;
+using ::android::hardware::audio::effect::CPP_VERSION::AudioBuffer;
+using ::android::hardware::audio::effect::CPP_VERSION::MessageQueueFlagBits;
+using ::android::hardware::audio::effect::CPP_VERSION::Result;
+using ::android::hardware::audio::effect::CPP_VERSION::implementation::Effect;
+using ::android::hardware::audio::effect::CPP_VERSION::implementation::EffectChain;
+using ::android::hidl::allocator::V1_0::IAllocator;
+using ::android::hidl::memory::V1_0::IMemory;
+
+static constexpr uint32_t kFrameCount = 16;
+static constexpr uint32_t kChannelCount = 2;
+static constexpr size_t kSampleCount = kFrameCount * kChannelCount;
+static constexpr int32_t kSession = 1;
+static constexpr size_t kEffectCount = 3;
+// The client is idle between buffers, which is how the chain tells where a buffer starts.
+static constexpr auto kBufferPeriod = std::chrono::milliseconds(2);
+// How many buffers the chain may take to learn the order of the client.
+static constexpr int kMaxLearningBuffers = 50;
+
+// A legacy effect that shifts its id into every sample, so that the result of processing a buffer
+// shows which effects processed it and in which order: effects 1, 2 and 3 turn 0 into 123.
+struct StubEffect {
+    struct effect_interface_s* itfe;  // Must come first, the handle points to it.
+    int16_t id;
+};
+
+static int32_t stubProcess(effect_handle_t self, audio_buffer_t* in, audio_buffer_t* out) {
+    const int16_t id = reinterpret_cast<StubEffect*>(self)->id;
+    for (size_t i = 0; i < in->frameCount * kChannelCount; ++i) {
+        out->s16[i] = in->s16[i] * 10 + id;
+    }
+    return 0;
+}
+
+static int32_t stubCommand(effect_handle_t /*self*/, uint32_t /*cmdCode*/, uint32_t /*cmdSize*/,
+                           void* /*pCmdData*/, uint32_t* replySize, void* pReplyData) {
+    if (replySize != nullptr && *replySize >= sizeof(int32_t) && pReplyData != nullptr) {
+        *static_cast<int32_t*>(pReplyData) = 0;
+    }
+    return 0;
+}
+
+static int32_t stubGetDescriptor(effect_handle_t /*self*/, effect_descriptor_t* /*pDescriptor*/) {
+    return 0;
+}
+
+static struct effect_interface_s kStubInterface = {
+        .process = stubProcess,
+        .command = stubCommand,
+        .get_descriptor = stubGetDescriptor,
+        .process_reverse = nullptr,
+};
+
+// An audio buffer shared with the effects, mapped to inspect its contents.
+struct SharedBuffer {
+    AudioBuffer buffer;
+    sp<IMemory> memory;
+
+    int16_t* samples() { return static_cast<int16_t*>(static_cast<void*>(memory->getPointer())); }
+    void fill(int16_t value) { std::fill(samples(), samples() + kSampleCount, value); }
+    bool contains(int16_t value) {
+        return std::all_of(samples(), samples() + kSampleCount,
+                           [value](int16_t sample) { return sample == value; });
+    }
+};
+
+// An effect as the client sees it.
+struct ClientEffect {
+    StubEffect stub;
+    sp<Effect> effect;
+    std::unique_ptr<Effect::StatusMQ> statusMQ;
+    EventFlag* efGroup = nullptr;
+    // Whether the client processes the effect.
+    bool enabled = false;
+};
+
+class EffectChainTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_NO_FATAL_FAILURE(allocateBuffer(1 /*id*/, &mBuffer));
+        for (size_t i = 0; i < kEffectCount; ++i) {
+            ASSERT_NO_FATAL_FAILURE(createEffect(i + 1, &mEffects[i]));
+        }
+    }
+
+    void TearDown() override {
+        for (ClientEffect& client : mEffects) {
+            closeEffect(&client);
+        }
+    }
+
+    void allocateBuffer(uint64_t id, SharedBuffer* shared) {
+        hidl_memory memory;
+        IAllocator::getService("ashmem")->allocate(
+                kSampleCount * sizeof(int16_t),
+                [&memory](bool success, const hidl_memory& allocated) {
+                    if (success) memory = allocated;
+                });
+        ASSERT_NE(0u, memory.size());
+        shared->memory = mapMemory(memory);
+        ASSERT_NE(nullptr, shared->memory);
+        shared->buffer = {.id = id, .frameCount = kFrameCount, .data = memory};
+    }
+
+    // Creates an effect processing mBuffer in place and enables it, the way the framework does.
+    void createEffect(int16_t id, ClientEffect* client) {
+        client->stub = {.itfe = &kStubInterface, .id = id};
+        effect_handle_t handle = &client->stub.itfe;
+        EffectChain::registerEffect(handle, kSession);
+        client->effect = new Effect(true /*isInput*/, handle);
+        client->effect->prepareForProcessing(
+                [client](Result retval, const MQDescriptorSync<Result>& statusMQ) {
+                    if (retval == Result::OK) {
+                        client->statusMQ = std::make_unique<Effect::StatusMQ>(statusMQ);
+                    }
+                });
+        ASSERT_NE(nullptr, client->statusMQ);
+        ASSERT_EQ(android::OK, EventFlag::createEventFlag(client->statusMQ->getEventFlagWord(),
+                                                          &client->efGroup));
+        ASSERT_EQ(Result::OK, client->effect->setProcessBuffers(mBuffer.buffer, mBuffer.buffer));
+        ASSERT_EQ(0, sendCommand(client, EFFECT_CMD_ENABLE));
+        client->enabled = true;
+    }
+
+    void closeEffect(ClientEffect* client) {
+        if (client->effect != nullptr) {
+            client->effect->close();
+            client->effect.clear();
+        }
+        if (client->efGroup != nullptr) {
+            EventFlag::deleteEventFlag(&client->efGroup);
+        }
+        client->statusMQ.reset();
+        client->enabled = false;
+    }
+
+    // Sends a command that replies with a status, and returns that status.
+    static int32_t sendCommand(ClientEffect* client, uint32_t commandId) {
+        int32_t status = -EINVAL;
+        client->effect->command(commandId, hidl_vec<uint8_t>(), sizeof(int32_t),
+                                [&status](int32_t retval, const hidl_vec<uint8_t>& result) {
+                                    if (retval == 0 && result.size() == sizeof(int32_t)) {
+                                        memcpy(&status, &result[0], sizeof(int32_t));
+                                    }
+                                });
+        return status;
+    }
+
+    size_t enabledCount() const {
+        return std::count_if(std::begin(mEffects), std::end(mEffects),
+                             [](const ClientEffect& client) { return client.enabled; });
+    }
+
+    // Processes a buffer through the enabled effects in order, the way the framework does, then
+    // stays idle until the next buffer. Sets `processedAhead` to how many effects had posted their
+    // result before the client requested it.
+    void processBuffer(size_t* processedAhead) {
+        *processedAhead = 0;
+        for (ClientEffect& client : mEffects) {
+            if (!client.enabled) continue;
+            uint32_t efState = 0;
+            client.efGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING),
+                                 &efState, 1 /* timeoutNanoSeconds */);
+            if (efState & static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING)) {
+                ++*processedAhead;
+            }
+            client.efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::REQUEST_PROCESS));
+            while (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING))) {
+                client.efGroup->wait(static_cast<uint32_t>(MessageQueueFlagBits::DONE_PROCESSING),
+                                     &efState);
+            }
+            Result retval = Result::NOT_INITIALIZED;
+            ASSERT_TRUE(client.statusMQ->read(&retval));
+            ASSERT_EQ(Result::OK, retval);
+        }
+        std::this_thread::sleep_for(kBufferPeriod);
+    }
+
+    // Processes buffers until every enabled effect but the first one is processed ahead, checking
+    // that each buffer comes out as `expected`.
+    void processUntilChained(int16_t expected, SharedBuffer* buffer) {
+        size_t processedAhead = 0;
+        for (int i = 0; i < kMaxLearningBuffers && processedAhead + 1 < enabledCount(); ++i) {
+            buffer->fill(0);
+            ASSERT_NO_FATAL_FAILURE(processBuffer(&processedAhead));
+            ASSERT_TRUE(buffer->contains(expected))
+                    << "buffer " << i << ": " << buffer->samples()[0];
+        }
+        ASSERT_EQ(enabledCount() - 1, processedAhead);
+    }
+    void processUntilChained(int16_t expected) { processUntilChained(expected, &mBuffer); }
+
+    // Processes buffers that must all be processed ahead after the first effect.
+    void processChained(int16_t expected) {
+        for (int i = 0; i < 10; ++i) {
+            mBuffer.fill(0);
+            size_t processedAhead = 0;
+            ASSERT_NO_FATAL_FAILURE(processBuffer(&processedAhead));
+            EXPECT_TRUE(mBuffer.contains(expected))
+                    << "buffer " << i << ": " << mBuffer.samples()[0];
+            EXPECT_EQ(enabledCount() - 1, processedAhead) << "buffer " << i;
+        }
+    }
+
+    SharedBuffer mBuffer;
+    ClientEffect mEffects[kEffectCount];
+};
+
+TEST_F(EffectChainTest, ProcessesEffectsInOrder) {
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    ASSERT_NO_FATAL_FAILURE(processChained(123));
+}
+
+TEST_F(EffectChainTest, FollowsEnableCommands) {
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    ASSERT_EQ(0, sendCommand(&mEffects[1], EFFECT_CMD_DISABLE));
+    mEffects[1].enabled = false;
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(13));
+    ASSERT_NO_FATAL_FAILURE(processChained(13));
+
+    ASSERT_EQ(0, sendCommand(&mEffects[1], EFFECT_CMD_ENABLE));
+    mEffects[1].enabled = true;
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    ASSERT_NO_FATAL_FAILURE(processChained(123));
+}
+
+TEST_F(EffectChainTest, SkipsDisabledEffectUntilReenabled) {
+    ASSERT_EQ(Result::OK, mEffects[1].effect->disable());
+    mEffects[1].enabled = false;
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(13));
+    ASSERT_NO_FATAL_FAILURE(processChained(13));
+
+    ASSERT_EQ(Result::OK, mEffects[1].effect->enable());
+    mEffects[1].enabled = true;
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    ASSERT_NO_FATAL_FAILURE(processChained(123));
+}
+
+TEST_F(EffectChainTest, FollowsOrderOfClient) {
+    // The framework inserts the new effect in the middle, but prepares it for processing last.
+    closeEffect(&mEffects[1]);
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(13));
+    ASSERT_NO_FATAL_FAILURE(createEffect(2, &mEffects[1]));
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    ASSERT_NO_FATAL_FAILURE(processChained(123));
+}
+
+TEST_F(EffectChainTest, DropsResultOfSkippedEffect) {
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    // The client skips an enabled effect for one buffer. The chain has already processed it
+    // ahead, so only the buffers that follow can be checked.
+    mEffects[1].enabled = false;
+    size_t processedAhead = 0;
+    mBuffer.fill(0);
+    ASSERT_NO_FATAL_FAILURE(processBuffer(&processedAhead));
+    mEffects[1].enabled = true;
+
+    mBuffer.fill(0);
+    ASSERT_NO_FATAL_FAILURE(processBuffer(&processedAhead));
+    EXPECT_TRUE(mBuffer.contains(123)) << mBuffer.samples()[0];
+    EXPECT_EQ(0u, processedAhead);
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+}
+
+TEST_F(EffectChainTest, FollowsChangedBuffers) {
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123));
+    SharedBuffer newBuffer;
+    ASSERT_NO_FATAL_FAILURE(allocateBuffer(2 /*id*/, &newBuffer));
+    for (ClientEffect& client : mEffects) {
+        ASSERT_EQ(Result::OK,
+                  client.effect->setProcessBuffers(newBuffer.buffer, newBuffer.buffer));
+    }
+    mBuffer.fill(0);
+    ASSERT_NO_FATAL_FAILURE(processUntilChained(123, &newBuffer));
+    EXPECT_TRUE(mBuffer.contains(0));
+}
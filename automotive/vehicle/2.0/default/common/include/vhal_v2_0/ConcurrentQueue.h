@@ -19,45 +19,120 @@
 
 #include <queue>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include <condition_variable>
 #include <iostream>
+#include <vector>
 
 namespace android {
 
+/*
+ * Multi-producer, single-consumer queue.
+ *
+ * Items are pushed into a bounded lock-free ring. If the ring is full, they go to an overflow
+ * queue guarded by mLock until the consumer drains it, so items pushed by one thread are
+ * always consumed in order. The consumer only takes mLock to sleep when the queue is empty or
+ * to drain the overflow queue.
+ */
 template<typename T>
 class ConcurrentQueue {
 public:
-    void waitForItems() {
+    static constexpr size_t kDefaultCapacity = 1024;
+
+    explicit ConcurrentQueue(size_t capacity = kDefaultCapacity)
+            : mCapacity(roundUpToPowerOfTwo(capacity)),
+              mRing(new Cell[mCapacity]) {
+        for (size_t i = 0; i < mCapacity; i++) {
+            mRing[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /* Blocks until there are items to consume. Returns false if the queue was deactivated. */
+    bool waitForItems() {
         std::unique_lock<std::mutex> g(mLock);
-        while (mQueue.empty() && mIsActive) {
+        while (!hasItemsOrInactive()) {
             mCond.wait(g);
         }
+        mConsumerWaiting.store(false, std::memory_order_relaxed);
+        return mIsActive;
+    }
+
+    /* Blocks until there are items to consume or the deadline passes. Returns true if there are
+     * items to consume. */
+    bool waitForItemsUntil(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> g(mLock);
+        bool timedOut = false;
+        while (!hasItemsOrInactive() && !timedOut) {
+            timedOut = mCond.wait_until(g, deadline) == std::cv_status::timeout;
+        }
+        mConsumerWaiting.store(false, std::memory_order_relaxed);
+        return mIsActive && !isEmpty();
     }
 
     std::vector<T> flush() {
         std::vector<T> items;
+        flush(&items, std::numeric_limits<size_t>::max());
+        return items;
+    }
 
-        MuxGuard g(mLock);
-        if (mQueue.empty() || !mIsActive) {
-            return items;
+    /* Appends up to maxItems items to outItems. Returns the number of items appended. */
+    size_t flush(std::vector<T>* outItems, size_t maxItems) {
+        if (!mIsActive) {
+            return 0;
         }
-        while (!mQueue.empty()) {
-            items.push_back(std::move(mQueue.front()));
-            mQueue.pop();
+
+        size_t count = 0;
+        while (count < maxItems && popFromRing(outItems)) {
+            count++;
         }
-        return items;
+        if (count < maxItems && mOverflowing.load(std::memory_order_acquire)) {
+            MuxGuard g(mLock);
+            // Items that found the ring full were pushed after everything else in the ring
+            // from the same thread, so drain the ring before taking them.
+            while (count < maxItems && popFromRing(outItems)) {
+                count++;
+            }
+            while (count < maxItems && !mOverflow.empty()) {
+                outItems->push_back(std::move(mOverflow.front()));
+                mOverflow.pop();
+                count++;
+            }
+            if (mOverflow.empty()) {
+                mOverflowing.store(false, std::memory_order_release);
+            }
+        }
+        return count;
     }
 
     void push(T&& item) {
-        {
+        if (!mIsActive) {
+            return;
+        }
+        if (mOverflowing.load(std::memory_order_acquire) || !pushToRing(&item)) {
             MuxGuard g(mLock);
             if (!mIsActive) {
                 return;
             }
-            mQueue.push(std::move(item));
+            mOverflowing.store(true, std::memory_order_release);
+            mOverflow.push(std::move(item));
+        }
+
+        // Pairs with the fence in hasItemsOrInactive(): either the consumer sees the item or
+        // we see that it is about to sleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mConsumerWaiting.load(std::memory_order_relaxed)) {
+            {
+                MuxGuard g(mLock);
+            }
+            mCond.notify_one();
         }
-        mCond.notify_one();
     }
 
     /* Deactivates the queue, thus no one can push items to it, also
@@ -71,17 +146,89 @@ public:
         mCond.notify_all();  // To unblock all waiting consumers.
     }
 
-    ConcurrentQueue() = default;
-
     ConcurrentQueue(const ConcurrentQueue &) = delete;
     ConcurrentQueue &operator=(const ConcurrentQueue &) = delete;
 private:
     using MuxGuard = std::lock_guard<std::mutex>;
 
-    bool mIsActive = true;
+    // A ring slot. sequence equals the slot's position when it is free and position + 1 when
+    // it holds an item ready for the consumer.
+    struct Cell {
+        std::atomic<size_t> sequence;
+        std::optional<T> item;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    bool pushToRing(T* item) {
+        size_t pos = mWritePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &mRing[pos & (mCapacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mWritePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // The ring is full.
+            } else {
+                pos = mWritePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item.emplace(std::move(*item));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Must only be called by the consumer.
+    bool popFromRing(std::vector<T>* outItems) {
+        Cell& cell = mRing[mReadPos & (mCapacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != mReadPos + 1) {
+            return false;
+        }
+        outItems->push_back(std::move(*cell.item));
+        cell.item.reset();
+        cell.sequence.store(mReadPos + mCapacity, std::memory_order_release);
+        mReadPos++;
+        return true;
+    }
+
+    // Must only be called by the consumer.
+    bool isEmpty() const {
+        const Cell& cell = mRing[mReadPos & (mCapacity - 1)];
+        return cell.sequence.load(std::memory_order_acquire) != mReadPos + 1
+                && !mOverflowing.load(std::memory_order_acquire);
+    }
+
+    // Called by the consumer with mLock held, right before it sleeps.
+    bool hasItemsOrInactive() {
+        if (!mIsActive) {
+            return true;
+        }
+        mConsumerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return !isEmpty();
+    }
+
+    const size_t mCapacity;
+    const std::unique_ptr<Cell[]> mRing;
+    std::atomic<size_t> mWritePos { 0 };
+    size_t mReadPos = 0;
+
+    std::atomic<bool> mIsActive { true };
+    std::atomic<bool> mConsumerWaiting { false };
+    std::atomic<bool> mOverflowing { false };
     mutable std::mutex mLock;
     std::condition_variable mCond;
-    std::queue<T> mQueue;
+    std::queue<T> mOverflow;  // Guarded by mLock.
 };
 
 template<typename T>
@@ -95,6 +242,14 @@ private:
     };
 
 public:
+    /* Decides when a batch is delivered: as soon as it holds maxBatchSize items, contains an
+     * item for which isPriority returns true, or its first item has waited for maxDelay. */
+    struct Policy {
+        std::chrono::nanoseconds maxDelay { 0 };
+        size_t maxBatchSize = std::numeric_limits<size_t>::max();
+        std::function<bool(const T& item)> isPriority;
+    };
+
     BatchingConsumer() : mState(State::INIT) {}
 
     BatchingConsumer(const BatchingConsumer &) = delete;
@@ -105,8 +260,19 @@ public:
     void run(ConcurrentQueue<T>* queue,
              std::chrono::nanoseconds batchInterval,
              const OnBatchReceivedFunc& func) {
+        Policy policy;
+        policy.maxDelay = batchInterval;
+        run(queue, policy, func);
+    }
+
+    void run(ConcurrentQueue<T>* queue,
+             const Policy& policy,
+             const OnBatchReceivedFunc& func) {
         mQueue = queue;
-        mBatchInterval = batchInterval;
+        mPolicy = policy;
+        if (mPolicy.maxBatchSize == 0) {
+            mPolicy.maxBatchSize = 1;
+        }
 
         mWorkerThread = std::thread(
             &BatchingConsumer<T>::runInternal, this, func);
@@ -125,15 +291,25 @@ public:
 private:
     void runInternal(const OnBatchReceivedFunc& onBatchReceived) {
         if (mState.exchange(State::RUNNING) == State::INIT) {
+            std::vector<T> items;
+            // Set when the previous batch was cut at maxBatchSize, so the items left in the
+            // queue have already waited and are delivered right away.
+            bool backlog = false;
             while (State::RUNNING == mState) {
-                mQueue->waitForItems();
+                if (!backlog && !mQueue->waitForItems()) break;
                 if (State::STOP_REQUESTED == mState) break;
 
-                std::this_thread::sleep_for(mBatchInterval);
+                items.clear();
+                bool deliverNow = collect(&items) || backlog;
+                const auto deadline = std::chrono::steady_clock::now() + mPolicy.maxDelay;
+                while (!deliverNow && items.size() < mPolicy.maxBatchSize
+                        && mQueue->waitForItemsUntil(deadline)) {
+                    if (State::STOP_REQUESTED == mState) break;
+                    deliverNow = collect(&items);
+                }
                 if (State::STOP_REQUESTED == mState) break;
 
-                std::vector<T> items = mQueue->flush();
-
+                backlog = items.size() >= mPolicy.maxBatchSize;
                 if (items.size() > 0) {
                     onBatchReceived(items);
                 }
@@ -143,11 +319,25 @@ private:
         mState = State::STOPPED;
     }
 
+    /* Moves available items into the batch. Returns true if one of them is a priority item. */
+    bool collect(std::vector<T>* items) {
+        size_t begin = items->size();
+        mQueue->flush(items, mPolicy.maxBatchSize - begin);
+        if (mPolicy.isPriority) {
+            for (size_t i = begin; i < items->size(); i++) {
+                if (mPolicy.isPriority((*items)[i])) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
 private:
     std::thread mWorkerThread;
 
     std::atomic<State> mState;
-    std::chrono::nanoseconds mBatchInterval;
+    Policy mPolicy;
     ConcurrentQueue<T>* mQueue;
 };
 
@@ -29,92 +29,202 @@
 #include <vector>
 
 /**
- * This class allows to specify multiple time intervals to receive
- * notifications. A single thread is used internally.
+ * Recurrent events ordered by their next event time in an indexed binary min-heap, so that
+ * finding due events costs O(log n) per due event instead of a scan over all events.
+ *
+ * This class is not thread-safe.
  */
-class RecurrentTimer {
-private:
+class RecurrentEventQueue {
+public:
     using Nanos = std::chrono::nanoseconds;
     using Clock = std::chrono::steady_clock;
     using TimePoint = std::chrono::time_point<Clock, Nanos>;
-public:
-    using Action = std::function<void(const std::vector<int32_t>& cookies)>;
 
-    RecurrentTimer(const Action& action) : mAction(action) {
-        mTimerThread = std::thread(&RecurrentTimer::loop, this, action);
-    }
+    static constexpr TimePoint kInvalidTime = TimePoint(Nanos::max());
 
-    virtual ~RecurrentTimer() {
-        stop();
-    }
+    /**
+     * Events due within this window after the current time are reported together with the
+     * events already due, saving a wake-up for each of them.
+     */
+    static constexpr Nanos kCoalescingWindow = std::chrono::microseconds(50);
 
     /**
-     * Registers recurrent event for a given interval. Registred events are distinguished by
-     * cookies thus calling this method multiple times with the same cookie will override the
-     * interval provided before.
+     * Adds an event, or replaces the interval of the event with the same cookie. Returns true
+     * if the event became the earliest one.
      */
-    void registerRecurrentEvent(std::chrono::nanoseconds interval, int32_t cookie) {
-        TimePoint now = Clock::now();
+    bool add(Nanos interval, int32_t cookie, TimePoint now) {
         // Align event time point among all intervals. Thus if we have two intervals 1ms and 2ms,
         // during every second wake-up both intervals will be triggered.
         TimePoint absoluteTime = now - Nanos(now.time_since_epoch().count() % interval.count());
+        RecurrentEvent event = { interval, cookie, absoluteTime };
 
-        {
-            std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap[cookie] = { interval, cookie, absoluteTime };
+        auto it = mCookieToIndex.find(cookie);
+        size_t index;
+        if (it == mCookieToIndex.end()) {
+            index = mEvents.size();
+            mEvents.push_back(event);
+            mCookieToIndex[cookie] = index;
+        } else {
+            index = it->second;
+            mEvents[index] = event;
+            index = siftDown(index);
         }
-        mCond.notify_one();
+        return siftUp(index) == 0;
     }
 
-    void unregisterRecurrentEvent(int32_t cookie) {
-        {
-            std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap.erase(cookie);
+    void remove(int32_t cookie) {
+        auto it = mCookieToIndex.find(cookie);
+        if (it == mCookieToIndex.end()) return;
+
+        size_t index = it->second;
+        mCookieToIndex.erase(it);
+        size_t last = mEvents.size() - 1;
+        if (index != last) {
+            moveEvent(last, index);
+            mEvents.pop_back();
+            siftUp(siftDown(index));
+        } else {
+            mEvents.pop_back();
         }
-        mCond.notify_one();
     }
 
+    void clear() {
+        mEvents.clear();
+        mCookieToIndex.clear();
+    }
 
-private:
+    size_t size() const { return mEvents.size(); }
+
+    TimePoint nextEventTime() const {
+        return mEvents.empty() ? kInvalidTime : mEvents.front().absoluteTime;
+    }
+
+    /**
+     * Appends cookies of the events due at now (including the coalescing window) to cookies,
+     * schedules their next occurrence and returns the time of the next event.
+     */
+    TimePoint popDueEvents(TimePoint now, std::vector<int32_t>* cookies) {
+        const TimePoint dueTime = now + kCoalescingWindow;
+        while (!mEvents.empty() && mEvents.front().absoluteTime <= dueTime) {
+            RecurrentEvent& event = mEvents.front();
+            cookies->push_back(event.cookie);
+            event.updateNextEventTime(dueTime);
+            siftDown(0);
+        }
+        return nextEventTime();
+    }
 
+private:
     struct RecurrentEvent {
         Nanos interval;
         int32_t cookie;
         TimePoint absoluteTime;  // Absolute time of the next event.
 
-        void updateNextEventTime(TimePoint now) {
+        void updateNextEventTime(TimePoint dueTime) {
             // We want to move time to next event by adding some number of intervals (usually 1)
-            // to previous absoluteTime.
-            int intervalMultiplier = (now - absoluteTime) / interval;
+            // to previous absoluteTime. Missed occurrences are skipped so that every event is
+            // reported at most once per wake-up.
+            int64_t intervalMultiplier = (dueTime - absoluteTime) / interval + 1;
             if (intervalMultiplier <= 0) intervalMultiplier = 1;
             absoluteTime += intervalMultiplier * interval;
         }
     };
 
-    void loop(const Action& action) {
-        static constexpr auto kInvalidTime = TimePoint(Nanos::max());
+    void moveEvent(size_t from, size_t to) {
+        mEvents[to] = mEvents[from];
+        mCookieToIndex[mEvents[to].cookie] = to;
+    }
+
+    void swapEvents(size_t a, size_t b) {
+        std::swap(mEvents[a], mEvents[b]);
+        mCookieToIndex[mEvents[a].cookie] = a;
+        mCookieToIndex[mEvents[b].cookie] = b;
+    }
+
+    size_t siftUp(size_t index) {
+        while (index > 0) {
+            size_t parent = (index - 1) / 2;
+            if (mEvents[parent].absoluteTime <= mEvents[index].absoluteTime) break;
+            swapEvents(parent, index);
+            index = parent;
+        }
+        return index;
+    }
+
+    size_t siftDown(size_t index) {
+        while (true) {
+            size_t smallest = index;
+            for (size_t child = 2 * index + 1; child <= 2 * index + 2; child++) {
+                if (child < mEvents.size()
+                        && mEvents[child].absoluteTime < mEvents[smallest].absoluteTime) {
+                    smallest = child;
+                }
+            }
+            if (smallest == index) break;
+            swapEvents(smallest, index);
+            index = smallest;
+        }
+        return index;
+    }
+
+    std::vector<RecurrentEvent> mEvents;  // Binary min-heap by absoluteTime.
+    std::unordered_map<int32_t, size_t> mCookieToIndex;
+};
+
+/**
+ * This class allows to specify multiple time intervals to receive
+ * notifications. A single thread is used internally.
+ */
+class RecurrentTimer {
+private:
+    using Nanos = RecurrentEventQueue::Nanos;
+    using Clock = RecurrentEventQueue::Clock;
+    using TimePoint = RecurrentEventQueue::TimePoint;
+public:
+    using Action = std::function<void(const std::vector<int32_t>& cookies)>;
+
+    RecurrentTimer(const Action& action) : mAction(action) {
+        mTimerThread = std::thread(&RecurrentTimer::loop, this, action);
+    }
+
+    virtual ~RecurrentTimer() {
+        stop();
+    }
+
+    /**
+     * Registers recurrent event for a given interval. Registred events are distinguished by
+     * cookies thus calling this method multiple times with the same cookie will override the
+     * interval provided before.
+     */
+    void registerRecurrentEvent(std::chrono::nanoseconds interval, int32_t cookie) {
+        bool isEarliest;
+        {
+            std::lock_guard<std::mutex> g(mLock);
+            isEarliest = mEvents.add(interval, cookie, Clock::now());
+        }
+        // The timer thread only needs to wake up earlier if this is the next event.
+        if (isEarliest) {
+            mCond.notify_one();
+        }
+    }
 
+    void unregisterRecurrentEvent(int32_t cookie) {
+        // The timer thread finds out on its next wake-up.
+        std::lock_guard<std::mutex> g(mLock);
+        mEvents.remove(cookie);
+    }
+
+
+private:
+    void loop(const Action& action) {
         std::vector<int32_t> cookies;
 
         while (!mStopRequested) {
-            auto now = Clock::now();
-            auto nextEventTime = kInvalidTime;
             cookies.clear();
 
             {
-                std::unique_lock<std::mutex> g(mLock);
-
-                for (auto&& it : mCookieToEventsMap) {
-                    RecurrentEvent& event = it.second;
-                    if (event.absoluteTime <= now) {
-                        event.updateNextEventTime(now);
-                        cookies.push_back(event.cookie);
-                    }
-
-                    if (nextEventTime > event.absoluteTime) {
-                        nextEventTime = event.absoluteTime;
-                    }
-                }
+                std::lock_guard<std::mutex> g(mLock);
+                mEvents.popDueEvents(Clock::now(), &cookies);
             }
 
             if (cookies.size() != 0) {
@@ -122,15 +232,18 @@ private:
             }
 
             std::unique_lock<std::mutex> g(mLock);
+            if (mStopRequested) break;
+            // Read under the lock so events registered while the action ran are accounted for.
+            auto nextEventTime = mEvents.nextEventTime();
             mCond.wait_until(g, nextEventTime);  // nextEventTime can be nanoseconds::max()
         }
     }
 
     void stop() {
-        mStopRequested = true;
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap.clear();
+            mStopRequested = true;
+            mEvents.clear();
         }
         mCond.notify_one();
         if (mTimerThread.joinable()) {
@@ -143,7 +256,7 @@ private:
     std::condition_variable mCond;
     std::atomic_bool mStopRequested { false };
     Action mAction;
-    std::unordered_map<int32_t, RecurrentEvent> mCookieToEventsMap;
+    RecurrentEventQueue mEvents;
 };
 
 
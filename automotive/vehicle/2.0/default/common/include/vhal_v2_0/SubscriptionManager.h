@@ -17,10 +17,13 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_SubscriptionManager_H_
 #define android_hardware_automotive_vehicle_V2_0_SubscriptionManager_H_
 
+#include <functional>
 #include <memory>
 #include <map>
 #include <set>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include <android/log.h>
 #include <hidl/HidlSupport.h>
@@ -39,8 +42,8 @@ namespace V2_0 {
 
 class HalClient : public android::RefBase {
 public:
-    HalClient(const sp<IVehicleCallback> &callback)
-        : mCallback(callback) {}
+    HalClient(const sp<IVehicleCallback> &callback, uint32_t slot = 0)
+        : mCallback(callback), mSlot(slot) {}
 
     virtual ~HalClient() {}
 public:
@@ -48,12 +51,18 @@ public:
         return mCallback;
     }
 
+    /** Index of this client in the SubscriptionManager's client masks. */
+    uint32_t getSlot() const {
+        return mSlot;
+    }
+
     void addOrUpdateSubscription(const SubscribeOptions &opts);
     bool isSubscribed(int32_t propId, SubscribeFlags flags);
     std::vector<int32_t> getSubscribedProperties() const;
 
 private:
     const sp<IVehicleCallback> mCallback;
+    const uint32_t mSlot;
 
     std::map<int32_t, SubscribeOptions> mSubscriptions;
 };
@@ -78,6 +87,92 @@ struct HalClientValues {
     std::list<VehiclePropValue *> values;
 };
 
+/**
+ * Set of clients keyed by HalClient slot. The first 64 slots are stored inline so that
+ * copying or merging masks does not allocate for the usual handful of clients.
+ */
+class ClientMask {
+public:
+    void set(uint32_t slot) {
+        if (slot < kBitsPerWord) {
+            mLow |= bit(slot);
+            return;
+        }
+        size_t word = slot / kBitsPerWord - 1;
+        if (mHigh.size() <= word) {
+            mHigh.resize(word + 1, 0);
+        }
+        mHigh[word] |= bit(slot);
+    }
+
+    bool test(uint32_t slot) const {
+        if (slot < kBitsPerWord) {
+            return mLow & bit(slot);
+        }
+        size_t word = slot / kBitsPerWord - 1;
+        return word < mHigh.size() && (mHigh[word] & bit(slot));
+    }
+
+    void merge(const ClientMask& other) {
+        mLow |= other.mLow;
+        if (mHigh.size() < other.mHigh.size()) {
+            mHigh.resize(other.mHigh.size(), 0);
+        }
+        for (size_t i = 0; i < other.mHigh.size(); i++) {
+            mHigh[i] |= other.mHigh[i];
+        }
+    }
+
+    // Bits are only ever set, so a non-empty mHigh always holds a set bit.
+    bool empty() const { return mLow == 0 && mHigh.empty(); }
+
+    bool operator==(const ClientMask& other) const {
+        return mLow == other.mLow && mHigh == other.mHigh;
+    }
+
+    size_t hash() const {
+        size_t h = std::hash<uint64_t>()(mLow);
+        for (uint64_t word : mHigh) {
+            h = h * 31 + std::hash<uint64_t>()(word);
+        }
+        return h;
+    }
+
+    /** Calls func(slot) for every slot in the mask, in increasing order. */
+    template <typename Func>
+    void forEach(Func&& func) const {
+        forEachInWord(mLow, 0, func);
+        for (size_t i = 0; i < mHigh.size(); i++) {
+            forEachInWord(mHigh[i], (i + 1) * kBitsPerWord, func);
+        }
+    }
+
+private:
+    static constexpr uint32_t kBitsPerWord = 64;
+
+    static uint64_t bit(uint32_t slot) { return uint64_t(1) << (slot % kBitsPerWord); }
+
+    template <typename Func>
+    static void forEachInWord(uint64_t word, uint32_t base, Func& func) {
+        while (word != 0) {
+            func(base + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+
+    uint64_t mLow = 0;
+    std::vector<uint64_t> mHigh;
+};
+
+/**
+ * Values that go to a group of clients which subscribed to exactly the same values of a
+ * batch, so the batch is serialized once and the same buffer is delivered to each of them.
+ */
+struct HalClientBatch {
+    std::vector<sp<HalClient>> clients;
+    std::vector<VehiclePropValue*> values;
+};
+
 using ClientId = uint64_t;
 
 class SubscriptionManager {
@@ -114,6 +209,14 @@ public:
             const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
             SubscribeFlags flags) const;
 
+    /**
+     * Same as distributeValuesToClients, but clients receiving the same values are grouped
+     * together. Values keep the order in which they appear in propValues.
+     */
+    std::vector<HalClientBatch> distributeValuesToClientBatches(
+            const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
+            SubscribeFlags flags) const;
+
     std::list<sp<HalClient>> getSubscribedClients(int32_t propId, SubscribeFlags flags) const;
     /**
      * If there are no clients subscribed to given properties than callback function provided
@@ -130,6 +233,11 @@ private:
 
     sp<HalClientVector> getClientsForPropertyLocked(int32_t propId) const;
 
+    /** Rebuilds the client masks of propId from mPropToClients. */
+    void updateClientMasksLocked(int32_t propId);
+
+    ClientMask getClientMaskLocked(int32_t propId, SubscribeFlags flags) const;
+
     sp<HalClient> getOrCreateHalClientLocked(ClientId callingPid,
                                              const sp<IVehicleCallback>& callback);
 
@@ -164,6 +272,16 @@ private:
     std::map<int32_t, sp<HalClientVector>> mPropToClients;
     std::map<int32_t, SubscribeOptions> mHalEventSubscribeOptions;
 
+    // Subscribers of a property per subscribe flag, derived from mPropToClients.
+    struct PropertyClientMasks {
+        ClientMask fromCar;
+        ClientMask fromAndroid;
+    };
+    std::unordered_map<int32_t, PropertyClientMasks> mPropToClientMasks;
+    // Clients by slot; slots of removed clients are reused.
+    std::vector<sp<HalClient>> mClientSlots;
+    std::vector<uint32_t> mFreeClientSlots;
+
     OnPropertyUnsubscribed mOnPropertyUnsubscribed;
     sp<DeathRecipient> mCallbackDeathRecipient;
 };
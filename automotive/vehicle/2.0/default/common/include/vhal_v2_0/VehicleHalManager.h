@@ -87,8 +87,9 @@ public:
                                int32_t areaId);
 
     // ---------------------------------------------------------------------------------------------
-    // This method will be called from BatchingConsumer thread
+    // These methods will be called from BatchingConsumer thread
     void onBatchHalEvent(const std::vector<VehiclePropValuePtr >& values);
+    bool isPriorityHalEvent(const VehiclePropValuePtr& v) const;
 
     void handlePropertySetEvent(const VehiclePropValue& value);
 
@@ -18,10 +18,14 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 #define android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/types.h>
 
@@ -32,31 +36,50 @@ namespace vehicle {
 namespace V2_0 {
 
 // Handy metric mostly for unit tests and debug.
-#define INC_METRIC_IF_DEBUG(val) PoolStats::instance()->val++;
+#define ADD_METRIC_IF_DEBUG(val, n) PoolStats::instance()->val.fetch_add(n, std::memory_order_relaxed);
+#define INC_METRIC_IF_DEBUG(val) ADD_METRIC_IF_DEBUG(val, 1)
 struct PoolStats {
     std::atomic<uint32_t> Obtained {0};
     std::atomic<uint32_t> Created {0};
     std::atomic<uint32_t> Recycled {0};
+    // Objects moved from the shared depot to thread caches and back.
+    std::atomic<uint32_t> Refilled {0};
+    std::atomic<uint32_t> Spilled {0};
+    // Recycled objects deleted because the depot was full.
+    std::atomic<uint32_t> Discarded {0};
 
     static PoolStats* instance() {
         static PoolStats inst;
         return &inst;
     }
+
+    void dump(int fd) const;
 };
 
+template <typename T>
+class ObjectPool;
+
 template<typename T>
 struct Deleter  {
     using OnDeleteFunc = std::function<void(T*)>;
 
     Deleter(const OnDeleteFunc& f) : mOnDelete(f) {};
 
+    // Returns objects directly to the pool, without going through std::function.
+    explicit Deleter(ObjectPool<T>* pool) : mPool(pool) {}
+
     Deleter() = default;
     Deleter(const Deleter&) = default;
 
     void operator()(T* o) {
-        mOnDelete(o);
+        if (mPool != nullptr) {
+            mPool->recycle(o);
+        } else {
+            mOnDelete(o);
+        }
     }
 private:
+    ObjectPool<T>* mPool = nullptr;
     OnDeleteFunc mOnDelete;
 };
 
@@ -67,6 +90,106 @@ private:
 template <typename T>
 using recyclable_ptr = typename std::unique_ptr<T, Deleter<T>>;
 
+/**
+ * Lock-free store of pooled objects shared by the threads using an ObjectPool.
+ * Objects are exchanged in batches of up to BatchSize, kept in a fixed number
+ * of slots linked into two stacks: batches holding objects and empty ones.
+ * Stack heads are tagged with a counter to avoid ABA. Objects left in the
+ * depot are deleted with it.
+ */
+template<typename T, size_t BatchSize>
+class ObjectDepot {
+public:
+    explicit ObjectDepot(uint32_t batchCount)
+        : mBatches(new Batch[batchCount]) {
+        for (uint32_t i = 0; i < batchCount; i++) {
+            pushBatch(&mEmptyBatches, i);
+        }
+    }
+
+    ~ObjectDepot() {
+        uint32_t i;
+        while (popBatch(&mFullBatches, &i)) {
+            for (size_t j = 0; j < mBatches[i].count; j++) {
+                delete mBatches[i].objects[j];
+            }
+        }
+    }
+
+    // Stores count (at most BatchSize) objects. Returns false if the depot is full.
+    bool push(T* const* objects, size_t count) {
+        uint32_t i;
+        if (!popBatch(&mEmptyBatches, &i)) {
+            return false;
+        }
+        std::copy(objects, objects + count, mBatches[i].objects);
+        mBatches[i].count = count;
+        pushBatch(&mFullBatches, i);
+        return true;
+    }
+
+    // Takes a batch of objects out of the depot. Returns the number of objects
+    // written to outObjects, 0 if the depot is empty.
+    size_t pop(T** outObjects) {
+        uint32_t i;
+        if (!popBatch(&mFullBatches, &i)) {
+            return 0;
+        }
+        size_t count = mBatches[i].count;
+        std::copy(mBatches[i].objects, mBatches[i].objects + count, outObjects);
+        pushBatch(&mEmptyBatches, i);
+        return count;
+    }
+
+    ObjectDepot& operator =(const ObjectDepot &) = delete;
+    ObjectDepot(const ObjectDepot &) = delete;
+
+private:
+    static constexpr uint32_t kNoBatch = UINT32_MAX;
+
+    struct Batch {
+        std::atomic<uint32_t> next {kNoBatch};
+        size_t count = 0;
+        T* objects[BatchSize];
+    };
+
+    // Stack head: modification tag in the upper 32 bits, batch index in the lower ones.
+    static uint64_t makeHead(uint64_t oldHead, uint32_t index) {
+        return (((oldHead >> 32) + 1) << 32) | index;
+    }
+
+    void pushBatch(std::atomic<uint64_t>* head, uint32_t index) {
+        uint64_t oldHead = head->load(std::memory_order_relaxed);
+        do {
+            mBatches[index].next.store(static_cast<uint32_t>(oldHead),
+                                       std::memory_order_relaxed);
+        } while (!head->compare_exchange_weak(oldHead, makeHead(oldHead, index),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    bool popBatch(std::atomic<uint64_t>* head, uint32_t* outIndex) {
+        uint64_t oldHead = head->load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = static_cast<uint32_t>(oldHead);
+            if (index == kNoBatch) {
+                return false;
+            }
+            uint32_t next = mBatches[index].next.load(std::memory_order_relaxed);
+            if (head->compare_exchange_weak(oldHead, makeHead(oldHead, next),
+                                            std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                *outIndex = index;
+                return true;
+            }
+        }
+    }
+
+    std::unique_ptr<Batch[]> mBatches;
+    alignas(64) std::atomic<uint64_t> mFullBatches {kNoBatch};
+    alignas(64) std::atomic<uint64_t> mEmptyBatches {kNoBatch};
+};
+
 /**
  * Generic abstract object pool class. Users of this class must implement
  * #createObject method.
@@ -75,25 +198,51 @@ using recyclable_ptr = typename std::unique_ptr<T, Deleter<T>>;
  * multiple threads is OK, also client can obtain an object in one thread and
  * then move ownership to another thread.
  *
+ * Each thread keeps a small cache (magazine) of objects per pool, so obtain
+ * and recycle do not synchronize with other threads unless the magazine is
+ * empty or full, in which case a batch of objects is moved from or to a depot
+ * shared by all threads. Objects cached by other threads when the pool is
+ * destroyed are deleted when those threads exit.
  */
 template<typename T>
 class ObjectPool {
 public:
-    ObjectPool() = default;
-    virtual ~ObjectPool() = default;
+    static constexpr size_t kMagazineSize = 32;
+    // Objects move between magazines and the depot in batches of half a magazine.
+    static constexpr size_t kBatchSize = kMagazineSize / 2;
+    static constexpr uint32_t kDepotBatches = 16;
+
+    ObjectPool()
+        : mId(sNextId.fetch_add(1, std::memory_order_relaxed)),
+          mDepot(std::make_shared<Depot>(kDepotBatches)),
+          mDeleter(this) {}
+
+    virtual ~ObjectPool() {
+        ThreadCache* cache = getThreadCache();
+        if (cache != nullptr) {
+            cache->drop(mId);
+        }
+    }
 
     virtual recyclable_ptr<T> obtain() {
-        std::lock_guard<std::mutex> g(mLock);
         INC_METRIC_IF_DEBUG(Obtained)
-        if (mObjects.empty()) {
-            INC_METRIC_IF_DEBUG(Created)
-            return wrap(createObject());
+        std::vector<T*>* objects = getMagazine();
+        T* o = nullptr;
+        if (objects != nullptr) {
+            if (objects->empty()) {
+                refill(objects);
+            }
+            if (!objects->empty()) {
+                o = objects->back();
+                objects->pop_back();
+            }
         }
 
-        auto o = wrap(mObjects.front().release());
-        mObjects.pop_front();
-
-        return o;
+        if (o == nullptr) {
+            INC_METRIC_IF_DEBUG(Created)
+            o = createObject();
+        }
+        return wrap(o);
     }
 
     ObjectPool& operator =(const ObjectPool &) = delete;
@@ -104,28 +253,137 @@ protected:
 
     virtual void recycle(T* o) {
         INC_METRIC_IF_DEBUG(Recycled)
-        std::lock_guard<std::mutex> g(mLock);
-        mObjects.push_back(std::unique_ptr<T> { o } );
+        std::vector<T*>* objects = getMagazine();
+        if (objects == nullptr) {
+            INC_METRIC_IF_DEBUG(Discarded)
+            delete o;
+            return;
+        }
+
+        if (objects->size() >= kMagazineSize) {
+            spill(objects);
+        }
+        objects->push_back(o);
     }
 
 private:
-    const Deleter<T>& getDeleter() {
-        if (!mDeleter.get()) {
-            Deleter<T> *d = new Deleter<T>(std::bind(
-                &ObjectPool::recycle, this, std::placeholders::_1));
-            mDeleter.reset(d);
+    friend struct Deleter<T>;
+
+    using Depot = ObjectDepot<T, kBatchSize>;
+
+    struct Magazine {
+        std::weak_ptr<Depot> depot;
+        std::vector<T*> objects;
+    };
+
+    // Magazines of the calling thread for every pool of this type it used.
+    class ThreadCache {
+    public:
+        // Set once the cache of the calling thread is destroyed, e.g. while exiting.
+        static inline thread_local bool sDestroyed = false;
+
+        ~ThreadCache() {
+            for (auto& entry : mMagazines) {
+                release(&entry.second);
+            }
+            sDestroyed = true;
         }
-        return *mDeleter.get();
+
+        std::vector<T*>& get(uint64_t poolId, const std::shared_ptr<Depot>& depot) {
+            auto it = mMagazines.find(poolId);
+            if (it == mMagazines.end()) {
+                pruneDestroyedPools();
+                it = mMagazines.emplace(poolId, Magazine { depot, {} }).first;
+                it->second.objects.reserve(kMagazineSize);
+            }
+            return it->second.objects;
+        }
+
+        void drop(uint64_t poolId) {
+            auto it = mMagazines.find(poolId);
+            if (it != mMagazines.end()) {
+                for (T* o : it->second.objects) {
+                    delete o;
+                }
+                mMagazines.erase(it);
+            }
+        }
+
+    private:
+        static void release(Magazine* magazine) {
+            auto depot = magazine->depot.lock();
+            std::vector<T*>& objects = magazine->objects;
+            for (size_t i = 0; i < objects.size(); i += kBatchSize) {
+                size_t count = std::min(kBatchSize, objects.size() - i);
+                if (depot == nullptr || !depot->push(&objects[i], count)) {
+                    for (size_t j = i; j < i + count; j++) {
+                        delete objects[j];
+                    }
+                }
+            }
+            objects.clear();
+        }
+
+        void pruneDestroyedPools() {
+            for (auto it = mMagazines.begin(); it != mMagazines.end();) {
+                if (it->second.depot.expired()) {
+                    release(&it->second);
+                    it = mMagazines.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        std::unordered_map<uint64_t, Magazine> mMagazines;
+    };
+
+    static ThreadCache* getThreadCache() {
+        if (ThreadCache::sDestroyed) {
+            return nullptr;
+        }
+        static thread_local ThreadCache cache;
+        return &cache;
+    }
+
+    // Returns nullptr if the calling thread no longer has a cache.
+    std::vector<T*>* getMagazine() {
+        ThreadCache* cache = getThreadCache();
+        return cache == nullptr ? nullptr : &cache->get(mId, mDepot);
+    }
+
+    // Moves a batch from the depot to an empty magazine.
+    void refill(std::vector<T*>* objects) {
+        T* batch[kBatchSize];
+        size_t count = mDepot->pop(batch);
+        objects->insert(objects->end(), batch, batch + count);
+        ADD_METRIC_IF_DEBUG(Refilled, count)
+    }
+
+    // Moves the upper half of a full magazine to the depot.
+    void spill(std::vector<T*>* objects) {
+        size_t keep = objects->size() - kBatchSize;
+        if (mDepot->push(&(*objects)[keep], kBatchSize)) {
+            ADD_METRIC_IF_DEBUG(Spilled, kBatchSize)
+        } else {
+            for (size_t i = keep; i < objects->size(); i++) {
+                delete (*objects)[i];
+            }
+            ADD_METRIC_IF_DEBUG(Discarded, kBatchSize)
+        }
+        objects->resize(keep);
     }
 
     recyclable_ptr<T> wrap(T* raw) {
-        return recyclable_ptr<T> { raw, getDeleter() };
+        return recyclable_ptr<T> { raw, mDeleter };
     }
 
 private:
-    mutable std::mutex mLock;
-    std::deque<std::unique_ptr<T>> mObjects;
-    std::unique_ptr<Deleter<T>> mDeleter;
+    static inline std::atomic<uint64_t> sNextId {1};
+
+    const uint64_t mId;
+    const std::shared_ptr<Depot> mDepot;
+    const Deleter<T> mDeleter;
 };
 
 /**
@@ -174,8 +432,8 @@ public:
      * returning back to the object pool.
      *
      */
-    VehiclePropValuePool(size_t maxRecyclableVectorSize = 4) :
-        mMaxRecyclableVectorSize(maxRecyclableVectorSize) {};
+    VehiclePropValuePool(size_t maxRecyclableVectorSize = 4);
+    ~VehiclePropValuePool();
 
     RecyclableType obtain(VehiclePropertyType type);
 
@@ -224,6 +482,10 @@ private:
         size_t mVectorSize;
     };
 
+    // Returns the pool for values of given type and vector size, or nullptr
+    // if the type is not pooled.
+    InternalPool* getInternalPool(VehiclePropertyType type, size_t vecSize);
+
 private:
     const Deleter<VehiclePropValue> mDisposableDeleter {
         [] (VehiclePropValue* v) {
@@ -232,9 +494,10 @@ private:
     };
 
 private:
-    mutable std::mutex mLock;
     const size_t mMaxRecyclableVectorSize;
-    std::map<int32_t, std::unique_ptr<InternalPool>> mValueTypePools;
+    // One pool per recyclable type and vector size (0 to mMaxRecyclableVectorSize),
+    // created on first use.
+    std::unique_ptr<std::atomic<InternalPool*>[]> mValueTypePools;
 };
 
 }  // namespace V2_0
@@ -17,10 +17,13 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 
+#include <array>
 #include <cstdint>
-#include <unordered_map>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 
@@ -34,10 +37,13 @@ namespace V2_0 {
  * Encapsulates work related to storing and accessing configuration, storing and modifying
  * vehicle property values.
  *
- * VehiclePropertyValues stored in a sorted map thus it makes easier to get range of values, e.g.
- * to get value for all areas for particular property.
+ * Properties are spread over shards by property ID. Values of a property are kept in an
+ * immutable snapshot sorted by area and token, and every value is itself immutable once
+ * published, so readers copy values out of the current snapshot without waiting for writers.
+ * Writers of the same property serialize on a per-property lock; writers of different
+ * properties do not contend. Registering a property briefly blocks its shard.
  *
- * This class is thread-safe, however it uses blocking synchronization across all methods.
+ * This class is thread-safe.
  */
 class VehiclePropertyStore {
 public:
@@ -45,11 +51,6 @@ public:
     using TokenFunction = std::function<int64_t(const VehiclePropValue& value)>;
 
 private:
-    struct RecordConfig {
-        VehiclePropConfig propConfig;
-        TokenFunction tokenFunction;
-    };
-
     struct RecordId {
         int32_t prop;
         int32_t area;
@@ -59,8 +60,33 @@ private:
         bool operator<(const RecordId& other) const;
     };
 
-    using PropertyMap = std::map<RecordId, VehiclePropValue>;
-    using PropertyMapRange = std::pair<PropertyMap::const_iterator, PropertyMap::const_iterator>;
+    // Published value of a record. The pointer is swapped atomically on every write.
+    struct RecordValue {
+        std::shared_ptr<const VehiclePropValue> value;
+    };
+
+    // Records of one property, sorted by RecordId. A snapshot is never modified once
+    // published; adding or removing records publishes a new one.
+    using RecordMap = std::map<RecordId, std::shared_ptr<RecordValue>>;
+
+    struct PropertyRecord {
+        VehiclePropConfig propConfig;
+        TokenFunction tokenFunction;
+
+        // serializes writers of this property
+        std::mutex writeLock;
+        // accessed with std::atomic_load/std::atomic_store
+        std::shared_ptr<const RecordMap> records;
+    };
+
+    struct Shard {
+        // held exclusively only to register properties
+        mutable std::shared_mutex lock;
+        std::unordered_map<int32_t /* VehicleProperty */, std::unique_ptr<PropertyRecord>>
+                properties;
+    };
+
+    static constexpr size_t kShardCount = 16;
 
 public:
     void registerProperty(const VehiclePropConfig& config, TokenFunction tokenFunc = nullptr);
@@ -83,16 +109,21 @@ public:
     const VehiclePropConfig* getConfigOrDie(int32_t propId) const;
 
 private:
-    RecordId getRecordIdLocked(const VehiclePropValue& valuePrototype) const;
-    const VehiclePropValue* getValueOrNullLocked(const RecordId& recId) const;
-    PropertyMapRange findRangeLocked(int32_t propId) const;
+    Shard& getShard(int32_t propId) const;
+    PropertyRecord* findPropertyLocked(const Shard& shard, int32_t propId) const;
+    RecordId getRecordId(const PropertyRecord& property,
+                         const VehiclePropValue& valuePrototype) const;
+    std::unique_ptr<VehiclePropValue> readRecordOrNull(const PropertyRecord& property,
+                                                       const RecordId& recId) const;
+    void appendValues(const PropertyRecord& property,
+                      std::vector<VehiclePropValue>* outValues) const;
 
 private:
+    using SharedGuard = std::shared_lock<std::shared_mutex>;
+    using UniqueGuard = std::unique_lock<std::shared_mutex>;
     using MuxGuard = std::lock_guard<std::mutex>;
-    mutable std::mutex mLock;
-    std::unordered_map<int32_t /* VehicleProperty */, RecordConfig> mConfigs;
 
-    PropertyMap mPropertyValues;  // Sorted map of RecordId : VehiclePropValue.
+    mutable std::array<Shard, kShardCount> mShards;
 };
 
 }  // namespace V2_0
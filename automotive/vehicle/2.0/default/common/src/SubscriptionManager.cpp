@@ -18,6 +18,7 @@
 
 #include "SubscriptionManager.h"
 
+#include <algorithm>
 #include <cmath>
 #include <inttypes.h>
 
@@ -105,6 +106,7 @@ StatusCode SubscriptionManager::addOrUpdateSubscription(
         client->addOrUpdateSubscription(opts);
 
         addClientToPropMapLocked(opts.propId, client);
+        updateClientMasksLocked(opts.propId);
 
         if (SubscribeFlags::EVENTS_FROM_CAR & opts.flags) {
             SubscribeOptions updated;
@@ -120,28 +122,81 @@ StatusCode SubscriptionManager::addOrUpdateSubscription(
 std::list<HalClientValues> SubscriptionManager::distributeValuesToClients(
         const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
         SubscribeFlags flags) const {
-    std::map<sp<HalClient>, std::list<VehiclePropValue*>> clientValuesMap;
+    std::list<HalClientValues> clientValues;
+    for (const HalClientBatch& batch : distributeValuesToClientBatches(propValues, flags)) {
+        for (const auto& client : batch.clients) {
+            clientValues.push_back(HalClientValues {
+                .client = client,
+                .values = std::list<VehiclePropValue*>(batch.values.begin(), batch.values.end())
+            });
+        }
+    }
 
+    return clientValues;
+}
+
+std::vector<HalClientBatch> SubscriptionManager::distributeValuesToClientBatches(
+        const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
+        SubscribeFlags flags) const {
+    struct ClientMaskHash {
+        size_t operator()(const ClientMask& mask) const { return mask.hash(); }
+    };
+    static constexpr uint32_t kNoGroup = UINT32_MAX;
+
+    // Values whose properties have the same subscribers form a group. A client receives
+    // every group it is part of, so clients that are part of the same groups share a batch.
+    std::unordered_map<ClientMask, uint32_t, ClientMaskHash> groupByMask;
+    std::vector<const ClientMask*> groupMasks;
+    std::vector<uint32_t> valueGroups(propValues.size(), kNoGroup);
+    ClientMask allClients;
+
+    std::vector<HalClientBatch> batches;
+    std::vector<std::vector<uint32_t>> batchGroups;
     {
         MuxGuard g(mLock);
-        for (const auto& propValue: propValues) {
-            VehiclePropValue* v = propValue.get();
-            auto clients = getSubscribedClientsLocked(v->prop, flags);
-            for (const auto& client : clients) {
-                clientValuesMap[client].push_back(v);
+        for (size_t i = 0; i < propValues.size(); i++) {
+            ClientMask mask = getClientMaskLocked(propValues[i]->prop, flags);
+            if (mask.empty()) {
+                continue;
+            }
+            auto res = groupByMask.emplace(std::move(mask), groupMasks.size());
+            if (res.second) {
+                groupMasks.push_back(&res.first->first);
+                allClients.merge(res.first->first);
             }
+            valueGroups[i] = res.first->second;
         }
-    }
 
-    std::list<HalClientValues> clientValues;
-    for (const auto& entry : clientValuesMap) {
-        clientValues.push_back(HalClientValues {
-            .client = entry.first,
-            .values = entry.second
+        std::map<std::vector<uint32_t>, size_t> batchByGroups;
+        std::vector<uint32_t> groups;
+        allClients.forEach([&](uint32_t slot) {
+            groups.clear();
+            for (uint32_t group = 0; group < groupMasks.size(); group++) {
+                if (groupMasks[group]->test(slot)) {
+                    groups.push_back(group);
+                }
+            }
+            auto res = batchByGroups.emplace(groups, batches.size());
+            if (res.second) {
+                batches.emplace_back();
+                batchGroups.push_back(groups);
+            }
+            batches[res.first->second].clients.push_back(mClientSlots[slot]);
         });
     }
 
-    return clientValues;
+    for (size_t b = 0; b < batches.size(); b++) {
+        const std::vector<uint32_t>& groups = batchGroups[b];
+        std::vector<VehiclePropValue*>& values = batches[b].values;
+        for (size_t i = 0; i < propValues.size(); i++) {
+            if (valueGroups[i] != kNoGroup &&
+                std::binary_search(groups.begin(), groups.end(), valueGroups[i])) {
+                values.push_back(propValues[i].get());
+            }
+        }
+    }
+
+    return batches;
 }
 
 std::list<sp<HalClient>> SubscriptionManager::getSubscribedClients(int32_t propId,
@@ -207,6 +262,41 @@ sp<HalClientVector> SubscriptionManager::getClientsForPropertyLocked(
     return it == mPropToClients.end() ? nullptr : it->second;
 }
 
+void SubscriptionManager::updateClientMasksLocked(int32_t propId) {
+    sp<HalClientVector> propClients = getClientsForPropertyLocked(propId);
+    if (propClients.get() == nullptr) {
+        mPropToClientMasks.erase(propId);
+        return;
+    }
+
+    PropertyClientMasks masks;
+    for (size_t i = 0; i < propClients->size(); i++) {
+        const auto& client = propClients->itemAt(i);
+        if (client->isSubscribed(propId, SubscribeFlags::EVENTS_FROM_CAR)) {
+            masks.fromCar.set(client->getSlot());
+        }
+        if (client->isSubscribed(propId, SubscribeFlags::EVENTS_FROM_ANDROID)) {
+            masks.fromAndroid.set(client->getSlot());
+        }
+    }
+    mPropToClientMasks[propId] = std::move(masks);
+}
+
+ClientMask SubscriptionManager::getClientMaskLocked(int32_t propId,
+                                                    SubscribeFlags flags) const {
+    ClientMask mask;
+    auto it = mPropToClientMasks.find(propId);
+    if (it != mPropToClientMasks.end()) {
+        if (SubscribeFlags::EVENTS_FROM_CAR & flags) {
+            mask.merge(it->second.fromCar);
+        }
+        if (SubscribeFlags::EVENTS_FROM_ANDROID & flags) {
+            mask.merge(it->second.fromAndroid);
+        }
+    }
+    return mask;
+}
+
 sp<HalClient> SubscriptionManager::getOrCreateHalClientLocked(
         ClientId clientId, const sp<IVehicleCallback>& callback) {
     auto it = mClients.find(clientId);
@@ -221,7 +311,17 @@ sp<HalClient> SubscriptionManager::getOrCreateHalClientLocked(
             return nullptr;
         }
 
-        sp<HalClient> client = new HalClient(callback);
+        uint32_t slot;
+        if (mFreeClientSlots.empty()) {
+            slot = mClientSlots.size();
+            mClientSlots.emplace_back();
+        } else {
+            slot = mFreeClientSlots.back();
+            mFreeClientSlots.pop_back();
+        }
+
+        sp<HalClient> client = new HalClient(callback, slot);
+        mClientSlots[slot] = client;
         mClients.insert({clientId, client});
         return client;
     } else {
@@ -245,6 +345,7 @@ void SubscriptionManager::unsubscribe(ClientId clientId,
             if (propertyClients->isEmpty()) {
                 mPropToClients.erase(propId);
             }
+            updateClientMasksLocked(propId);
         }
 
         bool isClientSubscribedToOtherProps = false;
@@ -261,6 +362,8 @@ void SubscriptionManager::unsubscribe(ClientId clientId,
                 ALOGW("%s failed to unlink to death, client: %p, err: %s",
                       __func__, client->getCallback().get(), res.description().c_str());
             }
+            mClientSlots[client->getSlot()].clear();
+            mFreeClientSlots.push_back(client->getSlot());
             mClients.erase(clientIter);
         }
     }
@@ -45,6 +45,8 @@ using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_string;
 
 constexpr std::chrono::milliseconds kHalEventBatchingTimeWindow(10);
+// Upper bound of events delivered to clients in one batch.
+constexpr size_t kHalEventBatchMaxSize = 128;
 
 const VehiclePropValue kEmptyValue{};
 
@@ -214,6 +216,8 @@ void VehicleHalManager::cmdDump(int fd, const hidl_vec<hidl_string>& options) {
         cmdDumpSpecificProperties(fd, options);
     } else if (EqualsIgnoreCase(option, "--set")) {
         cmdSetOneProperty(fd, options);
+    } else if (EqualsIgnoreCase(option, "--poolstats")) {
+        PoolStats::instance()->dump(fd);
     } else {
         dprintf(fd, "Invalid option: %s\n", option.c_str());
     }
@@ -260,6 +264,7 @@ void VehicleHalManager::cmdHelp(int fd) const {
             "s for string) and an optional area.\n"
             "Notice that the string value can be set just once, while the other can have multiple "
             "values (so they're used in the respective array)\n");
+    dprintf(fd, "--poolstats: dumps the property value pool statistics\n");
 }
 
 void VehicleHalManager::cmdListAllProperties(int fd) const {
@@ -433,12 +438,6 @@ void VehicleHalManager::init() {
 
     mHidlVecOfVehiclePropValuePool.resize(kMaxHidlVecOfVehiclPropValuePoolSize);
 
-
-    mBatchingConsumer.run(&mEventQueue,
-                          kHalEventBatchingTimeWindow,
-                          std::bind(&VehicleHalManager::onBatchHalEvent,
-                                    this, _1));
-
     mHal->init(&mValueObjectPool,
                std::bind(&VehicleHalManager::onHalEvent, this, _1),
                std::bind(&VehicleHalManager::onHalPropertySetError, this,
@@ -448,6 +447,17 @@ void VehicleHalManager::init() {
     auto supportedPropConfigs = mHal->listProperties();
     mConfigIndex.reset(new VehiclePropConfigIndex(supportedPropConfigs));
 
+    // Events pushed by the HAL so far wait in mEventQueue. The consumer starts once the config
+    // index is ready because isPriorityHalEvent() reads it.
+    BatchingConsumer<VehiclePropValuePtr>::Policy batchingPolicy;
+    batchingPolicy.maxDelay = kHalEventBatchingTimeWindow;
+    batchingPolicy.maxBatchSize = kHalEventBatchMaxSize;
+    batchingPolicy.isPriority = std::bind(&VehicleHalManager::isPriorityHalEvent, this, _1);
+    mBatchingConsumer.run(&mEventQueue,
+                          batchingPolicy,
+                          std::bind(&VehicleHalManager::onBatchHalEvent,
+                                    this, _1));
+
     std::vector<int32_t> supportedProperties(
         supportedPropConfigs.size());
     for (const auto& config : supportedPropConfigs) {
@@ -468,6 +478,13 @@ void VehicleHalManager::onHalEvent(VehiclePropValuePtr v) {
     mEventQueue.push(std::move(v));
 }
 
+bool VehicleHalManager::isPriorityHalEvent(const VehiclePropValuePtr& v) const {
+    // Continuous properties are sampled sensors that tolerate batching; on-change events such
+    // as state changes are delivered without waiting for the batching window.
+    const auto* config = getPropConfigOrNull(v->prop);
+    return config != nullptr && config->changeMode == VehiclePropertyChangeMode::ON_CHANGE;
+}
+
 void VehicleHalManager::onHalPropertySetError(StatusCode errorCode,
                                               int32_t property,
                                               int32_t areaId) {
@@ -480,11 +497,12 @@ void VehicleHalManager::onHalPropertySetError(StatusCode errorCode,
 }
 
 void VehicleHalManager::onBatchHalEvent(const std::vector<VehiclePropValuePtr>& values) {
-    const auto& clientValues =
-        mSubscriptionManager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR);
+    const auto& batches = mSubscriptionManager.distributeValuesToClientBatches(
+            values, SubscribeFlags::EVENTS_FROM_CAR);
 
-    for (const HalClientValues& cv : clientValues) {
-        auto vecSize = cv.values.size();
+    for (const HalClientBatch& batch : batches) {
+        // Clients subscribed to the same values share one copy of them.
+        auto vecSize = batch.values.size();
         hidl_vec<VehiclePropValue> vec;
         if (vecSize < kMaxHidlVecOfVehiclPropValuePoolSize) {
             vec.setToExternal(&mHidlVecOfVehiclePropValuePool[0], vecSize);
@@ -493,14 +511,16 @@ void VehicleHalManager::onBatchHalEvent(const std::vector<VehiclePropValuePtr>&
         }
 
         int i = 0;
-        for (VehiclePropValue* pValue : cv.values) {
+        for (VehiclePropValue* pValue : batch.values) {
             shallowCopy(&(vec)[i++], *pValue);
         }
-        auto status = cv.client->getCallback()->onPropertyEvent(vec);
-        if (!status.isOk()) {
-            ALOGE("Failed to notify client %s, err: %s",
-                  toString(cv.client->getCallback()).c_str(),
-                  status.description().c_str());
+        for (const auto& client : batch.clients) {
+            auto status = client->getCallback()->onPropertyEvent(vec);
+            if (!status.isOk()) {
+                ALOGE("Failed to notify client %s, err: %s",
+                      toString(client->getCallback()).c_str(),
+                      status.description().c_str());
+            }
         }
     }
 }
@@ -18,6 +18,9 @@
 
 #include "VehicleObjectPool.h"
 
+#include <inttypes.h>
+#include <stdio.h>
+
 #include <log/log.h>
 
 #include "VehicleUtils.h"
@@ -28,6 +31,51 @@ namespace automotive {
 namespace vehicle {
 namespace V2_0 {
 
+namespace {
+
+// Value types that have pools, all other types are disposable.
+constexpr VehiclePropertyType kRecyclableTypes[] = {
+    VehiclePropertyType::BOOLEAN,
+    VehiclePropertyType::INT32,
+    VehiclePropertyType::INT32_VEC,
+    VehiclePropertyType::INT64,
+    VehiclePropertyType::INT64_VEC,
+    VehiclePropertyType::FLOAT,
+    VehiclePropertyType::FLOAT_VEC,
+    VehiclePropertyType::BYTES,
+};
+constexpr size_t kRecyclableTypeCount = sizeof(kRecyclableTypes) / sizeof(kRecyclableTypes[0]);
+
+int getRecyclableTypeIndex(VehiclePropertyType type) {
+    for (size_t i = 0; i < kRecyclableTypeCount; i++) {
+        if (kRecyclableTypes[i] == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+}  // namespace
+
+void PoolStats::dump(int fd) const {
+    dprintf(fd, "Object pool stats:\n");
+    dprintf(fd, "  obtained: %" PRIu32 ", created: %" PRIu32 ", recycled: %" PRIu32 "\n",
+            Obtained.load(), Created.load(), Recycled.load());
+    dprintf(fd, "  depot refilled: %" PRIu32 ", spilled: %" PRIu32 ", discarded: %" PRIu32 "\n",
+            Refilled.load(), Spilled.load(), Discarded.load());
+}
+
+VehiclePropValuePool::VehiclePropValuePool(size_t maxRecyclableVectorSize)
+    : mMaxRecyclableVectorSize(maxRecyclableVectorSize),
+      mValueTypePools(new std::atomic<InternalPool*>[kRecyclableTypeCount *
+                                                     (maxRecyclableVectorSize + 1)]()) {}
+
+VehiclePropValuePool::~VehiclePropValuePool() {
+    for (size_t i = 0; i < kRecyclableTypeCount * (mMaxRecyclableVectorSize + 1); i++) {
+        delete mValueTypePools[i].load();
+    }
+}
+
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
         VehiclePropertyType type, size_t vecSize) {
     return isDisposable(type, vecSize)
@@ -88,18 +136,28 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainComplex() {
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainRecylable(
         VehiclePropertyType type, size_t vecSize) {
-    // VehiclePropertyType is not overlapping with vectorSize.
-    int32_t key = static_cast<int32_t>(type)
-                  | static_cast<int32_t>(vecSize);
+    InternalPool* pool = getInternalPool(type, vecSize);
+    return pool != nullptr ? pool->obtain() : obtainDisposable(type, vecSize);
+}
 
-    std::lock_guard<std::mutex> g(mLock);
-    auto it = mValueTypePools.find(key);
+VehiclePropValuePool::InternalPool* VehiclePropValuePool::getInternalPool(
+        VehiclePropertyType type, size_t vecSize) {
+    int typeIndex = getRecyclableTypeIndex(type);
+    if (typeIndex < 0) {
+        return nullptr;
+    }
 
-    if (it == mValueTypePools.end()) {
-        auto newPool(std::make_unique<InternalPool>(type, vecSize));
-        it = mValueTypePools.emplace(key, std::move(newPool)).first;
+    std::atomic<InternalPool*>& slot =
+            mValueTypePools[typeIndex * (mMaxRecyclableVectorSize + 1) + vecSize];
+    InternalPool* pool = slot.load(std::memory_order_acquire);
+    if (pool == nullptr) {
+        // Racing threads may both create the pool, only one of them is kept.
+        auto newPool = std::make_unique<InternalPool>(type, vecSize);
+        if (slot.compare_exchange_strong(pool, newPool.get(), std::memory_order_acq_rel)) {
+            pool = newPool.release();
+        }
     }
-    return it->second->obtain();
+    return pool;
 }
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainBoolean(
@@ -16,6 +16,8 @@
 #define LOG_TAG "VehiclePropertyStore"
 #include <log/log.h>
 
+#include <algorithm>
+
 #include <common/include/vhal_v2_0/VehicleUtils.h>
 #include "VehiclePropertyStore.h"
 
@@ -37,68 +39,109 @@ bool VehiclePropertyStore::RecordId::operator<(const VehiclePropertyStore::Recor
 
 void VehiclePropertyStore::registerProperty(const VehiclePropConfig& config,
                                             VehiclePropertyStore::TokenFunction tokenFunc) {
-    MuxGuard g(mLock);
-    mConfigs.insert({ config.prop, RecordConfig { config, tokenFunc } });
+    Shard& shard = getShard(config.prop);
+    UniqueGuard g(shard.lock);
+    if (shard.properties.count(config.prop)) return;
+
+    auto property = std::make_unique<PropertyRecord>();
+    property->propConfig = config;
+    property->tokenFunction = tokenFunc;
+    property->records = std::make_shared<const RecordMap>();
+    shard.properties.insert({ config.prop, std::move(property) });
 }
 
 bool VehiclePropertyStore::writeValue(const VehiclePropValue& propValue,
                                         bool updateStatus) {
-    MuxGuard g(mLock);
-    if (!mConfigs.count(propValue.prop)) return false;
-
-    RecordId recId = getRecordIdLocked(propValue);
-    VehiclePropValue* valueToUpdate = const_cast<VehiclePropValue*>(getValueOrNullLocked(recId));
-    if (valueToUpdate == nullptr) {
-        mPropertyValues.insert({ recId, propValue });
+    Shard& shard = getShard(propValue.prop);
+    SharedGuard g(shard.lock);
+    PropertyRecord* property = findPropertyLocked(shard, propValue.prop);
+    if (property == nullptr) return false;
+
+    RecordId recId = getRecordId(*property, propValue);
+    MuxGuard writeGuard(property->writeLock);
+    std::shared_ptr<const RecordMap> records = std::atomic_load(&property->records);
+    auto it = records->find(recId);
+    if (it == records->end()) {
+        auto newRecords = std::make_shared<RecordMap>(*records);
+        auto record = std::make_shared<RecordValue>();
+        record->value = std::make_shared<const VehiclePropValue>(propValue);
+        newRecords->insert({ recId, std::move(record) });
+        std::atomic_store(&property->records, std::shared_ptr<const RecordMap>(newRecords));
         return true;
     }
 
+    RecordValue& record = *it->second;
+    std::shared_ptr<const VehiclePropValue> current = std::atomic_load(&record.value);
     // propValue is outdated and drops it.
-    if (valueToUpdate->timestamp > propValue.timestamp) {
+    if (current->timestamp > propValue.timestamp) {
         return false;
     }
     // update the propertyValue.
     // The timestamp in propertyStore should only be updated by the server side. It indicates
     // the time when the event is generated by the server.
+    auto valueToUpdate = std::make_shared<VehiclePropValue>(*current);
     valueToUpdate->timestamp = propValue.timestamp;
     valueToUpdate->value = propValue.value;
     if (updateStatus) {
         valueToUpdate->status = propValue.status;
     }
+    std::atomic_store(&record.value, std::shared_ptr<const VehiclePropValue>(valueToUpdate));
     return true;
 }
 
 void VehiclePropertyStore::removeValue(const VehiclePropValue& propValue) {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(propValue);
-    auto it = mPropertyValues.find(recId);
-    if (it != mPropertyValues.end()) {
-        mPropertyValues.erase(it);
+    Shard& shard = getShard(propValue.prop);
+    SharedGuard g(shard.lock);
+    PropertyRecord* property = findPropertyLocked(shard, propValue.prop);
+    if (property == nullptr) return;
+
+    RecordId recId = getRecordId(*property, propValue);
+    MuxGuard writeGuard(property->writeLock);
+    std::shared_ptr<const RecordMap> records = std::atomic_load(&property->records);
+    if (records->count(recId)) {
+        auto newRecords = std::make_shared<RecordMap>(*records);
+        newRecords->erase(recId);
+        std::atomic_store(&property->records, std::shared_ptr<const RecordMap>(newRecords));
     }
 }
 
 void VehiclePropertyStore::removeValuesForProperty(int32_t propId) {
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    mPropertyValues.erase(range.first, range.second);
+    Shard& shard = getShard(propId);
+    SharedGuard g(shard.lock);
+    PropertyRecord* property = findPropertyLocked(shard, propId);
+    if (property == nullptr) return;
+
+    MuxGuard writeGuard(property->writeLock);
+    std::atomic_store(&property->records, std::make_shared<const RecordMap>());
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readAllValues() const {
-    MuxGuard g(mLock);
+    // Properties are never unregistered, so the records stay valid after the shard is unlocked.
+    std::vector<std::pair<int32_t, const PropertyRecord*>> properties;
+    for (const Shard& shard : mShards) {
+        SharedGuard g(shard.lock);
+        for (auto&& it : shard.properties) {
+            properties.push_back({ it.first, it.second.get() });
+        }
+    }
+    // Keep the values sorted by property as before sharding.
+    std::sort(properties.begin(), properties.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
     std::vector<VehiclePropValue> allValues;
-    allValues.reserve(mPropertyValues.size());
-    for (auto&& it : mPropertyValues) {
-        allValues.push_back(it.second);
+    for (auto&& it : properties) {
+        appendValues(*it.second, &allValues);
     }
     return allValues;
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readValuesForProperty(int32_t propId) const {
     std::vector<VehiclePropValue> values;
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    for (auto it = range.first; it != range.second; ++it) {
-        values.push_back(it->second);
+    Shard& shard = getShard(propId);
+    SharedGuard g(shard.lock);
+    const PropertyRecord* property = findPropertyLocked(shard, propId);
+    if (property != nullptr) {
+        appendValues(*property, &values);
     }
 
     return values;
@@ -106,35 +149,42 @@ std::vector<VehiclePropValue> VehiclePropertyStore::readValuesForProperty(int32_
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         const VehiclePropValue& request) const {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(request);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
-    return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
+    Shard& shard = getShard(request.prop);
+    SharedGuard g(shard.lock);
+    const PropertyRecord* property = findPropertyLocked(shard, request.prop);
+    if (property == nullptr) return nullptr;
+
+    return readRecordOrNull(*property, getRecordId(*property, request));
 }
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         int32_t prop, int32_t area, int64_t token) const {
     RecordId recId = {prop, isGlobalProp(prop) ? 0 : area, token };
-    MuxGuard g(mLock);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
-    return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
+    Shard& shard = getShard(prop);
+    SharedGuard g(shard.lock);
+    const PropertyRecord* property = findPropertyLocked(shard, prop);
+    if (property == nullptr) return nullptr;
+
+    return readRecordOrNull(*property, recId);
 }
 
 
 std::vector<VehiclePropConfig> VehiclePropertyStore::getAllConfigs() const {
-    MuxGuard g(mLock);
     std::vector<VehiclePropConfig> configs;
-    configs.reserve(mConfigs.size());
-    for (auto&& recordConfigIt: mConfigs) {
-        configs.push_back(recordConfigIt.second.propConfig);
+    for (const Shard& shard : mShards) {
+        SharedGuard g(shard.lock);
+        for (auto&& propertyIt : shard.properties) {
+            configs.push_back(propertyIt.second->propConfig);
+        }
     }
     return configs;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrNull(int32_t propId) const {
-    MuxGuard g(mLock);
-    auto recordConfigIt = mConfigs.find(propId);
-    return recordConfigIt != mConfigs.end() ? &recordConfigIt->second.propConfig : nullptr;
+    Shard& shard = getShard(propId);
+    SharedGuard g(shard.lock);
+    const PropertyRecord* property = findPropertyLocked(shard, propId);
+    return property != nullptr ? &property->propConfig : nullptr;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) const {
@@ -146,35 +196,48 @@ const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) co
     return cfg;
 }
 
-VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordIdLocked(
-        const VehiclePropValue& valuePrototype) const {
+VehiclePropertyStore::Shard& VehiclePropertyStore::getShard(int32_t propId) const {
+    // The low bits of the property ID are its index within the property group.
+    return mShards[static_cast<uint32_t>(propId) % kShardCount];
+}
+
+VehiclePropertyStore::PropertyRecord* VehiclePropertyStore::findPropertyLocked(
+        const Shard& shard, int32_t propId) const {
+    auto it = shard.properties.find(propId);
+    return it == shard.properties.end() ? nullptr : it->second.get();
+}
+
+VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordId(
+        const PropertyRecord& property, const VehiclePropValue& valuePrototype) const {
     RecordId recId = {
         .prop = valuePrototype.prop,
         .area = isGlobalProp(valuePrototype.prop) ? 0 : valuePrototype.areaId,
         .token = 0
     };
 
-    auto it = mConfigs.find(recId.prop);
-    if (it == mConfigs.end()) return {};
-
-    if (it->second.tokenFunction != nullptr) {
-        recId.token = it->second.tokenFunction(valuePrototype);
+    if (property.tokenFunction != nullptr) {
+        recId.token = property.tokenFunction(valuePrototype);
     }
     return recId;
 }
 
-const VehiclePropValue* VehiclePropertyStore::getValueOrNullLocked(
-        const VehiclePropertyStore::RecordId& recId) const  {
-    auto it = mPropertyValues.find(recId);
-    return it == mPropertyValues.end() ? nullptr : &it->second;
-}
+std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readRecordOrNull(
+        const PropertyRecord& property, const RecordId& recId) const {
+    std::shared_ptr<const RecordMap> records = std::atomic_load(&property.records);
+    auto it = records->find(recId);
+    if (it == records->end()) return nullptr;
 
-VehiclePropertyStore::PropertyMapRange VehiclePropertyStore::findRangeLocked(int32_t propId) const {
-    // Based on the fact that mPropertyValues is a sorted map by RecordId.
-    auto beginIt = mPropertyValues.lower_bound( RecordId { propId, INT32_MIN, 0 });
-    auto endIt = mPropertyValues.lower_bound( RecordId { propId + 1, INT32_MIN, 0 });
+    std::shared_ptr<const VehiclePropValue> value = std::atomic_load(&it->second->value);
+    return std::make_unique<VehiclePropValue>(*value);
+}
 
-    return  PropertyMapRange { beginIt, endIt };
+void VehiclePropertyStore::appendValues(const PropertyRecord& property,
+                                        std::vector<VehiclePropValue>* outValues) const {
+    std::shared_ptr<const RecordMap> records = std::atomic_load(&property.records);
+    outValues->reserve(outValues->size() + records->size());
+    for (auto&& it : *records) {
+        outValues->push_back(*std::atomic_load(&it.second->value));
+    }
 }
 
 }  // namespace V2_0
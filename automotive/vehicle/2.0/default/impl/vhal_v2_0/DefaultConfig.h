@@ -150,10 +150,17 @@ enum class FakeDataCommand : int32_t {
     /**
      * Starts JSON-based fake data generation. It iterates through JSON-encoded VHAL events from a
      * file and inject them to VHAL. The iteration can be repeated multiple times or infinitely.
+     * The file can also be a binary trace converted from JSON (see FakeValueTrace.h), which is
+     * replayed without loading it into memory first.
      * Caller must provide additional data:
      *     int32Values[1] - number of iterations. If it is not provided or -1. The iteration will be
      *                      repeated infinite times.
      *     stringValue    - path to the fake values JSON file
+     * Optionally:
+     *     int32Values[2] - replay id, to run several replays of the same file at the same time.
+     *                      Defaults to 0.
+     *     floatValues[0] - playback speed, e.g. 10 replays the events at 10x real-time. Defaults
+     *                      to 1.
      */
     StartJson = 2,
 
@@ -162,6 +169,8 @@ enum class FakeDataCommand : int32_t {
      * same time. Caller must provide the path of fake value JSON file to stop the corresponding
      * generation:
      *     stringValue    - path to the fake values JSON file
+     * Optionally:
+     *     int32Values[1] - replay id passed to StartJson. Defaults to 0.
      */
     StopJson = 3,
 
@@ -44,6 +44,15 @@ using TimePoint = std::chrono::time_point<Clock, Nanos>;
 
 using FakeValueGeneratorPtr = std::unique_ptr<FakeValueGenerator>;
 
+/**
+ * Returns the playback speed of a replay request (see FakeDataCommand::StartJson). Delays between
+ * replayed events are divided by it, e.g. 10 replays a recording at 10x real-time.
+ */
+inline float getReplaySpeed(const VehiclePropValue& request) {
+    const auto& floatValues = request.value.floatValues;
+    return floatValues.size() > 0 && floatValues[0] > 0 ? floatValues[0] : 1.0f;
+}
+
 }  // namespace impl
 
 }  // namespace V2_0
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeValueTrace"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <log/log.h>
+
+#include "FakeValueTrace.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+namespace {
+
+constexpr char kTraceMagic[8] = {'V', 'H', 'A', 'L', 'T', 'R', 'C', '\0'};
+constexpr uint32_t kTraceVersion = 1;
+constexpr size_t kRecordAlignment = 8;
+
+size_t alignRecordSize(size_t size) {
+    return (size + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+template <typename T>
+void appendValues(std::vector<uint8_t>* buffer, const T* values, size_t count) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+    buffer->insert(buffer->end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+const uint8_t* readValues(hidl_vec<T>* dest, const uint8_t* src, size_t count) {
+    dest->resize(count);
+    if (count > 0) {
+        memcpy(dest->data(), src, count * sizeof(T));
+    }
+    return src + count * sizeof(T);
+}
+
+}  // namespace
+
+FakeValueTraceWriter::~FakeValueTraceWriter() {
+    close();
+}
+
+bool FakeValueTraceWriter::open(const std::string& path) {
+    mFile = fopen(path.c_str(), "wbe");
+    if (mFile == nullptr) {
+        ALOGE("%s: couldn't open %s for writing: %s", __func__, path.c_str(), strerror(errno));
+        return false;
+    }
+    mEventCount = 0;
+    FakeValueTraceHeader header = {};
+    memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+    header.version = kTraceVersion;
+    if (fwrite(&header, sizeof(header), 1, mFile) != 1) {
+        ALOGE("%s: couldn't write the header of %s: %s", __func__, path.c_str(), strerror(errno));
+        fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool FakeValueTraceWriter::write(const VehiclePropValue& event) {
+    if (mFile == nullptr) {
+        return false;
+    }
+    const auto& value = event.value;
+    FakeValueTraceRecord record = {};
+    record.prop = event.prop;
+    record.areaId = event.areaId;
+    record.status = static_cast<int32_t>(event.status);
+    record.timestamp = event.timestamp;
+    record.int64Count = value.int64Values.size();
+    record.int32Count = value.int32Values.size();
+    record.floatCount = value.floatValues.size();
+    record.byteCount = value.bytes.size();
+    record.stringLength = value.stringValue.size();
+
+    mBuffer.clear();
+    appendValues(&mBuffer, &record, 1);
+    appendValues(&mBuffer, value.int64Values.data(), value.int64Values.size());
+    appendValues(&mBuffer, value.int32Values.data(), value.int32Values.size());
+    appendValues(&mBuffer, value.floatValues.data(), value.floatValues.size());
+    appendValues(&mBuffer, value.bytes.data(), value.bytes.size());
+    appendValues(&mBuffer, value.stringValue.c_str(), value.stringValue.size());
+    mBuffer.resize(alignRecordSize(mBuffer.size()), 0);
+
+    record.size = mBuffer.size();
+    memcpy(mBuffer.data(), &record, sizeof(record));
+    if (fwrite(mBuffer.data(), mBuffer.size(), 1, mFile) != 1) {
+        ALOGE("%s: failed to write event: %s", __func__, strerror(errno));
+        return false;
+    }
+    mEventCount++;
+    return true;
+}
+
+bool FakeValueTraceWriter::close() {
+    if (mFile == nullptr) {
+        return false;
+    }
+    bool success = fseek(mFile, offsetof(FakeValueTraceHeader, eventCount), SEEK_SET) == 0 &&
+                   fwrite(&mEventCount, sizeof(mEventCount), 1, mFile) == 1;
+    success = fclose(mFile) == 0 && success;
+    mFile = nullptr;
+    return success;
+}
+
+FakeValueTraceReader::~FakeValueTraceReader() {
+    close();
+}
+
+bool FakeValueTraceReader::isTraceFile(const std::string& path) {
+    int fd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        return false;
+    }
+    char magic[sizeof(kTraceMagic)];
+    bool isTrace = TEMP_FAILURE_RETRY(read(fd, magic, sizeof(magic))) == sizeof(magic) &&
+                   memcmp(magic, kTraceMagic, sizeof(magic)) == 0;
+    ::close(fd);
+    return isTrace;
+}
+
+bool FakeValueTraceReader::open(const std::string& path) {
+    close();
+    int fd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        ALOGE("%s: couldn't open %s: %s", __func__, path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FakeValueTraceHeader)) {
+        ALOGE("%s: %s is not a fake value trace", __func__, path.c_str());
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        ALOGE("%s: couldn't map %s: %s", __func__, path.c_str(), strerror(errno));
+        return false;
+    }
+    // Events are replayed front to back, let the kernel read ahead and drop replayed pages.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    mData = static_cast<const uint8_t*>(data);
+    mSize = st.st_size;
+
+    FakeValueTraceHeader header;
+    memcpy(&header, mData, sizeof(header));
+    if (memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 ||
+        header.version != kTraceVersion) {
+        ALOGE("%s: %s has unsupported format", __func__, path.c_str());
+        close();
+        return false;
+    }
+    mEventCount = header.eventCount;
+    rewind();
+    return true;
+}
+
+bool FakeValueTraceReader::next(VehiclePropValue* outEvent) {
+    if (mEventIndex >= mEventCount || mSize - mOffset < sizeof(FakeValueTraceRecord)) {
+        return false;
+    }
+    const uint8_t* recordStart = mData + mOffset;
+    FakeValueTraceRecord record;
+    memcpy(&record, recordStart, sizeof(record));
+
+    uint64_t payloadSize = uint64_t(record.int64Count) * sizeof(int64_t) +
+                           uint64_t(record.int32Count) * sizeof(int32_t) +
+                           uint64_t(record.floatCount) * sizeof(float) + record.byteCount +
+                           record.stringLength;
+    if (record.size > mSize - mOffset || sizeof(record) + payloadSize > record.size) {
+        ALOGE("%s: malformed record at offset %zu", __func__, mOffset);
+        return false;
+    }
+
+    outEvent->timestamp = record.timestamp;
+    outEvent->areaId = record.areaId;
+    outEvent->prop = record.prop;
+    outEvent->status = static_cast<VehiclePropertyStatus>(record.status);
+
+    auto& value = outEvent->value;
+    const uint8_t* p = recordStart + sizeof(record);
+    p = readValues(&value.int64Values, p, record.int64Count);
+    p = readValues(&value.int32Values, p, record.int32Count);
+    p = readValues(&value.floatValues, p, record.floatCount);
+    p = readValues(&value.bytes, p, record.byteCount);
+    value.stringValue = std::string(reinterpret_cast<const char*>(p), record.stringLength);
+
+    mOffset += record.size;
+    mEventIndex++;
+    return true;
+}
+
+void FakeValueTraceReader::rewind() {
+    mOffset = sizeof(FakeValueTraceHeader);
+    mEventIndex = 0;
+}
+
+void FakeValueTraceReader::close() {
+    if (mData != nullptr) {
+        munmap(const_cast<uint8_t*>(mData), mSize);
+    }
+    mData = nullptr;
+    mSize = 0;
+    mEventCount = 0;
+    rewind();
+}
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
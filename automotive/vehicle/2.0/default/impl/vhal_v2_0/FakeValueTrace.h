@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
+#define android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <android/hardware/automotive/vehicle/2.0/types.h>
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+/**
+ * Binary trace of recorded VHAL events, the compact counterpart of the fake values JSON file.
+ *
+ * The file starts with a FakeValueTraceHeader followed by eventCount records. Each record is a
+ * FakeValueTraceRecord followed by the int64, int32, float, byte and string values of the event,
+ * and is padded to a multiple of 8 bytes. All fields use the native byte order.
+ */
+struct FakeValueTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t eventCount;
+};
+
+struct FakeValueTraceRecord {
+    uint32_t size;  // Size of the record, including this header and the padding.
+    int32_t prop;
+    int32_t areaId;
+    int32_t status;
+    int64_t timestamp;
+    uint32_t int64Count;
+    uint32_t int32Count;
+    uint32_t floatCount;
+    uint32_t byteCount;
+    uint32_t stringLength;
+    uint32_t reserved;
+};
+
+/**
+ * Writes events to a binary trace file. The event count in the header is filled in by close().
+ */
+class FakeValueTraceWriter {
+public:
+    FakeValueTraceWriter() = default;
+    ~FakeValueTraceWriter();
+
+    bool open(const std::string& path);
+    bool write(const VehiclePropValue& event);
+    bool close();
+
+    FakeValueTraceWriter(const FakeValueTraceWriter&) = delete;
+    FakeValueTraceWriter& operator=(const FakeValueTraceWriter&) = delete;
+
+private:
+    FILE* mFile = nullptr;
+    uint64_t mEventCount = 0;
+    std::vector<uint8_t> mBuffer;
+};
+
+/**
+ * Reads events from a memory-mapped binary trace file one at a time, so the replay can start
+ * right away and only the pages being replayed stay resident.
+ */
+class FakeValueTraceReader {
+public:
+    FakeValueTraceReader() = default;
+    ~FakeValueTraceReader();
+
+    /** Returns true if the file at path starts with the trace file magic. */
+    static bool isTraceFile(const std::string& path);
+
+    bool open(const std::string& path);
+
+    uint64_t getEventCount() const { return mEventCount; }
+
+    /**
+     * Decodes the next event into outEvent. Returns false at the end of the trace or if the
+     * record is malformed.
+     */
+    bool next(VehiclePropValue* outEvent);
+
+    /** Moves back to the first event. */
+    void rewind();
+
+    FakeValueTraceReader(const FakeValueTraceReader&) = delete;
+    FakeValueTraceReader& operator=(const FakeValueTraceReader&) = delete;
+
+private:
+    void close();
+
+    const uint8_t* mData = nullptr;
+    size_t mSize = 0;
+    size_t mOffset = 0;
+    uint64_t mEventCount = 0;
+    uint64_t mEventIndex = 0;
+};
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Converts a fake values JSON file (see FakeDataCommand::StartJson) to a binary trace that the
+// VHAL replays without parsing the whole recording upfront.
+
+#include <iostream>
+
+#include "FakeValueTrace.h"
+#include "JsonFakeValueGenerator.h"
+
+using android::hardware::automotive::vehicle::V2_0::VehiclePropValue;
+using android::hardware::automotive::vehicle::V2_0::impl::FakeValueTraceWriter;
+using android::hardware::automotive::vehicle::V2_0::impl::JsonFakeValueGenerator;
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.json> <output.trace>" << std::endl;
+        return 1;
+    }
+
+    JsonFakeValueGenerator generator(argv[1]);
+    std::vector<VehiclePropValue> events = generator.getAllEvents();
+    if (events.empty()) {
+        std::cerr << "No events read from " << argv[1] << std::endl;
+        return 1;
+    }
+
+    FakeValueTraceWriter writer;
+    if (!writer.open(argv[2])) {
+        std::cerr << "Couldn't open " << argv[2] << std::endl;
+        return 1;
+    }
+    for (const auto& event : events) {
+        if (!writer.write(event)) {
+            std::cerr << "Failed to write " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    if (!writer.close()) {
+        std::cerr << "Failed to write " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << "Converted " << events.size() << " events" << std::endl;
+    return 0;
+}
@@ -71,8 +71,9 @@ void GeneratorHub::run() {
         const VhalEvent& curEvent = mEventQueue.top();
 
         TimePoint eventTime(Nanos(curEvent.val.timestamp));
-        // Wait until the soonest event happen
-        if (mCond.wait_until(g, eventTime) != std::cv_status::timeout) {
+        // Wait until the soonest event happen. Events that are already due, which is common when
+        // several replays run faster than real-time, are handled without waiting.
+        if (eventTime > Clock::now() && mCond.wait_until(g, eventTime) != std::cv_status::timeout) {
         // It is possible that a new generator is registered and produced a sooner event, or current
         // generator is unregistered, in this case the thread will re-evaluate the soonest event
             ALOGI("Something happened while waiting");
@@ -46,6 +46,7 @@ JsonFakeValueGenerator::JsonFakeValueGenerator(const VehiclePropValue& request)
     };
     // Iterate infinitely if repetition number is not provided
     mNumOfIterations = v.int32Values.size() < 2 ? -1 : v.int32Values[1];
+    mSpeed = getReplaySpeed(request);
 }
 
 JsonFakeValueGenerator::JsonFakeValueGenerator(std::string path) {
@@ -72,9 +73,10 @@ VehiclePropValue JsonFakeValueGenerator::nextEvent() {
     TimePoint eventTime = Clock::now();
     if (mGenCfg.index != 0) {
         // All events (start from 2nd one) are supposed to happen in the future with a delay
-        // equals to the duration between previous and current event.
-        eventTime += Nanos(mGenCfg.events[mGenCfg.index].timestamp -
-                           mGenCfg.events[mGenCfg.index - 1].timestamp);
+        // equals to the duration between previous and current event, divided by the speed.
+        eventTime += Nanos(static_cast<int64_t>((mGenCfg.events[mGenCfg.index].timestamp -
+                                                 mGenCfg.events[mGenCfg.index - 1].timestamp) /
+                                                mSpeed));
     }
     generatedValue = mGenCfg.events[mGenCfg.index];
     generatedValue.timestamp = eventTime.time_since_epoch().count();
@@ -64,6 +64,7 @@ private:
 private:
     GeneratorCfg mGenCfg;
     int32_t mNumOfIterations;
+    float mSpeed = 1.0f;
 };
 
 }  // namespace impl
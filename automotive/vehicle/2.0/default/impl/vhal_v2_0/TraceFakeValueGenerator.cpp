@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TraceFakeValueGenerator"
+
+#include <log/log.h>
+
+#include "TraceFakeValueGenerator.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+TraceFakeValueGenerator::TraceFakeValueGenerator(const VehiclePropValue& request) {
+    const auto& v = request.value;
+    if (mReader.open(v.stringValue)) {
+        mHasNextEvent = mReader.next(&mNextEvent);
+    }
+    // Iterate infinitely if repetition number is not provided
+    mNumOfIterations = v.int32Values.size() < 2 ? -1 : v.int32Values[1];
+    mSpeed = getReplaySpeed(request);
+}
+
+VehiclePropValue TraceFakeValueGenerator::nextEvent() {
+    if (!hasNext()) {
+        return VehiclePropValue();
+    }
+    TimePoint eventTime = Clock::now();
+    if (!mIsFirstInIteration) {
+        // Same as JsonFakeValueGenerator: events after the first one are delayed by the
+        // duration between the previous and the current event, divided by the speed.
+        eventTime += Nanos(static_cast<int64_t>((mNextEvent.timestamp - mLastTimestamp) / mSpeed));
+    }
+    mLastTimestamp = mNextEvent.timestamp;
+
+    VehiclePropValue generatedValue = std::move(mNextEvent);
+    generatedValue.timestamp = eventTime.time_since_epoch().count();
+    advance();
+    return generatedValue;
+}
+
+bool TraceFakeValueGenerator::hasNext() {
+    return mNumOfIterations != 0 && mHasNextEvent;
+}
+
+void TraceFakeValueGenerator::advance() {
+    mIsFirstInIteration = false;
+    mHasNextEvent = mReader.next(&mNextEvent);
+    if (!mHasNextEvent) {
+        mReader.rewind();
+        mIsFirstInIteration = true;
+        if (mNumOfIterations > 0) {
+            mNumOfIterations--;
+        }
+        mHasNextEvent = mReader.next(&mNextEvent);
+    }
+}
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
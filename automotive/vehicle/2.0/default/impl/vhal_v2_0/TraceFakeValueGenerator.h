@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_impl_TraceFakeValueGenerator_H_
+#define android_hardware_automotive_vehicle_V2_0_impl_TraceFakeValueGenerator_H_
+
+#include "FakeValueGenerator.h"
+#include "FakeValueTrace.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+/**
+ * Replays a binary trace (see FakeValueTrace.h) the same way JsonFakeValueGenerator replays a
+ * JSON file, but decodes events from the memory-mapped file as they are replayed instead of
+ * loading the whole recording upfront.
+ */
+class TraceFakeValueGenerator : public FakeValueGenerator {
+public:
+    TraceFakeValueGenerator(const VehiclePropValue& request);
+    ~TraceFakeValueGenerator() = default;
+
+    VehiclePropValue nextEvent();
+
+    bool hasNext();
+
+private:
+    // Decodes the event following mNextEvent, starting the next iteration at the end of trace.
+    void advance();
+
+private:
+    FakeValueTraceReader mReader;
+    VehiclePropValue mNextEvent;
+    bool mHasNextEvent = false;
+    bool mIsFirstInIteration = true;
+    int64_t mLastTimestamp = 0;
+    int32_t mNumOfIterations;
+    float mSpeed;
+};
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_impl_TraceFakeValueGenerator_H_
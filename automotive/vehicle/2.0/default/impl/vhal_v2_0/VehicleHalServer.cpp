@@ -27,9 +27,20 @@
 #include "JsonFakeValueGenerator.h"
 #include "LinearFakeValueGenerator.h"
 #include "Obd2SensorStore.h"
+#include "TraceFakeValueGenerator.h"
 
 namespace android::hardware::automotive::vehicle::V2_0::impl {
 
+namespace {
+
+// Replays of the same file are told apart by their replay id, see FakeDataCommand::StartJson.
+int32_t getReplayCookie(const std::string& path, int32_t replayId) {
+    return std::hash<std::string>()(replayId == 0 ? path
+                                                  : path + "#" + std::to_string(replayId));
+}
+
+}  // namespace
+
 GeneratorHub* VehicleHalServer::getGenerator() {
     return &mGeneratorHub;
 }
@@ -109,9 +120,15 @@ StatusCode VehicleHalServer::handleGenerateFakeDataRequest(const VehiclePropValu
                 LOG(ERROR) << __func__ << ": path to JSON file is missing";
                 return StatusCode::INVALID_ARG;
             }
-            int32_t cookie = std::hash<std::string>()(v.stringValue);
-            getGenerator()->registerGenerator(cookie,
-                                              std::make_unique<JsonFakeValueGenerator>(request));
+            int32_t replayId = v.int32Values.size() > 2 ? v.int32Values[2] : 0;
+            int32_t cookie = getReplayCookie(v.stringValue, replayId);
+            if (FakeValueTraceReader::isTraceFile(v.stringValue)) {
+                getGenerator()->registerGenerator(
+                        cookie, std::make_unique<TraceFakeValueGenerator>(request));
+            } else {
+                getGenerator()->registerGenerator(
+                        cookie, std::make_unique<JsonFakeValueGenerator>(request));
+            }
             break;
         }
         case FakeDataCommand::StopLinear: {
@@ -130,7 +147,8 @@ StatusCode VehicleHalServer::handleGenerateFakeDataRequest(const VehiclePropValu
                 LOG(ERROR) << __func__ << ": path to JSON file is missing";
                 return StatusCode::INVALID_ARG;
             }
-            int32_t cookie = std::hash<std::string>()(v.stringValue);
+            int32_t replayId = v.int32Values.size() > 1 ? v.int32Values[1] : 0;
+            int32_t cookie = getReplayCookie(v.stringValue, replayId);
             getGenerator()->unregisterGenerator(cookie);
             break;
         }
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/DefaultConfig.h"
+#include "vhal_v2_0/FakeValueTrace.h"
+#include "vhal_v2_0/TraceFakeValueGenerator.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+namespace impl {
+
+namespace {
+
+constexpr int64_t kSecond = 1000000000;
+
+std::vector<VehiclePropValue> getTestEvents() {
+    VehiclePropValue speed = {
+            .timestamp = 0,
+            .areaId = 0,
+            .prop = toInt(VehicleProperty::PERF_VEHICLE_SPEED),
+    };
+    speed.value.floatValues = {12.5f};
+
+    VehiclePropValue mixed = {
+            .timestamp = kSecond,
+            .areaId = 1,
+            .prop = kMixedTypePropertyForTest,
+    };
+    mixed.value.int32Values = {1, 2, 3};
+    mixed.value.int64Values = {-4};
+    mixed.value.floatValues = {5.5f, 6.5f};
+    mixed.value.bytes = {7, 8, 9};
+    mixed.value.stringValue = "mixed";
+
+    VehiclePropValue gear = {
+            .timestamp = 2 * kSecond,
+            .areaId = 0,
+            .prop = toInt(VehicleProperty::GEAR_SELECTION),
+    };
+    gear.value.int32Values = {toInt(VehicleGear::GEAR_DRIVE)};
+
+    return {speed, mixed, gear};
+}
+
+void writeTrace(const std::string& path, const std::vector<VehiclePropValue>& events) {
+    FakeValueTraceWriter writer;
+    ASSERT_TRUE(writer.open(path));
+    for (const auto& event : events) {
+        ASSERT_TRUE(writer.write(event));
+    }
+    ASSERT_TRUE(writer.close());
+}
+
+VehiclePropValue createStartRequest(const std::string& path, int32_t iterations, float speed) {
+    VehiclePropValue request = {
+            .prop = kGenerateFakeDataControllingProperty,
+    };
+    request.value.int32Values = {toInt(FakeDataCommand::StartJson), iterations};
+    request.value.floatValues = {speed};
+    request.value.stringValue = path;
+    return request;
+}
+
+TEST(FakeValueTraceTest, readWhatWasWritten) {
+    TemporaryFile file;
+    auto events = getTestEvents();
+    writeTrace(file.path, events);
+
+    ASSERT_TRUE(FakeValueTraceReader::isTraceFile(file.path));
+    FakeValueTraceReader reader;
+    ASSERT_TRUE(reader.open(file.path));
+    ASSERT_EQ(events.size(), reader.getEventCount());
+
+    // Read twice to check rewind.
+    for (int i = 0; i < 2; i++) {
+        for (const auto& expected : events) {
+            VehiclePropValue event;
+            ASSERT_TRUE(reader.next(&event));
+            EXPECT_EQ(toString(expected), toString(event));
+        }
+        VehiclePropValue event;
+        EXPECT_FALSE(reader.next(&event));
+        reader.rewind();
+    }
+}
+
+TEST(FakeValueTraceTest, rejectsOtherFiles) {
+    TemporaryFile file;
+    ASSERT_TRUE(android::base::WriteStringToFile("[{\"prop\": 1}]", file.path));
+
+    EXPECT_FALSE(FakeValueTraceReader::isTraceFile(file.path));
+    FakeValueTraceReader reader;
+    EXPECT_FALSE(reader.open(file.path));
+}
+
+TEST(FakeValueTraceTest, generatorReplaysWithSpeed) {
+    TemporaryFile file;
+    auto events = getTestEvents();
+    writeTrace(file.path, events);
+
+    TraceFakeValueGenerator generator(createStartRequest(file.path, 2, 10.0f));
+    std::vector<VehiclePropValue> generated;
+    while (generator.hasNext()) {
+        generated.push_back(generator.nextEvent());
+    }
+
+    ASSERT_EQ(2 * events.size(), generated.size());
+    for (size_t i = 0; i < generated.size(); i++) {
+        EXPECT_EQ(events[i % events.size()].prop, generated[i].prop);
+    }
+    // One second between the recorded events is replayed as 100 ms.
+    int64_t delay = generated[1].timestamp - generated[0].timestamp;
+    EXPECT_GE(delay, kSecond / 10);
+    EXPECT_LT(delay, kSecond / 2);
+    // The second iteration starts right away.
+    EXPECT_LT(generated[3].timestamp, generated[2].timestamp);
+}
+
+}  // namespace
+
+}  // namespace impl
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/ConcurrentQueue.h"
+
+namespace android {
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+BatchingConsumer<int>::Policy makePolicy(
+        milliseconds maxDelay, size_t maxBatchSize = std::numeric_limits<size_t>::max(),
+        std::function<bool(const int&)> isPriority = nullptr) {
+    BatchingConsumer<int>::Policy policy;
+    policy.maxDelay = maxDelay;
+    policy.maxBatchSize = maxBatchSize;
+    policy.isPriority = isPriority;
+    return policy;
+}
+
+class BatchCollector {
+public:
+    void onBatch(const std::vector<int>& batch) {
+        std::lock_guard<std::mutex> g(mLock);
+        mBatches.push_back({ batch, steady_clock::now() });
+        mCond.notify_all();
+    }
+
+    bool waitForItems(size_t count, milliseconds timeout = milliseconds(1000)) {
+        std::unique_lock<std::mutex> g(mLock);
+        return mCond.wait_for(g, timeout, [this, count] { return itemCountLocked() >= count; });
+    }
+
+    std::vector<std::vector<int>> batches() {
+        std::lock_guard<std::mutex> g(mLock);
+        std::vector<std::vector<int>> batches;
+        for (auto& batch : mBatches) {
+            batches.push_back(batch.first);
+        }
+        return batches;
+    }
+
+    steady_clock::time_point firstBatchTime() {
+        std::lock_guard<std::mutex> g(mLock);
+        return mBatches.front().second;
+    }
+
+private:
+    size_t itemCountLocked() const {
+        size_t count = 0;
+        for (auto& batch : mBatches) {
+            count += batch.first.size();
+        }
+        return count;
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::vector<std::pair<std::vector<int>, steady_clock::time_point>> mBatches;
+};
+
+class BatchingConsumerTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        mConsumer.requestStop();
+        mQueue.deactivate();
+        mConsumer.waitStopped();
+    }
+
+    void run(const BatchingConsumer<int>::Policy& policy) {
+        mConsumer.run(&mQueue, policy,
+                      [this](const std::vector<int>& batch) { mCollector.onBatch(batch); });
+    }
+
+    ConcurrentQueue<int> mQueue { 4 };
+    BatchingConsumer<int> mConsumer;
+    BatchCollector mCollector;
+};
+
+TEST(ConcurrentQueueTest, keepsOrderWhenRingOverflows) {
+    ConcurrentQueue<int> queue(4);
+    for (int i = 0; i < 10; i++) {
+        queue.push(int(i));
+    }
+
+    std::vector<int> items;
+    ASSERT_EQ(3u, queue.flush(&items, 3));
+    for (int i = 10; i < 20; i++) {
+        queue.push(int(i));
+    }
+    queue.flush(&items, 100);
+
+    ASSERT_EQ(20u, items.size());
+    for (int i = 0; i < 20; i++) {
+        ASSERT_EQ(i, items[i]);
+    }
+}
+
+TEST(ConcurrentQueueTest, multipleProducers) {
+    constexpr int kProducers = 4;
+    constexpr int kItemsPerProducer = 5000;
+    ConcurrentQueue<int> queue(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < kItemsPerProducer; i++) {
+                queue.push(p * kItemsPerProducer + i);
+            }
+        });
+    }
+
+    std::vector<int> lastSeen(kProducers, -1);
+    size_t received = 0;
+    while (received < kProducers * kItemsPerProducer) {
+        ASSERT_TRUE(queue.waitForItems());
+        for (int item : queue.flush()) {
+            int producer = item / kItemsPerProducer;
+            ASSERT_LT(lastSeen[producer], item);
+            lastSeen[producer] = item;
+            received++;
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+}
+
+TEST_F(BatchingConsumerTest, flushesFullBatchWithoutWaiting) {
+    run(makePolicy(milliseconds(10000), 3));
+    for (int i = 0; i < 7; i++) {
+        mQueue.push(int(i));
+    }
+
+    ASSERT_TRUE(mCollector.waitForItems(6));
+    auto batches = mCollector.batches();
+    ASSERT_EQ(3u, batches[0].size());
+    ASSERT_EQ(3u, batches[1].size());
+}
+
+TEST_F(BatchingConsumerTest, flushesAfterMaxDelay) {
+    run(makePolicy(milliseconds(50)));
+    auto start = steady_clock::now();
+    mQueue.push(1);
+    mQueue.push(2);
+
+    ASSERT_TRUE(mCollector.waitForItems(2));
+    ASSERT_EQ(std::vector<int>({1, 2}), mCollector.batches()[0]);
+    ASSERT_GE(mCollector.firstBatchTime() - start, milliseconds(50));
+}
+
+TEST_F(BatchingConsumerTest, flushesPriorityItemImmediately) {
+    run(makePolicy(milliseconds(10000), 100, [](const int& item) { return item < 0; }));
+    mQueue.push(1);
+    mQueue.push(-1);
+
+    ASSERT_TRUE(mCollector.waitForItems(2, milliseconds(5000)));
+    ASSERT_EQ(std::vector<int>({1, -1}), mCollector.batches()[0]);
+}
+
+}  // namespace
+
+}  // namespace android
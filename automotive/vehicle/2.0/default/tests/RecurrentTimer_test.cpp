@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -70,4 +71,72 @@ TEST(RecurrentTimerTest, multipleIntervals) {
     ASSERT_EQ_WITH_TOLERANCE(20, counter5ms.load(), 5);
 }
 
+TEST(RecurrentEventQueueTest, popsDueEventsInOrder) {
+    using TimePoint = RecurrentEventQueue::TimePoint;
+    RecurrentEventQueue queue;
+    // Divisible by all intervals, so that no event is aligned to an earlier time.
+    TimePoint start = TimePoint(milliseconds(600));
+
+    queue.add(milliseconds(10), 1, start);
+    queue.add(milliseconds(20), 2, start);
+    queue.add(milliseconds(30), 3, start);
+
+    std::vector<int32_t> cookies;
+    ASSERT_EQ(start + milliseconds(10), queue.popDueEvents(start, &cookies));
+    ASSERT_EQ(3u, cookies.size());
+
+    cookies.clear();
+    queue.popDueEvents(start + milliseconds(20), &cookies);
+    std::sort(cookies.begin(), cookies.end());
+    ASSERT_EQ(std::vector<int32_t>({1, 2}), cookies);
+
+    cookies.clear();
+    queue.popDueEvents(start + milliseconds(25), &cookies);
+    ASSERT_TRUE(cookies.empty());
+}
+
+TEST(RecurrentEventQueueTest, coalescesEventsDueInTheSameTick) {
+    using TimePoint = RecurrentEventQueue::TimePoint;
+    RecurrentEventQueue queue;
+    TimePoint start = TimePoint(milliseconds(1000));
+    queue.add(milliseconds(10), 1, start);
+    queue.add(milliseconds(20), 2, start);
+
+    std::vector<int32_t> cookies;
+    queue.popDueEvents(start, &cookies);
+    cookies.clear();
+
+    // Waking up slightly early still reports the events due within the coalescing window.
+    TimePoint dueTime = start + milliseconds(20);
+    queue.popDueEvents(dueTime - RecurrentEventQueue::kCoalescingWindow / 2, &cookies);
+    ASSERT_EQ(2u, cookies.size());
+    ASSERT_EQ(dueTime + milliseconds(10), queue.nextEventTime());
+}
+
+TEST(RecurrentEventQueueTest, removeAndReplace) {
+    using TimePoint = RecurrentEventQueue::TimePoint;
+    RecurrentEventQueue queue;
+    TimePoint start = TimePoint();
+    for (int32_t cookie = 0; cookie < 10; cookie++) {
+        queue.add(milliseconds(10 + cookie), cookie, start);
+    }
+    std::vector<int32_t> cookies;
+    queue.popDueEvents(start, &cookies);
+
+    queue.remove(0);
+    queue.remove(5);
+    queue.remove(42);
+    ASSERT_EQ(8u, queue.size());
+    ASSERT_EQ(start + milliseconds(11), queue.nextEventTime());
+
+    // Replacing the interval keeps a single event for the cookie, due right away.
+    queue.add(milliseconds(100), 1, start);
+    ASSERT_EQ(8u, queue.size());
+    ASSERT_EQ(start, queue.nextEventTime());
+
+    cookies.clear();
+    ASSERT_EQ(start + milliseconds(12), queue.popDueEvents(start, &cookies));
+    ASSERT_EQ(std::vector<int32_t>({1}), cookies);
+}
+
 }  // anonymous namespace
@@ -188,6 +188,61 @@ TEST_F(SubscriptionManagerTest, unsubscribe) {
     assertLastUnsubscribedProperty(PROP1);
 }
 
+TEST_F(SubscriptionManagerTest, distributeValuesToClientBatches) {
+    sp<IVehicleCallback> cb4 = new MockedVehicleCallback();
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(1, cb1, subscrToProp1, &updatedOptions));
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(2, cb2, subscrToProp2, &updatedOptions));
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(3, cb3, subscrToProp1and2, &updatedOptions));
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(4, cb4, subscrToProp1, &updatedOptions));
+
+    VehiclePropValuePool valuePool;
+    std::vector<recyclable_ptr<VehiclePropValue>> values;
+    for (int32_t prop : {PROP1, PROP2, PROP1, toInt(VehicleProperty::AP_POWER_BOOTUP_REASON)}) {
+        values.push_back(valuePool.obtainInt32(0));
+        values.back()->prop = prop;
+    }
+
+    auto batches = manager.distributeValuesToClientBatches(values,
+                                                           SubscribeFlags::EVENTS_FROM_CAR);
+    ASSERT_EQ((size_t) 3, batches.size());
+
+    std::map<sp<IVehicleCallback>, std::vector<VehiclePropValue*>> received;
+    for (const auto& batch : batches) {
+        for (const auto& client : batch.clients) {
+            received[client->getCallback()] = batch.values;
+        }
+    }
+    ASSERT_EQ((size_t) 4, received.size());
+    ASSERT_EQ(received[cb1], std::vector<VehiclePropValue*>({values[0].get(), values[2].get()}));
+    ASSERT_EQ(received[cb1], received[cb4]);
+    ASSERT_EQ(received[cb2], std::vector<VehiclePropValue*>({values[1].get()}));
+    ASSERT_EQ(received[cb3], std::vector<VehiclePropValue*>(
+                                     {values[0].get(), values[1].get(), values[2].get()}));
+
+    // The slot of an unsubscribed client is reused by the next one.
+    manager.unsubscribe(1, PROP1);
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(5, cb1, subscrToProp2, &updatedOptions));
+    batches = manager.distributeValuesToClientBatches(values, SubscribeFlags::EVENTS_FROM_CAR);
+    received.clear();
+    for (const auto& batch : batches) {
+        for (const auto& client : batch.clients) {
+            received[client->getCallback()] = batch.values;
+        }
+    }
+    ASSERT_EQ(received[cb1], received[cb2]);
+    ASSERT_EQ(received[cb4], std::vector<VehiclePropValue*>({values[0].get(), values[2].get()}));
+
+    // Nothing goes to clients subscribed to events from Android.
+    ASSERT_TRUE(manager.distributeValuesToClientBatches(values, SubscribeFlags::EVENTS_FROM_ANDROID)
+                        .empty());
+}
+
 }  // namespace anonymous
 
 }  // namespace V2_0
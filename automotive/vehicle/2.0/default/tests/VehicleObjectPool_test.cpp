@@ -81,6 +81,19 @@ TEST_F(VehicleObjectPoolTest, valuePoolStrings) {
     ASSERT_EQ(0u, stats->Obtained);
 }
 
+TEST_F(VehicleObjectPoolTest, valuePoolThreadCacheReleasedOnExit) {
+    void* raw = nullptr;
+    std::thread([this, &raw] () {
+        auto value = valuePool->obtain(VehiclePropertyType::INT32_VEC, 3);
+        raw = value.get();
+    }).join();
+
+    // The object cached by the exited thread goes back to the shared depot.
+    ASSERT_EQ(raw, valuePool->obtain(VehiclePropertyType::INT32_VEC, 3).get());
+    ASSERT_EQ(2u, stats->Obtained);
+    ASSERT_EQ(1u, stats->Created);
+}
+
 TEST_F(VehicleObjectPoolTest, valuePoolMultithreadedBenchmark) {
     // In this test we have T threads that concurrently in C cycles
     // obtain and release O VehiclePropValue objects of FLOAT / INT32 types.
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iterator>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/RecurrentTimer.h"
+
+namespace {
+
+using std::chrono::milliseconds;
+using TimePoint = RecurrentEventQueue::TimePoint;
+
+// Sample rates of continuous properties, between 10 and 100 Hz
+milliseconds getInterval(int32_t cookie) {
+    static constexpr milliseconds kIntervals[] = {
+            milliseconds(10), milliseconds(20), milliseconds(25), milliseconds(50),
+            milliseconds(100)};
+    return kIntervals[cookie % std::size(kIntervals)];
+}
+
+void fillQueue(RecurrentEventQueue* queue, int32_t cookieCount, TimePoint now) {
+    for (int32_t cookie = 0; cookie < cookieCount; cookie++) {
+        queue->add(getInterval(cookie), cookie, now);
+    }
+}
+
+// Simulates the timer thread: every iteration jumps to the next event time and collects the
+// due cookies, as RecurrentTimer::loop does on each wake-up.
+void BM_PopDueEvents(benchmark::State& state) {
+    RecurrentEventQueue queue;
+    TimePoint now = TimePoint(milliseconds(1000));
+    fillQueue(&queue, state.range(0), now);
+
+    std::vector<int32_t> cookies;
+    size_t fired = 0;
+    for (auto _ : state) {
+        cookies.clear();
+        now = queue.popDueEvents(now, &cookies);
+        fired += cookies.size();
+    }
+    state.SetItemsProcessed(fired);
+}
+BENCHMARK(BM_PopDueEvents)->Arg(10)->Arg(100)->Arg(1000);
+
+// Subscription changes: re-registers one cookie with another rate and removes another one.
+void BM_RegisterUnregister(benchmark::State& state) {
+    const int32_t cookieCount = state.range(0);
+    RecurrentEventQueue queue;
+    TimePoint now = TimePoint(milliseconds(1000));
+    fillQueue(&queue, cookieCount, now);
+
+    int32_t cookie = 0;
+    for (auto _ : state) {
+        queue.add(getInterval(cookie + 1), cookie, now);
+        queue.remove((cookie + cookieCount / 2) % cookieCount);
+        queue.add(getInterval(cookie), (cookie + cookieCount / 2) % cookieCount, now);
+        cookie = (cookie + 1) % cookieCount;
+    }
+    state.SetItemsProcessed(state.iterations() * 3);
+}
+BENCHMARK(BM_RegisterUnregister)->Arg(10)->Arg(100)->Arg(1000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
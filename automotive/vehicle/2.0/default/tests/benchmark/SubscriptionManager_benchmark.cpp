@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/SubscriptionManager.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int32_t kPropertyCount = 10;
+// 1000 events per second, delivered every 10 ms.
+constexpr int32_t kEventsPerBatch = 10;
+
+class NoopVehicleCallback : public IVehicleCallback {
+public:
+    Return<void> onPropertyEvent(const hidl_vec<VehiclePropValue>& values) override {
+        benchmark::DoNotOptimize(values.data());
+        return Return<void>();
+    }
+    Return<void> onPropertySet(const VehiclePropValue& /* value */) override {
+        return Return<void>();
+    }
+    Return<void> onPropertySetError(StatusCode /* errorCode */, int32_t /* propId */,
+                                    int32_t /* areaId */) override {
+        return Return<void>();
+    }
+};
+
+int32_t getPropId(int32_t index) {
+    return toInt(VehiclePropertyGroup::VENDOR) | toInt(VehicleArea::GLOBAL) |
+           toInt(VehiclePropertyType::INT32) | (0x100 + index);
+}
+
+class FanOutFixture {
+public:
+    // Every client subscribes to all properties except for one of the first
+    // distinctSets - 1 properties, which gives distinctSets different subscriber sets.
+    FanOutFixture(int32_t clientCount, int32_t distinctSets) : mManager([](int32_t) {}) {
+        std::list<SubscribeOptions> updatedOptions;
+        for (int32_t client = 0; client < clientCount; client++) {
+            int32_t skipped = distinctSets > 1 ? client % distinctSets : -1;
+            std::vector<SubscribeOptions> options;
+            for (int32_t i = 0; i < kPropertyCount; i++) {
+                if (i == skipped - 1) {
+                    continue;
+                }
+                options.push_back(SubscribeOptions{.propId = getPropId(i),
+                                                   .flags = SubscribeFlags::EVENTS_FROM_CAR});
+            }
+            mManager.addOrUpdateSubscription(client, new NoopVehicleCallback(), options,
+                                             &updatedOptions);
+        }
+
+        for (int32_t i = 0; i < kEventsPerBatch; i++) {
+            mValues.push_back(mValuePool.obtainInt32(i));
+            mValues.back()->prop = getPropId(i % kPropertyCount);
+        }
+    }
+
+    SubscriptionManager mManager;
+    VehiclePropValuePool mValuePool;
+    std::vector<recyclable_ptr<VehiclePropValue>> mValues;
+};
+
+template <typename Values>
+void copyValues(const Values& values, hidl_vec<VehiclePropValue>* vec) {
+    vec->resize(values.size());
+    size_t i = 0;
+    for (VehiclePropValue* value : values) {
+        shallowCopy(&(*vec)[i++], *value);
+    }
+}
+
+// Delivery as VehicleHalManager::onBatchHalEvent does it: one copy per subscriber set.
+void BM_FanOutShared(benchmark::State& state) {
+    FanOutFixture fixture(state.range(0), state.range(1));
+    hidl_vec<VehiclePropValue> vec;
+    for (auto _ : state) {
+        auto batches = fixture.mManager.distributeValuesToClientBatches(
+                fixture.mValues, SubscribeFlags::EVENTS_FROM_CAR);
+        for (const HalClientBatch& batch : batches) {
+            copyValues(batch.values, &vec);
+            for (const auto& client : batch.clients) {
+                client->getCallback()->onPropertyEvent(vec);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kEventsPerBatch);
+}
+
+// Per-client delivery, for comparison: one copy per client.
+void BM_FanOutPerClient(benchmark::State& state) {
+    FanOutFixture fixture(state.range(0), state.range(1));
+    hidl_vec<VehiclePropValue> vec;
+    for (auto _ : state) {
+        auto clientValues = fixture.mManager.distributeValuesToClients(
+                fixture.mValues, SubscribeFlags::EVENTS_FROM_CAR);
+        for (const HalClientValues& cv : clientValues) {
+            copyValues(cv.values, &vec);
+            cv.client->getCallback()->onPropertyEvent(vec);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kEventsPerBatch);
+}
+
+void FanOutArgs(benchmark::internal::Benchmark* b) {
+    for (int32_t clients : {1, 2, 5, 10, 20}) {
+        b->Args({clients, 1});
+        b->Args({clients, 4});
+    }
+}
+BENCHMARK(BM_FanOutShared)->Apply(FanOutArgs);
+BENCHMARK(BM_FanOutPerClient)->Apply(FanOutArgs);
+
+}  // namespace
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/VehiclePropertyStore.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int32_t kPropertyCount = 256;
+constexpr int32_t kOpsPerThread = 10000;
+
+int32_t getPropId(int32_t index) {
+    return toInt(VehiclePropertyGroup::VENDOR) | toInt(VehicleArea::GLOBAL) |
+           toInt(VehiclePropertyType::INT32) | (0x100 + index);
+}
+
+std::unique_ptr<VehiclePropertyStore> createStore() {
+    auto store = std::make_unique<VehiclePropertyStore>();
+    for (int32_t i = 0; i < kPropertyCount; i++) {
+        VehiclePropConfig config;
+        config.prop = getPropId(i);
+        store->registerProperty(config);
+
+        VehiclePropValue value;
+        value.prop = config.prop;
+        value.value.int32Values = {0};
+        store->writeValue(value, true);
+    }
+    return store;
+}
+
+// Runs range(0) reader threads and range(1) writer threads against one store. Writers walk
+// the properties in different orders, so some of them collide on the same property.
+void BM_ReadWrite(benchmark::State& state) {
+    const int32_t readerCount = state.range(0);
+    const int32_t writerCount = state.range(1);
+    auto store = createStore();
+    int64_t timestamp = 0;
+
+    for (auto _ : state) {
+        std::vector<std::thread> threads;
+        for (int32_t reader = 0; reader < readerCount; reader++) {
+            threads.emplace_back([&store, reader] {
+                for (int32_t i = 0; i < kOpsPerThread; i++) {
+                    auto value = store->readValueOrNull(getPropId((i + reader) % kPropertyCount));
+                    benchmark::DoNotOptimize(value);
+                }
+            });
+        }
+        for (int32_t writer = 0; writer < writerCount; writer++) {
+            threads.emplace_back([&store, writer, timestamp] {
+                VehiclePropValue value;
+                value.value.int32Values = {writer};
+                for (int32_t i = 0; i < kOpsPerThread; i++) {
+                    value.prop = getPropId((i * (writer + 1)) % kPropertyCount);
+                    value.timestamp = timestamp + i;
+                    store->writeValue(value, true);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        timestamp += kOpsPerThread;
+    }
+    state.SetItemsProcessed(state.iterations() * (readerCount + writerCount) * kOpsPerThread);
+}
+BENCHMARK(BM_ReadWrite)->RangeMultiplier(2)->Ranges({{1, 8}, {1, 8}})->UseRealTime();
+
+void BM_ReadAllValues(benchmark::State& state) {
+    auto store = createStore();
+    for (auto _ : state) {
+        auto values = store->readAllValues();
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * kPropertyCount);
+}
+BENCHMARK(BM_ReadAllValues);
+
+}  // namespace
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
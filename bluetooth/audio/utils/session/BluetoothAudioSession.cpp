@@ -18,6 +18,8 @@
 
 #include "BluetoothAudioSession.h"
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 
@@ -45,8 +47,12 @@ AudioConfiguration BluetoothAudioSession::invalidOffloadAudioConfiguration = {};
 static constexpr int kFmqSendTimeoutMs = 1000;  // 1000 ms timeout for sending
 static constexpr int kFmqReceiveTimeoutMs =
     1000;                                       // 1000 ms timeout for receiving
-static constexpr int kWritePollMs = 1;          // polled non-blocking interval
-static constexpr int kReadPollMs = 1;           // polled non-blocking interval
+static constexpr int kMinWaitMs = 1;  // shortest wait for the Bluetooth stack
+
+// The EventFlag bits of the FMQ, the same as the default bits of the blocking
+// read and write of libfmq
+static constexpr uint32_t kFmqNotEmpty = 1 << 0;
+static constexpr uint32_t kFmqNotFull = 1 << 1;
 
 static inline timespec timespec_convert_from_hal(const TimeSpec& TS) {
   return {.tv_sec = static_cast<long>(TS.tvSec),
@@ -54,7 +60,12 @@ static inline timespec timespec_convert_from_hal(const TimeSpec& TS) {
 }
 
 BluetoothAudioSession::BluetoothAudioSession(const SessionType& session_type)
-    : session_type_(session_type), stack_iface_(nullptr), mDataMQ(nullptr) {
+    : session_type_(session_type),
+      stack_iface_(nullptr),
+      data_path_(nullptr),
+      data_path_ready_(false),
+      data_path_generation_(0),
+      data_path_stats_() {
   invalidSoftwareAudioConfiguration.pcmConfig(kInvalidPcmParameters);
   invalidOffloadAudioConfiguration.codecConfig(kInvalidCodecConfiguration);
 }
@@ -73,7 +84,16 @@ void BluetoothAudioSession::OnSessionStarted(
     LOG(ERROR) << __func__ << " - SessionType=" << toString(session_type_)
                << ", AudioConfiguration=" << toString(audio_config)
                << " Invalid";
-  } else if (!UpdateDataPath(dataMQ)) {
+  } else if (!UpdateDataPath(
+                 dataMQ,
+                 audio_config.getDiscriminator() ==
+                         AudioConfiguration::hidl_discriminator::pcmConfig
+                     ? PcmBytesPerSecond(
+                           static_cast<uint32_t>(
+                               audio_config.pcmConfig().sampleRate),
+                           audio_config.pcmConfig().channelMode,
+                           audio_config.pcmConfig().bitsPerSample)
+                     : 0)) {
     LOG(ERROR) << __func__ << " - SessionType=" << toString(session_type_)
                << " DataMQ Invalid";
     audio_config_ =
@@ -82,6 +102,7 @@ void BluetoothAudioSession::OnSessionStarted(
              : kInvalidSoftwareAudioConfiguration);
   } else {
     stack_iface_ = stack_iface;
+    UpdateDataPathReady();
     LOG(INFO) << __func__ << " - SessionType=" << toString(session_type_)
               << ", AudioConfiguration=" << toString(audio_config);
     ReportSessionStatus();
@@ -99,7 +120,7 @@ void BluetoothAudioSession::OnSessionEnded() {
                        ? kInvalidOffloadAudioConfiguration
                        : kInvalidSoftwareAudioConfiguration);
   stack_iface_ = nullptr;
-  UpdateDataPath(nullptr);
+  UpdateDataPath(nullptr, 0);
   if (toggled) {
     ReportSessionStatus();
   }
@@ -152,26 +173,129 @@ bool BluetoothAudioSession::IsSessionReady() {
   std::lock_guard<std::recursive_mutex> guard(mutex_);
   bool dataMQ_valid =
       (session_type_ == SessionType::A2DP_HARDWARE_OFFLOAD_DATAPATH ||
-       (mDataMQ != nullptr && mDataMQ->isValid()));
+       (data_path_ != nullptr && data_path_->data_mq->isValid()));
   return stack_iface_ != nullptr && dataMQ_valid;
 }
 
-bool BluetoothAudioSession::UpdateDataPath(const DataMQ::Descriptor* dataMQ) {
+BluetoothAudioSession::DataPath::~DataPath() {
+  if (event_flag != nullptr) {
+    EventFlag::deleteEventFlag(&event_flag);
+  }
+}
+
+bool BluetoothAudioSession::UpdateDataPath(const DataMQ::Descriptor* dataMQ,
+                                           uint32_t bytes_per_second) {
+  // The audio thread may still be waiting on the previous data path, and
+  // checks data_path_ready_ and data_path_generation_ once it wakes up
+  data_path_ready_ = false;
+  uint64_t generation = ++data_path_generation_;
+  if (data_path_ != nullptr && data_path_->event_flag != nullptr) {
+    data_path_->event_flag->wake(kFmqNotEmpty | kFmqNotFull);
+  }
   if (dataMQ == nullptr) {
     // usecase of reset by nullptr
-    mDataMQ = nullptr;
+    data_path_ = nullptr;
     return true;
   }
   std::unique_ptr<DataMQ> tempDataMQ;
   tempDataMQ.reset(new DataMQ(*dataMQ));
   if (!tempDataMQ || !tempDataMQ->isValid()) {
-    mDataMQ = nullptr;
+    data_path_ = nullptr;
     return false;
   }
-  mDataMQ = std::move(tempDataMQ);
+  auto data_path = std::make_shared<DataPath>();
+  if (tempDataMQ->getEventFlagWord() != nullptr &&
+      EventFlag::createEventFlag(tempDataMQ->getEventFlagWord(),
+                                 &data_path->event_flag) != ::android::OK) {
+    LOG(WARNING) << __func__ << " - SessionType=" << toString(session_type_)
+                 << " failed to create the EventFlag of DataMQ";
+    data_path->event_flag = nullptr;
+  }
+  data_path->data_mq = std::move(tempDataMQ);
+  data_path->bytes_per_second = bytes_per_second;
+  data_path->generation = generation;
+  data_path_ = std::move(data_path);
+
+  data_path_stats_.transfer_count = 0;
+  data_path_stats_.transferred_bytes = 0;
+  data_path_stats_.underrun_count = 0;
+  data_path_stats_.timeout_count = 0;
+  data_path_stats_.total_wait_ns = 0;
+  data_path_stats_.max_wait_ns = 0;
   return true;
 }
 
+void BluetoothAudioSession::UpdateDataPathReady() {
+  // This is locked already by OnSessionStarted
+  data_path_ready_ = (data_path_ != nullptr && IsSessionReady());
+}
+
+uint32_t BluetoothAudioSession::PcmBytesPerSecond(
+    uint32_t sample_rate, ChannelMode channel_mode,
+    BitsPerSample bits_per_sample) {
+  uint32_t sample_rate_hz;
+  switch (sample_rate) {
+    case 0x01:
+      sample_rate_hz = 44100;
+      break;
+    case 0x02:
+      sample_rate_hz = 48000;
+      break;
+    case 0x04:
+      sample_rate_hz = 88200;
+      break;
+    case 0x08:
+      sample_rate_hz = 96000;
+      break;
+    case 0x10:
+      sample_rate_hz = 176400;
+      break;
+    case 0x20:
+      sample_rate_hz = 192000;
+      break;
+    case 0x40:
+      sample_rate_hz = 16000;
+      break;
+    case 0x80:
+      sample_rate_hz = 24000;
+      break;
+    case 0x100:
+      sample_rate_hz = 8000;
+      break;
+    case 0x200:
+      sample_rate_hz = 32000;
+      break;
+    default:
+      return 0;
+  }
+  uint32_t channel_count;
+  switch (channel_mode) {
+    case ChannelMode::MONO:
+      channel_count = 1;
+      break;
+    case ChannelMode::STEREO:
+      channel_count = 2;
+      break;
+    default:
+      return 0;
+  }
+  uint32_t bytes_per_sample;
+  switch (bits_per_sample) {
+    case BitsPerSample::BITS_16:
+      bytes_per_sample = 2;
+      break;
+    case BitsPerSample::BITS_24:
+      bytes_per_sample = 3;
+      break;
+    case BitsPerSample::BITS_32:
+      bytes_per_sample = 4;
+      break;
+    default:
+      return 0;
+  }
+  return sample_rate_hz * channel_count * bytes_per_sample;
+}
+
 bool BluetoothAudioSession::UpdateAudioConfig(
     const AudioConfiguration& audio_config) {
   bool is_software_session =
@@ -371,73 +495,172 @@ void BluetoothAudioSession::UpdateTracksMetadata(
   }
 }
 
+// The data path function fetches the data path if the session is ready
+std::shared_ptr<BluetoothAudioSession::DataPath>
+BluetoothAudioSession::GetDataPath() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (!data_path_ready_) return nullptr;
+  return data_path_;
+}
+
+// The data path function checks, without mutex_, that the session has neither
+// ended nor been restarted with another data path since it was fetched
+bool BluetoothAudioSession::IsDataPathCurrent(const DataPath& data_path) const {
+  return data_path_ready_ && data_path_generation_ == data_path.generation;
+}
+
+// The data path function waits for the Bluetooth stack to notify
+// notification_bits, or until it should have transferred the given bytes,
+// whichever comes first. The Bluetooth stack does not have to notify: the
+// audio thread then wakes up about when it is due instead of polling.
+bool BluetoothAudioSession::WaitDataPath(
+    const DataPath& data_path, uint32_t notification_bits, size_t bytes,
+    std::chrono::steady_clock::time_point deadline, uint64_t* wait_ns) {
+  auto start = std::chrono::steady_clock::now();
+  if (start >= deadline) return false;
+  std::chrono::nanoseconds timeout = std::chrono::milliseconds(kMinWaitMs);
+  if (data_path.bytes_per_second > 0) {
+    // No more than the FMQ holds can be transferred at once
+    bytes = std::min(bytes, data_path.data_mq->getQuantumCount());
+    timeout = std::max(timeout, std::chrono::nanoseconds(
+                                    bytes * 1000000000ull /
+                                    data_path.bytes_per_second));
+  }
+  timeout = std::min(timeout, std::chrono::nanoseconds(deadline - start));
+  if (data_path.event_flag != nullptr) {
+    uint32_t efState = 0;
+    data_path.event_flag->wait(notification_bits, &efState, timeout.count(),
+                               true /* retry on spurious wake */);
+  } else {
+    usleep(std::chrono::duration_cast<std::chrono::microseconds>(timeout)
+               .count());
+  }
+  *wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  return true;
+}
+
+void BluetoothAudioSession::UpdateDataPathStats(const DataPath& data_path,
+                                                size_t bytes, bool timed_out,
+                                                uint64_t wait_ns) {
+  // The statistics were reset for the data path that replaced this one
+  if (!IsDataPathCurrent(data_path)) return;
+  // Only the audio thread updates the statistics, so there is no need to
+  // update them atomically as a whole
+  data_path_stats_.transfer_count.fetch_add(1, std::memory_order_relaxed);
+  data_path_stats_.transferred_bytes.fetch_add(bytes,
+                                               std::memory_order_relaxed);
+  if (timed_out) {
+    data_path_stats_.timeout_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  data_path_stats_.total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+  if (wait_ns > data_path_stats_.max_wait_ns.load(std::memory_order_relaxed)) {
+    data_path_stats_.max_wait_ns.store(wait_ns, std::memory_order_relaxed);
+  }
+}
+
 // The control function writes stream to FMQ
 size_t BluetoothAudioSession::OutWritePcmData(const void* buffer,
                                               size_t bytes) {
   if (buffer == nullptr || !bytes) return 0;
+  std::shared_ptr<DataPath> data_path = GetDataPath();
+  if (data_path == nullptr) return 0;
+  DataMQ* data_mq = data_path->data_mq.get();
+  // The FMQ starts out empty, so only count underruns once data has flowed
+  if (data_mq->availableToRead() == 0 &&
+      data_path_stats_.transferred_bytes.load(std::memory_order_relaxed) != 0) {
+    data_path_stats_.underrun_count.fetch_add(1, std::memory_order_relaxed);
+  }
   size_t totalWritten = 0;
-  int ms_timeout = kFmqSendTimeoutMs;
-  do {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
-    if (!IsSessionReady()) break;
-    size_t availableToWrite = mDataMQ->availableToWrite();
+  bool timed_out = false;
+  uint64_t wait_ns = 0;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kFmqSendTimeoutMs);
+  while (totalWritten < bytes && IsDataPathCurrent(*data_path)) {
+    size_t availableToWrite = data_mq->availableToWrite();
     if (availableToWrite) {
       if (availableToWrite > (bytes - totalWritten)) {
         availableToWrite = bytes - totalWritten;
       }
 
-      if (!mDataMQ->write(static_cast<const uint8_t*>(buffer) + totalWritten,
+      if (!data_mq->write(static_cast<const uint8_t*>(buffer) + totalWritten,
                           availableToWrite)) {
         ALOGE("FMQ datapath writting %zu/%zu failed", totalWritten, bytes);
-        return totalWritten;
+        break;
       }
       totalWritten += availableToWrite;
-    } else if (ms_timeout >= kWritePollMs) {
-      lock.unlock();
-      usleep(kWritePollMs * 1000);
-      ms_timeout -= kWritePollMs;
-    } else {
+      if (data_path->event_flag != nullptr) {
+        data_path->event_flag->wake(kFmqNotEmpty);
+      }
+    } else if (!WaitDataPath(*data_path, kFmqNotFull, bytes - totalWritten,
+                             deadline, &wait_ns)) {
       ALOGD("data %zu/%zu overflow %d ms", totalWritten, bytes,
-            (kFmqSendTimeoutMs - ms_timeout));
-      return totalWritten;
+            kFmqSendTimeoutMs);
+      timed_out = true;
+      break;
     }
-  } while (totalWritten < bytes);
+  }
+  UpdateDataPathStats(*data_path, totalWritten, timed_out, wait_ns);
   return totalWritten;
 }
 
 // The control function reads stream from FMQ
 size_t BluetoothAudioSession::InReadPcmData(void* buffer, size_t bytes) {
   if (buffer == nullptr || !bytes) return 0;
+  std::shared_ptr<DataPath> data_path = GetDataPath();
+  if (data_path == nullptr) return 0;
+  DataMQ* data_mq = data_path->data_mq.get();
+  // The FMQ starts out empty, so only count underruns once data has flowed
+  if (data_mq->availableToRead() == 0 &&
+      data_path_stats_.transferred_bytes.load(std::memory_order_relaxed) != 0) {
+    data_path_stats_.underrun_count.fetch_add(1, std::memory_order_relaxed);
+  }
   size_t totalRead = 0;
-  int ms_timeout = kFmqReceiveTimeoutMs;
-  do {
-    std::unique_lock<std::recursive_mutex> lock(mutex_);
-    if (!IsSessionReady()) break;
-    size_t availableToRead = mDataMQ->availableToRead();
+  bool timed_out = false;
+  uint64_t wait_ns = 0;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kFmqReceiveTimeoutMs);
+  while (totalRead < bytes && IsDataPathCurrent(*data_path)) {
+    size_t availableToRead = data_mq->availableToRead();
     if (availableToRead) {
       if (availableToRead > (bytes - totalRead)) {
         availableToRead = bytes - totalRead;
       }
-      if (!mDataMQ->read(static_cast<uint8_t*>(buffer) + totalRead,
+      if (!data_mq->read(static_cast<uint8_t*>(buffer) + totalRead,
                          availableToRead)) {
         ALOGE("FMQ datapath reading %zu/%zu failed", totalRead, bytes);
-        return totalRead;
+        break;
       }
       totalRead += availableToRead;
-    } else if (ms_timeout >= kReadPollMs) {
-      lock.unlock();
-      usleep(kReadPollMs * 1000);
-      ms_timeout -= kReadPollMs;
-      continue;
-    } else {
+      if (data_path->event_flag != nullptr) {
+        data_path->event_flag->wake(kFmqNotFull);
+      }
+    } else if (!WaitDataPath(*data_path, kFmqNotEmpty, bytes - totalRead,
+                             deadline, &wait_ns)) {
       ALOGD("in data %zu/%zu overflow %d ms", totalRead, bytes,
-            (kFmqReceiveTimeoutMs - ms_timeout));
-      return totalRead;
+            kFmqReceiveTimeoutMs);
+      timed_out = true;
+      break;
     }
-  } while (totalRead < bytes);
+  }
+  UpdateDataPathStats(*data_path, totalRead, timed_out, wait_ns);
   return totalRead;
 }
 
+// The report function is used to fetch the statistics of the audio data path
+// since the session started
+DataPathStats BluetoothAudioSession::GetDataPathStats() {
+  return {
+      .transfer_count = data_path_stats_.transfer_count,
+      .transferred_bytes = data_path_stats_.transferred_bytes,
+      .underrun_count = data_path_stats_.underrun_count,
+      .timeout_count = data_path_stats_.timeout_count,
+      .total_wait_ns = data_path_stats_.total_wait_ns,
+      .max_wait_ns = data_path_stats_.max_wait_ns,
+  };
+}
+
 std::unique_ptr<BluetoothAudioSessionInstance>
     BluetoothAudioSessionInstance::instance_ptr =
         std::unique_ptr<BluetoothAudioSessionInstance>(
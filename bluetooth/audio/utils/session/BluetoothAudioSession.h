@@ -16,10 +16,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <unordered_map>
 
 #include <android/hardware/bluetooth/audio/2.0/IBluetoothAudioPort.h>
+#include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
 #include <hardware/audio.h>
 #include <hidl/MQDescriptor.h>
@@ -29,6 +32,7 @@ namespace bluetooth {
 namespace audio {
 
 using ::android::sp;
+using ::android::hardware::EventFlag;
 using ::android::hardware::kSynchronizedReadWrite;
 using ::android::hardware::MessageQueue;
 using ::android::hardware::bluetooth::audio::V2_0::AudioConfiguration;
@@ -78,10 +82,52 @@ struct PortStatusCallbacks {
   std::function<void(uint16_t cookie)> session_changed_cb_;
 };
 
+// The statistics of the audio data path (FMQ) for software encoding, since the
+// session started
+struct DataPathStats {
+  // number of OutWritePcmData / InReadPcmData calls, and the bytes they
+  // transferred
+  uint64_t transfer_count;
+  uint64_t transferred_bytes;
+  // number of times the Bluetooth stack had drained the FMQ when the
+  // bluetooth_audio module came to write, or had not written anything yet when
+  // the bluetooth_audio module came to read, once data has been transferred
+  uint64_t underrun_count;
+  // number of calls that gave up at the timeout before transferring all bytes
+  uint64_t timeout_count;
+  // time the bluetooth_audio module spent waiting for the Bluetooth stack
+  uint64_t total_wait_ns;
+  uint64_t max_wait_ns;
+};
+
 class BluetoothAudioSession {
   friend class BluetoothAudioSession_2_1;
 
  private:
+  // The audio data path (FMQ) for software encoding. The audio thread holds a
+  // reference while it waits on the FMQ, so that it does not need to hold
+  // mutex_ and the session can end at any time.
+  struct DataPath {
+    std::unique_ptr<DataMQ> data_mq;
+    // nullptr if the FMQ comes without an EventFlag word
+    EventFlag* event_flag = nullptr;
+    // the rate the Bluetooth stack consumes or produces data at, 0 if unknown
+    uint32_t bytes_per_second = 0;
+    // the data_path_generation_ this data path was created in
+    uint64_t generation = 0;
+    ~DataPath();
+  };
+
+  // The data path statistics, updated by the audio thread without mutex_
+  struct AtomicDataPathStats {
+    std::atomic<uint64_t> transfer_count;
+    std::atomic<uint64_t> transferred_bytes;
+    std::atomic<uint64_t> underrun_count;
+    std::atomic<uint64_t> timeout_count;
+    std::atomic<uint64_t> total_wait_ns;
+    std::atomic<uint64_t> max_wait_ns;
+  };
+
   // using recursive_mutex to allow hwbinder to re-enter agian.
   std::recursive_mutex mutex_;
   SessionType session_type_;
@@ -89,7 +135,13 @@ class BluetoothAudioSession {
   // audio control path to use for both software and offloading
   sp<IBluetoothAudioPort> stack_iface_;
   // audio data path (FMQ) for software encoding
-  std::unique_ptr<DataMQ> mDataMQ;
+  std::shared_ptr<DataPath> data_path_;
+  // whether data_path_ may be used, checked by the audio thread without mutex_
+  std::atomic<bool> data_path_ready_;
+  // incremented whenever data_path_ changes, so that the audio thread notices
+  // when the data path it holds has been replaced
+  std::atomic<uint64_t> data_path_generation_;
+  AtomicDataPathStats data_path_stats_;
   // audio data configuration for both software and offloading
   AudioConfiguration audio_config_;
 
@@ -100,11 +152,37 @@ class BluetoothAudioSession {
   std::unordered_map<uint16_t, std::shared_ptr<struct PortStatusCallbacks>>
       observers_;
 
-  bool UpdateDataPath(const DataMQ::Descriptor* dataMQ);
+  bool UpdateDataPath(const DataMQ::Descriptor* dataMQ,
+                      uint32_t bytes_per_second);
   bool UpdateAudioConfig(const AudioConfiguration& audio_config);
+  // publishing the data path to the audio thread once the session is ready
+  void UpdateDataPathReady();
   // invoking the registered session_changed_cb_
   void ReportSessionStatus();
 
+  // The data path function fetches the data path if the session is ready
+  std::shared_ptr<DataPath> GetDataPath();
+  // @return: true if the data path is still the one the session is ready with
+  bool IsDataPathCurrent(const DataPath& data_path) const;
+  // The data path function waits for the Bluetooth stack to notify
+  // notification_bits, or until it should have transferred the given bytes,
+  // whichever comes first
+  // @return: false if the deadline has passed already
+  static bool WaitDataPath(const DataPath& data_path,
+                           uint32_t notification_bits, size_t bytes,
+                           std::chrono::steady_clock::time_point deadline,
+                           uint64_t* wait_ns);
+  // The data path function accounts a transfer to the statistics, unless the
+  // session has moved on to another data path in the meantime
+  void UpdateDataPathStats(const DataPath& data_path, size_t bytes,
+                           bool timed_out, uint64_t wait_ns);
+
+  // The rate of PCM audio in bytes per second, or 0 if the parameters are
+  // unknown. sample_rate is either a 2.0 or a 2.1 SampleRate.
+  static uint32_t PcmBytesPerSecond(uint32_t sample_rate,
+                                    ChannelMode channel_mode,
+                                    BitsPerSample bits_per_sample);
+
  public:
   BluetoothAudioSession(const SessionType& session_type);
 
@@ -158,6 +236,10 @@ class BluetoothAudioSession {
   // The control function read stream from FMQ
   size_t InReadPcmData(void* buffer, size_t bytes);
 
+  // The report function is used to fetch the statistics of the audio data path
+  // since the session started
+  DataPathStats GetDataPathStats();
+
   static constexpr PcmParameters kInvalidPcmParameters = {
       .sampleRate = SampleRate::RATE_UNKNOWN,
       .channelMode = ChannelMode::UNKNOWN,
@@ -136,6 +136,19 @@ class BluetoothAudioSessionControl {
     }
     return 0;
   }
+
+  // The report API fetches the statistics of the audio data path since the
+  // session started
+  static bool GetDataPathStats(const SessionType& session_type,
+                               DataPathStats* stats) {
+    std::shared_ptr<BluetoothAudioSession> session_ptr =
+        BluetoothAudioSessionInstance::GetSessionInstance(session_type);
+    if (session_ptr != nullptr) {
+      *stats = session_ptr->GetDataPathStats();
+      return true;
+    }
+    return false;
+  }
 };
 
 }  // namespace audio
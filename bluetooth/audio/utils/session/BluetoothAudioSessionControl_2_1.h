@@ -153,6 +153,19 @@ class BluetoothAudioSessionControl_2_1 {
     }
     return 0;
   }
+
+  // The report API fetches the statistics of the audio data path since the
+  // session started
+  static bool GetDataPathStats(const SessionType_2_1& session_type,
+                               DataPathStats* stats) {
+    std::shared_ptr<BluetoothAudioSession_2_1> session_ptr =
+        BluetoothAudioSessionInstance_2_1::GetSessionInstance(session_type);
+    if (session_ptr != nullptr) {
+      *stats = session_ptr->GetAudioSession()->GetDataPathStats();
+      return true;
+    }
+    return false;
+  }
 };
 
 }  // namespace audio
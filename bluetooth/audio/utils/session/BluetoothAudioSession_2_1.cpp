@@ -164,7 +164,17 @@ void BluetoothAudioSession_2_1::OnSessionStarted(
       LOG(ERROR) << __func__ << " - SessionType=" << toString(session_type_2_1_)
                  << ", AudioConfiguration=" << toString(audio_config)
                  << " Invalid";
-    } else if (!audio_session->UpdateDataPath(dataMQ)) {
+    } else if (!audio_session->UpdateDataPath(
+                   dataMQ,
+                   audio_config.getDiscriminator() ==
+                           ::android::hardware::bluetooth::audio::V2_1::
+                               AudioConfiguration::hidl_discriminator::pcmConfig
+                       ? BluetoothAudioSession::PcmBytesPerSecond(
+                             static_cast<uint32_t>(
+                                 audio_config.pcmConfig().sampleRate),
+                             audio_config.pcmConfig().channelMode,
+                             audio_config.pcmConfig().bitsPerSample)
+                       : 0)) {
       LOG(ERROR) << __func__ << " - SessionType=" << toString(session_type_2_1_)
                  << " DataMQ Invalid";
       audio_config_2_1_ =
@@ -173,6 +183,7 @@ void BluetoothAudioSession_2_1::OnSessionStarted(
                : kInvalidSoftwareAudioConfiguration);
     } else {
       audio_session->stack_iface_ = stack_iface;
+      audio_session->UpdateDataPathReady();
       LOG(INFO) << __func__ << " - SessionType=" << toString(session_type_2_1_)
                 << ", AudioConfiguration=" << toString(audio_config);
       audio_session->ReportSessionStatus();
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BTAudioSessionTest"
+
+#include "BluetoothAudioSession.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace bluetooth {
+namespace audio {
+
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::hardware::audio::common::V5_0::SourceMetadata;
+using ::android::hardware::bluetooth::audio::V2_0::IBluetoothAudioPort;
+
+namespace {
+
+// 48 kHz, stereo, 16 bits: 192 bytes per ms
+constexpr size_t kBytesPerMs = 192;
+// 20 ms of audio, as the Bluetooth stack reads at once
+constexpr size_t kTickBytes = 20 * kBytesPerMs;
+constexpr auto kTick = std::chrono::milliseconds(20);
+// the same 1000 ms the bluetooth_audio module waits for the FMQ
+constexpr auto kTimeout = std::chrono::milliseconds(1000);
+
+class FakeBluetoothAudioPort : public IBluetoothAudioPort {
+ public:
+  Return<void> startStream() override { return Void(); }
+  Return<void> suspendStream() override { return Void(); }
+  Return<void> stopStream() override { return Void(); }
+  Return<void> getPresentationPosition(
+      getPresentationPosition_cb _hidl_cb) override {
+    _hidl_cb(BluetoothAudioStatus::SUCCESS, 0, 0, {});
+    return Void();
+  }
+  Return<void> updateMetadata(const SourceMetadata&) override {
+    return Void();
+  }
+};
+
+// Stands in for the Bluetooth stack at the other end of the FMQ, and moves
+// kTickBytes through it every tick. Like the Bluetooth stack, it does not
+// notify the EventFlag of the FMQ.
+class FakeBluetoothStack {
+ public:
+  FakeBluetoothStack(DataMQ* data_mq, bool consume,
+                     std::chrono::milliseconds tick)
+      : data_mq_(data_mq), running_(true) {
+    thread_ = std::thread([this, consume, tick] {
+      std::vector<uint8_t> buffer(kTickBytes);
+      while (running_) {
+        std::this_thread::sleep_for(tick);
+        if (consume) {
+          size_t bytes = std::min(data_mq_->availableToRead(), kTickBytes);
+          if (bytes > 0 && data_mq_->read(buffer.data(), bytes)) {
+            transferred_bytes_ += bytes;
+          }
+        } else {
+          size_t bytes = std::min(data_mq_->availableToWrite(), kTickBytes);
+          if (bytes > 0 && data_mq_->write(buffer.data(), bytes)) {
+            transferred_bytes_ += bytes;
+          }
+        }
+      }
+    });
+  }
+  ~FakeBluetoothStack() {
+    running_ = false;
+    thread_.join();
+  }
+
+  size_t transferred_bytes() const { return transferred_bytes_; }
+
+ private:
+  DataMQ* data_mq_;
+  std::atomic<bool> running_;
+  std::atomic<size_t> transferred_bytes_{0};
+  std::thread thread_;
+};
+
+class BluetoothAudioSessionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    session_ = std::make_unique<BluetoothAudioSession>(
+        SessionType::A2DP_SOFTWARE_ENCODING_DATAPATH);
+    // 100 ms of audio, with an EventFlag word as the Bluetooth stack creates
+    data_mq_ = std::make_unique<DataMQ>(100 * kBytesPerMs, true);
+    ASSERT_TRUE(data_mq_->isValid());
+
+    AudioConfiguration audio_config = {};
+    audio_config.pcmConfig({
+        .sampleRate = SampleRate::RATE_48000,
+        .channelMode = ChannelMode::STEREO,
+        .bitsPerSample = BitsPerSample::BITS_16,
+    });
+    session_->OnSessionStarted(new FakeBluetoothAudioPort(),
+                               data_mq_->getDesc(), audio_config);
+    ASSERT_TRUE(session_->IsSessionReady());
+  }
+
+  void TearDown() override { session_->OnSessionEnded(); }
+
+  std::unique_ptr<BluetoothAudioSession> session_;
+  std::unique_ptr<DataMQ> data_mq_;
+};
+
+}  // namespace
+
+TEST_F(BluetoothAudioSessionTest, WriteKeepsUpWithBluetoothStack) {
+  FakeBluetoothStack stack(data_mq_.get(), true /* consume */, kTick);
+  std::vector<uint8_t> buffer(kTickBytes);
+  // 1 s of audio, far more than the FMQ holds
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_EQ(buffer.size(),
+              session_->OutWritePcmData(buffer.data(), buffer.size()));
+  }
+
+  DataPathStats stats = session_->GetDataPathStats();
+  EXPECT_EQ(50u, stats.transfer_count);
+  EXPECT_EQ(50 * kTickBytes, stats.transferred_bytes);
+  EXPECT_EQ(0u, stats.timeout_count);
+  EXPECT_GT(stats.total_wait_ns, 0u);
+  EXPECT_LT(stats.max_wait_ns,
+            std::chrono::nanoseconds(kTimeout).count() / 2);
+}
+
+TEST_F(BluetoothAudioSessionTest, WriteTimesOutWhenBluetoothStackStalls) {
+  std::vector<uint8_t> buffer(data_mq_->getQuantumCount() + kTickBytes);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(data_mq_->getQuantumCount(),
+            session_->OutWritePcmData(buffer.data(), buffer.size()));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, kTimeout);
+  EXPECT_LT(elapsed, 2 * kTimeout);
+
+  DataPathStats stats = session_->GetDataPathStats();
+  EXPECT_EQ(1u, stats.transfer_count);
+  EXPECT_EQ(1u, stats.timeout_count);
+}
+
+TEST_F(BluetoothAudioSessionTest, SessionEndedWakesUpWriter) {
+  std::vector<uint8_t> buffer(data_mq_->getQuantumCount() + kTickBytes);
+  std::thread writer([this, &buffer] {
+    EXPECT_EQ(data_mq_->getQuantumCount(),
+              session_->OutWritePcmData(buffer.data(), buffer.size()));
+  });
+  // Leave the writer time to fill up the FMQ and wait for it to drain
+  std::this_thread::sleep_for(kTick);
+  auto start = std::chrono::steady_clock::now();
+  session_->OnSessionEnded();
+  writer.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, kTimeout / 2);
+  EXPECT_EQ(0u, session_->OutWritePcmData(buffer.data(), buffer.size()));
+}
+
+TEST_F(BluetoothAudioSessionTest, SessionRestartedWakesUpWriter) {
+  auto new_data_mq = std::make_unique<DataMQ>(100 * kBytesPerMs, true);
+  ASSERT_TRUE(new_data_mq->isValid());
+  AudioConfiguration audio_config = {};
+  audio_config.pcmConfig({
+      .sampleRate = SampleRate::RATE_48000,
+      .channelMode = ChannelMode::STEREO,
+      .bitsPerSample = BitsPerSample::BITS_16,
+  });
+  std::vector<uint8_t> buffer(data_mq_->getQuantumCount() + kTickBytes);
+  std::thread writer([this, &buffer] {
+    EXPECT_EQ(data_mq_->getQuantumCount(),
+              session_->OutWritePcmData(buffer.data(), buffer.size()));
+  });
+  // Leave the writer time to fill up the FMQ and wait for it to drain
+  std::this_thread::sleep_for(kTick);
+  // The Bluetooth stack starts the session again without ending it first
+  auto start = std::chrono::steady_clock::now();
+  session_->OnSessionStarted(new FakeBluetoothAudioPort(),
+                             new_data_mq->getDesc(), audio_config);
+  writer.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, kTimeout / 2);
+  EXPECT_TRUE(session_->IsSessionReady());
+  // What the writer moved into the old FMQ is not accounted to the new one
+  EXPECT_EQ(0u, session_->GetDataPathStats().transferred_bytes);
+}
+
+TEST_F(BluetoothAudioSessionTest, EmptyFmqAtStartIsNotAnUnderrun) {
+  std::vector<uint8_t> buffer(kTickBytes);
+  ASSERT_EQ(buffer.size(),
+            session_->OutWritePcmData(buffer.data(), buffer.size()));
+  EXPECT_EQ(0u, session_->GetDataPathStats().underrun_count);
+
+  // The Bluetooth stack starts the session again with a new, empty FMQ
+  auto new_data_mq = std::make_unique<DataMQ>(100 * kBytesPerMs, true);
+  ASSERT_TRUE(new_data_mq->isValid());
+  AudioConfiguration audio_config = {};
+  audio_config.pcmConfig({
+      .sampleRate = SampleRate::RATE_48000,
+      .channelMode = ChannelMode::STEREO,
+      .bitsPerSample = BitsPerSample::BITS_16,
+  });
+  session_->OnSessionStarted(new FakeBluetoothAudioPort(),
+                             new_data_mq->getDesc(), audio_config);
+  ASSERT_EQ(buffer.size(),
+            session_->OutWritePcmData(buffer.data(), buffer.size()));
+  EXPECT_EQ(0u, session_->GetDataPathStats().underrun_count);
+
+  // An FMQ the Bluetooth stack has drained is an underrun
+  new_data_mq->read(buffer.data(), buffer.size());
+  ASSERT_EQ(buffer.size(),
+            session_->OutWritePcmData(buffer.data(), buffer.size()));
+  EXPECT_EQ(1u, session_->GetDataPathStats().underrun_count);
+}
+
+TEST_F(BluetoothAudioSessionTest, ReadKeepsUpWithBluetoothStack) {
+  FakeBluetoothStack stack(data_mq_.get(), false /* consume */, kTick);
+  std::vector<uint8_t> buffer(kTickBytes);
+  for (int i = 0; i < 25; ++i) {
+    ASSERT_EQ(buffer.size(),
+              session_->InReadPcmData(buffer.data(), buffer.size()));
+  }
+
+  DataPathStats stats = session_->GetDataPathStats();
+  EXPECT_EQ(25u, stats.transfer_count);
+  EXPECT_EQ(25 * kTickBytes, stats.transferred_bytes);
+  EXPECT_EQ(0u, stats.timeout_count);
+  EXPECT_GT(stats.underrun_count, 0u);
+}
+
+}  // namespace audio
+}  // namespace bluetooth
+}  // namespace android
@@ -18,6 +18,7 @@
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include <log/log.h>
 
+#include <algorithm>
 #include <inttypes.h>
 #include "ExternalCameraDeviceSession.h"
 
@@ -25,6 +26,7 @@
 #include <utils/Timers.h>
 #include <utils/Trace.h>
 #include <linux/videodev2.h>
+#include <poll.h>
 #include <sync/sync.h>
 
 #define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
@@ -81,6 +83,48 @@ bool tryLock(std::mutex& mutex)
     return locked;
 }
 
+constexpr uint8_t kJpegSoiMarker = 0xD8;
+
+// Largest JPEG APP1 segment: 2 byte marker, 2 byte length and at most 65533 bytes of data
+constexpr size_t kMaxApp1SegmentSize = 4 + 65533;
+
+// Move a JPEG code stream from codeOffset to the start of buf, inserting an APP1 segment
+// right after SOI and the JFIF APP0 segment (where libjpeg would have written it).
+int insertJpegApp1(uint8_t* buf, size_t codeOffset, size_t codeSize,
+        const uint8_t* app1, size_t app1Size, /*out*/size_t* outCodeSize) {
+    const size_t app1SegmentSize = 4 + app1Size;
+    if (app1SegmentSize > kMaxApp1SegmentSize || app1SegmentSize > codeOffset) {
+        ALOGE("%s: APP1 size %zu does not fit in %zu bytes", __FUNCTION__, app1Size, codeOffset);
+        return -1;
+    }
+
+    const uint8_t* code = buf + codeOffset;
+    if (codeSize < 2 || code[0] != 0xFF || code[1] != kJpegSoiMarker) {
+        ALOGE("%s: code stream does not start with SOI", __FUNCTION__);
+        return -1;
+    }
+    size_t headerSize = 2;
+    if (codeSize >= 6 && code[2] == 0xFF && code[3] == JPEG_APP0) {
+        headerSize += 2 + ((code[4] << 8) | code[5]);
+        if (headerSize > codeSize) {
+            ALOGE("%s: malformed APP0 segment", __FUNCTION__);
+            return -1;
+        }
+    }
+
+    // codeOffset >= app1SegmentSize, so every destination byte precedes its source
+    memmove(buf, code, headerSize);
+    uint8_t* app1Segment = buf + headerSize;
+    app1Segment[0] = 0xFF;
+    app1Segment[1] = JPEG_APP0 + 1;
+    app1Segment[2] = static_cast<uint8_t>((app1Size + 2) >> 8);
+    app1Segment[3] = static_cast<uint8_t>((app1Size + 2) & 0xFF);
+    memcpy(app1Segment + 4, app1, app1Size);
+    memmove(app1Segment + app1SegmentSize, code + headerSize, codeSize - headerSize);
+    *outCodeSize = codeSize + app1SegmentSize;
+    return 0;
+}
+
 } // Anonymous namespace
 
 // Static instances
@@ -167,6 +211,7 @@ bool ExternalCameraDeviceSession::initialize() {
     }
 
     // TODO: check is PRIORITY_DISPLAY enough?
+    mOutputThread->startEncodeThread();
     mOutputThread->run("ExtCamOut", PRIORITY_DISPLAY);
     return false;
 }
@@ -193,6 +238,7 @@ void ExternalCameraDeviceSession::closeOutputThreadImpl() {
         mOutputThread->flush();
         mOutputThread->requestExit();
         mOutputThread->join();
+        mOutputThread->stopEncodeThread();
         mOutputThread.clear();
     }
 }
@@ -278,12 +324,24 @@ void ExternalCameraDeviceSession::dumpState(const native_handle_t* handle) {
                 mV4l2StreamingFps);
 
         size_t numDequeuedV4l2Buffers = 0;
+        size_t numSensorFrames = 0;
+        uint64_t numDroppedFrames = 0;
+        uint64_t numStaleFrames = 0;
+        bool sensorError = false;
         {
             std::lock_guard<std::mutex> lk(mV4l2BufferLock);
             numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
+            numSensorFrames = mSensorFrames.size();
+            numDroppedFrames = mNumDroppedV4l2Frames;
+            numStaleFrames = mNumStaleV4l2Frames;
+            sensorError = mSensorError;
         }
         dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n",
                 v4L2BufferCount, numDequeuedV4l2Buffers);
+        dprintf(fd, "V4L2 sensor frames buffered %zu/%zu%s, dropped %" PRIu64
+                ", skipped as stale %" PRIu64 "\n",
+                numSensorFrames, kMaxSensorFrames, sensorError ? " (sensor error)" : "",
+                numDroppedFrames, numStaleFrames);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -687,6 +745,8 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         }
 
         if (requestFpsMax != mV4l2StreamingFps) {
+            // Return frames buffered by the sensor thread so the pipeline can drain
+            stopSensorThreadLocked();
             {
                 std::unique_lock<std::mutex> lk(mV4l2BufferLock);
                 while (mNumDequeuedV4l2Buffers != 0) {
@@ -708,7 +768,7 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
     }
 
     nsecs_t shutterTs = 0;
-    sp<V4L2Frame> frameIn = dequeueV4l2FrameLocked(&shutterTs);
+    sp<V4L2Frame> frameIn = acquireLatestV4l2FrameLocked(&shutterTs);
     if ( frameIn == nullptr) {
         ALOGE("%s: V4L2 deque frame failed!", __FUNCTION__);
         return Status::INTERNAL_ERROR;
@@ -933,6 +993,17 @@ void ExternalCameraDeviceSession::OutputThread::setExifMakeModel(
 
 int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         sp<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+    return cropAndScaleImpl(in, outSz, mIntermediateFrames, /*reuseScaled*/true, out);
+}
+
+int ExternalCameraDeviceSession::OutputThread::cropAndScaleJpegLocked(
+        sp<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+    return cropAndScaleImpl(in, outSz, mJpegIntermediateFrames, /*reuseScaled*/false, out);
+}
+
+int ExternalCameraDeviceSession::OutputThread::cropAndScaleImpl(
+        sp<AllocatedFrame>& in, const Size& outSz,
+        IntermediateFrameArena& arena, bool reuseScaled, YCbCrLayout* out) {
     Size inSz = {in->mWidth, in->mHeight};
 
     int ret;
@@ -969,27 +1040,21 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return 0;
     }
 
-    auto it = mScaledYu12Frames.find(outSz);
-    sp<AllocatedFrame> scaledYu12Buf;
-    if (it != mScaledYu12Frames.end()) {
-        scaledYu12Buf = it->second;
-    } else {
-        it = mIntermediateBuffers.find(outSz);
-        if (it == mIntermediateBuffers.end()) {
-            ALOGE("%s: failed to find intermediate buffer size %dx%d",
-                    __FUNCTION__, outSz.width, outSz.height);
-            return -1;
-        }
-        scaledYu12Buf = it->second;
-    }
-    // Scale
     YCbCrLayout outLayout;
-    ret = scaledYu12Buf->getLayout(&outLayout);
-    if (ret != 0) {
-        ALOGE("%s: failed to get output buffer layout", __FUNCTION__);
-        return ret;
+    bool scaled = false;
+    sp<AllocatedFrame> scaledYu12Buf = arena.get(outSz, &outLayout, &scaled);
+    if (scaledYu12Buf == nullptr) {
+        ALOGE("%s: failed to find intermediate buffer size %dx%d",
+                __FUNCTION__, outSz.width, outSz.height);
+        return -1;
+    }
+    if (reuseScaled && scaled) {
+        *out = outLayout;
+        return 0;
     }
 
+    // Scale
+
     ret = libyuv::I420Scale(
             static_cast<uint8_t*>(croppedLayout.y),
             croppedLayout.yStride,
@@ -1018,7 +1083,9 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
     }
 
     *out = outLayout;
-    mScaledYu12Frames.insert({outSz, scaledYu12Buf});
+    if (reuseScaled) {
+        arena.markScaled(outSz);
+    }
     return 0;
 }
 
@@ -1236,6 +1303,14 @@ ssize_t ExternalCameraDeviceSession::getJpegBufferSize(
 int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         HalStreamBuffer &halBuf,
         const common::V1_0::helper::CameraMetadata& setting)
+{
+    return createJpegLocked(mYu12Frame, halBuf, setting);
+}
+
+int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
+        sp<AllocatedFrame>& in,
+        HalStreamBuffer &halBuf,
+        const common::V1_0::helper::CameraMetadata& setting)
 {
     ATRACE_CALL();
     int ret;
@@ -1258,7 +1333,7 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
           halBuf.bufPtr);
     ALOGV("%s: YV12 buffer %d x %d",
           __FUNCTION__,
-          mYu12Frame->mWidth, mYu12Frame->mHeight);
+          in->mWidth, in->mHeight);
 
     int jpegQuality, thumbQuality;
     Size thumbSize;
@@ -1323,7 +1398,7 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
 
     YCbCrLayout yu12Thumb;
     if (outputThumbnail) {
-        ret = cropAndScaleThumbLocked(mYu12Frame, thumbSize, &yu12Thumb);
+        ret = cropAndScaleThumbLocked(in, thumbSize, &yu12Thumb);
 
         if (ret != 0) {
             return lfail(
@@ -1331,24 +1406,6 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         }
     }
 
-    /* Scale and crop main jpeg */
-    ret = cropAndScaleLocked(mYu12Frame, jpegSize, &yu12Main);
-
-    if (ret != 0) {
-        return lfail("%s: crop and scale main failed!", __FUNCTION__);
-    }
-
-    /* Encode the thumbnail image */
-    if (outputThumbnail) {
-        ret = encodeJpegYU12(thumbSize, yu12Thumb,
-                thumbQuality, 0, 0,
-                &thumbCode[0], maxThumbCodeSize, thumbCodeSize);
-
-        if (ret != 0) {
-            return lfail("%s: thumbnail encodeJpegYU12 failed with %d",__FUNCTION__, ret);
-        }
-    }
-
     /* Combine camera characteristics with request settings to form EXIF
      * metadata */
     common::V1_0::helper::CameraMetadata meta(mCameraCharacteristics);
@@ -1363,28 +1420,98 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
     utils->setMake(mExifMake);
     utils->setModel(mExifModel);
 
-    ret = utils->generateApp1(outputThumbnail ? &thumbCode[0] : 0, thumbCodeSize);
+    /* Encode the thumbnail image and generate APP1 with it */
+    auto generateApp1 = [&]() {
+        if (outputThumbnail) {
+            int ret = mThumbJpegEncoder.encode(thumbSize, yu12Thumb,
+                    thumbQuality, 0, 0,
+                    &thumbCode[0], maxThumbCodeSize, thumbCodeSize);
 
-    if (!ret) {
-        return lfail("%s: generating APP1 failed", __FUNCTION__);
-    }
+            if (ret != 0) {
+                ALOGE("%s: thumbnail encode failed with %d", __FUNCTION__, ret);
+                return ret;
+            }
+        }
+
+        if (!utils->generateApp1(outputThumbnail ? &thumbCode[0] : 0, thumbCodeSize)) {
+            ALOGE("%s: generating APP1 failed", __FUNCTION__);
+            return 1;
+        }
+        return 0;
+    };
+
+    /* When the thumbnail thread is available, the main image is encoded while
+     * the thumbnail and APP1 are generated. The main image is then written
+     * after room reserved for the largest possible APP1 segment, which gets
+     * filled in once the thumbnail is done */
+    const size_t mainCodeOffset = kMaxApp1SegmentSize;
+    bool encodeInParallel = false;
+    if (mJpegThumbnailThread != nullptr &&
+            static_cast<size_t>(maxJpegCodeSize) > 2 * mainCodeOffset) {
+        encodeInParallel = (mJpegThumbnailThread->encodeStart(generateApp1) == 0);
+    }
+    // generateApp1 references locals of this function, wait for it on every return path
+    auto waitForApp1 = [&]() {
+        return encodeInParallel ? mJpegThumbnailThread->waitForEncodeDone() : 0;
+    };
+
+    /* Scale and crop main jpeg */
+    ret = cropAndScaleJpegLocked(in, jpegSize, &yu12Main);
 
-    /* Get internal buffer */
-    size_t exifDataSize = utils->getApp1Length();
-    const uint8_t* exifData = utils->getApp1Buffer();
+    if (ret != 0) {
+        waitForApp1();
+        return lfail("%s: crop and scale main failed!", __FUNCTION__);
+    }
 
     /* Lock the HAL jpeg code buffer */
     void *bufPtr = sHandleImporter.lock(
             *(halBuf.bufPtr), halBuf.usage, maxJpegCodeSize);
 
     if (!bufPtr) {
+        waitForApp1();
         return lfail("%s: could not lock %zu bytes", __FUNCTION__, maxJpegCodeSize);
     }
 
-    /* Encode the main jpeg image */
-    ret = encodeJpegYU12(jpegSize, yu12Main,
-            jpegQuality, exifData, exifDataSize,
-            bufPtr, maxJpegCodeSize, jpegCodeSize);
+    bool mainEncoded = false;
+    if (encodeInParallel) {
+        /* Encode the main jpeg image without APP1 */
+        uint8_t* codePtr = static_cast<uint8_t*>(bufPtr);
+        size_t mainCodeSize = 0;
+        ret = mJpegEncoder.encode(jpegSize, yu12Main,
+                jpegQuality, nullptr, 0,
+                codePtr + mainCodeOffset, maxJpegCodeSize - mainCodeOffset, mainCodeSize);
+        int app1Ret = waitForApp1();
+        if (app1Ret != 0) {
+            sHandleImporter.unlock(*(halBuf.bufPtr));
+            return lfail("%s: thumbnail/APP1 generation failed with %d", __FUNCTION__, app1Ret);
+        }
+        if (ret == 0) {
+            ret = insertJpegApp1(codePtr, mainCodeOffset, mainCodeSize,
+                    utils->getApp1Buffer(), utils->getApp1Length(), &jpegCodeSize);
+            mainEncoded = (ret == 0);
+        }
+        if (!mainEncoded) {
+            ALOGW("%s: parallel encode failed (%d), retrying with APP1 inline",
+                    __FUNCTION__, ret);
+        }
+    } else {
+        ret = generateApp1();
+        if (ret != 0) {
+            sHandleImporter.unlock(*(halBuf.bufPtr));
+            return lfail("%s: thumbnail/APP1 generation failed with %d", __FUNCTION__, ret);
+        }
+    }
+
+    if (!mainEncoded) {
+        /* Get internal buffer */
+        size_t exifDataSize = utils->getApp1Length();
+        const uint8_t* exifData = utils->getApp1Buffer();
+
+        /* Encode the main jpeg image */
+        ret = mJpegEncoder.encode(jpegSize, yu12Main,
+                jpegQuality, exifData, exifDataSize,
+                bufPtr, maxJpegCodeSize, jpegCodeSize);
+    }
 
     /* TODO: Not sure this belongs here, maybe better to pass jpegCodeSize out
      * and do this when returning buffer to parent */
@@ -1421,9 +1548,6 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
        return false;
     }
 
-    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
-    //       regularly to prevent v4l buffer queue filled with stale buffers
-    //       when app doesn't program a preveiw request
     waitForNextRequest(&req);
     if (req == nullptr) {
         // No new request, wait again
@@ -1452,6 +1576,13 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return onDeviceError("%s: failed to send buffer request!", __FUNCTION__);
     }
 
+    // Wait for the JPEG encode stage to return a decode buffer if both are in use
+    sp<AllocatedFrame> yu12Frame = acquireYu12Frame();
+    YCbCrLayout yu12Layout;
+    if (yu12Frame == nullptr || yu12Frame->getLayout(&yu12Layout) != 0) {
+        return onDeviceError("%s: no YU12 frame available for decoding!", __FUNCTION__);
+    }
+
     std::unique_lock<std::mutex> lk(mBufferLock);
     // Convert input V4L2 frame to YU12 of the same size
     // TODO: see if we can save some computation by converting to YV12 here
@@ -1459,69 +1590,107 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     size_t inDataSize;
     if (req->frameIn->getData(&inData, &inDataSize) != 0) {
         lk.unlock();
+        releaseYu12Frame(yu12Frame);
         return onDeviceError("%s: V4L2 buffer map failed", __FUNCTION__);
     }
 
-    // TODO: in some special case maybe we can decode jpg directly to gralloc output?
+    auto onDecodeError = [&](int res) {
+        // For some webcam, the first few V4L2 frames might be malformed...
+        ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, res);
+        lk.unlock();
+        releaseYu12Frame(yu12Frame);
+        Status st = dispatchResult(req, /*yu12Frame*/nullptr, /*requestError*/true);
+        if (st != Status::OK) {
+            return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
+        }
+        signalRequestDone();
+        return true;
+    };
+
+    auto waitBufferRequest = [&]() {
+        ATRACE_BEGIN("Wait for BufferRequest done");
+        int res = waitForBufferRequestDone(&req->buffers);
+        ATRACE_END();
+        if (res != 0) {
+            ALOGE("%s: wait for BufferRequest done failed! res %d", __FUNCTION__, res);
+        }
+        return res;
+    };
+
+    // If one output buffer is the only consumer of the decoded frame and needs neither crop
+    // nor scale, decode straight into it instead of going through the YU12 frame.
+    bool bufferRequestDone = false;
+    ssize_t directDecodeIdx = -1;
     if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
+        directDecodeIdx = getDirectDecodeBufferIndexLocked(
+                *req, Size{yu12Frame->mWidth, yu12Frame->mHeight});
+    }
+    if (directDecodeIdx >= 0) {
+        // Output buffers must be available before we can decode into them
+        if (waitBufferRequest() != 0) {
+            lk.unlock();
+            releaseYu12Frame(yu12Frame);
+            return onDeviceError("%s: failed to process buffer request error!", __FUNCTION__);
+        }
+        bufferRequestDone = true;
+
+        int res = decodeMjpegToOutputLocked(inData, inDataSize, req->buffers[directDecodeIdx]);
+        if (res == -EAGAIN) {
+            directDecodeIdx = -1; // Fall back to decode into the YU12 frame
+        } else if (res != 0) {
+            return onDecodeError(res);
+        }
+    }
+
+    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG && directDecodeIdx < 0) {
         ATRACE_BEGIN("MJPGtoI420");
         int res = libyuv::MJPGToI420(
-            inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
-            mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth, mYu12Frame->mHeight);
+            inData, inDataSize, static_cast<uint8_t*>(yu12Layout.y), yu12Layout.yStride,
+            static_cast<uint8_t*>(yu12Layout.cb), yu12Layout.cStride,
+            static_cast<uint8_t*>(yu12Layout.cr), yu12Layout.cStride,
+            yu12Frame->mWidth, yu12Frame->mHeight, yu12Frame->mWidth, yu12Frame->mHeight);
         ATRACE_END();
 
         if (res != 0) {
-            // For some webcam, the first few V4L2 frames might be malformed...
-            ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, res);
-            lk.unlock();
-            Status st = parent->processCaptureRequestError(req);
-            if (st != Status::OK) {
-                return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
-            }
-            signalRequestDone();
-            return true;
+            return onDecodeError(res);
         }
     }
 
-    ATRACE_BEGIN("Wait for BufferRequest done");
-    res = waitForBufferRequestDone(&req->buffers);
-    ATRACE_END();
-
-    if (res != 0) {
-        ALOGE("%s: wait for BufferRequest done failed! res %d", __FUNCTION__, res);
+    if (!bufferRequestDone && waitBufferRequest() != 0) {
         lk.unlock();
+        releaseYu12Frame(yu12Frame);
         return onDeviceError("%s: failed to process buffer request error!", __FUNCTION__);
     }
 
     ALOGV("%s processing new request", __FUNCTION__);
-    const int kSyncWaitTimeoutMs = 500;
-    for (auto& halBuf : req->buffers) {
-        if (*(halBuf.bufPtr) == nullptr) {
-            ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
-            halBuf.fenceTimeout = true;
-        } else if (halBuf.acquireFence >= 0) {
-            int ret = sync_wait(halBuf.acquireFence, kSyncWaitTimeoutMs);
-            if (ret) {
-                halBuf.fenceTimeout = true;
-            } else {
-                ::close(halBuf.acquireFence);
-                halBuf.acquireFence = -1;
-            }
+    mIntermediateFrames.invalidateScaled();
+    bool hasPendingJpeg = false;
+    for (size_t i = 0; i < req->buffers.size(); i++) {
+        auto& halBuf = req->buffers[i];
+        if (static_cast<ssize_t>(i) == directDecodeIdx) {
+            continue; // Already filled by decodeMjpegToOutputLocked
         }
 
-        if (halBuf.fenceTimeout) {
+        if (!waitForBufferFence(halBuf)) {
             continue;
         }
 
         // Gralloc lockYCbCr the buffer
         switch (halBuf.format) {
             case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req->setting);
+                if (mJpegEncodeThread != nullptr) {
+                    // Encoded by the JPEG encode stage after this loop
+                    hasPendingJpeg = true;
+                    break;
+                }
+
+                std::unique_lock<std::mutex> jpegLk(mJpegLock);
+                int ret = createJpegLocked(yu12Frame, halBuf, req->setting);
+                jpegLk.unlock();
 
                 if(ret != 0) {
                     lk.unlock();
+                    releaseYu12Frame(yu12Frame);
                     return onDeviceError("%s: createJpegLocked failed with %d",
                           __FUNCTION__, ret);
                 }
@@ -1558,12 +1727,13 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                 YCbCrLayout cropAndScaled;
                 ATRACE_BEGIN("cropAndScaleLocked");
                 int ret = cropAndScaleLocked(
-                        mYu12Frame,
+                        yu12Frame,
                         Size { halBuf.width, halBuf.height },
                         &cropAndScaled);
                 ATRACE_END();
                 if (ret != 0) {
                     lk.unlock();
+                    releaseYu12Frame(yu12Frame);
                     return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
                 }
 
@@ -1573,6 +1743,7 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                 ATRACE_END();
                 if (ret != 0) {
                     lk.unlock();
+                    releaseYu12Frame(yu12Frame);
                     return onDeviceError("%s: format coversion failed!", __FUNCTION__);
                 }
                 int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
@@ -1582,14 +1753,18 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
             } break;
             default:
                 lk.unlock();
+                releaseYu12Frame(yu12Frame);
                 return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
         }
     } // for each buffer
-    mScaledYu12Frames.clear();
 
     // Don't hold the lock while calling back to parent
     lk.unlock();
-    Status st = parent->processCaptureResult(req);
+    if (!hasPendingJpeg) {
+        releaseYu12Frame(yu12Frame);
+        yu12Frame.clear();
+    }
+    Status st = dispatchResult(req, yu12Frame, /*requestError*/false);
     if (st != Status::OK) {
         return onDeviceError("%s: failed to process capture result!", __FUNCTION__);
     }
@@ -1597,27 +1772,368 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     return true;
 }
 
+bool ExternalCameraDeviceSession::OutputThread::waitForBufferFence(HalStreamBuffer& halBuf) {
+    const int kSyncWaitTimeoutMs = 500;
+    if (halBuf.fenceTimeout) {
+        return false;
+    }
+    if (*(halBuf.bufPtr) == nullptr) {
+        ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
+        halBuf.fenceTimeout = true;
+    } else if (halBuf.acquireFence >= 0) {
+        int ret = sync_wait(halBuf.acquireFence, kSyncWaitTimeoutMs);
+        if (ret) {
+            halBuf.fenceTimeout = true;
+        } else {
+            ::close(halBuf.acquireFence);
+            halBuf.acquireFence = -1;
+        }
+    }
+    return !halBuf.fenceTimeout;
+}
+
+ssize_t ExternalCameraDeviceSession::OutputThread::getDirectDecodeBufferIndexLocked(
+        const HalRequest& req, const Size& v4lSize) {
+    ssize_t idx = -1;
+    for (size_t i = 0; i < req.buffers.size(); i++) {
+        const HalStreamBuffer& halBuf = req.buffers[i];
+        switch (halBuf.format) {
+            case PixelFormat::Y16:
+                // Copied from the V4L2 frame, does not need the decoded frame
+                break;
+            case PixelFormat::YCBCR_420_888:
+            case PixelFormat::YV12:
+                if (idx < 0 && halBuf.width == v4lSize.width &&
+                        halBuf.height == v4lSize.height &&
+                        mNoDirectDecodeStreams.count(halBuf.streamId) == 0) {
+                    idx = i;
+                    break;
+                }
+                return -1;
+            default:
+                // BLOB and scaled YUV outputs need the decoded YU12 frame
+                return -1;
+        }
+    }
+    return idx;
+}
+
+int ExternalCameraDeviceSession::OutputThread::decodeMjpegToOutputLocked(
+        uint8_t* inData, size_t inDataSize, HalStreamBuffer& halBuf) {
+    ATRACE_CALL();
+    if (!waitForBufferFence(halBuf)) {
+        // Buffer will be returned with error, decode into YU12 frame for the other outputs
+        return -EAGAIN;
+    }
+
+    IMapper::Rect outRect {0, 0,
+            static_cast<int32_t>(halBuf.width),
+            static_cast<int32_t>(halBuf.height)};
+    YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+            *(halBuf.bufPtr), halBuf.usage, outRect);
+
+    // MJPGToI420 writes planar chroma; interleaved layouts take the regular path
+    uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+    int ret = -EAGAIN;
+    if (outputFourcc == V4L2_PIX_FMT_YUV420 || outputFourcc == V4L2_PIX_FMT_YVU420) {
+        ATRACE_BEGIN("MJPGtoI420");
+        ret = libyuv::MJPGToI420(
+            inData, inDataSize, static_cast<uint8_t*>(outLayout.y), outLayout.yStride,
+            static_cast<uint8_t*>(outLayout.cb), outLayout.cStride,
+            static_cast<uint8_t*>(outLayout.cr), outLayout.cStride,
+            halBuf.width, halBuf.height, halBuf.width, halBuf.height);
+        ATRACE_END();
+    } else {
+        ALOGV("%s: stream %d layout %c%c%c%c cannot be decoded into directly", __FUNCTION__,
+                halBuf.streamId,
+                outputFourcc & 0xFF,
+                (outputFourcc >> 8) & 0xFF,
+                (outputFourcc >> 16) & 0xFF,
+                (outputFourcc >> 24) & 0xFF);
+        mNoDirectDecodeStreams.insert(halBuf.streamId);
+    }
+
+    int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+    if (relFence >= 0) {
+        halBuf.acquireFence = relFence;
+    }
+    return ret;
+}
+
+sp<AllocatedFrame> ExternalCameraDeviceSession::OutputThread::acquireYu12Frame() {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mYu12FramesLock);
+    std::chrono::seconds timeout = std::chrono::seconds(kYu12FrameWaitTimeoutSec);
+    if (!mYu12FrameReturned.wait_for(lk, timeout, [this] { return !mFreeYu12Frames.empty(); })) {
+        ALOGE("%s: wait for YU12 frame return timeout!", __FUNCTION__);
+        return nullptr;
+    }
+    sp<AllocatedFrame> frame = mFreeYu12Frames.front();
+    mFreeYu12Frames.pop_front();
+    return frame;
+}
+
+void ExternalCameraDeviceSession::OutputThread::releaseYu12Frame(
+        const sp<AllocatedFrame>& frame) {
+    std::unique_lock<std::mutex> lk(mYu12FramesLock);
+    mFreeYu12Frames.push_back(frame);
+    lk.unlock();
+    mYu12FrameReturned.notify_one();
+}
+
+Status ExternalCameraDeviceSession::OutputThread::dispatchResult(
+        std::shared_ptr<HalRequest>& req, const sp<AllocatedFrame>& yu12Frame,
+        bool requestError) {
+    // Only OutputThread submits to the encode stage, so an idle encode stage cannot have a
+    // result ordered before this one.
+    if (mJpegEncodeThread != nullptr &&
+            (yu12Frame != nullptr || !mJpegEncodeThread->isIdle())) {
+        mJpegEncodeThread->submit({req, yu12Frame, requestError});
+        return Status::OK;
+    }
+
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       return Status::INTERNAL_ERROR;
+    }
+    return requestError ? parent->processCaptureRequestError(req) :
+            parent->processCaptureResult(req);
+}
+
+bool ExternalCameraDeviceSession::OutputThread::processEncodeTask(
+        JpegEncodeThread::Task& task) {
+    ATRACE_CALL();
+    std::shared_ptr<HalRequest>& req = task.req;
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       if (task.yu12Frame != nullptr) {
+           releaseYu12Frame(task.yu12Frame);
+       }
+       return false;
+    }
+
+    if (task.yu12Frame != nullptr) {
+        std::unique_lock<std::mutex> lk(mJpegLock);
+        for (auto& halBuf : req->buffers) {
+            if (halBuf.fenceTimeout || halBuf.format != PixelFormat::BLOB) {
+                continue;
+            }
+            int ret = createJpegLocked(task.yu12Frame, halBuf, req->setting);
+            if (ret != 0) {
+                lk.unlock();
+                releaseYu12Frame(task.yu12Frame);
+                ALOGE("%s: createJpegLocked failed with %d", __FUNCTION__, ret);
+                parent->notifyError(req->frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
+                return false;
+            }
+        }
+        lk.unlock();
+        releaseYu12Frame(task.yu12Frame);
+        task.yu12Frame.clear();
+    }
+
+    Status st = task.requestError ? parent->processCaptureRequestError(req) :
+            parent->processCaptureResult(req);
+    if (st != Status::OK) {
+        ALOGE("%s: failed to process capture result!", __FUNCTION__);
+        parent->notifyError(req->frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
+        return false;
+    }
+    return true;
+}
+
+void ExternalCameraDeviceSession::OutputThread::returnLeftoverTasks(
+        std::list<JpegEncodeThread::Task>&& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+    auto parent = mParent.promote();
+    for (auto& task : tasks) {
+        if (task.yu12Frame != nullptr) {
+            releaseYu12Frame(task.yu12Frame);
+        }
+        if (parent != nullptr) {
+            parent->processCaptureRequestError(task.req);
+        }
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::startEncodeThread() {
+    if (mJpegEncodeThread != nullptr) {
+        ALOGE("%s: JPEG encode thread already exists!", __FUNCTION__);
+        return;
+    }
+    mJpegEncodeThread = new JpegEncodeThread(this);
+    mJpegEncodeThread->run("ExtCamJpeg", PRIORITY_DISPLAY);
+    mJpegThumbnailThread = new JpegThumbnailThread();
+    mJpegThumbnailThread->run("ExtCamJpegThumb", PRIORITY_DISPLAY);
+}
+
+void ExternalCameraDeviceSession::OutputThread::stopEncodeThread() {
+    if (mJpegEncodeThread == nullptr) {
+        return;
+    }
+    returnLeftoverTasks(mJpegEncodeThread->waitForIdle());
+    mJpegEncodeThread->requestExit();
+    mJpegEncodeThread->join();
+    mJpegEncodeThread.clear();
+    mJpegThumbnailThread->requestExit();
+    mJpegThumbnailThread->join();
+    mJpegThumbnailThread.clear();
+}
+
+void ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::submit(Task&& task) {
+    std::unique_lock<std::mutex> lk(mLock);
+    mTasks.push_back(std::move(task));
+    lk.unlock();
+    mTaskCond.notify_one();
+}
+
+bool ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::isIdle() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mTasks.empty() && !mProcessingTask;
+}
+
+std::list<ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::Task>
+ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::waitForIdle() {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mLock);
+    auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds(kFlushWaitTimeoutSec);
+    // Poll isRunning() periodically as the thread might exit on device error
+    while ((!mTasks.empty() || mProcessingTask) && isRunning()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            ALOGE("%s: wait for JPEG encode stage idle timeout!", __FUNCTION__);
+            break;
+        }
+        mIdleCond.wait_for(lk, std::chrono::milliseconds(kReqWaitTimeoutMs));
+    }
+    std::list<Task> leftover = std::move(mTasks);
+    mTasks.clear();
+    return leftover;
+}
+
+bool ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::threadLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (mTasks.empty()) {
+        if (exitPending()) {
+            return false;
+        }
+        mTaskCond.wait_for(lk, std::chrono::milliseconds(kReqWaitTimeoutMs));
+    }
+    Task task = std::move(mTasks.front());
+    mTasks.pop_front();
+    mProcessingTask = true;
+    mProcessingFrameNumber = task.req->frameNumber;
+    lk.unlock();
+
+    bool ret = mParent->processEncodeTask(task);
+
+    lk.lock();
+    mProcessingTask = false;
+    mProcessingFrameNumber = 0;
+    lk.unlock();
+    mIdleCond.notify_all();
+    return ret;
+}
+
+void ExternalCameraDeviceSession::OutputThread::JpegEncodeThread::dump(int fd) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mProcessingTask) {
+        dprintf(fd, "JpegEncodeThread processing frame %d\n", mProcessingFrameNumber);
+    } else {
+        dprintf(fd, "JpegEncodeThread not processing any frames\n");
+    }
+    dprintf(fd, "JpegEncodeThread task list contains frame: ");
+    for (const auto& task : mTasks) {
+        dprintf(fd, "%d, ", task.req->frameNumber);
+    }
+    dprintf(fd, "\n");
+}
+
+int ExternalCameraDeviceSession::OutputThread::JpegThumbnailThread::encodeStart(
+        std::function<int()>&& job) {
+    std::unique_lock<std::mutex> lk(mLock);
+    if (mJobPending) {
+        ALOGE("%s: previous thumbnail job is not done!", __FUNCTION__);
+        return -1;
+    }
+    mJob = std::move(job);
+    mJobPending = true;
+    mJobDone = false;
+    lk.unlock();
+    mJobCond.notify_one();
+    return 0;
+}
+
+int ExternalCameraDeviceSession::OutputThread::JpegThumbnailThread::waitForEncodeDone() {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mLock);
+    // No timeout: the job references the caller's stack and must finish before we return
+    mDoneCond.wait(lk, [this] { return mJobDone || !mJobPending; });
+    mJobPending = false;
+    mJobDone = false;
+    mJob = nullptr;
+    return mJobResult;
+}
+
+bool ExternalCameraDeviceSession::OutputThread::JpegThumbnailThread::threadLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (!mJobPending || mJobDone) {
+        if (exitPending()) {
+            return false;
+        }
+        mJobCond.wait_for(lk, std::chrono::milliseconds(kReqWaitTimeoutMs));
+    }
+    std::function<int()> job = mJob;
+    lk.unlock();
+
+    ATRACE_BEGIN("encodeThumbnail");
+    int ret = job();
+    ATRACE_END();
+
+    lk.lock();
+    mJobResult = ret;
+    mJobDone = true;
+    lk.unlock();
+    mDoneCond.notify_one();
+    return true;
+}
+
 Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         const Size& v4lSize, const Size& thumbSize,
         const hidl_vec<Stream>& streams,
         uint32_t blobBufferSize) {
     std::lock_guard<std::mutex> lk(mBufferLock);
-    if (mScaledYu12Frames.size() != 0) {
-        ALOGE("%s: intermediate buffer pool has %zu inflight buffers! (expect 0)",
-                __FUNCTION__, mScaledYu12Frames.size());
+    std::lock_guard<std::mutex> jpegLk(mJpegLock);
+    std::lock_guard<std::mutex> yu12Lk(mYu12FramesLock);
+    if (mFreeYu12Frames.size() != mYu12Frames.size()) {
+        ALOGE("%s: YU12 frame pool has %zu inflight frames! (expect 0)",
+                __FUNCTION__, mYu12Frames.size() - mFreeYu12Frames.size());
         return Status::INTERNAL_ERROR;
     }
 
-    // Allocating intermediate YU12 frame
+    // Allocating intermediate YU12 frames
     if (mYu12Frame == nullptr || mYu12Frame->mWidth != v4lSize.width ||
             mYu12Frame->mHeight != v4lSize.height) {
         mYu12Frame.clear();
-        mYu12Frame = new AllocatedFrame(v4lSize.width, v4lSize.height);
-        int ret = mYu12Frame->allocate(&mYu12FrameLayout);
-        if (ret != 0) {
-            ALOGE("%s: allocating YU12 frame failed!", __FUNCTION__);
-            return Status::INTERNAL_ERROR;
+        mYu12Frames.clear();
+        mFreeYu12Frames.clear();
+        for (size_t i = 0; i < kNumYu12Frames; i++) {
+            sp<AllocatedFrame> frame = new AllocatedFrame(v4lSize.width, v4lSize.height);
+            int ret = frame->allocate(i == 0 ? &mYu12FrameLayout : nullptr);
+            if (ret != 0) {
+                ALOGE("%s: allocating YU12 frame failed!", __FUNCTION__);
+                mYu12Frames.clear();
+                mFreeYu12Frames.clear();
+                return Status::INTERNAL_ERROR;
+            }
+            mYu12Frames.push_back(frame);
+            mFreeYu12Frames.push_back(frame);
         }
+        mYu12Frame = mYu12Frames[0];
     }
 
     // Allocating intermediate YU12 thumbnail frame
@@ -1633,42 +2149,27 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         }
     }
 
-    // Allocating scaled buffers
+    // Allocating scaled buffers, one per configured size. BLOB streams get their own buffers
+    // as they are scaled by the JPEG encode stage concurrently with the YUV outputs of the
+    // next frame.
+    std::vector<Size> scaledSizes;
+    std::vector<Size> jpegScaledSizes;
     for (const auto& stream : streams) {
         Size sz = {stream.width, stream.height};
         if (sz == v4lSize) {
             continue; // Don't need an intermediate buffer same size as v4lBuffer
         }
-        if (mIntermediateBuffers.count(sz) == 0) {
-            // Create new intermediate buffer
-            sp<AllocatedFrame> buf = new AllocatedFrame(stream.width, stream.height);
-            int ret = buf->allocate();
-            if (ret != 0) {
-                ALOGE("%s: allocating intermediate YU12 frame %dx%d failed!",
-                            __FUNCTION__, stream.width, stream.height);
-                return Status::INTERNAL_ERROR;
-            }
-            mIntermediateBuffers[sz] = buf;
+        auto& sizes = (stream.format == PixelFormat::BLOB) ? jpegScaledSizes : scaledSizes;
+        if (std::find(sizes.begin(), sizes.end(), sz) == sizes.end()) {
+            sizes.push_back(sz);
         }
     }
-
-    // Remove unconfigured buffers
-    auto it = mIntermediateBuffers.begin();
-    while (it != mIntermediateBuffers.end()) {
-        bool configured = false;
-        auto sz = it->first;
-        for (const auto& stream : streams) {
-            if (stream.width == sz.width && stream.height == sz.height) {
-                configured = true;
-                break;
-            }
-        }
-        if (configured) {
-            it++;
-        } else {
-            it = mIntermediateBuffers.erase(it);
-        }
+    if (mIntermediateFrames.reserve(scaledSizes) != 0 ||
+            mJpegIntermediateFrames.reserve(jpegScaledSizes) != 0) {
+        ALOGE("%s: allocating intermediate YU12 frames failed!", __FUNCTION__);
+        return Status::INTERNAL_ERROR;
     }
+    mNoDirectDecodeStreams.clear();
 
     mBlobBufferSize = blobBufferSize;
     return Status::OK;
@@ -1676,9 +2177,14 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
 
 void ExternalCameraDeviceSession::OutputThread::clearIntermediateBuffers() {
     std::lock_guard<std::mutex> lk(mBufferLock);
+    std::lock_guard<std::mutex> jpegLk(mJpegLock);
+    std::lock_guard<std::mutex> yu12Lk(mYu12FramesLock);
     mYu12Frame.clear();
+    mYu12Frames.clear();
+    mFreeYu12Frames.clear();
     mYu12ThumbFrame.clear();
-    mIntermediateBuffers.clear();
+    mIntermediateFrames.clear();
+    mJpegIntermediateFrames.clear();
     mBlobBufferSize = 0;
 }
 
@@ -1712,6 +2218,10 @@ void ExternalCameraDeviceSession::OutputThread::flush() {
 
     ALOGV("%s: flusing inflight requests", __FUNCTION__);
     lk.unlock();
+    // Requests already handed to the JPEG encode stage are returned normally
+    if (mJpegEncodeThread != nullptr) {
+        returnLeftoverTasks(mJpegEncodeThread->waitForIdle());
+    }
     for (const auto& req : reqs) {
         parent->processCaptureRequestError(req);
     }
@@ -1738,6 +2248,9 @@ ExternalCameraDeviceSession::OutputThread::switchToOffline() {
         }
     }
     lk.unlock();
+    if (mJpegEncodeThread != nullptr) {
+        returnLeftoverTasks(mJpegEncodeThread->waitForIdle());
+    }
     clearIntermediateBuffers();
     ALOGV("%s: returning %zu request for offline processing", __FUNCTION__, reqs.size());
     return reqs;
@@ -1782,17 +2295,34 @@ void ExternalCameraDeviceSession::OutputThread::signalRequestDone() {
 }
 
 void ExternalCameraDeviceSession::OutputThread::dump(int fd) {
-    std::lock_guard<std::mutex> lk(mRequestListLock);
-    if (mProcessingRequest) {
-        dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumer);
-    } else {
-        dprintf(fd, "OutputThread not processing any frames\n");
+    {
+        std::lock_guard<std::mutex> lk(mRequestListLock);
+        if (mProcessingRequest) {
+            dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumer);
+        } else {
+            dprintf(fd, "OutputThread not processing any frames\n");
+        }
+        dprintf(fd, "OutputThread request list contains frame: ");
+        for (const auto& req : mRequestList) {
+            dprintf(fd, "%d, ", req->frameNumber);
+        }
+        dprintf(fd, "\n");
+    }
+    {
+        std::lock_guard<std::mutex> bufLk(mBufferLock);
+        dprintf(fd, "Intermediate YU12 frames: %zu (%zu bytes, peak %zu bytes)\n",
+                mIntermediateFrames.numFrames(), mIntermediateFrames.allocatedBytes(),
+                mIntermediateFrames.peakBytes());
     }
-    dprintf(fd, "OutputThread request list contains frame: ");
-    for (const auto& req : mRequestList) {
-        dprintf(fd, "%d, ", req->frameNumber);
+    {
+        std::lock_guard<std::mutex> jpegLk(mJpegLock);
+        dprintf(fd, "Intermediate JPEG YU12 frames: %zu (%zu bytes, peak %zu bytes)\n",
+                mJpegIntermediateFrames.numFrames(), mJpegIntermediateFrames.allocatedBytes(),
+                mJpegIntermediateFrames.peakBytes());
+    }
+    if (mJpegEncodeThread != nullptr) {
+        mJpegEncodeThread->dump(fd);
     }
-    dprintf(fd, "\n");
 }
 
 void ExternalCameraDeviceSession::cleanupBuffersLocked(int id) {
@@ -1883,6 +2413,7 @@ bool ExternalCameraDeviceSession::isSupported(const Stream& stream,
 }
 
 int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
+    stopSensorThreadLocked();
     if (!mV4l2Streaming) {
         return OK;
     }
@@ -2118,27 +2649,151 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
                 __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, fps);
     mV4l2StreamingFmt = v4l2Fmt;
     mV4l2Streaming = true;
+    ret = startSensorThreadLocked();
+    if (ret != OK) {
+        // Without the sensor thread nothing dequeues the buffers: stop streaming
+        v4l2StreamOffLocked();
+        return ret;
+    }
     return OK;
 }
 
-sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs) {
-    ATRACE_CALL();
-    sp<V4L2Frame> ret = nullptr;
-
-    if (shutterTs == nullptr) {
-        ALOGE("%s: shutterTs must not be null!", __FUNCTION__);
+int ExternalCameraDeviceSession::startSensorThreadLocked() {
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mSensorError = false;
+    }
+    mSensorThread = new SensorThread(this);
+    status_t ret = mSensorThread->run("ExtCamSensor", PRIORITY_DISPLAY);
+    if (ret != OK) {
+        ALOGE("%s: failed to start sensor thread: %d", __FUNCTION__, ret);
+        mSensorThread.clear();
         return ret;
     }
+    return OK;
+}
+
+void ExternalCameraDeviceSession::stopSensorThreadLocked() {
+    if (mSensorThread == nullptr) {
+        return;
+    }
+    mSensorThread->requestExit();
+    mV4L2BufferReturned.notify_all();
+    mSensorThread->join();
+    mSensorThread.clear();
 
+    std::deque<SensorFrame> frames;
     {
-        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
-        if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
-            int waitRet = waitForV4L2BufferReturnLocked(lk);
-            if (waitRet != 0) {
-                return ret;
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        frames.swap(mSensorFrames);
+    }
+    for (const auto& sensorFrame : frames) {
+        enqueueV4l2Frame(sensorFrame.frame);
+    }
+}
+
+bool ExternalCameraDeviceSession::SensorThread::threadLoop() {
+    ExternalCameraDeviceSession* parent = mParent;
+    sp<V4L2Frame> recycledFrame;
+    {
+        std::unique_lock<std::mutex> lk(parent->mV4l2BufferLock);
+        if (parent->mNumDequeuedV4l2Buffers == parent->mV4L2BufferCount) {
+            if (parent->mSensorFrames.empty()) {
+                // All buffers are held by the output pipeline. Wait for one to come back.
+                parent->mV4L2BufferReturned.wait_for(
+                        lk, std::chrono::milliseconds(kSensorPollTimeoutMs));
+                return true;
             }
+            // Keep at least one buffer queued in the driver so newer frames keep coming
+            recycledFrame = parent->mSensorFrames.front().frame;
+            parent->mSensorFrames.pop_front();
+            parent->mNumDroppedV4l2Frames++;
+        }
+    }
+    if (recycledFrame != nullptr) {
+        parent->enqueueV4l2Frame(recycledFrame);
+    }
+
+    // Poll with a timeout instead of blocking in VIDIOC_DQBUF so exit requests are honored
+    // even if the device stops producing frames.
+    struct pollfd pfd = {.fd = parent->mV4l2Fd.get(), .events = POLLIN};
+    int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, kSensorPollTimeoutMs));
+    if (ret == 0) {
+        return true;
+    }
+
+    nsecs_t shutterTs = 0;
+    sp<V4L2Frame> frame = (ret > 0) ? parent->dequeueV4l2Frame(&shutterTs) : nullptr;
+    if (frame == nullptr) {
+        ALOGE("%s: V4L2 deque frame failed!", __FUNCTION__);
+        {
+            std::lock_guard<std::mutex> lk(parent->mV4l2BufferLock);
+            parent->mSensorError = true;
+        }
+        parent->mSensorFrameReady.notify_all();
+        return false;
+    }
+
+    sp<V4L2Frame> droppedFrame;
+    {
+        std::lock_guard<std::mutex> lk(parent->mV4l2BufferLock);
+        parent->mSensorFrames.push_back({frame, shutterTs});
+        if (parent->mSensorFrames.size() > kMaxSensorFrames) {
+            droppedFrame = parent->mSensorFrames.front().frame;
+            parent->mSensorFrames.pop_front();
+            parent->mNumDroppedV4l2Frames++;
         }
     }
+    parent->mSensorFrameReady.notify_one();
+    if (droppedFrame != nullptr) {
+        parent->enqueueV4l2Frame(droppedFrame);
+    }
+    return true;
+}
+
+sp<V4L2Frame> ExternalCameraDeviceSession::acquireLatestV4l2FrameLocked(
+        /*out*/nsecs_t* shutterTs) {
+    ATRACE_CALL();
+    if (mSensorThread == nullptr) {
+        ALOGE("%s: V4L2 sensor thread is not running!", __FUNCTION__);
+        return nullptr;
+    }
+
+    SensorFrame latest;
+    std::deque<SensorFrame> staleFrames;
+    {
+        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+        std::chrono::seconds timeout = std::chrono::seconds(kBufferWaitTimeoutSec);
+        bool ready = mSensorFrameReady.wait_for(lk, timeout,
+                [this] { return !mSensorFrames.empty() || mSensorError; });
+        if (!ready) {
+            ALOGE("%s: wait for V4L2 frame timeout!", __FUNCTION__);
+            return nullptr;
+        }
+        if (mSensorFrames.empty()) {
+            ALOGE("%s: V4L2 sensor thread stopped on error!", __FUNCTION__);
+            return nullptr;
+        }
+        latest = mSensorFrames.back();
+        mSensorFrames.pop_back();
+        staleFrames.swap(mSensorFrames);
+        mNumStaleV4l2Frames += staleFrames.size();
+    }
+    for (const auto& sensorFrame : staleFrames) {
+        enqueueV4l2Frame(sensorFrame.frame);
+    }
+    *shutterTs = latest.shutterTs;
+    return latest.frame;
+}
+
+sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2Frame(/*out*/nsecs_t* shutterTs) {
+    ATRACE_CALL();
+    sp<V4L2Frame> ret = nullptr;
+
+    if (shutterTs == nullptr) {
+        ALOGE("%s: shutterTs must not be null!", __FUNCTION__);
+        return ret;
+    }
 
     ATRACE_BEGIN("VIDIOC_DQBUF");
     v4l2_buffer buffer{};
@@ -2203,7 +2858,7 @@ void ExternalCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         mNumDequeuedV4l2Buffers--;
     }
-    mV4L2BufferReturned.notify_one();
+    mV4L2BufferReturned.notify_all();
 }
 
 Status ExternalCameraDeviceSession::isStreamCombinationSupported(
@@ -17,6 +17,7 @@
 //#define LOG_NDEBUG 0
 #include <log/log.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <sys/mman.h>
@@ -27,12 +28,54 @@
 
 #include <jpeglib.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ExternalCameraUtils.h"
 
 namespace {
 
 buffer_handle_t sEmptyBuffer = nullptr;
 
+// Write one row of planar chroma samples to a destination where consecutive samples are
+// |step| bytes apart. Bytes in between samples belong to other planes and are preserved.
+void scatterChromaRow(const uint8_t* src, uint8_t* dst, uint32_t width, int step) {
+    uint32_t i = 0;
+#if defined(__ARM_NEON)
+    if (step == 2) {
+        // Strict bound so the de-interleaving load never reads past the last sample
+        for (; i + 16 < width; i += 16) {
+            uint8x16x2_t d = vld2q_u8(dst + 2 * i);
+            d.val[0] = vld1q_u8(src + i);
+            vst2q_u8(dst + 2 * i, d);
+        }
+    }
+#elif defined(__SSE2__)
+    if (step == 2) {
+        const __m128i kOddBytes = _mm_set1_epi16(static_cast<int16_t>(0xFF00));
+        const __m128i kZero = _mm_setzero_si128();
+        for (; i + 8 < width; i += 8) {
+            __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + 2 * i));
+            d = _mm_or_si128(_mm_and_si128(d, kOddBytes), _mm_unpacklo_epi8(s, kZero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), d);
+        }
+    }
+#endif
+    for (; i + 4 <= width; i += 4) {
+        dst[i * step] = src[i];
+        dst[(i + 1) * step] = src[i + 1];
+        dst[(i + 2) * step] = src[i + 2];
+        dst[(i + 3) * step] = src[i + 3];
+    }
+    for (; i < width; i++) {
+        dst[i * step] = src[i];
+    }
+}
+
 } // Anonymous namespace
 
 namespace android {
@@ -170,6 +213,70 @@ int AllocatedFrame::getCroppedLayout(const IMapper::Rect& rect, YCbCrLayout* out
     return 0;
 }
 
+int IntermediateFrameArena::reserve(const std::vector<Size>& sizes) {
+    auto isRequested = [&sizes](const Size& sz) {
+        for (const auto& s : sizes) {
+            if (s == sz) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Free unused frames first to keep the peak footprint down
+    auto it = mSlots.begin();
+    while (it != mSlots.end()) {
+        if (isRequested(it->first)) {
+            it++;
+        } else {
+            mAllocatedBytes -= it->first.width * it->first.height * 3 / 2;
+            it = mSlots.erase(it);
+        }
+    }
+
+    for (const auto& sz : sizes) {
+        if (mSlots.count(sz) != 0) {
+            continue;
+        }
+        Slot slot;
+        slot.frame = new AllocatedFrame(sz.width, sz.height);
+        slot.scaledGeneration = 0;
+        int ret = slot.frame->allocate(&slot.layout);
+        if (ret != 0) {
+            ALOGE("%s: allocating intermediate YU12 frame %dx%d failed!",
+                    __FUNCTION__, sz.width, sz.height);
+            return ret;
+        }
+        mSlots.emplace(sz, slot);
+        mAllocatedBytes += sz.width * sz.height * 3 / 2;
+        mPeakBytes = std::max(mPeakBytes, mAllocatedBytes);
+    }
+    return 0;
+}
+
+void IntermediateFrameArena::clear() {
+    mSlots.clear();
+    mAllocatedBytes = 0;
+}
+
+sp<AllocatedFrame> IntermediateFrameArena::get(
+        const Size& sz, /*out*/YCbCrLayout* layout, /*out*/bool* scaled) {
+    auto it = mSlots.find(sz);
+    if (it == mSlots.end()) {
+        return nullptr;
+    }
+    *layout = it->second.layout;
+    *scaled = (it->second.scaledGeneration == mGeneration);
+    return it->second.frame;
+}
+
+void IntermediateFrameArena::markScaled(const Size& sz) {
+    auto it = mSlots.find(sz);
+    if (it != mSlots.end()) {
+        it->second.scaledGeneration = mGeneration;
+    }
+}
+
 bool isAspectRatioClose(float ar1, float ar2) {
     const float kAspectRatioMatchThres = 0.025f; // This threshold is good enough to distinguish
                                                 // 4:3/16:9/20:9
@@ -368,13 +475,34 @@ int formatConvert(
                 return ret;
             }
             break;
-        case FLEX_YUV_GENERIC:
-            // TODO: b/72261744 write to arbitrary flexible YUV layout. Slow.
-            ALOGE("%s: unsupported flexible yuv layout"
-                    " y %p cb %p cr %p y_str %d c_str %d c_step %d",
-                    __FUNCTION__, out.y, out.cb, out.cr,
-                    out.yStride, out.cStride, out.chromaStep);
-            return -1;
+        case FLEX_YUV_GENERIC: {
+            if (out.chromaStep < 1) {
+                ALOGE("%s: unsupported flexible yuv layout"
+                        " y %p cb %p cr %p y_str %d c_str %d c_step %d",
+                        __FUNCTION__, out.y, out.cb, out.cr,
+                        out.yStride, out.cStride, out.chromaStep);
+                return -1;
+            }
+            libyuv::CopyPlane(
+                    static_cast<uint8_t*>(in.y),
+                    in.yStride,
+                    static_cast<uint8_t*>(out.y),
+                    out.yStride,
+                    sz.width,
+                    sz.height);
+            uint32_t chromaWidth = (sz.width + 1) / 2;
+            uint32_t chromaHeight = (sz.height + 1) / 2;
+            for (uint32_t row = 0; row < chromaHeight; row++) {
+                scatterChromaRow(
+                        static_cast<uint8_t*>(in.cb) + row * in.cStride,
+                        static_cast<uint8_t*>(out.cb) + row * out.cStride,
+                        chromaWidth, out.chromaStep);
+                scatterChromaRow(
+                        static_cast<uint8_t*>(in.cr) + row * in.cStride,
+                        static_cast<uint8_t*>(out.cr) + row * out.cStride,
+                        chromaWidth, out.chromaStep);
+            }
+        } break;
         default:
             ALOGE("%s: unknown YUV format 0x%x!", __FUNCTION__, format);
             return -1;
@@ -382,11 +510,7 @@ int formatConvert(
     return 0;
 }
 
-int encodeJpegYU12(
-        const Size & inSz, const YCbCrLayout& inLayout,
-        int jpegQuality, const void *app1Buffer, size_t app1Size,
-        void *out, const size_t maxOutSize, size_t &actualCodeSize)
-{
+struct JpegEncoder::Context {
     /* libjpeg is a C library so we use C-style "inheritance" by
      * putting libjpeg's jpeg_destination_mgr first in our custom
      * struct. This allows us to cast jpeg_destination_mgr* to
@@ -402,11 +526,27 @@ int encodeJpegYU12(
     jpeg_compress_struct cinfo = {};
     jpeg_error_mgr jerr;
 
+    // Quality the current quantization tables are computed for
+    int jpegQuality = -1;
+    int maxVSampFactor = 1;
+    int cVSubSampling = 1;
+
+    /* libjpeg uses arrays of row pointers, which makes it really easy to pad
+     * data vertically (unfortunately doesn't help horizontally) */
+    std::vector<JSAMPROW> yLines;
+    std::vector<JSAMPROW> cbLines;
+    std::vector<JSAMPROW> crLines;
+};
+
+JpegEncoder::JpegEncoder() : mContext(std::make_unique<Context>()) {
+    jpeg_compress_struct& cinfo = mContext->cinfo;
+    Context::CustomJpegDestMgr& dmgr = mContext->dmgr;
+
     /* Initialize error handling with standard callbacks, but
      * then override output_message (to print to ALOG) and
      * error_exit to set a flag and print a message instead
      * of killing the whole process */
-    cinfo.err = jpeg_std_error(&jerr);
+    cinfo.err = jpeg_std_error(&mContext->jerr);
 
     cinfo.err->output_message = [](j_common_ptr cinfo) {
         char buffer[JMSG_LENGTH_MAX];
@@ -419,7 +559,7 @@ int encodeJpegYU12(
         (*cinfo->err->output_message)(cinfo);
         if(cinfo->client_data) {
             auto & dmgr =
-                *reinterpret_cast<CustomJpegDestMgr*>(cinfo->client_data);
+                *reinterpret_cast<Context::CustomJpegDestMgr*>(cinfo->client_data);
             dmgr.mSuccess = false;
         }
     };
@@ -427,8 +567,8 @@ int encodeJpegYU12(
     jpeg_create_compress(&cinfo);
 
     /* Initialize our destination manager */
-    dmgr.mBuffer = static_cast<JOCTET*>(out);
-    dmgr.mBufferSize = maxOutSize;
+    dmgr.mBuffer = nullptr;
+    dmgr.mBufferSize = 0;
     dmgr.mEncodedSize = 0;
     dmgr.mSuccess = true;
     cinfo.client_data = static_cast<void*>(&dmgr);
@@ -436,7 +576,7 @@ int encodeJpegYU12(
     /* These lambdas become C-style function pointers and as per C++11 spec
      * may not capture anything */
     dmgr.mgr.init_destination = [](j_compress_ptr cinfo) {
-        auto & dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+        auto & dmgr = reinterpret_cast<Context::CustomJpegDestMgr&>(*cinfo->dest);
         dmgr.mgr.next_output_byte = dmgr.mBuffer;
         dmgr.mgr.free_in_buffer = dmgr.mBufferSize;
         ALOGV("%s:%d jpeg start: %p [%zu]",
@@ -449,7 +589,7 @@ int encodeJpegYU12(
     };
 
     dmgr.mgr.term_destination = [](j_compress_ptr cinfo) {
-        auto & dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+        auto & dmgr = reinterpret_cast<Context::CustomJpegDestMgr&>(*cinfo->dest);
         dmgr.mEncodedSize = dmgr.mBufferSize - dmgr.mgr.free_in_buffer;
         ALOGV("%s:%d Done with jpeg: %zu", __FUNCTION__, __LINE__, dmgr.mEncodedSize);
     };
@@ -458,15 +598,13 @@ int encodeJpegYU12(
     /* We are going to be using JPEG in raw data mode, so we are passing
      * straight subsampled planar YCbCr and it will not touch our pixel
      * data or do any scaling or anything */
-    cinfo.image_width = inSz.width;
-    cinfo.image_height = inSz.height;
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_YCbCr;
 
-    /* Initialize defaults and then override what we want */
+    /* Initialize defaults and then override what we want. Parameters persist
+     * across images compressed with the same object, so this is done once */
     jpeg_set_defaults(&cinfo);
 
-    jpeg_set_quality(&cinfo, jpegQuality, 1);
     jpeg_set_colorspace(&cinfo, JCS_YCbCr);
     cinfo.raw_data_in = 1;
     cinfo.dct_method = JDCT_IFAST;
@@ -483,13 +621,42 @@ int encodeJpegYU12(
     cinfo.comp_info[2].v_samp_factor = 1;
 
     /* Let's not hardcode YUV420 in 6 places... 5 was enough */
-    int maxVSampFactor = std::max( {
+    mContext->maxVSampFactor = std::max( {
         cinfo.comp_info[0].v_samp_factor,
         cinfo.comp_info[1].v_samp_factor,
         cinfo.comp_info[2].v_samp_factor
     });
-    int cVSubSampling = cinfo.comp_info[0].v_samp_factor /
-                        cinfo.comp_info[1].v_samp_factor;
+    mContext->cVSubSampling = cinfo.comp_info[0].v_samp_factor /
+                              cinfo.comp_info[1].v_samp_factor;
+}
+
+JpegEncoder::~JpegEncoder() {
+    jpeg_destroy_compress(&mContext->cinfo);
+}
+
+int JpegEncoder::encode(
+        const Size & inSz, const YCbCrLayout& inLayout,
+        int jpegQuality, const void *app1Buffer, size_t app1Size,
+        void *out, const size_t maxOutSize, size_t &actualCodeSize)
+{
+    jpeg_compress_struct& cinfo = mContext->cinfo;
+    Context::CustomJpegDestMgr& dmgr = mContext->dmgr;
+    const int maxVSampFactor = mContext->maxVSampFactor;
+    const int cVSubSampling = mContext->cVSubSampling;
+
+    dmgr.mBuffer = static_cast<JOCTET*>(out);
+    dmgr.mBufferSize = maxOutSize;
+    dmgr.mEncodedSize = 0;
+    dmgr.mSuccess = true;
+
+    cinfo.image_width = inSz.width;
+    cinfo.image_height = inSz.height;
+
+    /* Quantization tables only need to be rebuilt when quality changes */
+    if (jpegQuality != mContext->jpegQuality) {
+        jpeg_set_quality(&cinfo, jpegQuality, 1);
+        mContext->jpegQuality = jpegQuality;
+    }
 
     /* Start the compressor */
     jpeg_start_compress(&cinfo, TRUE);
@@ -501,11 +668,13 @@ int encodeJpegYU12(
     size_t mcuV = DCTSIZE*maxVSampFactor;
     size_t paddedHeight = mcuV * ((inSz.height + mcuV - 1) / mcuV);
 
-    /* libjpeg uses arrays of row pointers, which makes it really easy to pad
-     * data vertically (unfortunately doesn't help horizontally) */
-    std::vector<JSAMPROW> yLines (paddedHeight);
-    std::vector<JSAMPROW> cbLines(paddedHeight/cVSubSampling);
-    std::vector<JSAMPROW> crLines(paddedHeight/cVSubSampling);
+    /* Row pointer arrays keep their capacity across encodes */
+    std::vector<JSAMPROW>& yLines = mContext->yLines;
+    std::vector<JSAMPROW>& cbLines = mContext->cbLines;
+    std::vector<JSAMPROW>& crLines = mContext->crLines;
+    yLines.resize(paddedHeight);
+    cbLines.resize(paddedHeight/cVSubSampling);
+    crLines.resize(paddedHeight/cVSubSampling);
 
     uint8_t *py = static_cast<uint8_t*>(inLayout.y);
     uint8_t *pcr = static_cast<uint8_t*>(inLayout.cr);
@@ -547,6 +716,8 @@ int encodeJpegYU12(
             ALOGE("%s: compressed %u lines, expected %u (total %u/%u)",
               __FUNCTION__, done, batchSize, cinfo.next_scanline,
               cinfo.image_height);
+            /* Reset the compressor so it can be reused for the next image */
+            jpeg_abort_compress(&cinfo);
             return -1;
         }
     }
@@ -554,12 +725,27 @@ int encodeJpegYU12(
     /* This will flush everything */
     jpeg_finish_compress(&cinfo);
 
+    if (!dmgr.mSuccess) {
+        jpeg_abort_compress(&cinfo);
+        return -1;
+    }
+
     /* Grab the actual code size and set it */
     actualCodeSize = dmgr.mEncodedSize;
 
     return 0;
 }
 
+int encodeJpegYU12(
+        const Size & inSz, const YCbCrLayout& inLayout,
+        int jpegQuality, const void *app1Buffer, size_t app1Size,
+        void *out, const size_t maxOutSize, size_t &actualCodeSize)
+{
+    JpegEncoder encoder;
+    return encoder.encode(inSz, inLayout, jpegQuality, app1Buffer, app1Size,
+            out, maxOutSize, actualCodeSize);
+}
+
 Size getMaxThumbnailResolution(const common::V1_0::helper::CameraMetadata& chars) {
     Size thumbSize { 0, 0 };
     camera_metadata_ro_entry entry =
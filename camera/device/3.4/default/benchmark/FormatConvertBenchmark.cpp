@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/videodev2.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ExternalCameraUtils.h"
+
+using ::android::sp;
+using ::android::hardware::camera::device::V3_4::implementation::AllocatedFrame;
+using ::android::hardware::camera::device::V3_4::implementation::FLEX_YUV_GENERIC;
+using ::android::hardware::camera::device::V3_4::implementation::formatConvert;
+using ::android::hardware::camera::external::common::Size;
+
+namespace {
+
+// Destination layouts exercised by formatConvert. kFlexStep2/kFlexStep4 place Cb and Cr in
+// separate planes with an interleaving step, which getFourCcFromLayout reports as
+// FLEX_YUV_GENERIC.
+enum class OutLayout { kNv12, kNv21, kFlexStep2, kFlexStep4 };
+
+struct OutBuffer {
+    std::vector<uint8_t> data;
+    YCbCrLayout layout;
+    uint32_t fourcc;
+};
+
+OutBuffer makeOutBuffer(OutLayout type, const Size& sz) {
+    OutBuffer buf;
+    uint32_t chromaW = (sz.width + 1) / 2;
+    uint32_t chromaH = (sz.height + 1) / 2;
+    uint32_t ySize = sz.width * sz.height;
+    switch (type) {
+        case OutLayout::kNv12:
+        case OutLayout::kNv21: {
+            buf.data.resize(ySize + chromaW * 2 * chromaH);
+            uint8_t* uv = buf.data.data() + ySize;
+            bool nv12 = type == OutLayout::kNv12;
+            buf.layout = {buf.data.data(), nv12 ? uv : uv + 1, nv12 ? uv + 1 : uv,
+                          sz.width, chromaW * 2, 2};
+            buf.fourcc = nv12 ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_NV21;
+        } break;
+        case OutLayout::kFlexStep2:
+        case OutLayout::kFlexStep4: {
+            uint32_t step = (type == OutLayout::kFlexStep2) ? 2 : 4;
+            uint32_t planeSize = chromaW * step * chromaH;
+            buf.data.resize(ySize + planeSize * 2);
+            uint8_t* cb = buf.data.data() + ySize;
+            buf.layout = {buf.data.data(), cb, cb + planeSize, sz.width, chromaW * step, step};
+            buf.fourcc = FLEX_YUV_GENERIC;
+        } break;
+    }
+    return buf;
+}
+
+void BM_FormatConvert(benchmark::State& state, OutLayout type) {
+    Size sz{static_cast<uint32_t>(state.range(0)), static_cast<uint32_t>(state.range(1))};
+    sp<AllocatedFrame> in = new AllocatedFrame(sz.width, sz.height);
+    YCbCrLayout inLayout;
+    if (in->allocate(&inLayout) != 0) {
+        state.SkipWithError("Failed to allocate input frame");
+        return;
+    }
+    OutBuffer out = makeOutBuffer(type, sz);
+
+    for (auto _ : state) {
+        if (formatConvert(inLayout, out.layout, sz, out.fourcc) != 0) {
+            state.SkipWithError("formatConvert failed");
+            return;
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * sz.width * sz.height * 3 / 2);
+}
+
+void ResolutionArgs(benchmark::internal::Benchmark* b) {
+    b->Args({640, 480})->Args({1280, 720})->Args({1920, 1080});
+}
+
+BENCHMARK_CAPTURE(BM_FormatConvert, NV12, OutLayout::kNv12)->Apply(ResolutionArgs);
+BENCHMARK_CAPTURE(BM_FormatConvert, NV21, OutLayout::kNv21)->Apply(ResolutionArgs);
+BENCHMARK_CAPTURE(BM_FormatConvert, FlexStep2, OutLayout::kFlexStep2)->Apply(ResolutionArgs);
+BENCHMARK_CAPTURE(BM_FormatConvert, FlexStep4, OutLayout::kFlexStep4)->Apply(ResolutionArgs);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -25,6 +25,8 @@
 #include <include/convert.h>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <list>
 #include <unordered_map>
 #include <unordered_set>
@@ -126,6 +128,11 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         void dump(int fd);
         virtual bool threadLoop() override;
 
+        // Start/stop the JPEG encode stage of the output pipeline. When the encode stage is
+        // not running, BLOB outputs are encoded inline in threadLoop.
+        void startEncodeThread();
+        void stopEncodeThread();
+
         void setExifMakeModel(const std::string& make, const std::string& model);
 
         // The remaining request list is returned for offline processing
@@ -141,21 +148,123 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         static const int kFlushWaitTimeoutSec = 3; // 3 sec
         static const int kReqWaitTimeoutMs = 33;   // 33ms
         static const int kReqWaitTimesMax = 90;    // 33ms * 90 ~= 3 sec
+        static const int kYu12FrameWaitTimeoutSec = 3; // 3 sec
+        // Number of decoded YU12 frames that can be in flight in the output pipeline:
+        // one being decoded/converted by OutputThread and one being JPEG encoded
+        static const size_t kNumYu12Frames = 2;
+
+        // Second stage of the output pipeline. Requests handed over by OutputThread after
+        // decode and YUV conversion are JPEG encoded here and returned to the parent in
+        // submission order, so the next frame can be decoded while this one is encoding.
+        class JpegEncodeThread : public android::Thread {
+        public:
+            struct Task {
+                std::shared_ptr<HalRequest> req;
+                sp<AllocatedFrame> yu12Frame; // nullptr if there is nothing to encode
+                bool requestError;            // return the request with ERROR_REQUEST
+            };
+
+            explicit JpegEncodeThread(OutputThread* parent) : mParent(parent) {}
+            virtual ~JpegEncodeThread() {}
+
+            void submit(Task&& task);
+            // True if no task is queued or being processed
+            bool isIdle();
+            // Wait until all submitted tasks are processed. Tasks that could not be processed
+            // before timeout (or after the thread exited) are returned to the caller.
+            std::list<Task> waitForIdle();
+            void dump(int fd);
+            virtual bool threadLoop() override;
+
+        private:
+            OutputThread* const mParent; // owns this thread and joins it before destruction
+
+            std::mutex mLock; // Protect access to all members below
+            std::condition_variable mTaskCond; // signaled when a new task is submitted
+            std::condition_variable mIdleCond; // signaled when a task is done processing
+            std::list<Task> mTasks;
+            bool mProcessingTask = false;
+            uint32_t mProcessingFrameNumber = 0;
+        };
+
+        // Runs the thumbnail encode and EXIF generation of a BLOB output concurrently with
+        // the main image encode.
+        class JpegThumbnailThread : public android::Thread {
+        public:
+            JpegThumbnailThread() {}
+            virtual ~JpegThumbnailThread() {}
+
+            // Job and everything it references must stay valid until waitForEncodeDone
+            // returns.
+            int encodeStart(std::function<int()>&& job);
+            int waitForEncodeDone();
+            virtual bool threadLoop() override;
+
+        private:
+            std::mutex mLock; // Protect access to all members below
+            std::condition_variable mJobCond;  // signaled when a new job is submitted
+            std::condition_variable mDoneCond; // signaled when a job is done
+            std::function<int()> mJob;
+            bool mJobPending = false;
+            bool mJobDone = false;
+            int mJobResult = 0;
+        };
 
         void waitForNextRequest(std::shared_ptr<HalRequest>* out);
         void signalRequestDone();
 
+        // Wait for the acquire fence of an output buffer. Returns false and marks the buffer
+        // as fenceTimeout if the buffer cannot be written to.
+        bool waitForBufferFence(HalStreamBuffer& halBuf);
+
+        // Returns the index of the output buffer the V4L2 frame can be decoded into directly,
+        // or -1 if the request needs the intermediate YU12 frame.
+        ssize_t getDirectDecodeBufferIndexLocked(const HalRequest& req, const Size& v4lSize);
+
+        // Decode the MJPEG frame into the output buffer. Returns -EAGAIN if the buffer
+        // layout cannot be decoded into directly.
+        int decodeMjpegToOutputLocked(uint8_t* inData, size_t inDataSize,
+                HalStreamBuffer& halBuf);
+
+        sp<AllocatedFrame> acquireYu12Frame();
+        void releaseYu12Frame(const sp<AllocatedFrame>& frame);
+
+        // Return the request to parent, or queue it behind the JPEG encode stage if the
+        // encode stage has pending work so that results are returned in order.
+        Status dispatchResult(std::shared_ptr<HalRequest>& req,
+                const sp<AllocatedFrame>& yu12Frame, bool requestError);
+        // Called by the JPEG encode stage. Returns false on device error.
+        bool processEncodeTask(JpegEncodeThread::Task& task);
+        void returnLeftoverTasks(std::list<JpegEncodeThread::Task>&& tasks);
+
         int cropAndScaleLocked(
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
 
+        // Same as cropAndScaleLocked, but scales into mJpegIntermediateFrames.
+        // Caller must hold mJpegLock.
+        int cropAndScaleJpegLocked(
+                sp<AllocatedFrame>& in, const Size& outSize,
+                YCbCrLayout* out);
+
+        // If reuseScaled is set, a frame already scaled from the current source frame is
+        // returned as is instead of being scaled again.
+        int cropAndScaleImpl(
+                sp<AllocatedFrame>& in, const Size& outSize,
+                IntermediateFrameArena& arena, bool reuseScaled,
+                YCbCrLayout* out);
+
         int cropAndScaleThumbLocked(
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
 
+        // Caller must hold mJpegLock
         int createJpegLocked(HalStreamBuffer &halBuf,
                 const common::V1_0::helper::CameraMetadata& settings);
 
+        int createJpegLocked(sp<AllocatedFrame>& in, HalStreamBuffer &halBuf,
+                const common::V1_0::helper::CameraMetadata& settings);
+
         void clearIntermediateBuffers();
 
         const wp<OutputThreadInterface> mParent;
@@ -171,17 +280,38 @@ struct ExternalCameraDeviceSession : public virtual RefBase,
         uint32_t mProcessingFrameNumer = 0;
 
         // V4L2 frameIn
-        // (MJPG decode)-> mYu12Frame
-        // (Scale)-> mScaledYu12Frames
+        // (MJPG decode)-> one of mYu12Frames
+        // (Scale)-> mIntermediateFrames
         // (Format convert) -> output gralloc frames
+        // BLOB outputs are then handed to mJpegEncodeThread together with the decoded frame
+        // (Scale)-> mJpegIntermediateFrames/mYu12ThumbFrame
+        // (JPEG encode) -> output gralloc frames
         mutable std::mutex mBufferLock; // Protect access to intermediate buffers
-        sp<AllocatedFrame> mYu12Frame;
-        sp<AllocatedFrame> mYu12ThumbFrame;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mIntermediateBuffers;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mScaledYu12Frames;
+        sp<AllocatedFrame> mYu12Frame; // Same as mYu12Frames[0]
+        // Invalidated at the start of each request, so outputs of the same size share one
+        // scaled frame
+        IntermediateFrameArena mIntermediateFrames;
         YCbCrLayout mYu12FrameLayout;
+        // Streams whose gralloc layout MJPEG cannot be decoded into directly
+        std::unordered_set<int32_t> mNoDirectDecodeStreams;
+
+        std::mutex mYu12FramesLock; // Protect access to mYu12Frames and mFreeYu12Frames
+        std::condition_variable mYu12FrameReturned;
+        std::vector<sp<AllocatedFrame>> mYu12Frames;
+        std::list<sp<AllocatedFrame>> mFreeYu12Frames;
+
+        mutable std::mutex mJpegLock; // Protect access to JPEG intermediate buffers
+        sp<AllocatedFrame> mYu12ThumbFrame;
+        IntermediateFrameArena mJpegIntermediateFrames;
         YCbCrLayout mYu12ThumbFrameLayout;
         uint32_t mBlobBufferSize = 0; // 0 -> HAL derive buffer size, else: use given size
+        JpegEncoder mJpegEncoder;
+        JpegEncoder mThumbJpegEncoder;
+
+        // Not protected by locks. Set in startEncodeThread before OutputThread is run and
+        // cleared in stopEncodeThread after OutputThread is joined.
+        sp<JpegEncodeThread> mJpegEncodeThread;
+        sp<JpegThumbnailThread> mJpegThumbnailThread;
 
         std::string mExifMake;
         std::string mExifModel;
@@ -269,9 +399,33 @@ protected:
             const std::vector<SupportedV4L2Format>& supportedFormats,
             const ExternalCameraConfig& devCfg);
 
+    // Dequeues V4L2 frames in the background while streaming so the driver queue never fills
+    // up with stale buffers. The newest frames are kept in mSensorFrames for
+    // processOneCaptureRequest to pick up.
+    class SensorThread : public android::Thread {
+    public:
+        explicit SensorThread(ExternalCameraDeviceSession* parent) : mParent(parent) {}
+        virtual ~SensorThread() {}
+
+        virtual bool threadLoop() override;
+
+    private:
+        ExternalCameraDeviceSession* const mParent; // owns this thread and joins it before
+                                                    // destruction
+    };
+
+    // Started at the end of configureV4l2StreamLocked and stopped by v4l2StreamOffLocked.
+    // Stopping the thread also returns all buffered frames to the V4L2 buffer queue.
+    int startSensorThreadLocked();
+    void stopSensorThreadLocked();
+
     // TODO: change to unique_ptr for better tracking
-    sp<V4L2Frame> dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs); // Called with mLock hold
+    // Called from SensorThread only, and only while mV4l2Streaming is true
+    sp<V4L2Frame> dequeueV4l2Frame(/*out*/nsecs_t* shutterTs);
     void enqueueV4l2Frame(const sp<V4L2Frame>&);
+    // Take the newest frame buffered by SensorThread, waiting for one if needed. Older buffered
+    // frames are returned to the V4L2 buffer queue. Called with mLock hold.
+    sp<V4L2Frame> acquireLatestV4l2FrameLocked(/*out*/nsecs_t* shutterTs);
 
     // Check if input Stream is one of supported stream setting on this device
     static bool isSupported(const Stream& stream,
@@ -343,11 +497,29 @@ protected:
     size_t mV4L2BufferCount = 0;
 
     static const int kBufferWaitTimeoutSec = 3; // TODO: handle long exposure (or not allowing)
-    std::mutex mV4l2BufferLock; // protect the buffer count and condition below
+    static const int kSensorPollTimeoutMs = 100;
+    // Number of the newest V4L2 frames SensorThread keeps around for incoming requests
+    static const size_t kMaxSensorFrames = 2;
+    std::mutex mV4l2BufferLock; // protect the buffer count, sensor frames and conditions below
     std::condition_variable mV4L2BufferReturned;
     size_t mNumDequeuedV4l2Buffers = 0;
     uint32_t mMaxV4L2BufferSize = 0;
 
+    struct SensorFrame {
+        sp<V4L2Frame> frame;
+        nsecs_t shutterTs;
+    };
+    std::condition_variable mSensorFrameReady;
+    std::deque<SensorFrame> mSensorFrames; // oldest first, also counted as dequeued buffers
+    bool mSensorError = false;             // SensorThread stopped on a V4L2 error
+    // Frames recycled by SensorThread to keep the driver fed, and older frames skipped by
+    // acquireLatestV4l2FrameLocked in favor of a newer one.
+    uint64_t mNumDroppedV4l2Frames = 0;
+    uint64_t mNumStaleV4l2Frames = 0;
+
+    // Set and cleared with mLock hold
+    sp<SensorThread> mSensorThread;
+
     // Not protected by mLock (but might be used when mLock is locked)
     sp<OutputThread> mOutputThread;
 
@@ -22,6 +22,7 @@
 #include <android/hardware/graphics/common/1.0/types.h>
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <inttypes.h>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
@@ -178,6 +179,42 @@ private:
     std::vector<uint8_t> mData;
 };
 
+// Size keyed pool of AllocatedFrames used as scaling destinations. Frames are allocated by
+// reserve() when streams are configured and reused across requests, so the capture path never
+// allocates. Each frame also records whether it already holds the scaled version of the
+// current source frame, so outputs sharing a size are only scaled once per request.
+// Not thread safe: callers serialize access with their own lock.
+class IntermediateFrameArena {
+public:
+    // Make sure there is exactly one frame for each of the given sizes. Frames of sizes that
+    // are still needed are kept, others are freed before new ones are allocated.
+    int reserve(const std::vector<Size>& sizes);
+    void clear();
+
+    // Returns nullptr if no frame of the given size was reserved. *scaled is set to true if
+    // markScaled() was called for this size since the last invalidateScaled().
+    sp<AllocatedFrame> get(const Size& sz, /*out*/YCbCrLayout* layout, /*out*/bool* scaled);
+    void markScaled(const Size& sz);
+    // Called when the source frame changes
+    void invalidateScaled() { mGeneration++; }
+
+    size_t numFrames() const { return mSlots.size(); }
+    size_t allocatedBytes() const { return mAllocatedBytes; }
+    size_t peakBytes() const { return mPeakBytes; }
+
+private:
+    struct Slot {
+        sp<AllocatedFrame> frame;
+        YCbCrLayout layout;
+        uint64_t scaledGeneration;
+    };
+    std::unordered_map<Size, Slot, SizeHasher> mSlots;
+    // Starts at 1 so that freshly reserved frames (scaledGeneration 0) are never scaled
+    uint64_t mGeneration = 1;
+    size_t mAllocatedBytes = 0;
+    size_t mPeakBytes = 0;
+};
+
 enum CroppingType {
     HORIZONTAL = 0,
     VERTICAL = 1
@@ -242,6 +279,26 @@ int getCropRect(CroppingType ct, const Size& inSize,
 
 int formatConvert(const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32_t format);
 
+// Encodes YU12 frames to JPEG. The libjpeg compressor, its quantization and Huffman tables
+// and the row pointer arrays are set up once and reused across encodes.
+// Not thread safe: use one instance per concurrent encode.
+class JpegEncoder {
+public:
+    JpegEncoder();
+    ~JpegEncoder();
+
+    int encode(const Size &inSz,
+            const YCbCrLayout& inLayout, int jpegQuality,
+            const void *app1Buffer, size_t app1Size,
+            void *out, size_t maxOutSize,
+            size_t &actualCodeSize);
+
+private:
+    struct Context;
+    std::unique_ptr<Context> mContext;
+};
+
+// One-shot version of JpegEncoder::encode
 int encodeJpegYU12(const Size &inSz,
         const YCbCrLayout& inLayout, int jpegQuality,
         const void *app1Buffer, size_t app1Size,
@@ -180,6 +180,7 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
     }
 
     ALOGV("%s processing new request", __FUNCTION__);
+    mIntermediateFrames.invalidateScaled();
     const int kSyncWaitTimeoutMs = 500;
     for (auto& halBuf : req->buffers) {
         if (*(halBuf.bufPtr) == nullptr) {
@@ -202,7 +203,9 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
         // Gralloc lockYCbCr the buffer
         switch (halBuf.format) {
             case PixelFormat::BLOB: {
+                std::unique_lock<std::mutex> jpegLk(mJpegLock);
                 int ret = createJpegLocked(halBuf, req->setting);
+                jpegLk.unlock();
 
                 if(ret != 0) {
                     lk.unlock();
@@ -269,7 +272,6 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
                 return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
         }
     } // for each buffer
-    mScaledYu12Frames.clear();
 
     // Don't hold the lock while calling back to parent
     lk.unlock();
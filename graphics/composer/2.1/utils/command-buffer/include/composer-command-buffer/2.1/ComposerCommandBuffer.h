@@ -54,14 +54,32 @@ using CommandQueueType = MessageQueue<uint32_t, kSynchronizedReadWrite>;
 // units of uint32_t's.
 class CommandWriterBase {
    public:
-    CommandWriterBase(uint32_t initialMaxSize) : mDataMaxSize(initialMaxSize) {
-        mData = std::make_unique<uint32_t[]>(mDataMaxSize);
+    CommandWriterBase(uint32_t initialMaxSize)
+        : mDataBufferSize(initialMaxSize), mInitialQueueSize(initialMaxSize) {
+        mDataBuffer = std::make_unique<uint32_t[]>(mDataBufferSize);
         reset();
     }
 
     virtual ~CommandWriterBase() { reset(); }
 
+    // In direct queue write mode, commands are serialized straight into the message queue
+    // instead of being built in a private buffer and copied into the queue by writeQueue().
+    // The queue is replaced by one twice as large at the start of a frame once the previous
+    // frame used more than half of it, so it grows ahead of need. A frame that still does not
+    // fit falls back to the private buffer. Must be called before any command is written.
+    void setDirectQueueWrite(bool enabled) {
+        if (mDataWritten) {
+            LOG_FATAL("setDirectQueueWrite called with pending commands");
+            return;
+        }
+        mDirectQueueWrite = enabled;
+    }
+
     void reset() {
+        // Commands not yet committed to the queue are simply abandoned
+        mData = mDataBuffer.get();
+        mDataMaxSize = mDataBufferSize;
+        mWritingToQueue = false;
         mDataWritten = 0;
         mCommandEnd = 0;
 
@@ -91,41 +109,45 @@ class CommandWriterBase {
             return true;
         }
 
-        // After data are written to the queue, it may not be read by the
-        // remote reader when
-        //
-        //  - the writer does not send them (because of other errors)
-        //  - the hwbinder transaction fails
-        //  - the reader does not read them (because of other errors)
-        //
-        // Discard the stale data here.
-        size_t staleDataSize = mQueue ? mQueue->availableToRead() : 0;
-        if (staleDataSize > 0) {
-            ALOGW("discarding stale data from message queue");
-            CommandQueueType::MemTransaction tx;
-            if (mQueue->beginRead(staleDataSize, &tx)) {
-                mQueue->commitRead(staleDataSize);
-            }
-        }
-
-        // write data to queue, optionally resizing it
-        if (mQueue && (mDataMaxSize <= mQueue->getQuantumCount())) {
-            if (!mQueue->write(mData.get(), mDataWritten)) {
-                ALOGE("failed to write commands to message queue");
+        if (mWritingToQueue) {
+            // commands are already in place; publish them
+            if (!mQueue->commitWrite(mDataWritten)) {
+                ALOGE("failed to commit commands to message queue");
                 return false;
             }
 
-            *outQueueChanged = false;
+            // further writes before reset() go to the private buffer
+            mWritingToQueue = false;
+            mDataMaxSize = mDataWritten;
+            *outQueueChanged = mQueueChanged;
         } else {
-            auto newQueue = std::make_unique<CommandQueueType>(mDataMaxSize);
-            if (!newQueue->isValid() || !newQueue->write(mData.get(), mDataWritten)) {
-                ALOGE("failed to prepare a new message queue ");
-                return false;
+            if (mData != mDataBuffer.get()) {
+                // writeQueue called again on commands already committed to the queue
+                moveDataToBuffer(std::max(mDataWritten, mDataBufferSize));
             }
+            discardStaleData();
 
-            mQueue = std::move(newQueue);
-            *outQueueChanged = true;
+            // write data to queue, optionally resizing it
+            if (mQueue && (mDataMaxSize <= mQueue->getQuantumCount())) {
+                if (!mQueue->write(mData, mDataWritten)) {
+                    ALOGE("failed to write commands to message queue");
+                    return false;
+                }
+
+                *outQueueChanged = mQueueChanged;
+            } else {
+                auto newQueue = std::make_unique<CommandQueueType>(mDataMaxSize);
+                if (!newQueue->isValid() || !newQueue->write(mData, mDataWritten)) {
+                    ALOGE("failed to prepare a new message queue ");
+                    return false;
+                }
+
+                mQueue = std::move(newQueue);
+                *outQueueChanged = true;
+            }
         }
+        mQueueChanged = false;
+        mLastFrameSize = mDataWritten;
 
         *outCommandLength = mDataWritten;
         outCommandHandles->setToExternal(const_cast<hidl_handle*>(mDataHandles.data()),
@@ -539,7 +561,8 @@ class CommandWriterBase {
 
     static constexpr uint16_t kMaxLength = std::numeric_limits<uint16_t>::max();
 
-    std::unique_ptr<uint32_t[]> mData;
+    // points to either mDataBuffer or the writable region of mQueue
+    uint32_t* mData;
     uint32_t mDataWritten;
 
    private:
@@ -550,6 +573,10 @@ class CommandWriterBase {
                              mDataWritten, grow);
         }
 
+        if (mDirectQueueWrite && mDataWritten == 0 && !mWritingToQueue) {
+            beginQueueWrite(newWritten);
+        }
+
         if (newWritten <= mDataMaxSize) {
             return;
         }
@@ -559,12 +586,84 @@ class CommandWriterBase {
             newMaxSize = newWritten;
         }
 
+        moveDataToBuffer(newMaxSize);
+    }
+
+    void moveDataToBuffer(uint32_t newMaxSize) {
         auto newData = std::make_unique<uint32_t[]>(newMaxSize);
-        std::copy_n(mData.get(), mDataWritten, newData.get());
+        std::copy_n(mData, mDataWritten, newData.get());
+        mDataBufferSize = newMaxSize;
+        mDataBuffer = std::move(newData);
+        mData = mDataBuffer.get();
         mDataMaxSize = newMaxSize;
-        mData = std::move(newData);
+        mWritingToQueue = false;
+    }
+
+    // After data are written to the queue, it may not be read by the
+    // remote reader when
+    //
+    //  - the writer does not send them (because of other errors)
+    //  - the hwbinder transaction fails
+    //  - the reader does not read them (because of other errors)
+    //
+    // Discard the stale data here.
+    void discardStaleData() {
+        size_t staleDataSize = mQueue ? mQueue->availableToRead() : 0;
+        if (staleDataSize > 0) {
+            ALOGW("discarding stale data from message queue");
+            CommandQueueType::MemTransaction tx;
+            if (mQueue->beginRead(staleDataSize, &tx)) {
+                mQueue->commitRead(staleDataSize);
+            }
+        }
+    }
+
+    // Point mData at the queue so that the next frame is serialized in place. On failure
+    // mData is left pointing at mDataBuffer.
+    void beginQueueWrite(uint32_t minSize) {
+        uint32_t queueSize = mQueue ? mQueue->getQuantumCount() : 0;
+        uint32_t wantedSize = std::max({minSize, mInitialQueueSize, mLastFrameSize * 2});
+        if (queueSize < wantedSize) {
+            auto newQueue = std::make_unique<CommandQueueType>(std::max(queueSize * 2, wantedSize));
+            if (!newQueue->isValid()) {
+                ALOGE("failed to prepare a new message queue ");
+                return;
+            }
+
+            mQueue = std::move(newQueue);
+            mQueueChanged = true;
+        } else {
+            discardStaleData();
+        }
+
+        size_t count = mQueue->getQuantumCount();
+        CommandQueueType::MemTransaction tx;
+        if (!mQueue->beginWrite(count, &tx)) {
+            ALOGE("failed to begin writing to message queue");
+            return;
+        }
+
+        // The queue is empty, but its write position may be anywhere in the ring. Move both
+        // positions to the start of the ring so that the whole queue is contiguous. Only the
+        // positions are updated; no data is copied.
+        size_t skip = tx.getFirstRegion().getLength();
+        if (skip < count) {
+            CommandQueueType::MemTransaction readTx;
+            if (!mQueue->commitWrite(skip) || !mQueue->beginRead(skip, &readTx) ||
+                !mQueue->commitRead(skip) || !mQueue->beginWrite(count, &tx)) {
+                ALOGE("failed to rewind message queue");
+                return;
+            }
+        }
+
+        mData = tx.getFirstRegion().getAddress();
+        mDataMaxSize = tx.getFirstRegion().getLength();
+        mWritingToQueue = true;
     }
 
+    // private buffer used when not writing to the queue directly
+    std::unique_ptr<uint32_t[]> mDataBuffer;
+    uint32_t mDataBufferSize;
     uint32_t mDataMaxSize;
     // end offset of the current command
     uint32_t mCommandEnd;
@@ -573,6 +672,14 @@ class CommandWriterBase {
     std::vector<native_handle_t*> mTemporaryHandles;
 
     std::unique_ptr<CommandQueueType> mQueue;
+
+    const uint32_t mInitialQueueSize;
+    bool mDirectQueueWrite = false;
+    // mData points to the writable region of mQueue
+    bool mWritingToQueue = false;
+    // mQueue was replaced since the last writeQueue
+    bool mQueueChanged = false;
+    uint32_t mLastFrameSize = 0;
 };
 
 // This class helps parse a command queue.  Note that all sizes/lengths are in
@@ -677,6 +784,9 @@ class CommandReaderBase {
 
     uint32_t getCommandLoc() const { return mCommandBegin; }
 
+    // size of the command stream read by the last readQueue()
+    uint32_t getDataSize() const { return mDataSize; }
+
     uint32_t read() { return mData[mDataRead++]; }
 
     int32_t readSigned() {
@@ -20,6 +20,8 @@
 #warning "ComposerCommandEngine.h included without LOG_TAG"
 #endif
 
+#include <functional>
+#include <utility>
 #include <vector>
 
 #include <composer-command-buffer/2.1/ComposerCommandBuffer.h>
@@ -42,6 +44,8 @@ class ComposerCommandEngine : protected CommandReaderBase {
      ComposerCommandEngine(ComposerHal* hal, ComposerResources* resources)
          : mHal(hal), mResources(resources) {
          mWriter = createCommandWriter(kWriterInitialSize);
+         mWriter->setDirectQueueWrite(true);
+         registerCommands();
      }
 
     virtual ~ComposerCommandEngine() = default;
@@ -56,6 +60,11 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return Error::BAD_PARAMETER;
         }
 
+        // Reject malformed command streams before any command takes effect
+        if (!validateCommands()) {
+            return Error::BAD_PARAMETER;
+        }
+
         IComposerClient::Command command;
         uint16_t length = 0;
         while (!isEmpty()) {
@@ -63,6 +72,11 @@ class ComposerCommandEngine : protected CommandReaderBase {
                 break;
             }
 
+            // Commands without a handler are left to subclasses that override executeCommand,
+            // and may depend on any layer state
+            if (!findCommand(static_cast<uint32_t>(command))) {
+                flushLayerState();
+            }
             bool parsed = executeCommand(command, length);
             endCommand();
 
@@ -71,6 +85,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
                 break;
             }
         }
+        flushLayerState();
 
         if (!isEmpty()) {
             return Error::BAD_PARAMETER;
@@ -89,63 +104,193 @@ class ComposerCommandEngine : protected CommandReaderBase {
     }
 
    protected:
+    using CommandHandler = std::function<bool(uint16_t length)>;
+
+    struct CommandEntry {
+        CommandHandler handler;
+        // The command length must be minLength + N * lengthStep. A lengthStep of 0 means the
+        // length must be exactly minLength.
+        uint16_t minLength = 0;
+        uint16_t lengthStep = 0;
+        // The command only touches properties of the selected layer that are independent of
+        // the deferred layer state, so the deferred state does not need to be applied first.
+        bool keepsLayerState = false;
+
+        bool isValidLength(uint16_t length) const {
+            if (lengthStep == 0) {
+                return length == minLength;
+            }
+            return length >= minLength && (length - minLength) % lengthStep == 0;
+        }
+    };
+
+    // Add or replace the handler of a command. Subclasses register their commands from their
+    // constructors. Commands without a handler go to executeCommand, which subclasses may
+    // still override.
+    template <typename Command, typename Engine>
+    void registerCommand(Command command, bool (Engine::*handler)(uint16_t),
+                         uint16_t minLength, uint16_t lengthStep = 0,
+                         bool keepsLayerState = false) {
+        const uint32_t opcode = static_cast<uint32_t>(command);
+        size_t index = getCommandIndex(opcode);
+        if (index >= kCommandTableSize) {
+            LOG_ALWAYS_FATAL("command 0x%x does not fit in the command table", opcode);
+        }
+        if (mCommandTable.empty()) {
+            mCommandTable.resize(kCommandTableSize);
+        }
+
+        Engine* engine = static_cast<Engine*>(this);
+        mCommandTable[index] = CommandEntry{
+                [engine, handler](uint16_t length) { return (engine->*handler)(length); },
+                minLength, lengthStep, keepsLayerState};
+    }
+
+    const CommandEntry* findCommand(uint32_t command) const {
+        size_t index = getCommandIndex(command);
+        if (index >= mCommandTable.size() || !mCommandTable[index].handler) {
+            return nullptr;
+        }
+        return &mCommandTable[index];
+    }
+
     virtual bool executeCommand(IComposerClient::Command command, uint16_t length) {
-        switch (command) {
-            case IComposerClient::Command::SELECT_DISPLAY:
-                return executeSelectDisplay(length);
-            case IComposerClient::Command::SELECT_LAYER:
-                return executeSelectLayer(length);
-            case IComposerClient::Command::SET_COLOR_TRANSFORM:
-                return executeSetColorTransform(length);
-            case IComposerClient::Command::SET_CLIENT_TARGET:
-                return executeSetClientTarget(length);
-            case IComposerClient::Command::SET_OUTPUT_BUFFER:
-                return executeSetOutputBuffer(length);
-            case IComposerClient::Command::VALIDATE_DISPLAY:
-                return executeValidateDisplay(length);
-            case IComposerClient::Command::PRESENT_OR_VALIDATE_DISPLAY:
-                return executePresentOrValidateDisplay(length);
-            case IComposerClient::Command::ACCEPT_DISPLAY_CHANGES:
-                return executeAcceptDisplayChanges(length);
-            case IComposerClient::Command::PRESENT_DISPLAY:
-                return executePresentDisplay(length);
-            case IComposerClient::Command::SET_LAYER_CURSOR_POSITION:
-                return executeSetLayerCursorPosition(length);
-            case IComposerClient::Command::SET_LAYER_BUFFER:
-                return executeSetLayerBuffer(length);
-            case IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE:
-                return executeSetLayerSurfaceDamage(length);
-            case IComposerClient::Command::SET_LAYER_BLEND_MODE:
-                return executeSetLayerBlendMode(length);
-            case IComposerClient::Command::SET_LAYER_COLOR:
-                return executeSetLayerColor(length);
-            case IComposerClient::Command::SET_LAYER_COMPOSITION_TYPE:
-                return executeSetLayerCompositionType(length);
-            case IComposerClient::Command::SET_LAYER_DATASPACE:
-                return executeSetLayerDataspace(length);
-            case IComposerClient::Command::SET_LAYER_DISPLAY_FRAME:
-                return executeSetLayerDisplayFrame(length);
-            case IComposerClient::Command::SET_LAYER_PLANE_ALPHA:
-                return executeSetLayerPlaneAlpha(length);
-            case IComposerClient::Command::SET_LAYER_SIDEBAND_STREAM:
-                return executeSetLayerSidebandStream(length);
-            case IComposerClient::Command::SET_LAYER_SOURCE_CROP:
-                return executeSetLayerSourceCrop(length);
-            case IComposerClient::Command::SET_LAYER_TRANSFORM:
-                return executeSetLayerTransform(length);
-            case IComposerClient::Command::SET_LAYER_VISIBLE_REGION:
-                return executeSetLayerVisibleRegion(length);
-            case IComposerClient::Command::SET_LAYER_Z_ORDER:
-                return executeSetLayerZOrder(length);
-            default:
+        const CommandEntry* entry = findCommand(static_cast<uint32_t>(command));
+        if (!entry) {
+            return false;
+        }
+        if (!entry->keepsLayerState) {
+            flushLayerState();
+        }
+        return entry->handler(length);
+    }
+
+    // Check the length of every command in the stream without executing any. Only registered
+    // commands have a known length; the others are checked by executeCommand as they run.
+    bool validateCommands() {
+        constexpr uint32_t opcodeMask =
+                static_cast<uint32_t>(IComposerClient::Command::OPCODE_MASK);
+        constexpr uint32_t lengthMask =
+                static_cast<uint32_t>(IComposerClient::Command::LENGTH_MASK);
+
+        const uint32_t dataSize = getDataSize();
+        uint32_t pos = mDataRead;
+        while (pos < dataSize) {
+            uint32_t val = mData[pos++];
+            uint32_t command = val & opcodeMask;
+            uint16_t length = static_cast<uint16_t>(val & lengthMask);
+
+            const CommandEntry* entry = findCommand(command);
+            if (length > dataSize - pos || (entry && !entry->isValidLength(length))) {
+                ALOGE("command 0x%x at %" PRIu32 " has invalid length %" PRIu16, command,
+                      pos - 1, length);
                 return false;
+            }
+            pos += length;
         }
+
+        return true;
     }
 
     virtual std::unique_ptr<CommandWriterBase> createCommandWriter(size_t writerInitialSize) {
         return std::make_unique<CommandWriterBase>(writerInitialSize);
     }
 
+    // A layer property decoded from the command stream but not yet applied to the HAL
+    template <typename T>
+    struct PendingProperty {
+        bool pending = false;
+        // location of the command that set the value, for error reporting
+        uint32_t location = 0;
+        T value{};
+    };
+
+    // Properties of the selected layer that are applied to the HAL together, when another
+    // layer or display is selected, before any command that depends on them, or at the end
+    // of the command stream. A property set more than once in the meantime is applied once,
+    // with its last value.
+    struct LayerState {
+        PendingProperty<std::pair<int32_t, int32_t>> cursorPosition;
+        PendingProperty<std::vector<hwc_rect_t>> surfaceDamage;
+        PendingProperty<int32_t> blendMode;
+        PendingProperty<IComposerClient::Color> color;
+        PendingProperty<int32_t> compositionType;
+        PendingProperty<int32_t> dataspace;
+        PendingProperty<hwc_rect_t> displayFrame;
+        PendingProperty<float> planeAlpha;
+        PendingProperty<hwc_frect_t> sourceCrop;
+        PendingProperty<int32_t> transform;
+        PendingProperty<std::vector<hwc_rect_t>> visibleRegion;
+        PendingProperty<uint32_t> zOrder;
+    };
+
+    template <typename T>
+    T& deferLayerProperty(PendingProperty<T>* property) {
+        property->pending = true;
+        property->location = getCommandLoc();
+        mLayerStatePending = true;
+        return property->value;
+    }
+
+    template <typename T, typename Apply>
+    void applyLayerProperty(PendingProperty<T>* property, Apply apply) {
+        if (!property->pending) {
+            return;
+        }
+        property->pending = false;
+
+        auto err = apply(property->value);
+        if (err != Error::NONE) {
+            mWriter->setError(property->location, err);
+        }
+    }
+
+    void flushLayerState() {
+        if (!mLayerStatePending) {
+            return;
+        }
+        mLayerStatePending = false;
+
+        const Display display = mCurrentDisplay;
+        const Layer layer = mCurrentLayer;
+        applyLayerProperty(&mLayerState.cursorPosition, [&](const auto& position) {
+            return mHal->setLayerCursorPosition(display, layer, position.first, position.second);
+        });
+        applyLayerProperty(&mLayerState.surfaceDamage, [&](const auto& damage) {
+            return mHal->setLayerSurfaceDamage(display, layer, damage);
+        });
+        applyLayerProperty(&mLayerState.blendMode, [&](auto mode) {
+            return mHal->setLayerBlendMode(display, layer, mode);
+        });
+        applyLayerProperty(&mLayerState.color, [&](const auto& color) {
+            return mHal->setLayerColor(display, layer, color);
+        });
+        applyLayerProperty(&mLayerState.compositionType, [&](auto type) {
+            return mHal->setLayerCompositionType(display, layer, type);
+        });
+        applyLayerProperty(&mLayerState.dataspace, [&](auto dataspace) {
+            return mHal->setLayerDataspace(display, layer, dataspace);
+        });
+        applyLayerProperty(&mLayerState.displayFrame, [&](const auto& frame) {
+            return mHal->setLayerDisplayFrame(display, layer, frame);
+        });
+        applyLayerProperty(&mLayerState.planeAlpha, [&](auto alpha) {
+            return mHal->setLayerPlaneAlpha(display, layer, alpha);
+        });
+        applyLayerProperty(&mLayerState.sourceCrop, [&](const auto& crop) {
+            return mHal->setLayerSourceCrop(display, layer, crop);
+        });
+        applyLayerProperty(&mLayerState.transform, [&](auto transform) {
+            return mHal->setLayerTransform(display, layer, transform);
+        });
+        applyLayerProperty(&mLayerState.visibleRegion, [&](const auto& visible) {
+            return mHal->setLayerVisibleRegion(display, layer, visible);
+        });
+        applyLayerProperty(&mLayerState.zOrder, [&](auto z) {
+            return mHal->setLayerZOrder(display, layer, z);
+        });
+    }
+
     virtual Error executeValidateDisplayInternal() {
         std::vector<Layer> changedLayers;
         std::vector<IComposerClient::Composition> compositionTypes;
@@ -181,7 +326,11 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        mCurrentLayer = read64();
+        Layer layer = read64();
+        if (layer != mCurrentLayer) {
+            flushLayerState();
+            mCurrentLayer = layer;
+        }
 
         return true;
     }
@@ -345,11 +494,9 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerCursorPosition(mCurrentDisplay, mCurrentLayer, readSigned(),
-                                                readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        auto& position = deferLayerProperty(&mLayerState.cursorPosition);
+        position.first = readSigned();
+        position.second = readSigned();
 
         return true;
     }
@@ -391,11 +538,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto damage = readRegion(length / 4);
-        auto err = mHal->setLayerSurfaceDamage(mCurrentDisplay, mCurrentLayer, damage);
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        readRegion(length / 4, &deferLayerProperty(&mLayerState.surfaceDamage));
 
         return true;
     }
@@ -405,10 +548,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerBlendMode(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.blendMode) = readSigned();
 
         return true;
     }
@@ -418,10 +558,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerColor(mCurrentDisplay, mCurrentLayer, readColor());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.color) = readColor();
 
         return true;
     }
@@ -431,10 +568,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerCompositionType(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.compositionType) = readSigned();
 
         return true;
     }
@@ -444,10 +578,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerDataspace(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.dataspace) = readSigned();
 
         return true;
     }
@@ -457,10 +588,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerDisplayFrame(mCurrentDisplay, mCurrentLayer, readRect());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.displayFrame) = readRect();
 
         return true;
     }
@@ -470,10 +598,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerPlaneAlpha(mCurrentDisplay, mCurrentLayer, readFloat());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.planeAlpha) = readFloat();
 
         return true;
     }
@@ -504,10 +629,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerSourceCrop(mCurrentDisplay, mCurrentLayer, readFRect());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.sourceCrop) = readFRect();
 
         return true;
     }
@@ -517,10 +639,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerTransform(mCurrentDisplay, mCurrentLayer, readSigned());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.transform) = readSigned();
 
         return true;
     }
@@ -531,11 +650,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto region = readRegion(length / 4);
-        auto err = mHal->setLayerVisibleRegion(mCurrentDisplay, mCurrentLayer, region);
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        readRegion(length / 4, &deferLayerProperty(&mLayerState.visibleRegion));
 
         return true;
     }
@@ -545,10 +660,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
-        auto err = mHal->setLayerZOrder(mCurrentDisplay, mCurrentLayer, read());
-        if (err != Error::NONE) {
-            mWriter->setError(getCommandLoc(), err);
-        }
+        deferLayerProperty(&mLayerState.zOrder) = read();
 
         return true;
     }
@@ -561,13 +673,18 @@ class ComposerCommandEngine : protected CommandReaderBase {
 
     std::vector<hwc_rect_t> readRegion(size_t count) {
         std::vector<hwc_rect_t> region;
-        region.reserve(count);
+        readRegion(count, &region);
+        return region;
+    }
+
+    // reuses the capacity of outRegion
+    void readRegion(size_t count, std::vector<hwc_rect_t>* outRegion) {
+        outRegion->clear();
+        outRegion->reserve(count);
         while (count > 0) {
-            region.emplace_back(readRect());
+            outRegion->emplace_back(readRect());
             count--;
         }
-
-        return region;
     }
 
     hwc_frect_t readFRect() {
@@ -585,6 +702,86 @@ class ComposerCommandEngine : protected CommandReaderBase {
 
     Display mCurrentDisplay = 0;
     Layer mCurrentLayer = 0;
+
+   private:
+    // Opcodes are grouped by their high byte, e.g. 0x3xx for layer buffer commands and 0x4xx
+    // for other layer commands. The table holds kOpcodesPerGroup entries per group.
+    static constexpr size_t kOpcodeGroups = 8;
+    static constexpr size_t kOpcodesPerGroup = 32;
+    static constexpr size_t kCommandTableSize = kOpcodeGroups * kOpcodesPerGroup;
+
+    static size_t getCommandIndex(uint32_t command) {
+        uint32_t opcode =
+                command >> static_cast<uint32_t>(IComposerClient::Command::OPCODE_SHIFT);
+        size_t group = opcode >> 8;
+        size_t index = opcode & 0xff;
+        if (group >= kOpcodeGroups || index >= kOpcodesPerGroup) {
+            return kCommandTableSize;
+        }
+        return group * kOpcodesPerGroup + index;
+    }
+
+    void registerCommands() {
+        using Command = IComposerClient::Command;
+        using Engine = ComposerCommandEngine;
+        registerCommand(Command::SELECT_DISPLAY, &Engine::executeSelectDisplay,
+                        CommandWriterBase::kSelectDisplayLength);
+        registerCommand(Command::SELECT_LAYER, &Engine::executeSelectLayer,
+                        CommandWriterBase::kSelectLayerLength, 0, /*keepsLayerState*/ true);
+        registerCommand(Command::SET_COLOR_TRANSFORM, &Engine::executeSetColorTransform,
+                        CommandWriterBase::kSetColorTransformLength);
+        // 4 parameters followed by N rectangles
+        registerCommand(Command::SET_CLIENT_TARGET, &Engine::executeSetClientTarget, 4, 4);
+        registerCommand(Command::SET_OUTPUT_BUFFER, &Engine::executeSetOutputBuffer,
+                        CommandWriterBase::kSetOutputBufferLength);
+        registerCommand(Command::VALIDATE_DISPLAY, &Engine::executeValidateDisplay,
+                        CommandWriterBase::kValidateDisplayLength);
+        registerCommand(Command::PRESENT_OR_VALIDATE_DISPLAY,
+                        &Engine::executePresentOrValidateDisplay,
+                        CommandWriterBase::kPresentOrValidateDisplayLength);
+        registerCommand(Command::ACCEPT_DISPLAY_CHANGES, &Engine::executeAcceptDisplayChanges,
+                        CommandWriterBase::kAcceptDisplayChangesLength);
+        registerCommand(Command::PRESENT_DISPLAY, &Engine::executePresentDisplay,
+                        CommandWriterBase::kPresentDisplayLength);
+
+        // Layer commands. Buffers and sideband streams go through ComposerResources and are
+        // applied right away; the other properties are deferred into mLayerState.
+        registerCommand(Command::SET_LAYER_CURSOR_POSITION, &Engine::executeSetLayerCursorPosition,
+                        CommandWriterBase::kSetLayerCursorPositionLength, 0, true);
+        registerCommand(Command::SET_LAYER_BUFFER, &Engine::executeSetLayerBuffer,
+                        CommandWriterBase::kSetLayerBufferLength, 0, true);
+        // N rectangles
+        registerCommand(Command::SET_LAYER_SURFACE_DAMAGE, &Engine::executeSetLayerSurfaceDamage,
+                        0, 4, true);
+        registerCommand(Command::SET_LAYER_BLEND_MODE, &Engine::executeSetLayerBlendMode,
+                        CommandWriterBase::kSetLayerBlendModeLength, 0, true);
+        registerCommand(Command::SET_LAYER_COLOR, &Engine::executeSetLayerColor,
+                        CommandWriterBase::kSetLayerColorLength, 0, true);
+        registerCommand(Command::SET_LAYER_COMPOSITION_TYPE,
+                        &Engine::executeSetLayerCompositionType,
+                        CommandWriterBase::kSetLayerCompositionTypeLength, 0, true);
+        registerCommand(Command::SET_LAYER_DATASPACE, &Engine::executeSetLayerDataspace,
+                        CommandWriterBase::kSetLayerDataspaceLength, 0, true);
+        registerCommand(Command::SET_LAYER_DISPLAY_FRAME, &Engine::executeSetLayerDisplayFrame,
+                        CommandWriterBase::kSetLayerDisplayFrameLength, 0, true);
+        registerCommand(Command::SET_LAYER_PLANE_ALPHA, &Engine::executeSetLayerPlaneAlpha,
+                        CommandWriterBase::kSetLayerPlaneAlphaLength, 0, true);
+        registerCommand(Command::SET_LAYER_SIDEBAND_STREAM, &Engine::executeSetLayerSidebandStream,
+                        CommandWriterBase::kSetLayerSidebandStreamLength, 0, true);
+        registerCommand(Command::SET_LAYER_SOURCE_CROP, &Engine::executeSetLayerSourceCrop,
+                        CommandWriterBase::kSetLayerSourceCropLength, 0, true);
+        registerCommand(Command::SET_LAYER_TRANSFORM, &Engine::executeSetLayerTransform,
+                        CommandWriterBase::kSetLayerTransformLength, 0, true);
+        // N rectangles
+        registerCommand(Command::SET_LAYER_VISIBLE_REGION, &Engine::executeSetLayerVisibleRegion,
+                        0, 4, true);
+        registerCommand(Command::SET_LAYER_Z_ORDER, &Engine::executeSetLayerZOrder,
+                        CommandWriterBase::kSetLayerZOrderLength, 0, true);
+    }
+
+    std::vector<CommandEntry> mCommandTable;
+    LayerState mLayerState;
+    bool mLayerStatePending = false;
 };
 
 }  // namespace hal
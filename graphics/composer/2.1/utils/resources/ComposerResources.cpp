@@ -18,6 +18,10 @@
 
 #include "composer-resources/2.1/ComposerResources.h"
 
+#include <algorithm>
+#include <functional>
+#include <thread>
+
 namespace android {
 namespace hardware {
 namespace graphics {
@@ -274,6 +278,12 @@ bool ComposerDisplayResource::mustValidate() const {
     return mMustValidate;
 }
 
+ComposerResources::ComposerResources() : mDisplayResources(new DisplayMap()) {}
+
+ComposerResources::~ComposerResources() {
+    delete mDisplayResources.load();
+}
+
 std::unique_ptr<ComposerResources> ComposerResources::create() {
     auto resources = std::make_unique<ComposerResources>();
     return resources->init() ? std::move(resources) : nullptr;
@@ -285,40 +295,54 @@ bool ComposerResources::init() {
 
 void ComposerResources::clear(RemoveDisplay removeDisplay) {
     std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    for (const auto& displayKey : mDisplayResources) {
+    DisplayMap displayMap = *mDisplayResources.load();
+    publishDisplayMapLocked(std::make_unique<DisplayMap>());
+
+    for (const auto& displayKey : displayMap) {
         Display display = displayKey.first;
-        const ComposerDisplayResource& displayResource = *displayKey.second;
-        removeDisplay(display, displayResource.isVirtual(), displayResource.getLayers());
+        DisplayShard& shard = *displayKey.second;
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        shard.removed = true;
+        removeDisplay(display, shard.resource->isVirtual(), shard.resource->getLayers());
     }
-    mDisplayResources.clear();
 }
 
 Error ComposerResources::addPhysicalDisplay(Display display) {
     auto displayResource = createDisplayResource(ComposerDisplayResource::DisplayType::PHYSICAL, 0);
-
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    auto result = mDisplayResources.emplace(display, std::move(displayResource));
-    return result.second ? Error::NONE : Error::BAD_DISPLAY;
+    return addDisplayResource(display, std::move(displayResource));
 }
 
 Error ComposerResources::addVirtualDisplay(Display display, uint32_t outputBufferCacheSize) {
     auto displayResource = createDisplayResource(ComposerDisplayResource::DisplayType::VIRTUAL,
                                                  outputBufferCacheSize);
-
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    auto result = mDisplayResources.emplace(display, std::move(displayResource));
-    return result.second ? Error::NONE : Error::BAD_DISPLAY;
+    return addDisplayResource(display, std::move(displayResource));
 }
 
 Error ComposerResources::removeDisplay(Display display) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    return mDisplayResources.erase(display) > 0 ? Error::NONE : Error::BAD_DISPLAY;
+    std::shared_ptr<DisplayShard> shard;
+    {
+        std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+        const DisplayMap& current = *mDisplayResources.load();
+        auto iter = current.find(display);
+        if (iter == current.end()) {
+            return Error::BAD_DISPLAY;
+        }
+        shard = iter->second;
+
+        auto displayMap = std::make_unique<DisplayMap>(current);
+        displayMap->erase(display);
+        publishDisplayMapLocked(std::move(displayMap));
+    }
+
+    // wait for commands still using the display
+    std::lock_guard<std::mutex> shardLock(shard->mutex);
+    shard->removed = true;
+    return Error::NONE;
 }
 
 Error ComposerResources::setDisplayClientTargetCacheSize(Display display,
                                                          uint32_t clientTargetCacheSize) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource displayResource = lockDisplayResource(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
@@ -330,8 +354,7 @@ Error ComposerResources::setDisplayClientTargetCacheSize(Display display,
 Error ComposerResources::addLayer(Display display, Layer layer, uint32_t bufferCacheSize) {
     auto layerResource = createLayerResource(bufferCacheSize);
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource displayResource = lockDisplayResource(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
@@ -341,8 +364,7 @@ Error ComposerResources::addLayer(Display display, Layer layer, uint32_t bufferC
 }
 
 Error ComposerResources::removeLayer(Display display, Layer layer) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource displayResource = lockDisplayResource(display);
     if (!displayResource) {
         return Error::BAD_DISPLAY;
     }
@@ -383,16 +405,14 @@ Error ComposerResources::getLayerSidebandStream(Display display, Layer layer,
 }
 
 void ComposerResources::setDisplayMustValidateState(Display display, bool mustValidate) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    auto* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource displayResource = lockDisplayResource(display);
     if (displayResource) {
         displayResource->setMustValidateState(mustValidate);
     }
 }
 
 bool ComposerResources::mustValidateDisplay(Display display) {
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-    auto* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource displayResource = lockDisplayResource(display);
     if (displayResource) {
         return displayResource->mustValidate();
     }
@@ -409,12 +429,88 @@ std::unique_ptr<ComposerLayerResource> ComposerResources::createLayerResource(
     return std::make_unique<ComposerLayerResource>(mImporter, bufferCacheSize);
 }
 
-ComposerDisplayResource* ComposerResources::findDisplayResourceLocked(Display display) {
-    auto iter = mDisplayResources.find(display);
-    if (iter == mDisplayResources.end()) {
-        return nullptr;
+ComposerResources::LockedDisplayResource ComposerResources::lockDisplayResource(Display display) {
+    std::shared_ptr<DisplayShard> shard = findDisplayShard(display);
+    if (!shard) {
+        return LockedDisplayResource();
+    }
+    return LockedDisplayResource(std::move(shard));
+}
+
+std::shared_ptr<ComposerResources::DisplayShard> ComposerResources::findDisplayShard(Display display) {
+    auto find = [display](const DisplayMap& displayMap) {
+        auto iter = displayMap.find(display);
+        return iter != displayMap.end() ? iter->second : std::shared_ptr<DisplayShard>();
+    };
+
+    // Threads start from different slots, so readers rarely share one
+    const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (size_t i = 0; i < kHazardSlotCount; i++) {
+        HazardSlot& slot = mHazardSlots[(start + i) % kHazardSlotCount];
+        if (slot.inUse.load(std::memory_order_relaxed) ||
+            slot.inUse.exchange(true, std::memory_order_acquire)) {
+            continue;
+        }
+
+        // The seq_cst ordering of the hazard and the map pointer guarantees that
+        // reclaimDisplayMapsLocked either sees the hazard or this reader sees the new map.
+        const DisplayMap* displayMap = mDisplayResources.load();
+        while (true) {
+            slot.map.store(displayMap);
+            const DisplayMap* published = mDisplayResources.load();
+            if (published == displayMap) {
+                break;
+            }
+            displayMap = published;
+        }
+
+        std::shared_ptr<DisplayShard> shard = find(*displayMap);
+        slot.map.store(nullptr, std::memory_order_release);
+        slot.inUse.store(false, std::memory_order_release);
+        return shard;
     }
-    return iter->second.get();
+
+    // More readers than slots; maps are only replaced and deleted with the mutex held
+    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    return find(*mDisplayResources.load());
+}
+
+Error ComposerResources::addDisplayResource(
+        Display display, std::unique_ptr<ComposerDisplayResource> displayResource) {
+    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+    const DisplayMap& current = *mDisplayResources.load();
+    if (current.count(display) > 0) {
+        return Error::BAD_DISPLAY;
+    }
+
+    auto displayMap = std::make_unique<DisplayMap>(current);
+    displayMap->emplace(display, std::make_shared<DisplayShard>(std::move(displayResource)));
+    publishDisplayMapLocked(std::move(displayMap));
+    return Error::NONE;
+}
+
+void ComposerResources::publishDisplayMapLocked(std::unique_ptr<DisplayMap> displayMap) {
+    mRetiredDisplayMaps.emplace_back(mDisplayResources.exchange(displayMap.release()));
+    reclaimDisplayMapsLocked();
+}
+
+void ComposerResources::reclaimDisplayMapsLocked() {
+    // Readers only hold a map for a hash lookup, so a map still in use now is left to the
+    // next change rather than waited for
+    auto inUse = [this](const DisplayMap* displayMap) {
+        for (const HazardSlot& slot : mHazardSlots) {
+            if (slot.map.load() == displayMap) {
+                return true;
+            }
+        }
+        return false;
+    };
+    mRetiredDisplayMaps.erase(
+            std::remove_if(mRetiredDisplayMaps.begin(), mRetiredDisplayMaps.end(),
+                           [&inUse](const std::unique_ptr<const DisplayMap>& displayMap) {
+                               return !inUse(displayMap.get());
+                           }),
+            mRetiredDisplayMaps.end());
 }
 
 Error ComposerResources::getHandle(Display display, Layer layer, uint32_t slot, Cache cache,
@@ -434,12 +530,11 @@ Error ComposerResources::getHandle(Display display, Layer layer, uint32_t slot,
         }
     }
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-
-    // find display/layer resource
+    // find display/layer resource; the display stays locked until the handle is replaced
     const bool needLayerResource = (cache == ComposerResources::Cache::LAYER_BUFFER ||
                                     cache == ComposerResources::Cache::LAYER_SIDEBAND_STREAM);
-    ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+    LockedDisplayResource lockedDisplayResource = lockDisplayResource(display);
+    ComposerDisplayResource* displayResource = lockedDisplayResource.get();
     ComposerLayerResource* layerResource = (displayResource && needLayerResource)
                                                    ? displayResource->findLayerResource(layer)
                                                    : nullptr;
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ComposerResourcesBenchmark"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <composer-resources/2.1/ComposerResources.h>
+#include <cutils/native_handle.h>
+
+using ::android::hardware::graphics::composer::V2_1::Display;
+using ::android::hardware::graphics::composer::V2_1::Error;
+using ::android::hardware::graphics::composer::V2_1::Layer;
+using ::android::hardware::graphics::composer::V2_1::hal::ComposerResources;
+
+namespace {
+
+constexpr uint32_t kLayersPerDisplay = 8;
+constexpr uint32_t kBufferCacheSize = 3;
+constexpr uint32_t kOpsPerThread = 20000;
+
+// The benchmarks only exercise handles that do not need buffers to be allocated: cached buffer
+// slots, null buffers and sideband streams, which are cloned.
+std::unique_ptr<ComposerResources> createResources(uint32_t displayCount) {
+    auto resources = ComposerResources::create();
+    if (!resources) {
+        return nullptr;
+    }
+    for (Display display = 0; display < displayCount; display++) {
+        resources->addPhysicalDisplay(display);
+        for (Layer layer = 0; layer < kLayersPerDisplay; layer++) {
+            resources->addLayer(display, layer, kBufferCacheSize);
+        }
+    }
+    return resources;
+}
+
+// Threads that run a round of work each time they are kicked, so that starting them is not
+// measured
+class WorkerThreads {
+  public:
+    WorkerThreads(uint32_t count, std::function<void(uint32_t index)> work)
+        : mWork(std::move(work)) {
+        for (uint32_t index = 0; index < count; index++) {
+            mThreads.emplace_back([this, index] { threadLoop(index); });
+        }
+    }
+
+    ~WorkerThreads() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mExit = true;
+        }
+        mKick.notify_all();
+        for (auto& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    // Runs one round of work on every thread and waits for all of them to finish it
+    void runRound() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mRound++;
+        mPending = mThreads.size();
+        mKick.notify_all();
+        mDone.wait(lock, [this] { return mPending == 0; });
+    }
+
+  private:
+    void threadLoop(uint32_t index) {
+        uint64_t round = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mKick.wait(lock, [this, round] { return mExit || mRound != round; });
+                if (mExit) {
+                    return;
+                }
+                round = mRound;
+            }
+            mWork(index);
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (--mPending == 0) {
+                mDone.notify_one();
+            }
+        }
+    }
+
+    const std::function<void(uint32_t index)> mWork;
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::condition_variable mKick;
+    std::condition_variable mDone;
+    uint64_t mRound = 0;
+    size_t mPending = 0;
+    bool mExit = false;
+};
+
+// Runs op on one thread per display and reports the combined throughput
+template <typename Op>
+void runPerDisplay(benchmark::State& state, Op op) {
+    const uint32_t displayCount = state.range(0);
+    auto resources = createResources(displayCount);
+    if (!resources) {
+        state.SkipWithError("failed to initialize ComposerResources");
+        return;
+    }
+
+    WorkerThreads threads(displayCount, [&resources, &op](Display display) {
+        for (uint32_t i = 0; i < kOpsPerThread; i++) {
+            op(resources.get(), display, i);
+        }
+    });
+    for (auto _ : state) {
+        threads.runRound();
+    }
+    state.SetItemsProcessed(state.iterations() * displayCount * kOpsPerThread);
+}
+
+void BM_LayerBufferLookup(benchmark::State& state) {
+    runPerDisplay(state, [](ComposerResources* resources, Display display, uint32_t i) {
+        const native_handle_t* handle;
+        ComposerResources::ReplacedHandle replaced(true);
+        Error error = resources->getLayerBuffer(display, i % kLayersPerDisplay,
+                                                i % kBufferCacheSize, true, nullptr, &handle,
+                                                &replaced);
+        benchmark::DoNotOptimize(error);
+    });
+}
+BENCHMARK(BM_LayerBufferLookup)->DenseRange(1, 4)->UseRealTime();
+
+void BM_LayerBufferUpdate(benchmark::State& state) {
+    runPerDisplay(state, [](ComposerResources* resources, Display display, uint32_t i) {
+        const native_handle_t* handle;
+        ComposerResources::ReplacedHandle replaced(true);
+        Error error = resources->getLayerBuffer(display, i % kLayersPerDisplay,
+                                                i % kBufferCacheSize, false, nullptr, &handle,
+                                                &replaced);
+        benchmark::DoNotOptimize(error);
+    });
+}
+BENCHMARK(BM_LayerBufferUpdate)->DenseRange(1, 4)->UseRealTime();
+
+void BM_SidebandStreamImport(benchmark::State& state) {
+    native_handle_t* stream = native_handle_create(0, 1);
+    runPerDisplay(state, [stream](ComposerResources* resources, Display display, uint32_t i) {
+        const native_handle_t* handle;
+        ComposerResources::ReplacedHandle replaced(false);
+        Error error = resources->getLayerSidebandStream(display, i % kLayersPerDisplay, stream,
+                                                        &handle, &replaced);
+        benchmark::DoNotOptimize(error);
+    });
+    native_handle_delete(stream);
+}
+BENCHMARK(BM_SidebandStreamImport)->DenseRange(1, 4)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -20,6 +20,7 @@
 #warning "ComposerResources.h included without LOG_TAG"
 #endif
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -153,8 +154,8 @@ class ComposerResources {
   public:
     static std::unique_ptr<ComposerResources> create();
 
-    ComposerResources() = default;
-    virtual ~ComposerResources() = default;
+    ComposerResources();
+    virtual ~ComposerResources();
 
     bool init();
 
@@ -232,14 +233,69 @@ class ComposerResources {
 
     virtual std::unique_ptr<ComposerLayerResource> createLayerResource(uint32_t bufferCacheSize);
 
-    ComposerDisplayResource* findDisplayResourceLocked(Display display);
+    // A display resource and the lock serializing its caches and layers. Commands for different
+    // displays only contend on their own shard.
+    struct DisplayShard {
+        explicit DisplayShard(std::unique_ptr<ComposerDisplayResource> displayResource)
+            : resource(std::move(displayResource)) {}
+
+        std::mutex mutex;
+        const std::unique_ptr<ComposerDisplayResource> resource;
+        // set, with mutex held, once the display is removed
+        bool removed = false;
+    };
+
+    // A display resource locked for the lifetime of this object, or nothing if the display
+    // does not exist
+    class LockedDisplayResource {
+      public:
+        LockedDisplayResource() = default;
+        explicit LockedDisplayResource(std::shared_ptr<DisplayShard> shard)
+            : mShard(std::move(shard)), mLock(mShard->mutex) {
+            if (mShard->removed) {
+                mLock.unlock();
+                mShard.reset();
+            }
+        }
+
+        explicit operator bool() const { return mShard != nullptr; }
+        ComposerDisplayResource* get() const { return mShard ? mShard->resource.get() : nullptr; }
+        ComposerDisplayResource* operator->() const { return get(); }
+
+      private:
+        std::shared_ptr<DisplayShard> mShard;
+        std::unique_lock<std::mutex> mLock;
+    };
+
+    // looks up the display without taking mDisplayResourcesMutex
+    LockedDisplayResource lockDisplayResource(Display display);
+
+    using DisplayMap = std::unordered_map<Display, std::shared_ptr<DisplayShard>>;
+
+    // The current displays. The map stays valid as long as mDisplayResourcesMutex is held.
+    const DisplayMap& getDisplayResourcesLocked() const { return *mDisplayResources.load(); }
 
     ComposerHandleImporter mImporter;
 
+    // serializes adding and removing displays; lookups do not take it
     std::mutex mDisplayResourcesMutex;
-    std::unordered_map<Display, std::unique_ptr<ComposerDisplayResource>> mDisplayResources;
 
   private:
+    // Displays are added and removed rarely, so the map is copied on every change and
+    // published as a whole. A reader protects the map it uses with a hazard slot of its own; a
+    // replaced map is retired and deleted by a later change once no hazard slot points to it.
+    struct alignas(64) HazardSlot {
+        std::atomic<bool> inUse{false};
+        std::atomic<const DisplayMap*> map{nullptr};
+    };
+    static constexpr size_t kHazardSlotCount = 32;
+
+    std::shared_ptr<DisplayShard> findDisplayShard(Display display);
+    Error addDisplayResource(Display display,
+                             std::unique_ptr<ComposerDisplayResource> displayResource);
+    void publishDisplayMapLocked(std::unique_ptr<DisplayMap> displayMap);
+    void reclaimDisplayMapsLocked();
+
     enum class Cache {
         CLIENT_TARGET,
         OUTPUT_BUFFER,
@@ -250,6 +306,11 @@ class ComposerResources {
     Error getHandle(Display display, Layer layer, uint32_t slot, Cache cache, bool fromCache,
                     const native_handle_t* rawHandle, const native_handle_t** outHandle,
                     ReplacedHandle* outReplacedHandle);
+
+    std::atomic<const DisplayMap*> mDisplayResources;
+    HazardSlot mHazardSlots[kHazardSlotCount];
+    // replaced maps that a reader may still use, protected by mDisplayResourcesMutex
+    std::vector<std::unique_ptr<const DisplayMap>> mRetiredDisplayMaps;
 };
 
 }  // namespace hal
@@ -54,15 +54,13 @@ Error ComposerResources::getDisplayReadbackBuffer(Display display, const native_
         return error;
     }
 
-    std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-
-    auto iter = mDisplayResources.find(display);
-    if (iter == mDisplayResources.end()) {
+    LockedDisplayResource lockedDisplayResource = lockDisplayResource(display);
+    if (!lockedDisplayResource) {
         mImporter.freeBuffer(importedHandle);
         return Error::BAD_DISPLAY;
     }
     ComposerDisplayResource& displayResource =
-            *static_cast<ComposerDisplayResource*>(iter->second.get());
+            *static_cast<ComposerDisplayResource*>(lockedDisplayResource.get());
 
     // update cache
     const native_handle_t* replacedHandle;
@@ -68,15 +68,13 @@ class ComposerResources : public V2_1::hal::ComposerResources {
             return error;
         }
 
-        std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
-
-        auto iter = mDisplayResources.find(display);
-        if (iter == mDisplayResources.end()) {
+        LockedDisplayResource lockedDisplayResource = lockDisplayResource(display);
+        if (!lockedDisplayResource) {
             mImporter.freeBuffer(importedHandle);
             return Error::BAD_DISPLAY;
         }
         ComposerDisplayResource& displayResource =
-                *static_cast<ComposerDisplayResource*>(iter->second.get());
+                *static_cast<ComposerDisplayResource*>(lockedDisplayResource.get());
 
         // update cache
         const native_handle_t* replacedHandle;
@@ -71,6 +71,7 @@ class PreparedModel final : public nn::IPreparedModel,
   private:
     const sp<V1_0::IPreparedModel> kPreparedModel;
     const hal::utils::DeathHandler kDeathHandler;
+    const hal::utils::RequestRelocationPool kRelocationPool;
 };
 
 }  // namespace android::hardware::neuralnetworks::V1_0::utils
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <android/hardware/neuralnetworks/1.2/types.h>
+#include <benchmark/benchmark.h>
+#include <nnapi/hal/1.2/ExecutionBurstUtils.h>
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using ::android::hardware::neuralnetworks::V1_0::DataLocation;
+using ::android::hardware::neuralnetworks::V1_0::ErrorStatus;
+using ::android::hardware::neuralnetworks::V1_0::Request;
+using ::android::hardware::neuralnetworks::V1_0::RequestArgument;
+using ::android::hardware::neuralnetworks::V1_2::MeasureTiming;
+using ::android::hardware::neuralnetworks::V1_2::OutputShape;
+using ::android::hardware::neuralnetworks::V1_2::Timing;
+using ::android::hardware::neuralnetworks::V1_2::utils::deserialize;
+using ::android::hardware::neuralnetworks::V1_2::utils::kExecutionBurstChannelLength;
+using ::android::hardware::neuralnetworks::V1_2::utils::RequestChannelReceiver;
+using ::android::hardware::neuralnetworks::V1_2::utils::RequestChannelSender;
+using ::android::hardware::neuralnetworks::V1_2::utils::ResultChannelReceiver;
+using ::android::hardware::neuralnetworks::V1_2::utils::ResultChannelSender;
+using ::android::hardware::neuralnetworks::V1_2::utils::serialize;
+
+namespace {
+
+// Both ends poll for the whole benchmark, so the measured latency is the cost of moving packets
+// through the FMQs rather than of futex wakeups.
+constexpr auto kPollingTimeWindow = std::chrono::seconds(1);
+constexpr uint32_t kRank = 4;
+constexpr Timing kNoTiming = {std::numeric_limits<uint64_t>::max(),
+                              std::numeric_limits<uint64_t>::max()};
+
+RequestArgument makeArgument(uint32_t index) {
+    return {.hasNoValue = false,
+            .location = {.poolIndex = 0, .offset = index * 64, .length = 64},
+            .dimensions = std::vector<uint32_t>(kRank, 2)};
+}
+
+// A request with `numOperands` inputs and as many outputs, all in a single pool.
+Request makeRequest(uint32_t numOperands) {
+    std::vector<RequestArgument> inputs, outputs;
+    for (uint32_t i = 0; i < numOperands; ++i) {
+        inputs.push_back(makeArgument(i));
+        outputs.push_back(makeArgument(numOperands + i));
+    }
+    return {.inputs = inputs, .outputs = outputs, .pools = {}};
+}
+
+std::vector<OutputShape> makeOutputShapes(uint32_t numOperands) {
+    return std::vector<OutputShape>(
+            numOperands, {.dimensions = std::vector<uint32_t>(kRank, 2), .isSufficient = true});
+}
+
+// The four ends of a burst's request and result channels, as the controller and server each
+// hold them.
+struct Channels {
+    std::unique_ptr<RequestChannelSender> requestSender;
+    std::unique_ptr<RequestChannelReceiver> requestReceiver;
+    std::unique_ptr<ResultChannelSender> resultSender;
+    std::unique_ptr<ResultChannelReceiver> resultReceiver;
+};
+
+Channels createChannels() {
+    auto [requestSender, requestDescriptor] =
+            RequestChannelSender::create(kExecutionBurstChannelLength).value();
+    auto [resultReceiver, resultDescriptor] =
+            ResultChannelReceiver::create(kExecutionBurstChannelLength, kPollingTimeWindow)
+                    .value();
+    auto requestReceiver =
+            RequestChannelReceiver::create(*requestDescriptor, kPollingTimeWindow).value();
+    auto resultSender = ResultChannelSender::create(*resultDescriptor).value();
+    return {.requestSender = std::move(requestSender),
+            .requestReceiver = std::move(requestReceiver),
+            .resultSender = std::move(resultSender),
+            .resultReceiver = std::move(resultReceiver)};
+}
+
+// Runs `serve` on a separate thread in place of the burst server, and `execute` once per benchmark
+// iteration in place of the burst controller.
+template <typename Serve, typename Execute>
+void runRoundTrip(benchmark::State& state, const Serve& serve, const Execute& execute) {
+    const uint32_t numOperands = state.range(0);
+    const Request request = makeRequest(numOperands);
+    const std::vector<OutputShape> outputShapes = makeOutputShapes(numOperands);
+    const std::vector<int32_t> slots = {0};
+    Channels channels = createChannels();
+
+    std::thread server([&channels, &outputShapes, &serve] {
+        while (serve(&channels, outputShapes)) {
+        }
+    });
+
+    for (auto _ : state) {
+        if (!execute(&channels, request, slots)) {
+            state.SkipWithError("burst round trip failed");
+            break;
+        }
+    }
+
+    channels.requestReceiver->invalidate();
+    server.join();
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Packets are serialized straight into and parsed straight out of the FMQs.
+void BM_BurstRoundTrip(benchmark::State& state) {
+    const auto serve = [](Channels* channels, const std::vector<OutputShape>& outputShapes) {
+        const auto arguments = channels->requestReceiver->getBlocking();
+        if (!arguments.has_value()) {
+            return false;
+        }
+        channels->resultSender->send(ErrorStatus::NONE, outputShapes, kNoTiming);
+        return true;
+    };
+    const auto execute = [](Channels* channels, const Request& request,
+                            const std::vector<int32_t>& slots) {
+        if (!channels->requestSender->send(request, MeasureTiming::NO, slots).ok()) {
+            return false;
+        }
+        const auto result = channels->resultReceiver->getBlocking();
+        benchmark::DoNotOptimize(result);
+        return result.has_value();
+    };
+    runRoundTrip(state, serve, execute);
+}
+
+// Packets are staged in vectors wherever the channels still accept or return them, for comparison
+// with BM_BurstRoundTrip. Requests are always parsed straight out of the FMQ.
+void BM_BurstRoundTripStaged(benchmark::State& state) {
+    const auto serve = [](Channels* channels, const std::vector<OutputShape>& outputShapes) {
+        const auto arguments = channels->requestReceiver->getBlocking();
+        if (!arguments.has_value()) {
+            return false;
+        }
+        channels->resultSender->sendPacket(serialize(ErrorStatus::NONE, outputShapes, kNoTiming));
+        return true;
+    };
+    const auto execute = [](Channels* channels, const Request& request,
+                            const std::vector<int32_t>& slots) {
+        const auto packet = serialize(request, MeasureTiming::NO, slots);
+        if (!channels->requestSender->sendPacket(packet).ok()) {
+            return false;
+        }
+        const auto resultPacket = channels->resultReceiver->getPacketBlocking();
+        if (!resultPacket.has_value()) {
+            return false;
+        }
+        const auto result = deserialize(resultPacket.value());
+        benchmark::DoNotOptimize(result);
+        return result.has_value();
+    };
+    runRoundTrip(state, serve, execute);
+}
+
+BENCHMARK(BM_BurstRoundTrip)->RangeMultiplier(2)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_BurstRoundTripStaged)->RangeMultiplier(2)->Range(1, 64)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
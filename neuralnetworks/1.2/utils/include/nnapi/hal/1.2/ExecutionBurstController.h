@@ -188,6 +188,20 @@ class ExecutionBurstController final
             const hal::utils::RequestRelocation& relocation, FallbackFunction fallback) const;
 
   private:
+    // Same as the public executeInternal, except that the request is serialized directly into the
+    // request channel instead of being sent as a packet that was serialized up front.
+    nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> executeInternal(
+            const V1_0::Request& requestWithoutPools, MeasureTiming measure,
+            const std::vector<int32_t>& slots, const hal::utils::RequestRelocation& relocation,
+            FallbackFunction fallback) const;
+
+    // Shared implementation of both executeInternal overloads. `sendRequest` sends the request on
+    // mRequestChannelSender and returns its status.
+    template <typename SendRequest>
+    nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> executeInternal(
+            const SendRequest& sendRequest, const hal::utils::RequestRelocation& relocation,
+            FallbackFunction fallback) const;
+
     mutable std::atomic_flag mExecutionInFlight = ATOMIC_FLAG_INIT;
     const nn::SharedPreparedModel kPreparedModel;
     const std::unique_ptr<RequestChannelSender> mRequestChannelSender;
@@ -195,6 +209,7 @@ class ExecutionBurstController final
     const sp<ExecutionBurstCallback> mBurstCallback;
     const sp<IBurstContext> mBurstContext;
     const std::shared_ptr<MemoryCache> mMemoryCache;
+    const hal::utils::RequestRelocationPool kRelocationPool;
     // `kDeathHandler` must come after `mRequestChannelSender` and `mResultChannelReceiver` because
     // it holds references to both objects.
     const neuralnetworks::utils::DeathHandler kDeathHandler;
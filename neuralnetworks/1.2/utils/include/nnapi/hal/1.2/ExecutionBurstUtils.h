@@ -19,6 +19,7 @@
 
 #include <android/hardware/neuralnetworks/1.0/types.h>
 #include <android/hardware/neuralnetworks/1.2/types.h>
+#include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
 #include <hidl/MQDescriptor.h>
 #include <nnapi/Result.h>
@@ -57,6 +58,14 @@ std::chrono::microseconds getBurstControllerPollingTimeWindow();
  */
 std::chrono::microseconds getBurstServerPollingTimeWindow();
 
+/**
+ * Deleter that releases an EventFlag created by EventFlag::createEventFlag.
+ */
+struct EventFlagDeleter {
+    void operator()(EventFlag* eventFlag) const;
+};
+using UniqueEventFlag = std::unique_ptr<EventFlag, EventFlagDeleter>;
+
 /**
  * Function to serialize a request.
  *
@@ -126,6 +135,8 @@ class RequestChannelSender final : public neuralnetworks::utils::IProtectedCallb
     /**
      * Send the request to the channel.
      *
+     * The request is serialized directly into the FMQ's memory, without staging the packet.
+     *
      * @param request Request object without the pool information.
      * @param measure Whether to collect timing information for the execution.
      * @param slots Slot identifiers corresponding to memory resources for the request.
@@ -147,6 +158,7 @@ class RequestChannelSender final : public neuralnetworks::utils::IProtectedCallb
 
   private:
     MessageQueue<FmqRequestDatum, kSynchronizedReadWrite> mFmqRequestChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mValid{true};
 };
 
@@ -181,6 +193,8 @@ class RequestChannelReceiver final {
      * 1) The packet has been retrieved, or
      * 2) The receiver has been invalidated
      *
+     * The packet is parsed directly from the FMQ's memory, without staging it.
+     *
      * @return Request object if successfully received, an appropriate message if error or if the
      *     receiver object was invalidated.
      */
@@ -197,9 +211,8 @@ class RequestChannelReceiver final {
                            std::chrono::microseconds pollingTimeWindow);
 
   private:
-    nn::Result<std::vector<FmqRequestDatum>> getPacketBlocking();
-
     MessageQueue<FmqRequestDatum, kSynchronizedReadWrite> mFmqRequestChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mTeardown{false};
     const std::chrono::microseconds kPollingTimeWindow;
 };
@@ -224,6 +237,8 @@ class ResultChannelSender final {
     /**
      * Send the result to the channel.
      *
+     * The result is serialized directly into the FMQ's memory, without staging the packet.
+     *
      * @param errorStatus Status of the execution.
      * @param outputShapes Dynamic shapes of the output tensors.
      * @param timing Timing information of the execution.
@@ -239,6 +254,7 @@ class ResultChannelSender final {
 
   private:
     MessageQueue<FmqResultDatum, kSynchronizedReadWrite> mFmqResultChannel;
+    UniqueEventFlag mEventFlag;
 };
 
 /**
@@ -273,6 +289,8 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
      * 1) The packet has been retrieved, or
      * 2) The receiver has been invalidated
      *
+     * The packet is parsed directly from the FMQ's memory, without staging it.
+     *
      * @return Result object if successfully received, otherwise an appropriate message if error or
      *     if the receiver object was invalidated.
      */
@@ -292,6 +310,7 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
 
   private:
     MessageQueue<FmqResultDatum, kSynchronizedReadWrite> mFmqResultChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mValid{true};
     const std::chrono::microseconds kPollingTimeWindow;
 };
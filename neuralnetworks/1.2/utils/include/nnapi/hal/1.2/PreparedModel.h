@@ -79,6 +79,7 @@ class PreparedModel final : public nn::IPreparedModel,
     const bool kExecuteSynchronously;
     const sp<V1_2::IPreparedModel> kPreparedModel;
     const hal::utils::DeathHandler kDeathHandler;
+    const hal::utils::RequestRelocationPool kRelocationPool;
 };
 
 }  // namespace android::hardware::neuralnetworks::V1_2::utils
@@ -326,8 +326,8 @@ ExecutionBurstController::execute(const nn::Request& request, nn::MeasureTiming
     // ensure that request is ready for IPC
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared =
-            NN_TRY(hal::utils::makeExecutionFailure(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(
+            hal::utils::makeExecutionFailure(kRelocationPool.convertRequestFromPointerToShared(
                     &request, nn::kDefaultRequestMemoryAlignment, nn::kMinMemoryPadding,
                     &maybeRequestInShared, &relocation)));
 
@@ -349,11 +349,10 @@ ExecutionBurstController::execute(const nn::Request& request, nn::MeasureTiming
     }
 
     // send request packet
-    const auto requestPacket = serialize(hidlRequest, hidlMeasure, slots);
     const auto fallback = [this, &request, measure, &deadline, &loopTimeoutDuration] {
         return kPreparedModel->execute(request, measure, deadline, loopTimeoutDuration);
     };
-    return executeInternal(requestPacket, relocation, fallback);
+    return executeInternal(hidlRequest, hidlMeasure, slots, relocation, fallback);
 }
 
 // See IBurst::createReusableExecution for information on this method.
@@ -373,7 +372,7 @@ nn::GeneralResult<nn::SharedExecution> ExecutionBurstController::createReusableE
     // ensure that request is ready for IPC
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(kRelocationPool.convertRequestFromPointerToShared(
             &request, nn::kDefaultRequestMemoryAlignment, nn::kMinMemoryPadding,
             &maybeRequestInShared, &relocation));
 
@@ -402,6 +401,28 @@ nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>>
 ExecutionBurstController::executeInternal(const std::vector<FmqRequestDatum>& requestPacket,
                                           const hal::utils::RequestRelocation& relocation,
                                           FallbackFunction fallback) const {
+    const auto sendRequest = [this, &requestPacket] {
+        return mRequestChannelSender->sendPacket(requestPacket);
+    };
+    return executeInternal(sendRequest, relocation, std::move(fallback));
+}
+
+nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>>
+ExecutionBurstController::executeInternal(const V1_0::Request& requestWithoutPools,
+                                          MeasureTiming measure, const std::vector<int32_t>& slots,
+                                          const hal::utils::RequestRelocation& relocation,
+                                          FallbackFunction fallback) const {
+    const auto sendRequest = [this, &requestWithoutPools, measure, &slots] {
+        return mRequestChannelSender->send(requestWithoutPools, measure, slots);
+    };
+    return executeInternal(sendRequest, relocation, std::move(fallback));
+}
+
+template <typename SendRequest>
+nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>>
+ExecutionBurstController::executeInternal(const SendRequest& sendRequest,
+                                          const hal::utils::RequestRelocation& relocation,
+                                          FallbackFunction fallback) const {
     NNTRACE_FULL(NNTRACE_LAYER_IPC, NNTRACE_PHASE_EXECUTION,
                  "ExecutionBurstController::executeInternal");
 
@@ -417,7 +438,7 @@ ExecutionBurstController::executeInternal(const std::vector<FmqRequestDatum>& re
     }
 
     // send request packet
-    const auto sendStatus = mRequestChannelSender->sendPacket(requestPacket);
+    const auto sendStatus = sendRequest();
     if (!sendStatus.ok()) {
         // fallback to another execution path if the packet could not be sent
         if (fallback) {
@@ -23,15 +23,21 @@
 #include <android/hardware/neuralnetworks/1.0/types.h>
 #include <android/hardware/neuralnetworks/1.1/types.h>
 #include <android/hardware/neuralnetworks/1.2/types.h>
+#include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
 #include <hidl/MQDescriptor.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/ProtectCallback.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <new>
 #include <thread>
 #include <tuple>
 #include <utility>
@@ -66,10 +72,92 @@ std::chrono::microseconds getBurstServerPollingTimeWindow() {
     return getPollingTimeWindow("debug.nn.burst-server-polling-window");
 }
 
-// serialize a request into a packet
-std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::MeasureTiming measure,
-                                       const std::vector<int32_t>& slots) {
-    // count how many elements need to be sent for a request
+namespace {
+
+using FmqRequestChannel = MessageQueue<FmqRequestDatum, kSynchronizedReadWrite>;
+
+// Bits used by MessageQueue::readBlocking and MessageQueue::writeBlocking. The in-place reads and
+// writes below signal the same bits so that they interoperate with the blocking calls on the other
+// end of the channel.
+constexpr uint32_t kFmqNotEmpty =
+        static_cast<uint32_t>(FmqRequestChannel::EventFlagBits::FMQ_NOT_EMPTY);
+constexpr uint32_t kFmqNotFull =
+        static_cast<uint32_t>(FmqRequestChannel::EventFlagBits::FMQ_NOT_FULL);
+
+// Hands out the elements of a packet being serialized by appending them to a vector.
+template <typename Datum>
+class VectorSink {
+  public:
+    explicit VectorSink(std::vector<Datum>* data) : mData(data) {}
+    Datum* next() { return &mData->emplace_back(); }
+
+  private:
+    std::vector<Datum>* const mData;
+};
+
+// Hands out the elements of a packet being serialized directly from the FMQ memory of a write
+// transaction, so that nothing is staged in between.
+template <typename Datum>
+class TransactionSink {
+  public:
+    using MemTransaction = typename MessageQueue<Datum, kSynchronizedReadWrite>::MemTransaction;
+    explicit TransactionSink(const MemTransaction& transaction) : kTransaction(transaction) {}
+    Datum* next() {
+        const auto& first = kTransaction.getFirstRegion();
+        Datum* slot = mIndex < first.getLength()
+                              ? first.getAddress() + mIndex
+                              : kTransaction.getSecondRegion().getAddress() +
+                                        (mIndex - first.getLength());
+        ++mIndex;
+        // The slot holds whatever was last written there. Construct a fresh element so that
+        // setting its value does not try to destroy a stale union member.
+        return new (slot) Datum();
+    }
+
+  private:
+    const MemTransaction& kTransaction;
+    size_t mIndex = 0;
+};
+
+// Read-only view of a received packet.
+template <typename Datum>
+class VectorSource {
+  public:
+    explicit VectorSource(const std::vector<Datum>& data) : kData(data) {}
+    size_t size() const { return kData.size(); }
+    const Datum& operator[](size_t index) const { return kData[index]; }
+
+  private:
+    const std::vector<Datum>& kData;
+};
+
+// Read-only view of a packet still in the FMQ memory of a read transaction. Each element is copied
+// out exactly once before it is inspected, because the other end of the channel may still modify
+// the shared memory while it is being parsed.
+template <typename Datum>
+class TransactionSource {
+  public:
+    using MemTransaction = typename MessageQueue<Datum, kSynchronizedReadWrite>::MemTransaction;
+    TransactionSource(const MemTransaction& transaction, size_t size)
+        : kTransaction(transaction), kSize(size) {}
+    size_t size() const { return kSize; }
+    Datum operator[](size_t index) const {
+        const auto& first = kTransaction.getFirstRegion();
+        const Datum* slot = index < first.getLength()
+                                    ? first.getAddress() + index
+                                    : kTransaction.getSecondRegion().getAddress() +
+                                              (index - first.getLength());
+        Datum datum;
+        std::memcpy(&datum, slot, sizeof(datum));
+        return datum;
+    }
+
+  private:
+    const MemTransaction& kTransaction;
+    const size_t kSize;
+};
+
+size_t getSerializedSize(const V1_0::Request& request, const std::vector<int32_t>& slots) {
     size_t count = 2 + request.inputs.size() + request.outputs.size() + slots.size();
     for (const auto& input : request.inputs) {
         count += input.dimensions.size();
@@ -78,14 +166,23 @@ std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::Measu
         count += output.dimensions.size();
     }
     CHECK_LE(count, std::numeric_limits<uint32_t>::max());
+    return count;
+}
 
-    // create buffer to temporarily store elements
-    std::vector<FmqRequestDatum> data;
-    data.reserve(count);
+size_t getSerializedSize(const std::vector<V1_2::OutputShape>& outputShapes) {
+    size_t count = 2 + outputShapes.size();
+    for (const auto& outputShape : outputShapes) {
+        count += outputShape.dimensions.size();
+    }
+    return count;
+}
 
+// serialize a request into a packet of `count` elements
+template <typename Sink>
+void serializeTo(const V1_0::Request& request, V1_2::MeasureTiming measure,
+                 const std::vector<int32_t>& slots, size_t count, Sink* sink) {
     // package packetInfo
-    data.emplace_back();
-    data.back().packetInformation(
+    sink->next()->packetInformation(
             {.packetSize = static_cast<uint32_t>(count),
              .numberOfInputOperands = static_cast<uint32_t>(request.inputs.size()),
              .numberOfOutputOperands = static_cast<uint32_t>(request.outputs.size()),
@@ -94,110 +191,86 @@ std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::Measu
     // package input data
     for (const auto& input : request.inputs) {
         // package operand information
-        data.emplace_back();
-        data.back().inputOperandInformation(
+        sink->next()->inputOperandInformation(
                 {.hasNoValue = input.hasNoValue,
                  .location = input.location,
                  .numberOfDimensions = static_cast<uint32_t>(input.dimensions.size())});
 
         // package operand dimensions
         for (uint32_t dimension : input.dimensions) {
-            data.emplace_back();
-            data.back().inputOperandDimensionValue(dimension);
+            sink->next()->inputOperandDimensionValue(dimension);
         }
     }
 
     // package output data
     for (const auto& output : request.outputs) {
         // package operand information
-        data.emplace_back();
-        data.back().outputOperandInformation(
+        sink->next()->outputOperandInformation(
                 {.hasNoValue = output.hasNoValue,
                  .location = output.location,
                  .numberOfDimensions = static_cast<uint32_t>(output.dimensions.size())});
 
         // package operand dimensions
         for (uint32_t dimension : output.dimensions) {
-            data.emplace_back();
-            data.back().outputOperandDimensionValue(dimension);
+            sink->next()->outputOperandDimensionValue(dimension);
         }
     }
 
     // package pool identifier
     for (int32_t slot : slots) {
-        data.emplace_back();
-        data.back().poolIdentifier(slot);
+        sink->next()->poolIdentifier(slot);
     }
 
     // package measureTiming
-    data.emplace_back();
-    data.back().measureTiming(measure);
-
-    CHECK_EQ(data.size(), count);
-
-    // return packet
-    return data;
+    sink->next()->measureTiming(measure);
 }
 
-// serialize result
-std::vector<FmqResultDatum> serialize(V1_0::ErrorStatus errorStatus,
-                                      const std::vector<V1_2::OutputShape>& outputShapes,
-                                      V1_2::Timing timing) {
-    // count how many elements need to be sent for a request
-    size_t count = 2 + outputShapes.size();
-    for (const auto& outputShape : outputShapes) {
-        count += outputShape.dimensions.size();
-    }
-
-    // create buffer to temporarily store elements
-    std::vector<FmqResultDatum> data;
-    data.reserve(count);
-
+// serialize result into a packet of `count` elements
+template <typename Sink>
+void serializeTo(V1_0::ErrorStatus errorStatus, const std::vector<V1_2::OutputShape>& outputShapes,
+                 V1_2::Timing timing, size_t count, Sink* sink) {
     // package packetInfo
-    data.emplace_back();
-    data.back().packetInformation({.packetSize = static_cast<uint32_t>(count),
-                                   .errorStatus = errorStatus,
-                                   .numberOfOperands = static_cast<uint32_t>(outputShapes.size())});
+    sink->next()->packetInformation(
+            {.packetSize = static_cast<uint32_t>(count),
+             .errorStatus = errorStatus,
+             .numberOfOperands = static_cast<uint32_t>(outputShapes.size())});
 
     // package output shape data
     for (const auto& operand : outputShapes) {
         // package operand information
-        data.emplace_back();
-        data.back().operandInformation(
+        sink->next()->operandInformation(
                 {.isSufficient = operand.isSufficient,
                  .numberOfDimensions = static_cast<uint32_t>(operand.dimensions.size())});
 
         // package operand dimensions
         for (uint32_t dimension : operand.dimensions) {
-            data.emplace_back();
-            data.back().operandDimensionValue(dimension);
+            sink->next()->operandDimensionValue(dimension);
         }
     }
 
     // package executionTiming
-    data.emplace_back();
-    data.back().executionTiming(timing);
-
-    CHECK_EQ(data.size(), count);
-
-    // return result
-    return data;
+    sink->next()->executionTiming(timing);
 }
 
 // deserialize request
-nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>> deserialize(
-        const std::vector<FmqRequestDatum>& data) {
+template <typename Source>
+nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
+deserializeRequest(const Source& data) {
     using discriminator = FmqRequestDatum::hidl_discriminator;
 
     size_t index = 0;
 
     // validate packet information
-    if (data.size() == 0 || data[index].getDiscriminator() != discriminator::packetInformation) {
+    if (data.size() == 0) {
+        return NN_ERROR() << "FMQ Request packet ill-formed";
+    }
+    const FmqRequestDatum packetDatum = data[index];
+    if (packetDatum.getDiscriminator() != discriminator::packetInformation) {
         return NN_ERROR() << "FMQ Request packet ill-formed";
     }
 
     // unpackage packet information
-    const FmqRequestDatum::PacketInformation& packetInfo = data[index].packetInformation();
+    const FmqRequestDatum::PacketInformation& packetInfo = packetDatum.packetInformation();
     index++;
     const uint32_t packetSize = packetInfo.packetSize;
     const uint32_t numberOfInputOperands = packetInfo.numberOfInputOperands;
@@ -209,109 +282,78 @@ nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
         return NN_ERROR() << "FMQ Request packet ill-formed";
     }
 
-    // unpackage input operands
-    std::vector<V1_0::RequestArgument> inputs;
-    inputs.reserve(numberOfInputOperands);
-    for (size_t operand = 0; operand < numberOfInputOperands; ++operand) {
-        // validate input operand information
-        if (data[index].getDiscriminator() != discriminator::inputOperandInformation) {
+    // Take the next element if it has the expected type. Each element is read only once.
+    const auto next = [&data, &index](discriminator expected) -> nn::Result<FmqRequestDatum> {
+        if (index >= data.size()) {
             return NN_ERROR() << "FMQ Request packet ill-formed";
         }
-
-        // unpackage operand information
-        const FmqRequestDatum::OperandInformation& operandInfo =
-                data[index].inputOperandInformation();
-        index++;
-        const bool hasNoValue = operandInfo.hasNoValue;
-        const V1_0::DataLocation location = operandInfo.location;
-        const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
-
-        // unpackage operand dimensions
-        std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
-        for (size_t i = 0; i < numberOfDimensions; ++i) {
-            // validate dimension
-            if (data[index].getDiscriminator() != discriminator::inputOperandDimensionValue) {
-                return NN_ERROR() << "FMQ Request packet ill-formed";
-            }
-
-            // unpackage dimension
-            const uint32_t dimension = data[index].inputOperandDimensionValue();
-            index++;
-
-            // store result
-            dimensions.push_back(dimension);
-        }
-
-        // store result
-        inputs.push_back(
-                {.hasNoValue = hasNoValue, .location = location, .dimensions = dimensions});
-    }
-
-    // unpackage output operands
-    std::vector<V1_0::RequestArgument> outputs;
-    outputs.reserve(numberOfOutputOperands);
-    for (size_t operand = 0; operand < numberOfOutputOperands; ++operand) {
-        // validate output operand information
-        if (data[index].getDiscriminator() != discriminator::outputOperandInformation) {
+        FmqRequestDatum datum = data[index];
+        if (datum.getDiscriminator() != expected) {
             return NN_ERROR() << "FMQ Request packet ill-formed";
         }
-
-        // unpackage operand information
-        const FmqRequestDatum::OperandInformation& operandInfo =
-                data[index].outputOperandInformation();
         index++;
-        const bool hasNoValue = operandInfo.hasNoValue;
-        const V1_0::DataLocation location = operandInfo.location;
-        const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
+        return datum;
+    };
 
-        // unpackage operand dimensions
-        std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
-        for (size_t i = 0; i < numberOfDimensions; ++i) {
-            // validate dimension
-            if (data[index].getDiscriminator() != discriminator::outputOperandDimensionValue) {
+    // unpackage operands
+    const auto unpackageOperands =
+            [&data, &next](uint32_t numberOfOperands, discriminator operandDiscriminator,
+                           discriminator dimensionDiscriminator)
+            -> nn::Result<hidl_vec<V1_0::RequestArgument>> {
+        // Every operand and dimension takes one element of the packet, which bounds the sizes
+        // allocated below.
+        if (numberOfOperands > data.size()) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
+        hidl_vec<V1_0::RequestArgument> operands(numberOfOperands);
+        for (auto& operand : operands) {
+            // unpackage operand information
+            const FmqRequestDatum operandDatum = NN_TRY(next(operandDiscriminator));
+            const FmqRequestDatum::OperandInformation& operandInfo =
+                    operandDiscriminator == discriminator::inputOperandInformation
+                            ? operandDatum.inputOperandInformation()
+                            : operandDatum.outputOperandInformation();
+            const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
+            if (numberOfDimensions > data.size()) {
                 return NN_ERROR() << "FMQ Request packet ill-formed";
             }
 
-            // unpackage dimension
-            const uint32_t dimension = data[index].outputOperandDimensionValue();
-            index++;
-
             // store result
-            dimensions.push_back(dimension);
+            operand.hasNoValue = operandInfo.hasNoValue;
+            operand.location = operandInfo.location;
+            operand.dimensions.resize(numberOfDimensions);
+
+            // unpackage operand dimensions
+            for (auto& dimension : operand.dimensions) {
+                const FmqRequestDatum dimensionDatum = NN_TRY(next(dimensionDiscriminator));
+                dimension = dimensionDiscriminator == discriminator::inputOperandDimensionValue
+                                    ? dimensionDatum.inputOperandDimensionValue()
+                                    : dimensionDatum.outputOperandDimensionValue();
+            }
         }
-
-        // store result
-        outputs.push_back(
-                {.hasNoValue = hasNoValue, .location = location, .dimensions = dimensions});
-    }
+        return operands;
+    };
+    auto inputs = NN_TRY(unpackageOperands(numberOfInputOperands,
+                                           discriminator::inputOperandInformation,
+                                           discriminator::inputOperandDimensionValue));
+    auto outputs = NN_TRY(unpackageOperands(numberOfOutputOperands,
+                                            discriminator::outputOperandInformation,
+                                            discriminator::outputOperandDimensionValue));
 
     // unpackage pools
+    if (numberOfPools > data.size()) {
+        return NN_ERROR() << "FMQ Request packet ill-formed";
+    }
     std::vector<int32_t> slots;
     slots.reserve(numberOfPools);
     for (size_t pool = 0; pool < numberOfPools; ++pool) {
-        // validate input operand information
-        if (data[index].getDiscriminator() != discriminator::poolIdentifier) {
-            return NN_ERROR() << "FMQ Request packet ill-formed";
-        }
-
-        // unpackage operand information
-        const int32_t poolId = data[index].poolIdentifier();
-        index++;
-
-        // store result
-        slots.push_back(poolId);
-    }
-
-    // validate measureTiming
-    if (data[index].getDiscriminator() != discriminator::measureTiming) {
-        return NN_ERROR() << "FMQ Request packet ill-formed";
+        const FmqRequestDatum poolDatum = NN_TRY(next(discriminator::poolIdentifier));
+        slots.push_back(poolDatum.poolIdentifier());
     }
 
     // unpackage measureTiming
-    const V1_2::MeasureTiming measure = data[index].measureTiming();
-    index++;
+    const FmqRequestDatum measureDatum = NN_TRY(next(discriminator::measureTiming));
+    const V1_2::MeasureTiming measure = measureDatum.measureTiming();
 
     // validate packet information
     if (index != packetSize) {
@@ -319,23 +361,29 @@ nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
     }
 
     // return request
-    V1_0::Request request = {.inputs = inputs, .outputs = outputs, .pools = {}};
+    V1_0::Request request = {
+            .inputs = std::move(inputs), .outputs = std::move(outputs), .pools = {}};
     return std::make_tuple(std::move(request), std::move(slots), measure);
 }
 
 // deserialize a packet into the result
-nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>> deserialize(
-        const std::vector<FmqResultDatum>& data) {
+template <typename Source>
+nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>>
+deserializeResult(const Source& data) {
     using discriminator = FmqResultDatum::hidl_discriminator;
     size_t index = 0;
 
     // validate packet information
-    if (data.size() == 0 || data[index].getDiscriminator() != discriminator::packetInformation) {
+    if (data.size() == 0) {
+        return NN_ERROR() << "FMQ Result packet ill-formed";
+    }
+    const FmqResultDatum packetDatum = data[index];
+    if (packetDatum.getDiscriminator() != discriminator::packetInformation) {
         return NN_ERROR() << "FMQ Result packet ill-formed";
     }
 
     // unpackage packet information
-    const FmqResultDatum::PacketInformation& packetInfo = data[index].packetInformation();
+    const FmqResultDatum::PacketInformation& packetInfo = packetDatum.packetInformation();
     index++;
     const uint32_t packetSize = packetInfo.packetSize;
     const V1_0::ErrorStatus errorStatus = packetInfo.errorStatus;
@@ -346,50 +394,45 @@ nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::T
         return NN_ERROR() << "FMQ Result packet ill-formed";
     }
 
-    // unpackage operands
-    std::vector<V1_2::OutputShape> outputShapes;
-    outputShapes.reserve(numberOfOperands);
-    for (size_t operand = 0; operand < numberOfOperands; ++operand) {
-        // validate operand information
-        if (data[index].getDiscriminator() != discriminator::operandInformation) {
+    // Take the next element if it has the expected type. Each element is read only once.
+    const auto next = [&data, &index](discriminator expected) -> nn::Result<FmqResultDatum> {
+        if (index >= data.size()) {
+            return NN_ERROR() << "FMQ Result packet ill-formed";
+        }
+        FmqResultDatum datum = data[index];
+        if (datum.getDiscriminator() != expected) {
             return NN_ERROR() << "FMQ Result packet ill-formed";
         }
+        index++;
+        return datum;
+    };
 
+    // unpackage operands
+    std::vector<V1_2::OutputShape> outputShapes;
+    outputShapes.reserve(std::min<size_t>(numberOfOperands, packetSize));
+    for (size_t operand = 0; operand < numberOfOperands; ++operand) {
         // unpackage operand information
-        const FmqResultDatum::OperandInformation& operandInfo = data[index].operandInformation();
-        index++;
+        const FmqResultDatum operandDatum = NN_TRY(next(discriminator::operandInformation));
+        const FmqResultDatum::OperandInformation& operandInfo = operandDatum.operandInformation();
         const bool isSufficient = operandInfo.isSufficient;
         const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
 
         // unpackage operand dimensions
         std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
+        dimensions.reserve(std::min<size_t>(numberOfDimensions, packetSize));
         for (size_t i = 0; i < numberOfDimensions; ++i) {
-            // validate dimension
-            if (data[index].getDiscriminator() != discriminator::operandDimensionValue) {
-                return NN_ERROR() << "FMQ Result packet ill-formed";
-            }
-
-            // unpackage dimension
-            const uint32_t dimension = data[index].operandDimensionValue();
-            index++;
-
-            // store result
-            dimensions.push_back(dimension);
+            const FmqResultDatum dimensionDatum =
+                    NN_TRY(next(discriminator::operandDimensionValue));
+            dimensions.push_back(dimensionDatum.operandDimensionValue());
         }
 
         // store result
-        outputShapes.push_back({.dimensions = dimensions, .isSufficient = isSufficient});
-    }
-
-    // validate execution timing
-    if (data[index].getDiscriminator() != discriminator::executionTiming) {
-        return NN_ERROR() << "FMQ Result packet ill-formed";
+        outputShapes.push_back({.dimensions = std::move(dimensions), .isSufficient = isSufficient});
     }
 
     // unpackage execution timing
-    const V1_2::Timing timing = data[index].executionTiming();
-    index++;
+    const FmqResultDatum timingDatum = NN_TRY(next(discriminator::executionTiming));
+    const V1_2::Timing timing = timingDatum.executionTiming();
 
     // validate packet information
     if (index != packetSize) {
@@ -400,6 +443,145 @@ nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::T
     return std::make_tuple(errorStatus, std::move(outputShapes), timing);
 }
 
+// Serialize a packet of `count` elements directly into the FMQ and wake up the reader. The caller
+// must have checked that `count` elements are available to write.
+template <typename Datum, typename Serializer>
+bool writeInPlace(MessageQueue<Datum, kSynchronizedReadWrite>* channel, EventFlag* eventFlag,
+                  size_t count, const Serializer& serializer) {
+    typename MessageQueue<Datum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!channel->beginWrite(count, &transaction)) {
+        return false;
+    }
+    TransactionSink<Datum> sink(transaction);
+    serializer(&sink);
+    if (!channel->commitWrite(count)) {
+        return false;
+    }
+    eventFlag->wake(kFmqNotEmpty);
+    return true;
+}
+
+// Wait until the FMQ has data to read, polling for up to `pollingTimeWindow` before blocking on
+// the EventFlag, the same way as MessageQueue::readBlocking. Returns the number of elements
+// available, or zero if `isValid` turned false.
+template <typename Datum, typename IsValid>
+size_t waitForData(MessageQueue<Datum, kSynchronizedReadWrite>* channel, EventFlag* eventFlag,
+                   std::chrono::microseconds pollingTimeWindow, const IsValid& isValid) {
+    // First spend time polling if data is available in FMQ instead of waiting on the futex.
+    // Polling is more responsive (yielding lower latencies), but can take up more power, so only
+    // poll for a limited period of time.
+    auto& getCurrentTime = std::chrono::high_resolution_clock::now;
+    const auto timeToStopPolling = getCurrentTime() + pollingTimeWindow;
+    while (getCurrentTime() < timeToStopPolling) {
+        if (!isValid()) {
+            return 0;
+        }
+        if (const size_t available = channel->availableToRead(); available > 0) {
+            return available;
+        }
+        std::this_thread::yield();
+    }
+
+    // If we get to this point, we either stopped polling because it was taking too long or polling
+    // was not allowed. Instead, perform a blocking call which uses a futex to save power.
+    while (true) {
+        if (!isValid()) {
+            return 0;
+        }
+        // NOTE: all of a packet is available as soon as any of it is. This is known because in
+        // FMQ, all writes are published (made available) atomically, and the producer always
+        // publishes the entire packet in one function call.
+        if (const size_t available = channel->availableToRead(); available > 0) {
+            return available;
+        }
+        uint32_t efState = 0;
+        const status_t status = eventFlag->wait(kFmqNotEmpty, &efState);
+        if (status != OK && status != -EINTR && status != -EAGAIN) {
+            LOG(ERROR) << "EventFlag::wait failed with " << status;
+            return 0;
+        }
+    }
+}
+
+// Parse the `count` elements at the front of the FMQ in place, then release them and wake up the
+// writer.
+template <typename Datum, typename Deserializer>
+auto readInPlace(MessageQueue<Datum, kSynchronizedReadWrite>* channel, EventFlag* eventFlag,
+                 size_t count, const Deserializer& deserializer)
+        -> decltype(deserializer(std::declval<const TransactionSource<Datum>&>())) {
+    typename MessageQueue<Datum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!channel->beginRead(count, &transaction)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+    auto result = deserializer(TransactionSource<Datum>(transaction, count));
+    if (!channel->commitRead(count)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+    eventFlag->wake(kFmqNotFull);
+    return result;
+}
+
+nn::GeneralResult<UniqueEventFlag> createEventFlag(std::atomic<uint32_t>* eventFlagWord) {
+    EventFlag* eventFlag = nullptr;
+    if (EventFlag::createEventFlag(eventFlagWord, &eventFlag) != OK || eventFlag == nullptr) {
+        return NN_ERROR() << "Unable to create EventFlag";
+    }
+    return UniqueEventFlag(eventFlag);
+}
+
+}  // namespace
+
+void EventFlagDeleter::operator()(EventFlag* eventFlag) const {
+    EventFlag::deleteEventFlag(&eventFlag);
+}
+
+// serialize a request into a packet
+std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::MeasureTiming measure,
+                                       const std::vector<int32_t>& slots) {
+    // count how many elements need to be sent for a request
+    const size_t count = getSerializedSize(request, slots);
+
+    // create buffer to temporarily store elements
+    std::vector<FmqRequestDatum> data;
+    data.reserve(count);
+    VectorSink<FmqRequestDatum> sink(&data);
+    serializeTo(request, measure, slots, count, &sink);
+    CHECK_EQ(data.size(), count);
+
+    // return packet
+    return data;
+}
+
+// serialize result
+std::vector<FmqResultDatum> serialize(V1_0::ErrorStatus errorStatus,
+                                      const std::vector<V1_2::OutputShape>& outputShapes,
+                                      V1_2::Timing timing) {
+    // count how many elements need to be sent for a request
+    const size_t count = getSerializedSize(outputShapes);
+
+    // create buffer to temporarily store elements
+    std::vector<FmqResultDatum> data;
+    data.reserve(count);
+    VectorSink<FmqResultDatum> sink(&data);
+    serializeTo(errorStatus, outputShapes, timing, count, &sink);
+    CHECK_EQ(data.size(), count);
+
+    // return result
+    return data;
+}
+
+// deserialize request
+nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>> deserialize(
+        const std::vector<FmqRequestDatum>& data) {
+    return deserializeRequest(VectorSource<FmqRequestDatum>(data));
+}
+
+// deserialize a packet into the result
+nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>> deserialize(
+        const std::vector<FmqResultDatum>& data) {
+    return deserializeResult(VectorSource<FmqResultDatum>(data));
+}
+
 // RequestChannelSender methods
 
 nn::GeneralResult<
@@ -410,6 +592,8 @@ RequestChannelSender::create(size_t channelLength) {
     if (!requestChannelSender->mFmqRequestChannel.isValid()) {
         return NN_ERROR() << "Unable to create RequestChannelSender";
     }
+    requestChannelSender->mEventFlag =
+            NN_TRY(createEventFlag(requestChannelSender->mFmqRequestChannel.getEventFlagWord()));
 
     const MQDescriptorSync<FmqRequestDatum>* descriptor =
             requestChannelSender->mFmqRequestChannel.getDesc();
@@ -422,8 +606,25 @@ RequestChannelSender::RequestChannelSender(PrivateConstructorTag /*tag*/, size_t
 nn::Result<void> RequestChannelSender::send(const V1_0::Request& request,
                                             V1_2::MeasureTiming measure,
                                             const std::vector<int32_t>& slots) {
-    const std::vector<FmqRequestDatum> serialized = serialize(request, measure, slots);
-    return sendPacket(serialized);
+    if (!mValid) {
+        return NN_ERROR() << "FMQ object is invalid";
+    }
+
+    const size_t count = getSerializedSize(request, slots);
+    if (count > mFmqRequestChannel.availableToWrite()) {
+        return NN_ERROR()
+               << "RequestChannelSender::send -- packet size exceeds size available in FMQ";
+    }
+
+    const bool success = writeInPlace(&mFmqRequestChannel, mEventFlag.get(), count,
+                                      [&](TransactionSink<FmqRequestDatum>* sink) {
+                                          serializeTo(request, measure, slots, count, sink);
+                                      });
+    if (!success) {
+        return NN_ERROR() << "RequestChannelSender::send -- unable to write to FMQ";
+    }
+
+    return {};
 }
 
 nn::Result<void> RequestChannelSender::sendPacket(const std::vector<FmqRequestDatum>& packet) {
@@ -466,6 +667,8 @@ nn::GeneralResult<std::unique_ptr<RequestChannelReceiver>> RequestChannelReceive
         return NN_ERROR()
                << "RequestChannelReceiver::create was passed an MQDescriptor without an EventFlag";
     }
+    requestChannelReceiver->mEventFlag =
+            NN_TRY(createEventFlag(requestChannelReceiver->mFmqRequestChannel.getEventFlagWord()));
 
     return requestChannelReceiver;
 }
@@ -477,8 +680,22 @@ RequestChannelReceiver::RequestChannelReceiver(
 
 nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
 RequestChannelReceiver::getBlocking() {
-    const auto packet = NN_TRY(getPacketBlocking());
-    return deserialize(packet);
+    const auto isValid = [this] { return !mTeardown.load(std::memory_order_relaxed); };
+    const size_t count =
+            waitForData(&mFmqRequestChannel, mEventFlag.get(), kPollingTimeWindow, isValid);
+
+    // terminate loop
+    if (mTeardown) {
+        return NN_ERROR() << "FMQ object is being torn down";
+    }
+    if (count == 0) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+
+    return readInPlace(&mFmqRequestChannel, mEventFlag.get(), count,
+                       [](const TransactionSource<FmqRequestDatum>& data) {
+                           return deserializeRequest(data);
+                       });
 }
 
 void RequestChannelReceiver::invalidate() {
@@ -492,69 +709,6 @@ void RequestChannelReceiver::invalidate() {
     mFmqRequestChannel.writeBlocking(data.data(), data.size());
 }
 
-nn::Result<std::vector<FmqRequestDatum>> RequestChannelReceiver::getPacketBlocking() {
-    if (mTeardown) {
-        return NN_ERROR() << "FMQ object is being torn down";
-    }
-
-    // First spend time polling if results are available in FMQ instead of waiting on the futex.
-    // Polling is more responsive (yielding lower latencies), but can take up more power, so only
-    // poll for a limited period of time.
-
-    auto& getCurrentTime = std::chrono::high_resolution_clock::now;
-    const auto timeToStopPolling = getCurrentTime() + kPollingTimeWindow;
-
-    while (getCurrentTime() < timeToStopPolling) {
-        // if class is being torn down, immediately return
-        if (mTeardown.load(std::memory_order_relaxed)) {
-            return NN_ERROR() << "FMQ object is being torn down";
-        }
-
-        // Check if data is available. If it is, immediately retrieve it and return.
-        const size_t available = mFmqRequestChannel.availableToRead();
-        if (available > 0) {
-            std::vector<FmqRequestDatum> packet(available);
-            const bool success = mFmqRequestChannel.readBlocking(packet.data(), available);
-            if (!success) {
-                return NN_ERROR() << "Error receiving packet";
-            }
-            return packet;
-        }
-
-        std::this_thread::yield();
-    }
-
-    // If we get to this point, we either stopped polling because it was taking too long or polling
-    // was not allowed. Instead, perform a blocking call which uses a futex to save power.
-
-    // wait for request packet and read first element of request packet
-    FmqRequestDatum datum;
-    bool success = mFmqRequestChannel.readBlocking(&datum, 1);
-
-    // retrieve remaining elements
-    // NOTE: all of the data is already available at this point, so there's no need to do a blocking
-    // wait to wait for more data. This is known because in FMQ, all writes are published (made
-    // available) atomically. Currently, the producer always publishes the entire packet in one
-    // function call, so if the first element of the packet is available, the remaining elements are
-    // also available.
-    const size_t count = mFmqRequestChannel.availableToRead();
-    std::vector<FmqRequestDatum> packet(count + 1);
-    std::memcpy(&packet.front(), &datum, sizeof(datum));
-    success &= mFmqRequestChannel.read(packet.data() + 1, count);
-
-    // terminate loop
-    if (mTeardown) {
-        return NN_ERROR() << "FMQ object is being torn down";
-    }
-
-    // ensure packet was successfully received
-    if (!success) {
-        return NN_ERROR() << "Error receiving packet";
-    }
-
-    return packet;
-}
-
 // ResultChannelSender methods
 
 nn::GeneralResult<std::unique_ptr<ResultChannelSender>> ResultChannelSender::create(
@@ -569,6 +723,8 @@ nn::GeneralResult<std::unique_ptr<ResultChannelSender>> ResultChannelSender::cre
         return NN_ERROR()
                << "ResultChannelSender::create was passed an MQDescriptor without an EventFlag";
     }
+    resultChannelSender->mEventFlag =
+            NN_TRY(createEventFlag(resultChannelSender->mFmqResultChannel.getEventFlagWord()));
 
     return resultChannelSender;
 }
@@ -580,8 +736,25 @@ ResultChannelSender::ResultChannelSender(PrivateConstructorTag /*tag*/,
 void ResultChannelSender::send(V1_0::ErrorStatus errorStatus,
                                const std::vector<V1_2::OutputShape>& outputShapes,
                                V1_2::Timing timing) {
-    const std::vector<FmqResultDatum> serialized = serialize(errorStatus, outputShapes, timing);
-    sendPacket(serialized);
+    const auto write = [this](V1_0::ErrorStatus status,
+                              const std::vector<V1_2::OutputShape>& shapes, V1_2::Timing time) {
+        const size_t count = getSerializedSize(shapes);
+        return writeInPlace(&mFmqResultChannel, mEventFlag.get(), count,
+                            [&](TransactionSink<FmqResultDatum>* sink) {
+                                serializeTo(status, shapes, time, count, sink);
+                            });
+    };
+
+    bool success;
+    if (getSerializedSize(outputShapes) > mFmqResultChannel.availableToWrite()) {
+        LOG(ERROR) << "ResultChannelSender::send -- packet size exceeds size available in FMQ";
+        success = write(V1_0::ErrorStatus::GENERAL_FAILURE, {}, kNoTiming);
+    } else {
+        success = write(errorStatus, outputShapes, timing);
+    }
+    if (!success) {
+        LOG(ERROR) << "ResultChannelSender::send -- unable to write to FMQ";
+    }
 }
 
 void ResultChannelSender::sendPacket(const std::vector<FmqResultDatum>& packet) {
@@ -611,6 +784,8 @@ ResultChannelReceiver::create(size_t channelLength, std::chrono::microseconds po
     if (!resultChannelReceiver->mFmqResultChannel.isValid()) {
         return NN_ERROR() << "Unable to create ResultChannelReceiver";
     }
+    resultChannelReceiver->mEventFlag =
+            NN_TRY(createEventFlag(resultChannelReceiver->mFmqResultChannel.getEventFlagWord()));
 
     const MQDescriptorSync<FmqResultDatum>* descriptor =
             resultChannelReceiver->mFmqResultChannel.getDesc();
@@ -624,8 +799,21 @@ ResultChannelReceiver::ResultChannelReceiver(PrivateConstructorTag /*tag*/, size
 
 nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>>
 ResultChannelReceiver::getBlocking() {
-    const auto packet = NN_TRY(getPacketBlocking());
-    return deserialize(packet);
+    const auto isValid = [this] { return mValid.load(std::memory_order_relaxed); };
+    const size_t count =
+            waitForData(&mFmqResultChannel, mEventFlag.get(), kPollingTimeWindow, isValid);
+
+    if (!mValid) {
+        return NN_ERROR() << "FMQ object is invalid";
+    }
+    if (count == 0) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+
+    return readInPlace(&mFmqResultChannel, mEventFlag.get(), count,
+                       [](const TransactionSource<FmqResultDatum>& data) {
+                           return deserializeResult(data);
+                       });
 }
 
 void ResultChannelReceiver::notifyAsDeadObject() {
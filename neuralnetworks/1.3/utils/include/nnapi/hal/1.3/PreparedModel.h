@@ -88,6 +88,7 @@ class PreparedModel final : public nn::IPreparedModel,
     const bool kExecuteSynchronously;
     const sp<V1_3::IPreparedModel> kPreparedModel;
     const hal::utils::DeathHandler kDeathHandler;
+    const hal::utils::RequestRelocationPool kRelocationPool;
 };
 
 }  // namespace android::hardware::neuralnetworks::V1_3::utils
@@ -141,8 +141,8 @@ nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> Prepare
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared =
-            NN_TRY(hal::utils::makeExecutionFailure(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(
+            hal::utils::makeExecutionFailure(kRelocationPool.convertRequestFromPointerToShared(
                     &request, nn::kDefaultRequestMemoryAlignment, nn::kMinMemoryPadding,
                     &maybeRequestInShared, &relocation)));
 
@@ -184,7 +184,7 @@ PreparedModel::executeFenced(const nn::Request& request, const std::vector<nn::S
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(kRelocationPool.convertRequestFromPointerToShared(
             &request, nn::kDefaultRequestMemoryAlignment, nn::kMinMemoryPadding,
             &maybeRequestInShared, &relocation));
 
@@ -237,7 +237,7 @@ nn::GeneralResult<nn::SharedExecution> PreparedModel::createReusableExecution(
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(kRelocationPool.convertRequestFromPointerToShared(
             &request, nn::kDefaultRequestMemoryAlignment, nn::kMinMemoryPadding,
             &maybeRequestInShared, &relocation));
 
@@ -114,6 +114,7 @@ class Burst final : public nn::IBurst, public std::enable_shared_from_this<Burst
     mutable std::atomic_flag mExecutionInFlight = ATOMIC_FLAG_INIT;
     const std::shared_ptr<aidl_hal::IBurst> kBurst;
     const std::shared_ptr<MemoryCache> kMemoryCache;
+    const hal::utils::RequestRelocationPool kRelocationPool;
 };
 
 }  // namespace aidl::android::hardware::neuralnetworks::utils
@@ -78,6 +78,7 @@ class PreparedModel final : public nn::IPreparedModel,
 
   private:
     const std::shared_ptr<aidl_hal::IPreparedModel> kPreparedModel;
+    const hal::utils::RequestRelocationPool kRelocationPool;
 };
 
 }  // namespace aidl::android::hardware::neuralnetworks::utils
@@ -176,8 +176,8 @@ nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> Burst::
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared =
-            NN_TRY(hal::utils::makeExecutionFailure(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(
+            hal::utils::makeExecutionFailure(kRelocationPool.convertRequestFromPointerToShared(
                     &request, nn::kDefaultRequestMemoryAlignment, nn::kDefaultRequestMemoryPadding,
                     &maybeRequestInShared, &relocation)));
 
@@ -248,7 +248,7 @@ nn::GeneralResult<nn::SharedExecution> Burst::createReusableExecution(
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(kRelocationPool.convertRequestFromPointerToShared(
             &request, nn::kDefaultRequestMemoryAlignment, nn::kDefaultRequestMemoryPadding,
             &maybeRequestInShared, &relocation));
 
@@ -60,7 +60,8 @@ sp<V1_3::IDevice> adapt(nn::SharedDevice device, Executor executor);
  * The IPreparedModel object created from IDevice::prepareModel or IDevice::preparedModelFromCache
  * must return "const nn::Model*" from IPreparedModel::getUnderlyingResource().
  *
- * This function uses a default executor, which will execute tasks from a detached thread.
+ * This function uses a default executor, which runs tasks on a process-wide ThreadPoolExecutor
+ * with one worker thread per CPU.
  *
  * @param device NNAPI canonical IDevice interface object to be adapted.
  * @return HIDL NN HAL IDevice interface object.
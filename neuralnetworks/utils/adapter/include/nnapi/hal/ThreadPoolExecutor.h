@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_ADAPTER_THREAD_POOL_EXECUTOR_H
+#define ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_ADAPTER_THREAD_POOL_EXECUTOR_H
+
+#include "nnapi/hal/Adapter.h"
+
+#include <nnapi/Types.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// See hardware/interfaces/neuralnetworks/utils/README.md for more information on HIDL interface
+// lifetimes across processes and for protecting asynchronous calls across HIDL.
+
+namespace android::hardware::neuralnetworks::adapter {
+
+/**
+ * An executor backed by a fixed number of worker threads.
+ *
+ * Queued tasks are kept per Application ID. Workers serve the Application IDs with queued tasks in
+ * round-robin order, so a client that submits many tasks at once cannot starve the others. Within
+ * one Application ID, tasks run in order of their deadline, and tasks without a deadline run after
+ * all tasks with one, in the order they were submitted.
+ *
+ * The number of queued tasks is bounded. When the queue is full, the task is run on the thread that
+ * submitted it instead, which pushes back on the client that is flooding the queue.
+ *
+ * This class is thread-safe. It is owned through std::shared_ptr, and the Executor returned by
+ * asExecutor() keeps it alive. Tasks that are already queued when the last reference goes away
+ * still run before the worker threads exit.
+ */
+class ThreadPoolExecutor final : public std::enable_shared_from_this<ThreadPoolExecutor> {
+    struct PrivateConstructorTag {};
+
+  public:
+    struct Metrics {
+        //! Number of tasks currently waiting for a worker.
+        size_t queueDepth = 0;
+        //! Largest number of tasks that have been waiting for a worker at once.
+        size_t maxQueueDepth = 0;
+        //! Number of tasks that have been handed to a worker.
+        uint64_t numTasksDequeued = 0;
+        //! Number of tasks run on the submitting thread because the queue was full.
+        uint64_t numTasksRunInline = 0;
+        //! Total and longest time tasks handed to a worker spent in the queue.
+        std::chrono::nanoseconds totalWaitTime{0};
+        std::chrono::nanoseconds maxWaitTime{0};
+    };
+
+    /**
+     * Create a thread pool executor.
+     *
+     * @param numThreads Number of worker threads. Must be at least 1.
+     * @param maxQueuedTasks Maximum number of tasks waiting for a worker. Must be at least 1.
+     * @return The executor.
+     */
+    static std::shared_ptr<ThreadPoolExecutor> create(size_t numThreads, size_t maxQueuedTasks);
+
+    ThreadPoolExecutor(PrivateConstructorTag tag, size_t numThreads, size_t maxQueuedTasks);
+    ~ThreadPoolExecutor();
+
+    /**
+     * Queue a task to be run by a worker thread, or run it on the calling thread if the queue is
+     * full.
+     */
+    void execute(Task task, uid_t userId, nn::OptionalTimePoint deadline);
+
+    /**
+     * Type-erased Executor that forwards to execute() and shares ownership of this object.
+     */
+    Executor asExecutor();
+
+    Metrics getMetrics() const;
+
+  private:
+    // Defined in ThreadPoolExecutor.cpp. Shared with the detached worker threads, so the last
+    // reference to this object may be dropped from within a task.
+    struct State;
+    const std::shared_ptr<State> kState;
+};
+
+/**
+ * The process-wide executor that adapt(nn::SharedDevice) runs tasks on, e.g. to report its metrics.
+ *
+ * @return The executor, which lives until the process exits.
+ */
+const std::shared_ptr<ThreadPoolExecutor>& getDefaultThreadPoolExecutor();
+
+}  // namespace android::hardware::neuralnetworks::adapter
+
+#endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_ADAPTER_THREAD_POOL_EXECUTOR_H
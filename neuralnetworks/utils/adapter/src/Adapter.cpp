@@ -17,12 +17,14 @@
 #include "Adapter.h"
 
 #include "Device.h"
+#include "ThreadPoolExecutor.h"
 
 #include <android/hardware/neuralnetworks/1.3/IDevice.h>
 #include <nnapi/IDevice.h>
 #include <nnapi/Types.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <thread>
@@ -31,16 +33,29 @@
 // lifetimes across processes and for protecting asynchronous calls across HIDL.
 
 namespace android::hardware::neuralnetworks::adapter {
+namespace {
+
+// Tasks queued beyond this many are run on the calling binder thread instead.
+constexpr size_t kDefaultMaxQueuedTasks = 64;
+
+}  // namespace
+
+// Shared by every device adapted with the default executor, so that the per-Application ID
+// fairness applies across all of them.
+const std::shared_ptr<ThreadPoolExecutor>& getDefaultThreadPoolExecutor() {
+    static const auto executor = [] {
+        const size_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        return ThreadPoolExecutor::create(numThreads, kDefaultMaxQueuedTasks);
+    }();
+    return executor;
+}
 
 sp<V1_3::IDevice> adapt(nn::SharedDevice device, Executor executor) {
     return sp<Device>::make(std::move(device), std::move(executor));
 }
 
 sp<V1_3::IDevice> adapt(nn::SharedDevice device) {
-    Executor defaultExecutor = [](Task task, uid_t /*uid*/, nn::OptionalTimePoint /*deadline*/) {
-        std::thread(std::move(task)).detach();
-    };
-    return adapt(std::move(device), std::move(defaultExecutor));
+    return adapt(std::move(device), getDefaultThreadPoolExecutor()->asExecutor());
 }
 
 }  // namespace android::hardware::neuralnetworks::adapter
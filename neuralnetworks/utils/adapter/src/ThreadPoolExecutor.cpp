@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadPoolExecutor.h"
+
+#include <android-base/logging.h>
+#include <android-base/thread_annotations.h>
+#include <nnapi/Types.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// See hardware/interfaces/neuralnetworks/utils/README.md for more information on HIDL interface
+// lifetimes across processes and for protecting asynchronous calls across HIDL.
+
+namespace android::hardware::neuralnetworks::adapter {
+namespace {
+
+using QueueClock = std::chrono::steady_clock;
+
+struct QueuedTask {
+    Task task;
+    nn::OptionalTimePoint deadline;
+    uint64_t sequenceNumber;
+    QueueClock::time_point queueTime;
+};
+
+// Heap comparator that puts the most urgent task at the front: earliest deadline first, tasks
+// without a deadline last, and submission order among equals.
+bool isLessUrgent(const QueuedTask& lhs, const QueuedTask& rhs) {
+    if (lhs.deadline.has_value() != rhs.deadline.has_value()) {
+        return !lhs.deadline.has_value();
+    }
+    if (lhs.deadline.has_value() && *lhs.deadline != *rhs.deadline) {
+        return *lhs.deadline > *rhs.deadline;
+    }
+    return lhs.sequenceNumber > rhs.sequenceNumber;
+}
+
+}  // namespace
+
+struct ThreadPoolExecutor::State {
+    explicit State(size_t maxQueuedTasks) : kMaxQueuedTasks(maxQueuedTasks) {}
+
+    // Returns false if the task was not queued because the queue is full.
+    bool push(Task* task, uid_t userId, nn::OptionalTimePoint deadline);
+    void runWorker();
+    void stop();
+
+    const size_t kMaxQueuedTasks;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    // Heap of queued tasks per Application ID, ordered by isLessUrgent. Entries are erased as soon
+    // as they become empty, so the map only grows with the number of clients that are waiting.
+    std::unordered_map<uid_t, std::vector<QueuedTask>> mQueues GUARDED_BY(mMutex);
+    // Application IDs that have queued tasks, in the order they will next be served.
+    std::deque<uid_t> mReadyUsers GUARDED_BY(mMutex);
+    uint64_t mNextSequenceNumber GUARDED_BY(mMutex) = 0;
+    bool mStopping GUARDED_BY(mMutex) = false;
+    Metrics mMetrics GUARDED_BY(mMutex);
+};
+
+bool ThreadPoolExecutor::State::push(Task* task, uid_t userId, nn::OptionalTimePoint deadline) {
+    {
+        std::lock_guard guard(mMutex);
+        if (mMetrics.queueDepth >= kMaxQueuedTasks) {
+            ++mMetrics.numTasksRunInline;
+            return false;
+        }
+        auto& queue = mQueues[userId];
+        if (queue.empty()) {
+            mReadyUsers.push_back(userId);
+        }
+        queue.push_back({.task = std::move(*task),
+                         .deadline = deadline,
+                         .sequenceNumber = mNextSequenceNumber++,
+                         .queueTime = QueueClock::now()});
+        std::push_heap(queue.begin(), queue.end(), isLessUrgent);
+        ++mMetrics.queueDepth;
+        mMetrics.maxQueueDepth = std::max(mMetrics.maxQueueDepth, mMetrics.queueDepth);
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+void ThreadPoolExecutor::State::runWorker() {
+    std::unique_lock lock(mMutex);
+    while (true) {
+        while (!mStopping && mReadyUsers.empty()) {
+            mCondition.wait(lock);
+        }
+        if (mReadyUsers.empty()) {
+            // Only reached once stopping and every queued task has been run.
+            return;
+        }
+
+        // Take the most urgent task of the next Application ID in line, then move that Application
+        // ID to the back of the line if it still has tasks queued.
+        const uid_t userId = mReadyUsers.front();
+        mReadyUsers.pop_front();
+        const auto it = mQueues.find(userId);
+        CHECK(it != mQueues.end());
+        auto& queue = it->second;
+        std::pop_heap(queue.begin(), queue.end(), isLessUrgent);
+        QueuedTask queuedTask = std::move(queue.back());
+        queue.pop_back();
+        if (queue.empty()) {
+            mQueues.erase(it);
+        } else {
+            mReadyUsers.push_back(userId);
+        }
+
+        const auto waitTime = QueueClock::now() - queuedTask.queueTime;
+        --mMetrics.queueDepth;
+        ++mMetrics.numTasksDequeued;
+        mMetrics.totalWaitTime += waitTime;
+        mMetrics.maxWaitTime = std::max<std::chrono::nanoseconds>(mMetrics.maxWaitTime, waitTime);
+
+        lock.unlock();
+        queuedTask.task();
+        // Release whatever the task captured before taking the lock again.
+        queuedTask.task = nullptr;
+        lock.lock();
+    }
+}
+
+void ThreadPoolExecutor::State::stop() {
+    {
+        std::lock_guard guard(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+}
+
+std::shared_ptr<ThreadPoolExecutor> ThreadPoolExecutor::create(size_t numThreads,
+                                                               size_t maxQueuedTasks) {
+    return std::make_shared<ThreadPoolExecutor>(PrivateConstructorTag{}, numThreads,
+                                                maxQueuedTasks);
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(PrivateConstructorTag /*tag*/, size_t numThreads,
+                                       size_t maxQueuedTasks)
+    : kState(std::make_shared<State>(maxQueuedTasks)) {
+    CHECK_GT(numThreads, 0u);
+    CHECK_GT(maxQueuedTasks, 0u);
+    for (size_t i = 0; i < numThreads; ++i) {
+        // Workers are detached rather than joined so that the executor can be destroyed from one of
+        // its own tasks, e.g. when a task holds the last reference to the adapted device.
+        std::thread([state = kState] { state->runWorker(); }).detach();
+    }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+    kState->stop();
+}
+
+void ThreadPoolExecutor::execute(Task task, uid_t userId, nn::OptionalTimePoint deadline) {
+    if (!kState->push(&task, userId, deadline)) {
+        task();
+    }
+}
+
+Executor ThreadPoolExecutor::asExecutor() {
+    return [self = shared_from_this()](Task task, uid_t userId, nn::OptionalTimePoint deadline) {
+        self->execute(std::move(task), userId, deadline);
+    };
+}
+
+ThreadPoolExecutor::Metrics ThreadPoolExecutor::getMetrics() const {
+    std::lock_guard guard(kState->mMutex);
+    return kState->mMetrics;
+}
+
+}  // namespace android::hardware::neuralnetworks::adapter
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gmock/gmock.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/ThreadPoolExecutor.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::adapter {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr uid_t kUserA = 1;
+constexpr uid_t kUserB = 2;
+constexpr uid_t kUserC = 3;
+
+nn::TimePoint inSeconds(int seconds) {
+    return nn::Clock::now() + std::chrono::seconds(seconds);
+}
+
+// Records the order tasks run in, and lets the test wait until a number of them have.
+class TaskLog {
+  public:
+    Task record(std::string name) {
+        return [this, name = std::move(name)] {
+            std::lock_guard guard(mMutex);
+            mNames.push_back(name);
+            mCondition.notify_all();
+        };
+    }
+
+    std::vector<std::string> waitFor(size_t count) {
+        std::unique_lock lock(mMutex);
+        mCondition.wait(lock, [this, count] { return mNames.size() >= count; });
+        return mNames;
+    }
+
+  private:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::vector<std::string> mNames;
+};
+
+// Occupies a worker until released, so that the tasks submitted in the meantime are queued.
+class Gate {
+  public:
+    Gate() : mReleased(mRelease.get_future().share()) {}
+
+    Task block() {
+        return [this, released = mReleased] {
+            mBlocked.set_value();
+            released.wait();
+        };
+    }
+
+    void waitUntilBlocked() { mBlocked.get_future().wait(); }
+    void release() { mRelease.set_value(); }
+
+  private:
+    std::promise<void> mBlocked;
+    std::promise<void> mRelease;
+    std::shared_future<void> mReleased;
+};
+
+}  // namespace
+
+TEST(ThreadPoolExecutorTest, runsTasksOnWorkers) {
+    // setup test
+    const auto executor = ThreadPoolExecutor::create(/*numThreads=*/4, /*maxQueuedTasks=*/64);
+    TaskLog log;
+
+    // run test
+    for (int i = 0; i < 16; ++i) {
+        executor->execute(log.record(std::to_string(i)), kUserA, {});
+    }
+
+    // verify result
+    EXPECT_EQ(log.waitFor(16).size(), 16u);
+    const auto metrics = executor->getMetrics();
+    EXPECT_EQ(metrics.numTasksDequeued, 16u);
+    EXPECT_EQ(metrics.numTasksRunInline, 0u);
+}
+
+TEST(ThreadPoolExecutorTest, servesApplicationIdsRoundRobin) {
+    // setup test
+    const auto executor = ThreadPoolExecutor::create(/*numThreads=*/1, /*maxQueuedTasks=*/64);
+    Gate gate;
+    TaskLog log;
+    executor->execute(gate.block(), kUserC, {});
+    gate.waitUntilBlocked();
+
+    // run test
+    executor->execute(log.record("a1"), kUserA, {});
+    executor->execute(log.record("a2"), kUserA, {});
+    executor->execute(log.record("a3"), kUserA, {});
+    executor->execute(log.record("b1"), kUserB, {});
+    executor->execute(log.record("b2"), kUserB, {});
+    gate.release();
+
+    // verify result
+    EXPECT_THAT(log.waitFor(5), ElementsAre("a1", "b1", "a2", "b2", "a3"));
+}
+
+TEST(ThreadPoolExecutorTest, runsEarliestDeadlineFirst) {
+    // setup test
+    const auto executor = ThreadPoolExecutor::create(/*numThreads=*/1, /*maxQueuedTasks=*/64);
+    Gate gate;
+    TaskLog log;
+    executor->execute(gate.block(), kUserC, {});
+    gate.waitUntilBlocked();
+
+    // run test
+    executor->execute(log.record("none1"), kUserA, {});
+    executor->execute(log.record("3s"), kUserA, inSeconds(3));
+    executor->execute(log.record("1s"), kUserA, inSeconds(1));
+    executor->execute(log.record("none2"), kUserA, {});
+    executor->execute(log.record("2s"), kUserA, inSeconds(2));
+    gate.release();
+
+    // verify result
+    EXPECT_THAT(log.waitFor(5), ElementsAre("1s", "2s", "3s", "none1", "none2"));
+}
+
+TEST(ThreadPoolExecutorTest, runsInlineWhenQueueIsFull) {
+    // setup test
+    const auto executor = ThreadPoolExecutor::create(/*numThreads=*/1, /*maxQueuedTasks=*/2);
+    Gate gate;
+    TaskLog log;
+    executor->execute(gate.block(), kUserA, {});
+    gate.waitUntilBlocked();
+    executor->execute(log.record("queued1"), kUserA, {});
+    executor->execute(log.record("queued2"), kUserA, {});
+
+    // run test
+    std::thread::id inlineThread;
+    executor->execute([&inlineThread] { inlineThread = std::this_thread::get_id(); }, kUserA, {});
+
+    // verify result
+    EXPECT_EQ(inlineThread, std::this_thread::get_id());
+    gate.release();
+    EXPECT_THAT(log.waitFor(2), ElementsAre("queued1", "queued2"));
+    const auto metrics = executor->getMetrics();
+    EXPECT_EQ(metrics.numTasksRunInline, 1u);
+    EXPECT_EQ(metrics.maxQueueDepth, 2u);
+}
+
+TEST(ThreadPoolExecutorTest, runsQueuedTasksAfterLastReferenceIsDropped) {
+    // setup test
+    auto executor = ThreadPoolExecutor::create(/*numThreads=*/1, /*maxQueuedTasks=*/64);
+    Gate gate;
+    TaskLog log;
+    executor->execute(gate.block(), kUserA, {});
+    gate.waitUntilBlocked();
+    executor->execute(log.record("a"), kUserA, {});
+    executor->execute(log.record("b"), kUserB, {});
+
+    // run test
+    executor.reset();
+    gate.release();
+
+    // verify result
+    EXPECT_THAT(log.waitFor(2), ElementsAre("a", "b"));
+}
+
+TEST(ThreadPoolExecutorTest, canBeDestroyedFromItsOwnTask) {
+    // setup test
+    auto executor = std::make_optional(
+            ThreadPoolExecutor::create(/*numThreads=*/1, /*maxQueuedTasks=*/64)->asExecutor());
+    std::promise<void> submitted;
+    const auto destroyed = std::make_shared<std::promise<void>>();
+    auto destroyedFuture = destroyed->get_future();
+
+    // run test
+    (*executor)(
+            [&executor, submitted = submitted.get_future().share(), destroyed] {
+                submitted.wait();
+                // Drops the last reference to the executor on its own worker thread
+                executor.reset();
+                destroyed->set_value();
+            },
+            kUserA, {});
+    submitted.set_value();
+
+    // verify result
+    EXPECT_EQ(destroyedFuture.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+}
+
+}  // namespace android::hardware::neuralnetworks::adapter
@@ -23,6 +23,8 @@
 #include <nnapi/SharedMemory.h>
 #include <nnapi/Types.h>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <vector>
 
 // Shorthands
@@ -90,7 +92,7 @@ class RelocationTracker {
 
     RelocationTracker(std::vector<RelocationInfoType> relocationInfos, nn::SharedMemory memory,
                       nn::Mapping mapping)
-        : kRelocationInfos(std::move(relocationInfos)),
+        : mRelocationInfos(std::move(relocationInfos)),
           kMemory(std::move(memory)),
           kMapping(std::move(mapping)) {}
 
@@ -99,8 +101,14 @@ class RelocationTracker {
     // For OutputRelocationTracker, this method will copy shared memory data to the pointers.
     void flush() const;
 
+    const nn::SharedMemory& getMemory() const { return kMemory; }
+
+    // Used by RequestRelocationPool to point a cached tracker at the data of a new request. Only
+    // the `data` fields may be changed, since the lengths and offsets describe `kMemory`'s layout.
+    std::vector<RelocationInfoType>& getRelocationInfos() { return mRelocationInfos; }
+
   private:
-    const std::vector<RelocationInfoType> kRelocationInfos;
+    std::vector<RelocationInfoType> mRelocationInfos;
     const nn::SharedMemory kMemory;
     const nn::Mapping kMapping;
 };
@@ -108,8 +116,8 @@ using InputRelocationTracker = RelocationTracker<InputRelocationInfo>;
 using OutputRelocationTracker = RelocationTracker<OutputRelocationInfo>;
 
 struct RequestRelocation {
-    std::unique_ptr<InputRelocationTracker> input;
-    std::unique_ptr<OutputRelocationTracker> output;
+    std::shared_ptr<InputRelocationTracker> input;
+    std::shared_ptr<OutputRelocationTracker> output;
 };
 
 // Relocate pointer-based data to shared memory. If `request` has no
@@ -125,6 +133,32 @@ nn::GeneralResult<std::reference_wrapper<const nn::Request>> convertRequestFromP
         const nn::Request* request, uint32_t alignment, uint32_t padding,
         std::optional<nn::Request>* maybeRequestInSharedOut, RequestRelocation* relocationOut);
 
+// Caches the shared memory pools and relocation trackers created by
+// `convertRequestFromPointerToShared`, so that executions whose POINTER arguments have the same
+// lengths as an earlier one reuse its pools instead of allocating and mapping new ones. The
+// relocation handed out for an execution keeps its pools checked out until it is destroyed, at
+// which point they return to the cache for the next matching request.
+//
+// Meant to be owned by a prepared model or burst object. This class is thread-safe, and the
+// relocations it hands out may safely outlive it.
+class RequestRelocationPool {
+  public:
+    RequestRelocationPool();
+    ~RequestRelocationPool();
+
+    // Same contract as the free function `convertRequestFromPointerToShared` above.
+    nn::GeneralResult<std::reference_wrapper<const nn::Request>> convertRequestFromPointerToShared(
+            const nn::Request* request, uint32_t alignment, uint32_t padding,
+            std::optional<nn::Request>* maybeRequestInSharedOut,
+            RequestRelocation* relocationOut) const;
+
+  private:
+    // Defined in CommonUtils.cpp. Shared with the relocations handed out so they can return their
+    // pools after the pool object itself is gone.
+    struct Cache;
+    const std::shared_ptr<Cache> kCache;
+};
+
 nn::GeneralResult<std::vector<uint32_t>> countNumberOfConsumers(
         size_t numberOfOperands, const std::vector<nn::Operation>& operations);
 
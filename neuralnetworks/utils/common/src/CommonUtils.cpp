@@ -19,6 +19,7 @@
 #include "HandleError.h"
 
 #include <android-base/logging.h>
+#include <android-base/thread_annotations.h>
 #include <android-base/unique_fd.h>
 #include <android/hardware_buffer.h>
 #include <hidl/HidlSupport.h>
@@ -32,6 +33,8 @@
 #include <algorithm>
 #include <any>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <variant>
 #include <vector>
@@ -89,6 +92,136 @@ void copyPointersToSharedMemory(nn::Model::Subgraph* subgraph,
                   });
 }
 
+// The relocated layout of the POINTER arguments of a request, in argument order, and the trackers
+// for the memory pools backing it. Locations are recorded with a pool index of zero and rebased
+// onto the request's pools when applied.
+struct RelocationEntry {
+    uint32_t alignment;
+    uint32_t padding;
+    std::vector<nn::DataLocation> inputLocations;
+    std::vector<nn::DataLocation> outputLocations;
+    std::unique_ptr<InputRelocationTracker> input;
+    std::unique_ptr<OutputRelocationTracker> output;
+};
+
+// Upper bound on the number of idle entries a RequestRelocationPool keeps around for reuse.
+constexpr size_t kMaxCachedRelocationEntries = 4;
+
+bool matchesLayout(const std::vector<nn::Request::Argument>& arguments,
+                   const std::vector<nn::DataLocation>& locations) {
+    size_t i = 0;
+    for (const auto& argument : arguments) {
+        if (argument.lifetime != nn::Request::Argument::LifeTime::POINTER) {
+            continue;
+        }
+        if (i == locations.size() || locations[i].length != argument.location.length) {
+            return false;
+        }
+        ++i;
+    }
+    return i == locations.size();
+}
+
+bool matchesLayout(const nn::Request& request, uint32_t alignment, uint32_t padding,
+                   const RelocationEntry& entry) {
+    return entry.alignment == alignment && entry.padding == padding &&
+           matchesLayout(request.inputs, entry.inputLocations) &&
+           matchesLayout(request.outputs, entry.outputLocations);
+}
+
+template <typename RelocationInfoType>
+nn::GeneralResult<std::unique_ptr<RelocationTracker<RelocationInfoType>>> layOutPointerArguments(
+        const std::vector<nn::Request::Argument>& arguments, uint32_t alignment, uint32_t padding,
+        std::vector<nn::DataLocation>* locationsOut) {
+    nn::MutableMemoryBuilder builder(0);
+    std::vector<RelocationInfoType> relocationInfos;
+    for (const auto& argument : arguments) {
+        if (argument.lifetime != nn::Request::Argument::LifeTime::POINTER) {
+            continue;
+        }
+        const auto location = builder.append(argument.location.length, alignment, padding);
+        locationsOut->push_back(location);
+        relocationInfos.push_back({nullptr, location.length, location.offset});
+    }
+    if (builder.empty()) {
+        return nullptr;
+    }
+    auto memory = NN_TRY(builder.finish());
+    return RelocationTracker<RelocationInfoType>::create(std::move(relocationInfos),
+                                                         std::move(memory));
+}
+
+nn::GeneralResult<std::unique_ptr<RelocationEntry>> createRelocationEntry(
+        const nn::Request& request, uint32_t alignment, uint32_t padding) {
+    auto entry = std::make_unique<RelocationEntry>();
+    entry->alignment = alignment;
+    entry->padding = padding;
+    entry->input = NN_TRY(layOutPointerArguments<InputRelocationInfo>(
+            request.inputs, alignment, padding, &entry->inputLocations));
+    entry->output = NN_TRY(layOutPointerArguments<OutputRelocationInfo>(
+            request.outputs, alignment, padding, &entry->outputLocations));
+    return entry;
+}
+
+void getRelocationData(const nn::DataLocation& location, const void** data) {
+    *data = std::visit([](auto ptr) { return static_cast<const void*>(ptr); }, location.pointer);
+}
+
+void getRelocationData(const nn::DataLocation& location, void** data) {
+    *data = std::get<void*>(location.pointer);
+}
+
+// Point the POINTER arguments at their locations in the pool at `poolIndex`, and point the tracker
+// at the arguments' data.
+template <typename RelocationInfoType>
+void relocatePointerArguments(std::vector<nn::Request::Argument>* arguments,
+                              const std::vector<nn::DataLocation>& locations, uint32_t poolIndex,
+                              RelocationTracker<RelocationInfoType>* tracker) {
+    auto& relocationInfos = tracker->getRelocationInfos();
+    size_t i = 0;
+    for (auto& argument : *arguments) {
+        if (argument.lifetime != nn::Request::Argument::LifeTime::POINTER) {
+            continue;
+        }
+        getRelocationData(argument.location, &relocationInfos[i].data);
+        CHECK(relocationInfos[i].data != nullptr);
+        argument.lifetime = nn::Request::Argument::LifeTime::POOL;
+        argument.location = locations[i];
+        argument.location.poolIndex = poolIndex;
+        ++i;
+    }
+}
+
+nn::Request relocateRequest(const nn::Request& request, RelocationEntry* entry) {
+    // Make a copy of the request in order to make modifications.
+    nn::Request requestInShared = request;
+    if (entry->input) {
+        const auto poolIndex = static_cast<uint32_t>(requestInShared.pools.size());
+        relocatePointerArguments(&requestInShared.inputs, entry->inputLocations, poolIndex,
+                                 entry->input.get());
+        requestInShared.pools.push_back(entry->input->getMemory());
+    }
+    if (entry->output) {
+        const auto poolIndex = static_cast<uint32_t>(requestInShared.pools.size());
+        relocatePointerArguments(&requestInShared.outputs, entry->outputLocations, poolIndex,
+                                 entry->output.get());
+        requestInShared.pools.push_back(entry->output->getMemory());
+    }
+    return requestInShared;
+}
+
+// The trackers share ownership of the whole entry, which is released once both are gone.
+RequestRelocation makeRequestRelocation(const std::shared_ptr<RelocationEntry>& entry) {
+    RequestRelocation relocation;
+    if (entry->input) {
+        relocation.input = std::shared_ptr<InputRelocationTracker>(entry, entry->input.get());
+    }
+    if (entry->output) {
+        relocation.output = std::shared_ptr<OutputRelocationTracker>(entry, entry->output.get());
+    }
+    return relocation;
+}
+
 nn::GeneralResult<hidl_handle> createNativeHandleFrom(base::unique_fd fd,
                                                       const std::vector<int32_t>& ints) {
     constexpr size_t kIntMax = std::numeric_limits<int>::max();
@@ -204,7 +337,7 @@ template <>
 void InputRelocationTracker::flush() const {
     // Copy from pointers to shared memory.
     uint8_t* memoryPtr = static_cast<uint8_t*>(std::get<void*>(kMapping.pointer));
-    for (const auto& [data, length, offset] : kRelocationInfos) {
+    for (const auto& [data, length, offset] : mRelocationInfos) {
         std::memcpy(memoryPtr + offset, data, length);
     }
 }
@@ -214,7 +347,7 @@ void OutputRelocationTracker::flush() const {
     // Copy from shared memory to pointers.
     const uint8_t* memoryPtr = static_cast<const uint8_t*>(
             std::visit([](auto ptr) { return static_cast<const void*>(ptr); }, kMapping.pointer));
-    for (const auto& [data, length, offset] : kRelocationInfos) {
+    for (const auto& [data, length, offset] : mRelocationInfos) {
         std::memcpy(data, memoryPtr + offset, length);
     }
 }
@@ -230,63 +363,75 @@ nn::GeneralResult<std::reference_wrapper<const nn::Request>> convertRequestFromP
         return *request;
     }
 
-    // Make a copy of the request in order to make modifications. The modified request is returned
-    // to the caller through `maybeRequestInSharedOut` if the function succeeds.
-    nn::Request requestInShared = *request;
+    std::shared_ptr<RelocationEntry> entry =
+            NN_TRY(createRelocationEntry(*request, alignment, padding));
 
-    RequestRelocation relocation;
+    *maybeRequestInSharedOut = relocateRequest(*request, entry.get());
+    *relocationOut = makeRequestRelocation(entry);
+    return **maybeRequestInSharedOut;
+}
 
-    // Change input pointers to shared memory.
-    nn::MutableMemoryBuilder inputBuilder(requestInShared.pools.size());
-    std::vector<InputRelocationInfo> inputRelocationInfos;
-    for (auto& input : requestInShared.inputs) {
-        const auto& location = input.location;
-        if (input.lifetime != nn::Request::Argument::LifeTime::POINTER) {
-            continue;
-        }
+struct RequestRelocationPool::Cache {
+    std::mutex mutex;
+    // Entries not currently checked out by a RequestRelocation, least recently returned first.
+    std::vector<std::unique_ptr<RelocationEntry>> idleEntries GUARDED_BY(mutex);
+};
 
-        input.lifetime = nn::Request::Argument::LifeTime::POOL;
-        const void* data = std::visit([](auto ptr) { return static_cast<const void*>(ptr); },
-                                      location.pointer);
-        CHECK(data != nullptr);
-        input.location = inputBuilder.append(location.length, alignment, padding);
-        inputRelocationInfos.push_back({data, input.location.length, input.location.offset});
-    }
+RequestRelocationPool::RequestRelocationPool() : kCache(std::make_shared<Cache>()) {}
 
-    // Allocate input memory.
-    if (!inputBuilder.empty()) {
-        auto memory = NN_TRY(inputBuilder.finish());
-        requestInShared.pools.push_back(memory);
-        relocation.input = NN_TRY(
-                InputRelocationTracker::create(std::move(inputRelocationInfos), std::move(memory)));
-    }
+RequestRelocationPool::~RequestRelocationPool() = default;
 
-    // Change output pointers to shared memory.
-    nn::MutableMemoryBuilder outputBuilder(requestInShared.pools.size());
-    std::vector<OutputRelocationInfo> outputRelocationInfos;
-    for (auto& output : requestInShared.outputs) {
-        const auto& location = output.location;
-        if (output.lifetime != nn::Request::Argument::LifeTime::POINTER) {
-            continue;
-        }
+nn::GeneralResult<std::reference_wrapper<const nn::Request>>
+RequestRelocationPool::convertRequestFromPointerToShared(
+        const nn::Request* request, uint32_t alignment, uint32_t padding,
+        std::optional<nn::Request>* maybeRequestInSharedOut,
+        RequestRelocation* relocationOut) const {
+    CHECK(request != nullptr);
+    CHECK(maybeRequestInSharedOut != nullptr);
+    CHECK(relocationOut != nullptr);
 
-        output.lifetime = nn::Request::Argument::LifeTime::POOL;
-        void* data = std::get<void*>(location.pointer);
-        CHECK(data != nullptr);
-        output.location = outputBuilder.append(location.length, alignment, padding);
-        outputRelocationInfos.push_back({data, output.location.length, output.location.offset});
+    if (hasNoPointerData(*request)) {
+        return *request;
     }
 
-    // Allocate output memory.
-    if (!outputBuilder.empty()) {
-        auto memory = NN_TRY(outputBuilder.finish());
-        requestInShared.pools.push_back(memory);
-        relocation.output = NN_TRY(OutputRelocationTracker::create(std::move(outputRelocationInfos),
-                                                                   std::move(memory)));
+    std::unique_ptr<RelocationEntry> entry;
+    {
+        std::lock_guard guard(kCache->mutex);
+        auto& idleEntries = kCache->idleEntries;
+        const auto it = std::find_if(idleEntries.begin(), idleEntries.end(), [&](const auto& e) {
+            return matchesLayout(*request, alignment, padding, *e);
+        });
+        if (it != idleEntries.end()) {
+            entry = std::move(*it);
+            idleEntries.erase(it);
+        }
+    }
+    if (entry == nullptr) {
+        entry = NN_TRY(createRelocationEntry(*request, alignment, padding));
     }
 
-    *maybeRequestInSharedOut = requestInShared;
-    *relocationOut = std::move(relocation);
+    *maybeRequestInSharedOut = relocateRequest(*request, entry.get());
+
+    // Hand the entry back to the cache rather than freeing its memory once the execution is done
+    // with it. The least recently returned entry is evicted when the cache is full.
+    const auto returnToCache = [weakCache = std::weak_ptr<Cache>(kCache)](RelocationEntry* e) {
+        std::unique_ptr<RelocationEntry> returned(e);
+        const auto cache = weakCache.lock();
+        if (cache == nullptr) {
+            return;
+        }
+        // Declared before the guard so the evicted memory is unmapped after the lock is released.
+        std::unique_ptr<RelocationEntry> evicted;
+        std::lock_guard guard(cache->mutex);
+        auto& idleEntries = cache->idleEntries;
+        if (idleEntries.size() >= kMaxCachedRelocationEntries) {
+            evicted = std::move(idleEntries.front());
+            idleEntries.erase(idleEntries.begin());
+        }
+        idleEntries.push_back(std::move(returned));
+    };
+    *relocationOut =
+            makeRequestRelocation(std::shared_ptr<RelocationEntry>(entry.release(), returnToCache));
     return **maybeRequestInSharedOut;
 }
 
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gmock/gmock.h>
+#include <nnapi/TypeUtils.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/CommonUtils.h>
+
+#include <array>
+#include <optional>
+#include <utility>
+
+namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+constexpr uint32_t kAlignment = nn::kDefaultRequestMemoryAlignment;
+constexpr uint32_t kPadding = nn::kMinMemoryPadding;
+
+nn::Request::Argument makePointerArgument(const void* data, uint32_t length) {
+    return {.lifetime = nn::Request::Argument::LifeTime::POINTER,
+            .location = {.pointer = data, .length = length}};
+}
+
+nn::Request::Argument makePointerArgument(void* data, uint32_t length) {
+    return {.lifetime = nn::Request::Argument::LifeTime::POINTER,
+            .location = {.pointer = data, .length = length}};
+}
+
+nn::Request makePointerRequest(const float* input, float* output, uint32_t length) {
+    return {.inputs = {makePointerArgument(input, length)},
+            .outputs = {makePointerArgument(output, length)}};
+}
+
+const nn::SharedMemory& getPool(const nn::Request& request, const nn::Request::Argument& argument) {
+    return std::get<nn::SharedMemory>(request.pools.at(argument.location.poolIndex));
+}
+
+}  // namespace
+
+TEST(CommonUtilsTest, convertRequestFromPointerToSharedRelocatesPointers) {
+    // setup test
+    const std::array<float, 4> input = {};
+    std::array<float, 4> output = {};
+    const auto request = makePointerRequest(input.data(), output.data(), sizeof(input));
+
+    // run test
+    std::optional<nn::Request> maybeRequestInShared;
+    RequestRelocation relocation;
+    const auto result = convertRequestFromPointerToShared(&request, kAlignment, kPadding,
+                                                          &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_TRUE(result.has_value());
+    const nn::Request& requestInShared = result.value();
+    EXPECT_TRUE(hasNoPointerData(requestInShared));
+    ASSERT_EQ(requestInShared.pools.size(), 2u);
+    ASSERT_NE(relocation.input, nullptr);
+    ASSERT_NE(relocation.output, nullptr);
+
+    EXPECT_NE(requestInShared.inputs[0].location.poolIndex,
+              requestInShared.outputs[0].location.poolIndex);
+    EXPECT_EQ(requestInShared.inputs[0].location.length, sizeof(input));
+    EXPECT_EQ(requestInShared.outputs[0].location.length, sizeof(output));
+}
+
+TEST(CommonUtilsTest, relocationPoolReusesMemoryForMatchingRequest) {
+    // setup test
+    const RequestRelocationPool pool;
+    const std::array<float, 4> input1 = {}, input2 = {};
+    std::array<float, 4> output1 = {}, output2 = {};
+    const auto request1 = makePointerRequest(input1.data(), output1.data(), sizeof(input1));
+    const auto request2 = makePointerRequest(input2.data(), output2.data(), sizeof(input2));
+
+    nn::SharedMemory firstInputPool;
+    {
+        std::optional<nn::Request> maybeRequestInShared;
+        RequestRelocation relocation;
+        const auto result = pool.convertRequestFromPointerToShared(
+                &request1, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+        ASSERT_TRUE(result.has_value());
+        firstInputPool = getPool(result.value(), result.value().inputs[0]);
+    }
+
+    // run test
+    std::optional<nn::Request> maybeRequestInShared;
+    RequestRelocation relocation;
+    const auto result = pool.convertRequestFromPointerToShared(
+            &request2, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(getPool(result.value(), result.value().inputs[0]), firstInputPool);
+}
+
+TEST(CommonUtilsTest, relocationPoolDoesNotShareMemoryInUse) {
+    // setup test
+    const RequestRelocationPool pool;
+    const std::array<float, 4> input = {};
+    std::array<float, 4> output = {};
+    const auto request = makePointerRequest(input.data(), output.data(), sizeof(input));
+
+    std::optional<nn::Request> maybeRequestInShared1;
+    RequestRelocation relocation1;
+    const auto result1 = pool.convertRequestFromPointerToShared(
+            &request, kAlignment, kPadding, &maybeRequestInShared1, &relocation1);
+    ASSERT_TRUE(result1.has_value());
+
+    // run test
+    std::optional<nn::Request> maybeRequestInShared2;
+    RequestRelocation relocation2;
+    const auto result2 = pool.convertRequestFromPointerToShared(
+            &request, kAlignment, kPadding, &maybeRequestInShared2, &relocation2);
+
+    // verify result
+    ASSERT_TRUE(result2.has_value());
+    EXPECT_NE(getPool(result1.value(), result1.value().inputs[0]),
+              getPool(result2.value(), result2.value().inputs[0]));
+}
+
+TEST(CommonUtilsTest, relocationPoolDoesNotReuseMemoryForDifferentLengths) {
+    // setup test
+    const RequestRelocationPool pool;
+    const std::array<float, 8> input = {};
+    std::array<float, 8> output = {};
+    const auto smallRequest = makePointerRequest(input.data(), output.data(), sizeof(float) * 4);
+    const auto largeRequest = makePointerRequest(input.data(), output.data(), sizeof(input));
+
+    nn::SharedMemory smallInputPool;
+    {
+        std::optional<nn::Request> maybeRequestInShared;
+        RequestRelocation relocation;
+        const auto result = pool.convertRequestFromPointerToShared(
+                &smallRequest, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+        ASSERT_TRUE(result.has_value());
+        smallInputPool = getPool(result.value(), result.value().inputs[0]);
+    }
+
+    // run test
+    std::optional<nn::Request> maybeRequestInShared;
+    RequestRelocation relocation;
+    const auto result = pool.convertRequestFromPointerToShared(
+            &largeRequest, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_TRUE(result.has_value());
+    EXPECT_NE(getPool(result.value(), result.value().inputs[0]), smallInputPool);
+    EXPECT_EQ(result.value().inputs[0].location.length, sizeof(input));
+}
+
+TEST(CommonUtilsTest, relocationOutlivesPool) {
+    // setup test
+    auto pool = std::make_unique<RequestRelocationPool>();
+    const std::array<float, 4> input = {};
+    std::array<float, 4> output = {};
+    const auto request = makePointerRequest(input.data(), output.data(), sizeof(input));
+    std::optional<nn::Request> maybeRequestInShared;
+    RequestRelocation relocation;
+    ASSERT_TRUE(pool->convertRequestFromPointerToShared(&request, kAlignment, kPadding,
+                                                        &maybeRequestInShared, &relocation)
+                        .has_value());
+
+    // run test
+    pool.reset();
+
+    // verify result
+    relocation.input->flush();
+    relocation.output->flush();
+}
+
+}  // namespace android::hardware::neuralnetworks::utils
@@ -15,6 +15,7 @@
  */
 
 #include "Sensor.h"
+#include "SensorScheduler.h"
 
 #include <utils/SystemClock.h>
 
@@ -39,19 +40,17 @@ using ::android::hardware::sensors::V2_1::SensorType;
 Sensor::Sensor(ISensorsEventCallback* callback)
     : mIsEnabled(false),
       mSamplingPeriodNs(0),
-      mLastSampleTimeNs(0),
       mCallback(callback),
-      mMode(OperationMode::NORMAL) {
-    mRunThread = std::thread(startThread, this);
-}
+      mMode(OperationMode::NORMAL),
+      mLastSampleTimeNs(0),
+      mNextSampleTimeNs(0),
+      mScheduledPeriodNs(0),
+      mHeapIndex(SensorScheduler::kNotScheduled) {}
 
 Sensor::~Sensor() {
-    std::unique_lock<std::mutex> lock(mRunMutex);
-    mStopThread = true;
+    std::lock_guard<std::mutex> lock(mRunMutex);
     mIsEnabled = false;
-    mWaitCV.notify_all();
-    lock.release();
-    mRunThread.join();
+    SensorScheduler::getInstance().unschedule(this);
 }
 
 const SensorInfo& Sensor::getSensorInfo() const {
@@ -65,18 +64,19 @@ void Sensor::batch(int64_t samplingPeriodNs) {
         samplingPeriodNs = mSensorInfo.maxDelay * 1000ll;
     }
 
+    std::lock_guard<std::mutex> lock(mRunMutex);
     if (mSamplingPeriodNs != samplingPeriodNs) {
         mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+        // Let the scheduler check if a new event should be generated now
+        updateScheduleLocked();
     }
 }
 
 void Sensor::activate(bool enable) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
     if (mIsEnabled != enable) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
         mIsEnabled = enable;
-        mWaitCV.notify_all();
+        updateScheduleLocked();
     }
 }
 
@@ -99,33 +99,11 @@ Result Sensor::flush() {
     return Result::OK;
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
-}
-
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
-
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_REALTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            }
-
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
-        }
+void Sensor::updateScheduleLocked() {
+    if (mIsEnabled && mMode == OperationMode::NORMAL) {
+        SensorScheduler::getInstance().schedule(this, mSamplingPeriodNs);
+    } else {
+        SensorScheduler::getInstance().unschedule(this);
     }
 }
 
@@ -133,23 +111,20 @@ bool Sensor::isWakeUpSensor() {
     return mSensorInfo.flags & static_cast<uint32_t>(SensorFlagBits::WAKE_UP);
 }
 
-std::vector<Event> Sensor::readEvents() {
-    std::vector<Event> events;
-    Event event;
-    event.sensorHandle = mSensorInfo.sensorHandle;
-    event.sensorType = mSensorInfo.type;
-    event.timestamp = ::android::elapsedRealtimeNano();
-    memset(&event.u, 0, sizeof(event.u));
-    readEventPayload(event.u);
-    events.push_back(event);
-    return events;
+bool Sensor::readEvent(int64_t timestamp, Event* event) {
+    event->sensorHandle = mSensorInfo.sensorHandle;
+    event->sensorType = mSensorInfo.type;
+    event->timestamp = timestamp;
+    memset(&event->u, 0, sizeof(event->u));
+    readEventPayload(event->u);
+    return true;
 }
 
 void Sensor::setOperationMode(OperationMode mode) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
     if (mMode != mode) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
         mMode = mode;
-        mWaitCV.notify_all();
+        updateScheduleLocked();
     }
 }
 
@@ -182,19 +157,14 @@ void OnChangeSensor::activate(bool enable) {
     }
 }
 
-std::vector<Event> OnChangeSensor::readEvents() {
-    std::vector<Event> events = Sensor::readEvents();
-    std::vector<Event> outputEvents;
-
-    for (auto iter = events.begin(); iter != events.end(); ++iter) {
-        Event ev = *iter;
-        if (!mPreviousEventSet || memcmp(&mPreviousEvent.u, &ev.u, sizeof(ev.u)) != 0) {
-            outputEvents.push_back(ev);
-            mPreviousEvent = ev;
-            mPreviousEventSet = true;
-        }
+bool OnChangeSensor::readEvent(int64_t timestamp, Event* event) {
+    Sensor::readEvent(timestamp, event);
+    if (mPreviousEventSet && memcmp(&mPreviousEvent.u, &event->u, sizeof(event->u)) == 0) {
+        return false;
     }
-    return outputEvents;
+    mPreviousEvent = *event;
+    mPreviousEventSet = true;
+    return true;
 }
 
 AccelSensor::AccelSensor(int32_t sensorHandle, ISensorsEventCallback* callback) : Sensor(callback) {
@@ -20,10 +20,8 @@
 #include <android/hardware/sensors/1.0/types.h>
 #include <android/hardware/sensors/2.1/types.h>
 
-#include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 namespace android {
@@ -34,6 +32,8 @@ namespace implementation {
 
 static constexpr int32_t kDefaultMaxDelayUs = 10 * 1000 * 1000;
 
+class SensorScheduler;
+
 class ISensorsEventCallback {
   public:
     using Event = ::android::hardware::sensors::V2_1::Event;
@@ -64,26 +64,38 @@ class Sensor {
     Result injectEvent(const Event& event);
 
   protected:
-    void run();
-    virtual std::vector<Event> readEvents();
+    /**
+     * Fill in the sample taken at the given time. Called from the SensorScheduler thread.
+     *
+     * @return false if the sample should not be reported.
+     */
+    virtual bool readEvent(int64_t timestamp, Event* event);
     virtual void readEventPayload(EventPayload&) {}
-    static void startThread(Sensor* sensor);
 
     bool isWakeUpSensor();
 
+    //! Add or remove this sensor from the SensorScheduler to match its current state.
+    void updateScheduleLocked();
+
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
-    int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
+    //! Serializes state changes coming in from the framework.
     std::mutex mRunMutex;
-    std::thread mRunThread;
 
     ISensorsEventCallback* mCallback;
 
     OperationMode mMode;
+
+  private:
+    friend class SensorScheduler;
+
+    // Owned by the SensorScheduler and only accessed with its lock held.
+    int64_t mLastSampleTimeNs;
+    int64_t mNextSampleTimeNs;
+    int64_t mScheduledPeriodNs;
+    size_t mHeapIndex;
 };
 
 class OnChangeSensor : public Sensor {
@@ -93,7 +105,7 @@ class OnChangeSensor : public Sensor {
     virtual void activate(bool enable) override;
 
   protected:
-    virtual std::vector<Event> readEvents() override;
+    virtual bool readEvent(int64_t timestamp, Event* event) override;
 
   protected:
     Event mPreviousEvent;
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SensorScheduler.h"
+
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_X {
+namespace implementation {
+
+// Sensors due within this window of each other are sampled together, as long as that is a small
+// fraction of their period. This keeps sensors that were enabled a few microseconds apart from
+// drifting into separate wakeups and separate postEvents() calls forever.
+static constexpr int64_t kMaxCoalesceWindowNs = 1000 * 1000;
+static constexpr int64_t kCoalescePeriodDivisor = 16;
+
+static int64_t getCoalesceWindowNs(int64_t periodNs) {
+    return std::min(kMaxCoalesceWindowNs, periodNs / kCoalescePeriodDivisor);
+}
+
+SensorScheduler& SensorScheduler::getInstance() {
+    // Intentionally leaked: the scheduler thread runs for the lifetime of the process and must not
+    // be torn down by static destructors while a sensor may still be using it.
+    static SensorScheduler* sInstance = new SensorScheduler();
+    return *sInstance;
+}
+
+void SensorScheduler::schedule(Sensor* sensor, int64_t periodNs) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mThread.joinable()) {
+        mThread = std::thread(&SensorScheduler::run, this);
+    }
+
+    int64_t now = ::android::elapsedRealtimeNano();
+    // A zero period would never move the sensor's deadline past the current round.
+    periodNs = std::max(periodNs, int64_t{1});
+    sensor->mScheduledPeriodNs = periodNs;
+    sensor->mNextSampleTimeNs = std::max(now, sensor->mLastSampleTimeNs + periodNs);
+    if (sensor->mHeapIndex == kNotScheduled) {
+        sensor->mHeapIndex = mHeap.size();
+        mHeap.push_back(sensor);
+        heapSiftUp(sensor->mHeapIndex);
+    } else {
+        heapSiftUp(sensor->mHeapIndex);
+        heapSiftDown(sensor->mHeapIndex);
+    }
+    if (mHeap.front() == sensor) {
+        mScheduleCV.notify_one();
+    }
+}
+
+void SensorScheduler::unschedule(Sensor* sensor) {
+    std::unique_lock<std::mutex> lock(mLock);
+    if (sensor->mHeapIndex != kNotScheduled) {
+        heapRemove(sensor->mHeapIndex);
+    }
+    if (std::this_thread::get_id() != mThread.get_id()) {
+        // Events read from this sensor may still be on their way to its callback.
+        mPostedCV.wait(lock, [&] { return !mPosting; });
+        if (mHeap.empty()) {
+            // Drop batches for callbacks that may be going away along with their sensors.
+            mBatches.clear();
+        }
+    }
+}
+
+void SensorScheduler::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        if (mHeap.empty()) {
+            mScheduleCV.wait(lock);
+            continue;
+        }
+        int64_t now = ::android::elapsedRealtimeNano();
+        Sensor* next = mHeap.front();
+        int64_t nextSampleTime =
+                next->mNextSampleTimeNs - getCoalesceWindowNs(next->mScheduledPeriodNs);
+        if (nextSampleTime > now) {
+            mScheduleCV.wait_for(lock, std::chrono::nanoseconds(nextSampleTime - now));
+            continue;
+        }
+
+        sampleDueSensorsLocked(now);
+
+        mPosting = true;
+        lock.unlock();
+        for (EventBatch& batch : mBatches) {
+            if (!batch.events.empty()) {
+                batch.callback->postEvents(batch.events, batch.wakeup);
+            }
+        }
+        lock.lock();
+        mPosting = false;
+        mPostedCV.notify_all();
+    }
+}
+
+void SensorScheduler::sampleDueSensorsLocked(int64_t now) {
+    for (EventBatch& batch : mBatches) {
+        batch.events.clear();
+    }
+
+    // Every sensor due in this round is sampled with the same timestamp.
+    while (!mHeap.empty()) {
+        Sensor* sensor = mHeap.front();
+        if (sensor->mNextSampleTimeNs - getCoalesceWindowNs(sensor->mScheduledPeriodNs) > now) {
+            break;
+        }
+        EventBatch& batch = getBatchLocked(sensor->mCallback, sensor->isWakeUpSensor());
+        batch.events.emplace_back();
+        if (!sensor->readEvent(now, &batch.events.back())) {
+            batch.events.pop_back();
+        }
+
+        // After the first sample, deadlines fall on multiples of the period. Sensors running at the
+        // same or harmonic rates then share wakeups no matter when they were enabled, and a sensor
+        // that fell behind skips the samples it missed instead of bursting to catch up.
+        int64_t periodNs = sensor->mScheduledPeriodNs;
+        int64_t base = std::max(now, sensor->mNextSampleTimeNs);
+        sensor->mLastSampleTimeNs = now;
+        sensor->mNextSampleTimeNs = (base / periodNs + 1) * periodNs;
+        heapSiftDown(0);
+    }
+}
+
+SensorScheduler::EventBatch& SensorScheduler::getBatchLocked(ISensorsEventCallback* callback,
+                                                             bool wakeup) {
+    for (EventBatch& batch : mBatches) {
+        if (batch.callback == callback && batch.wakeup == wakeup) {
+            return batch;
+        }
+    }
+    mBatches.push_back(EventBatch{callback, wakeup, {}});
+    return mBatches.back();
+}
+
+void SensorScheduler::heapSwap(size_t i, size_t j) {
+    std::swap(mHeap[i], mHeap[j]);
+    mHeap[i]->mHeapIndex = i;
+    mHeap[j]->mHeapIndex = j;
+}
+
+void SensorScheduler::heapSiftUp(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (mHeap[parent]->mNextSampleTimeNs <= mHeap[i]->mNextSampleTimeNs) {
+            break;
+        }
+        heapSwap(i, parent);
+        i = parent;
+    }
+}
+
+void SensorScheduler::heapSiftDown(size_t i) {
+    size_t size = mHeap.size();
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < size && mHeap[left]->mNextSampleTimeNs < mHeap[smallest]->mNextSampleTimeNs) {
+            smallest = left;
+        }
+        if (right < size && mHeap[right]->mNextSampleTimeNs < mHeap[smallest]->mNextSampleTimeNs) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        heapSwap(i, smallest);
+        i = smallest;
+    }
+}
+
+void SensorScheduler::heapRemove(size_t i) {
+    Sensor* removed = mHeap[i];
+    size_t last = mHeap.size() - 1;
+    if (i != last) {
+        heapSwap(i, last);
+    }
+    mHeap.pop_back();
+    removed->mHeapIndex = kNotScheduled;
+    if (i < mHeap.size()) {
+        heapSiftUp(i);
+        heapSiftDown(i);
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_X
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
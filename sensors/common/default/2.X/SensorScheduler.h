@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_X_SENSOR_SCHEDULER_H
+#define ANDROID_HARDWARE_SENSORS_V2_X_SENSOR_SCHEDULER_H
+
+#include "Sensor.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_X {
+namespace implementation {
+
+/**
+ * Drives every active Sensor in the process from a single thread.
+ *
+ * Sensors are kept in a min-heap ordered by their next sample time. Each time the thread wakes up
+ * it samples every sensor that is due with the same timestamp, then posts the events with one
+ * postEvents() call per callback and wakeup class. The event vectors are reused from one wakeup to
+ * the next, so the sample path does not allocate once it has warmed up.
+ */
+class SensorScheduler {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+
+    //! The Sensor::mHeapIndex of a sensor that is not being sampled.
+    static constexpr size_t kNotScheduled = static_cast<size_t>(-1);
+
+    static SensorScheduler& getInstance();
+
+    /**
+     * Start sampling the sensor every periodNs, or update its period if it is already scheduled.
+     * The next sample is taken one period after the previous one, or right away if that is already
+     * in the past.
+     */
+    void schedule(Sensor* sensor, int64_t periodNs);
+
+    /**
+     * Stop sampling the sensor. Once this returns the scheduler thread no longer references the
+     * sensor or any events read from it, so it is safe to destroy.
+     */
+    void unschedule(Sensor* sensor);
+
+  private:
+    struct EventBatch {
+        ISensorsEventCallback* callback;
+        bool wakeup;
+        std::vector<Event> events;
+    };
+
+    SensorScheduler() = default;
+
+    void run();
+    void sampleDueSensorsLocked(int64_t now);
+    EventBatch& getBatchLocked(ISensorsEventCallback* callback, bool wakeup);
+
+    // Indexed binary heap on Sensor::mNextSampleTimeNs. Each sensor tracks its own position in
+    // mHeapIndex so it can be moved or removed without a search.
+    void heapSwap(size_t i, size_t j);
+    void heapSiftUp(size_t i);
+    void heapSiftDown(size_t i);
+    void heapRemove(size_t i);
+
+    std::mutex mLock;
+
+    //! Wakes the scheduler thread when the earliest deadline changes.
+    std::condition_variable mScheduleCV;
+
+    //! Signalled once the scheduler thread has finished posting a round of events.
+    std::condition_variable mPostedCV;
+
+    std::vector<Sensor*> mHeap;
+
+    //! One batch per callback and wakeup class seen so far. Only the scheduler thread touches the
+    //! event vectors, and only while it holds mLock or mPosting is set.
+    std::vector<EventBatch> mBatches;
+
+    bool mPosting = false;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_X
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_X_SENSOR_SCHEDULER_H
@@ -23,6 +23,7 @@
 
 #include <dlfcn.h>
 
+#include <cerrno>
 #include <cinttypes>
 #include <cmath>
 #include <fstream>
@@ -208,9 +209,11 @@ Return<Result> HalProxy::initializeCommon(
     // again we do not get new events until after initialize resets the subhals.
     disableAllSensors();
 
-    // Clears the queue if any events were pending write before.
-    mPendingWriteEventsQueue = std::queue<std::pair<std::vector<V2_1::Event>, size_t>>();
-    mSizePendingWriteEventsQueue = 0;
+    // Clears the ring if any events were pending write before.
+    {
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+        mPendingWriteEvents.clear();
+    }
 
     // Clears previously connected dynamic sensors
     mDynamicSensors.clear();
@@ -356,14 +359,16 @@ Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&
            << " ms ago" << std::endl;
     // TODO(b/142969448): Add logging for history of wakelock acquisition per subhal.
     stream << "  Wakelock ref count: " << mWakelockRefCount << std::endl;
-    stream << "  # of events on pending write writes queue: " << mSizePendingWriteEventsQueue
-           << std::endl;
-    stream << " Most events seen on pending write events queue: "
-           << mMostEventsObservedPendingWriteEventsQueue << std::endl;
-    if (!mPendingWriteEventsQueue.empty()) {
-        stream << "  Size of events list on front of pending writes queue: "
-               << mPendingWriteEventsQueue.front().first.size() << std::endl;
-    }
+    stream << "  # of events on pending write events ring: " << mPendingWriteEvents.size()
+           << " / " << mPendingWriteEvents.capacity() << std::endl;
+    stream << "  Most events seen on pending write events ring: "
+           << mPendingWriteEvents.highWater() << std::endl;
+    stream << "  # of events written by pending writes thread: "
+           << mNumEventsWrittenInBackground.load() << std::endl;
+    stream << "  # of events dropped with pending write events ring full: "
+           << mNumEventsDroppedRingFull.load() << std::endl;
+    stream << "  # of events dropped after pending write timeout: "
+           << mNumEventsDroppedTimeout.load() << std::endl;
     stream << "  # of non-dynamic sensors across all subhals: " << mSensors.size() << std::endl;
     stream << "  # of dynamic sensors across all subhals: " << mDynamicSensors.size() << std::endl;
     stream << "SubHals (" << mSubHalList.size() << "):" << std::endl;
@@ -530,7 +535,10 @@ void HalProxy::stopThreads() {
         mWakelockQueueFlag->wake(static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN));
     }
     mWakelockCV.notify_one();
-    mEventQueueWriteCV.notify_one();
+    {
+        std::lock_guard<std::mutex> lock(mPendingWritesMutex);
+    }
+    mPendingWritesCV.notify_one();
     if (mPendingWritesThread.joinable()) {
         mPendingWritesThread.join();
     }
@@ -556,45 +564,92 @@ void HalProxy::startPendingWritesThread(HalProxy* halProxy) {
 }
 
 void HalProxy::handlePendingWrites() {
-    // TODO(b/143302327): Find a way to optimize locking strategy maybe using two mutexes instead of
-    // one.
-    std::unique_lock<std::mutex> lock(mEventQueueWriteMutex);
     while (mThreadsRun.load()) {
-        mEventQueueWriteCV.wait(
-                lock, [&] { return !mPendingWriteEventsQueue.empty() || !mThreadsRun.load(); });
-        if (mThreadsRun.load()) {
-            std::vector<Event>& pendingWriteEvents = mPendingWriteEventsQueue.front().first;
-            size_t numWakeupEvents = mPendingWriteEventsQueue.front().second;
-            size_t eventQueueSize = mEventQueue->getQuantumCount();
-            size_t numToWrite = std::min(pendingWriteEvents.size(), eventQueueSize);
-            lock.unlock();
-            if (!mEventQueue->writeBlocking(
-                        pendingWriteEvents.data(), numToWrite,
-                        static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
-                        static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
-                        kPendingWriteTimeoutNs, mEventQueueFlag)) {
-                ALOGE("Dropping %zu events after blockingWrite failed.", numToWrite);
-                if (numWakeupEvents > 0) {
-                    if (pendingWriteEvents.size() > eventQueueSize) {
-                        decrementRefCountAndMaybeReleaseWakelock(
-                                countNumWakeupEvents(pendingWriteEvents, eventQueueSize));
-                    } else {
-                        decrementRefCountAndMaybeReleaseWakelock(numWakeupEvents);
-                    }
-                }
-            }
-            lock.lock();
-            mSizePendingWriteEventsQueue -= numToWrite;
-            if (pendingWriteEvents.size() > eventQueueSize) {
-                // TODO(b/143302327): Check if this erase operation is too inefficient. It will copy
-                // all the events ahead of it down to fill gap off array at front after the erase.
-                pendingWriteEvents.erase(pendingWriteEvents.begin(),
-                                         pendingWriteEvents.begin() + eventQueueSize);
-            } else {
-                mPendingWriteEventsQueue.pop();
-            }
+        {
+            std::unique_lock<std::mutex> lock(mPendingWritesMutex);
+            mPendingWritesCV.wait(lock, [&] {
+                return mPendingWriteEvents.hasPublished() || !mThreadsRun.load();
+            });
+        }
+        if (!mThreadsRun.load()) {
+            break;
+        }
+
+        size_t numWritten;
+        {
+            std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+            numWritten = drainPendingWritesLocked();
+        }
+        mNumEventsWrittenInBackground += numWritten;
+        if (numWritten > 0 || !mPendingWriteEvents.hasPublished()) {
+            continue;
+        }
+
+        // The fmq is full. Sleep until the framework reads from it rather than blocking a write
+        // for a fixed batch size, so that whatever space it frees up gets filled right away.
+        uint32_t efState = 0;
+        status_t status =
+                mEventQueueFlag->wait(static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
+                                      &efState, kPendingWriteTimeoutNs);
+        if (status != -ETIMEDOUT || !mThreadsRun.load()) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+        if (mEventQueue->availableToWrite() > 0) {
+            continue;
+        }
+        const Event* events;
+        size_t numToDrop = mPendingWriteEvents.peek(mEventQueue->getQuantumCount(), &events);
+        ALOGE("Dropping %zu events after pending write timed out.", numToDrop);
+        decrementRefCountAndMaybeReleaseWakelock(countNumWakeupEvents(events, numToDrop));
+        mPendingWriteEvents.pop(numToDrop);
+        mNumEventsDroppedTimeout += numToDrop;
+    }
+}
+
+size_t HalProxy::drainPendingWritesLocked() {
+    size_t numWritten = 0;
+    // A single peek never crosses the end of the ring, so it can take two writes to fill the fmq.
+    for (;;) {
+        size_t availableToWrite = mEventQueue->availableToWrite();
+        if (availableToWrite == 0) {
+            break;
+        }
+        const Event* events;
+        size_t numToWrite = mPendingWriteEvents.peek(availableToWrite, &events);
+        if (numToWrite == 0 || !mEventQueue->write(events, numToWrite)) {
+            break;
+        }
+        mPendingWriteEvents.pop(numToWrite);
+        numWritten += numToWrite;
+    }
+    if (numWritten > 0) {
+        mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+    }
+    return numWritten;
+}
+
+void HalProxy::drainPendingWritesFromCallback() {
+    // Whoever holds the lock re-checks the ring after releasing it, so events pushed by a callback
+    // that lost the try_lock race are never left behind while the fmq still has room.
+    while (mPendingWriteEvents.hasPublished() && mEventQueueWriteMutex.try_lock()) {
+        bool fmqFull = false;
+        if (mEventQueue != nullptr) {
+            drainPendingWritesLocked();
+            fmqFull = mEventQueue->availableToWrite() == 0;
+        }
+        mEventQueueWriteMutex.unlock();
+        if (fmqFull) {
+            break;
         }
     }
+    if (mPendingWriteEvents.hasPublished()) {
+        {
+            std::lock_guard<std::mutex> lock(mPendingWritesMutex);
+        }
+        mPendingWritesCV.notify_one();
+    }
 }
 
 void HalProxy::startWakelockThread(HalProxy* halProxy) {
@@ -646,33 +701,20 @@ void HalProxy::resetSharedWakelock() {
 
 void HalProxy::postEventsToMessageQueue(const std::vector<Event>& events, size_t numWakeupEvents,
                                         V2_0::implementation::ScopedWakelock wakelock) {
-    size_t numToWrite = 0;
-    std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
     if (wakelock.isLocked()) {
         incrementRefCountAndMaybeAcquireWakelock(numWakeupEvents);
     }
-    if (mPendingWriteEventsQueue.empty()) {
-        numToWrite = std::min(events.size(), mEventQueue->availableToWrite());
-        if (numToWrite > 0) {
-            if (mEventQueue->write(events.data(), numToWrite)) {
-                // TODO(b/143302327): While loop if mEventQueue->avaiableToWrite > 0 to possibly fit
-                // in more writes immediately
-                mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
-            } else {
-                numToWrite = 0;
-            }
+    size_t numPushed = mPendingWriteEvents.push(events.data(), events.size());
+    if (numPushed < events.size()) {
+        size_t numDropped = events.size() - numPushed;
+        ALOGE("Dropping %zu events with pending write events ring full.", numDropped);
+        mNumEventsDroppedRingFull += numDropped;
+        if (numWakeupEvents > 0) {
+            decrementRefCountAndMaybeReleaseWakelock(
+                    countNumWakeupEvents(events.data() + numPushed, numDropped));
         }
     }
-    size_t numLeft = events.size() - numToWrite;
-    if (numToWrite < events.size() &&
-        mSizePendingWriteEventsQueue + numLeft <= kMaxSizePendingWriteEventsQueue) {
-        std::vector<Event> eventsLeft(events.begin() + numToWrite, events.end());
-        mPendingWriteEventsQueue.push({eventsLeft, numWakeupEvents});
-        mSizePendingWriteEventsQueue += numLeft;
-        mMostEventsObservedPendingWriteEventsQueue =
-                std::max(mMostEventsObservedPendingWriteEventsQueue, mSizePendingWriteEventsQueue);
-        mEventQueueWriteCV.notify_one();
-    }
+    drainPendingWritesFromCallback();
 }
 
 bool HalProxy::incrementRefCountAndMaybeAcquireWakelock(size_t delta,
@@ -730,11 +772,13 @@ bool HalProxy::isSubHalIndexValid(int32_t sensorHandle) {
     return extractSubHalIndex(sensorHandle) < mSubHalList.size();
 }
 
-size_t HalProxy::countNumWakeupEvents(const std::vector<Event>& events, size_t n) {
+size_t HalProxy::countNumWakeupEvents(const Event* events, size_t n) {
     size_t numWakeupEvents = 0;
     for (size_t i = 0; i < n; i++) {
-        int32_t sensorHandle = events[i].sensorHandle;
-        if (mSensors[sensorHandle].flags & static_cast<uint32_t>(V1_0::SensorFlagBits::WAKE_UP)) {
+        // Called off the binder threads, so look up without inserting into mSensors.
+        auto sensor = mSensors.find(events[i].sensorHandle);
+        if (sensor != mSensors.end() &&
+            (sensor->second.flags & static_cast<uint32_t>(V1_0::SensorFlagBits::WAKE_UP))) {
             numWakeupEvents++;
         }
     }
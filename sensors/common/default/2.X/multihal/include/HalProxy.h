@@ -19,6 +19,7 @@
 #include "EventMessageQueueWrapper.h"
 #include "HalProxyCallback.h"
 #include "ISensorsCallbackWrapper.h"
+#include "PendingEventRing.h"
 #include "SubHalWrapper.h"
 #include "V2_0/ScopedWakelock.h"
 #include "V2_0/SubHal.h"
@@ -36,7 +37,6 @@
 #include <condition_variable>
 #include <map>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <utility>
 
@@ -199,26 +199,35 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     //! The bit mask used to get the subhal index from a sensor handle.
     static constexpr int32_t kSensorHandleSubHalIndexMask = 0xFF000000;
 
+    //! The max number of events allowed in the pending write events ring
+    static constexpr size_t kMaxSizePendingWriteEventsQueue = 100000;
+
     /**
-     * A FIFO queue of pairs of vector of events and the number of wakeup events in that vector
-     * which are waiting to be written to the events fmq in the background thread.
+     * The ring every posted event goes through on its way to the events fmq. Subhal callbacks push
+     * onto it without locking and whichever thread holds mEventQueueWriteMutex drains it.
      */
-    std::queue<std::pair<std::vector<Event>, size_t>> mPendingWriteEventsQueue;
+    PendingEventRing mPendingWriteEvents{kMaxSizePendingWriteEventsQueue};
 
-    //! The most events observed on the pending write events queue for debug purposes.
-    size_t mMostEventsObservedPendingWriteEventsQueue = 0;
+    //! The number of events dropped because the pending write events ring was full
+    std::atomic<size_t> mNumEventsDroppedRingFull = 0;
 
-    //! The max number of events allowed in the pending write events queue
-    static constexpr size_t kMaxSizePendingWriteEventsQueue = 100000;
+    //! The number of events dropped because the framework did not read the fmq in time
+    std::atomic<size_t> mNumEventsDroppedTimeout = 0;
 
-    //! The number of events in the pending write events queue
-    size_t mSizePendingWriteEventsQueue = 0;
+    //! The number of events written to the fmq by the pending writes thread
+    std::atomic<size_t> mNumEventsWrittenInBackground = 0;
 
-    //! The mutex protecting writing to the fmq and the pending events queue
+    /**
+     * The mutex serializing writes to the fmq and consumption of mPendingWriteEvents. Only ever
+     * held for non blocking fmq writes; callbacks try_lock it and never wait on it.
+     */
     std::mutex mEventQueueWriteMutex;
 
+    //! The mutex the pending writes thread sleeps on while the ring is empty
+    std::mutex mPendingWritesMutex;
+
     //! The condition variable waiting on pending write events to stack up
-    std::condition_variable mEventQueueWriteCV;
+    std::condition_variable mPendingWritesCV;
 
     //! The thread object ptr that handles pending writes
     std::thread mPendingWritesThread;
@@ -301,6 +310,20 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     //! Handles the pending writes on events to eventqueue.
     void handlePendingWrites();
 
+    /**
+     * Move as many events from the pending write events ring to the event fmq as fit in it right
+     * now. The caller must hold mEventQueueWriteMutex.
+     *
+     * @return The number of events written.
+     */
+    size_t drainPendingWritesLocked();
+
+    /**
+     * Drain the pending write events ring from a callback thread for as long as no other thread is
+     * already doing so, then hand anything that did not fit to the pending writes thread.
+     */
+    void drainPendingWritesFromCallback();
+
     /**
      * Starts the thread that handles decrementing the ref count on wakeup events processed by the
      * framework and timing out wakelocks.
@@ -355,14 +378,14 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     bool isSubHalIndexValid(int32_t sensorHandle);
 
     /**
-     * Count the number of wakeup events in the first n events of the vector.
+     * Count the number of wakeup events in the first n events of the array.
      *
-     * @param events The vector of Event objects.
+     * @param events The array of Event objects.
      * @param n The end index not inclusive of events to consider.
      *
      * @return The number of wakeup events of the considered events.
      */
-    size_t countNumWakeupEvents(const std::vector<Event>& events, size_t n);
+    size_t countNumWakeupEvents(const Event* events, size_t n);
 
     /*
      * Clear out the subhal index bytes from a sensorHandle.
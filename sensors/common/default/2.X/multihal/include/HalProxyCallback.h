@@ -50,9 +50,9 @@ class ISubHalCallback {
             const hidl_vec<int32_t>& dynamicSensorHandlesRemoved, int32_t subHalIndex) = 0;
 
     /**
-     * Post events to the event message queue if there is room to write them. Otherwise post the
-     * remaining events to a background thread for a blocking write with a kPendingWriteTimeoutNs
-     * timeout.
+     * Push events onto the pending write events ring and write as many of them to the event
+     * message queue as there is room for. Whatever is left is written by the pending writes
+     * thread once the framework has read events. Events that do not fit in the ring are dropped.
      *
      * @param events The list of events to post to the message queue.
      * @param numWakeupEvents The number of wakeup events in events.
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * A bounded ring of preallocated Event slots that sits between the subhal callbacks and the
+ * events fmq. Any number of threads may push concurrently without taking a lock: a producer
+ * reserves a contiguous run of slots with a single CAS on the tail, copies its events in and
+ * publishes each slot by stamping its sequence number. A single consumer at a time (serialized by
+ * the caller) peeks the longest contiguous run of published slots and pops it once written.
+ *
+ * Positions grow monotonically and are never rewound, so a slot's stamp from a previous lap can
+ * never be mistaken for the current one, even across clear().
+ */
+class PendingEventRing {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+
+    /**
+     * @param minCapacity The minimum number of events the ring must be able to hold. Rounded up
+     *     to a power of two. Slot storage is allocated up front but left untouched, so only the
+     *     pages backing the high water mark ever become resident.
+     */
+    explicit PendingEventRing(size_t minCapacity)
+        : mCapacity(roundUpToPowerOfTwo(minCapacity)),
+          mMask(mCapacity - 1),
+          mEvents(new Event[mCapacity]),
+          mSequences(new std::atomic<uint32_t>[mCapacity]()) {}
+
+    PendingEventRing(const PendingEventRing&) = delete;
+    PendingEventRing& operator=(const PendingEventRing&) = delete;
+
+    /**
+     * Push up to count events. Safe to call from any number of threads at once.
+     *
+     * @return The number of leading events of the array that were enqueued. Anything past that
+     *     did not fit and is the caller's to drop.
+     */
+    size_t push(const Event* events, size_t count) {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        size_t numToPush;
+        for (;;) {
+            uint64_t used = tail - mHead.load(std::memory_order_acquire);
+            if (used > mCapacity) {
+                // Our tail is stale and the consumer has already moved past it.
+                tail = mTail.load(std::memory_order_relaxed);
+                continue;
+            }
+            numToPush = std::min(count, static_cast<size_t>(mCapacity - used));
+            if (numToPush == 0) {
+                return 0;
+            }
+            if (mTail.compare_exchange_weak(tail, tail + numToPush, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                updateHighWater(used + numToPush);
+                break;
+            }
+        }
+        for (size_t i = 0; i < numToPush; i++) {
+            uint64_t pos = tail + i;
+            mEvents[pos & mMask] = events[i];
+            mSequences[pos & mMask].store(stamp(pos), std::memory_order_release);
+        }
+        return numToPush;
+    }
+
+    /**
+     * Find the run of published events at the head of the ring that can be handed to a single
+     * fmq write. Consumer only.
+     *
+     * @param maxCount The largest number of events the caller can accept.
+     * @param events Set to the first event of the run when the return value is non zero.
+     *
+     * @return The length of the run, which never crosses the end of the slot array.
+     */
+    size_t peek(size_t maxCount, const Event** events) const {
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        size_t limit = std::min(maxCount, static_cast<size_t>(mCapacity - (head & mMask)));
+        size_t count = 0;
+        while (count < limit &&
+               mSequences[(head + count) & mMask].load(std::memory_order_acquire) ==
+                       stamp(head + count)) {
+            count++;
+        }
+        *events = &mEvents[head & mMask];
+        return count;
+    }
+
+    //! Release the first count events returned by peek(). Consumer only.
+    void pop(size_t count) {
+        mHead.store(mHead.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    //! Discard everything currently in the ring. Must not race with producers or the consumer.
+    void clear() { mHead.store(mTail.load(std::memory_order_acquire), std::memory_order_release); }
+
+    //! Whether the event at the head of the ring has been published and can be consumed.
+    bool hasPublished() const {
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        return mSequences[head & mMask].load(std::memory_order_acquire) == stamp(head);
+    }
+
+    //! The number of slots currently reserved, including those still being filled in.
+    size_t size() const {
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        return static_cast<size_t>(mTail.load(std::memory_order_acquire) - head);
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+    //! The most slots ever reserved at once since construction.
+    size_t highWater() const { return mHighWater.load(std::memory_order_relaxed); }
+
+  private:
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t capacity = 1;
+        while (capacity < n) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    // Truncated to 32 bits: a stale stamp differs from the current one by a non zero multiple of
+    // the capacity, which is far smaller than 2^32.
+    static uint32_t stamp(uint64_t pos) { return static_cast<uint32_t>(pos + 1); }
+
+    void updateHighWater(size_t used) {
+        size_t highWater = mHighWater.load(std::memory_order_relaxed);
+        while (used > highWater && !mHighWater.compare_exchange_weak(
+                                           highWater, used, std::memory_order_relaxed)) {
+        }
+    }
+
+    const size_t mCapacity;
+    const size_t mMask;
+    std::unique_ptr<Event[]> mEvents;
+    std::unique_ptr<std::atomic<uint32_t>[]> mSequences;
+
+    //! Position of the next slot to consume. Only the consumer writes it.
+    std::atomic<uint64_t> mHead = 0;
+
+    //! Position of the next slot to reserve.
+    std::atomic<uint64_t> mTail = 0;
+
+    std::atomic<size_t> mHighWater = 0;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
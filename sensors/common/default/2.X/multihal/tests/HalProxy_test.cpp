@@ -798,6 +798,48 @@ TEST(HalProxyTest, FillAndDrainPendingQueueTest) {
     EXPECT_TRUE(readEventsOutOfQueue(1, eventQueue, eventQueueFlag));
 }
 
+TEST(HalProxyTest, PendingEventsKeepPostOrder) {
+    constexpr size_t kQueueSize = 5;
+    constexpr size_t kNumEventsPerPost = 7;
+    constexpr size_t kNumPosts = 3;
+    AllSensorsSubHal<SensorsSubHalV2_0> subhal;
+    std::vector<ISensorsSubHal*> subHals{&subhal};
+
+    std::unique_ptr<EventMessageQueueV2_0> eventQueue = makeEventFMQ(kQueueSize);
+    std::unique_ptr<WakeupMessageQueue> wakeLockQueue = makeWakelockFMQ(kQueueSize);
+    ::android::sp<ISensorsCallbackV2_0> callback = new SensorsCallback();
+    EventFlag* eventQueueFlag;
+    EventFlag::createEventFlag(eventQueue->getEventFlagWord(), &eventQueueFlag);
+    HalProxy proxy(subHals);
+    proxy.initialize(*eventQueue->getDesc(), *wakeLockQueue->getDesc(), callback);
+
+    int64_t timestamp = 0;
+    for (size_t i = 0; i < kNumPosts; i++) {
+        std::vector<EventV1_0> events = makeMultipleAccelerometerEvents(kNumEventsPerPost);
+        for (EventV1_0& event : events) {
+            event.timestamp = timestamp++;
+        }
+        subhal.postEvents(convertToNewEvents(events), false);
+    }
+
+    // Events parked on the pending writes ring must come out in the order they were posted, with
+    // the fmq refilled as soon as each read frees up room.
+    constexpr int64_t kReadBlockingTimeout = INT64_C(500000000);
+    int64_t expectedTimestamp = 0;
+    while (expectedTimestamp < timestamp) {
+        size_t numToRead = std::min(kQueueSize, static_cast<size_t>(timestamp - expectedTimestamp));
+        std::vector<EventV1_0> eventsOut(numToRead);
+        ASSERT_TRUE(eventQueue->readBlocking(
+                eventsOut.data(), numToRead,
+                static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
+                static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS), kReadBlockingTimeout,
+                eventQueueFlag));
+        for (const EventV1_0& event : eventsOut) {
+            EXPECT_EQ(event.timestamp, expectedTimestamp++);
+        }
+    }
+}
+
 TEST(HalProxyTest, PostEventsMultipleSubhalsThreadedV2_1) {
     constexpr size_t kQueueSize = 5;
     constexpr size_t kNumEvents = 2;
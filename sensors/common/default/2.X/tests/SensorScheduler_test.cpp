@@ -0,0 +1,236 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "Sensor.h"
+#include "SensorScheduler.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_X {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::SensorType;
+
+using namespace std::chrono_literals;
+
+static constexpr int64_t kFastPeriodNs = 10 * 1000 * 1000;
+static constexpr int64_t kSlowPeriodNs = 100 * 1000 * 1000;
+static constexpr auto kTimeout = 1s;
+
+class RecordingCallback : public ISensorsEventCallback {
+  public:
+    struct Post {
+        std::vector<Event> events;
+        bool wakeup;
+    };
+
+    void postEvents(const std::vector<Event>& events, bool wakeup) override {
+        std::unique_lock<std::mutex> lock(mLock);
+        mPosts.push_back({events, wakeup});
+        mPostedCV.notify_all();
+        mReleasedCV.wait(lock, [this] { return !mBlocked; });
+    }
+
+    //! Makes postEvents() block until release() is called.
+    void block() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mBlocked = true;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mBlocked = false;
+        mReleasedCV.notify_all();
+    }
+
+    bool waitForPost() {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mPostedCV.wait_for(lock, kTimeout, [this] { return !mPosts.empty(); });
+    }
+
+    std::vector<Post> takePosts() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return std::move(mPosts);
+    }
+
+    size_t countEvents(int32_t sensorHandle) {
+        std::lock_guard<std::mutex> lock(mLock);
+        size_t count = 0;
+        for (const Post& post : mPosts) {
+            for (const Event& event : post.events) {
+                if (event.sensorHandle == sensorHandle) {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mPostedCV;
+    std::condition_variable mReleasedCV;
+    std::vector<Post> mPosts;
+    bool mBlocked = false;
+};
+
+class TestSensor : public Sensor {
+  public:
+    TestSensor(int32_t sensorHandle, ISensorsEventCallback* callback, bool wakeup = false)
+        : Sensor(callback) {
+        mSensorInfo.sensorHandle = sensorHandle;
+        mSensorInfo.type = SensorType::ACCELEROMETER;
+        mSensorInfo.minDelay = 1000;  // microseconds
+        mSensorInfo.maxDelay = kDefaultMaxDelayUs;
+        mSensorInfo.flags = wakeup ? static_cast<uint32_t>(SensorFlagBits::WAKE_UP) : 0;
+    }
+
+    void start(int64_t samplingPeriodNs) {
+        batch(samplingPeriodNs);
+        activate(true);
+    }
+};
+
+TEST(SensorSchedulerTest, FollowsPeriodChangeWhileScheduled) {
+    RecordingCallback callback;
+    TestSensor sensor(1, &callback);
+    sensor.start(kSlowPeriodNs);
+    ASSERT_TRUE(callback.waitForPost());
+
+    sensor.batch(kFastPeriodNs);
+    callback.takePosts();
+    std::this_thread::sleep_for(200ms);
+    // 20 samples are due at the fast period, 2 at the slow one.
+    EXPECT_GE(callback.countEvents(1), 10u);
+
+    sensor.batch(kSlowPeriodNs);
+    std::this_thread::sleep_for(10ms);
+    callback.takePosts();
+    std::this_thread::sleep_for(300ms);
+    EXPECT_LE(callback.countEvents(1), 4u);
+}
+
+TEST(SensorSchedulerTest, RemovesSensorFromMiddleOfHeap) {
+    RecordingCallback callback;
+    std::vector<std::unique_ptr<TestSensor>> sensors;
+    for (int32_t handle = 1; handle <= 5; handle++) {
+        sensors.push_back(std::make_unique<TestSensor>(handle, &callback));
+        sensors.back()->start(handle * kFastPeriodNs);
+    }
+    std::this_thread::sleep_for(50ms);
+
+    // Their deadlines fall between those of the sensors that remain, so they are removed from the
+    // middle of the heap rather than from its top or its end.
+    sensors[1]->activate(false);
+    sensors[3]->activate(false);
+    callback.takePosts();
+    std::this_thread::sleep_for(300ms);
+
+    EXPECT_EQ(0u, callback.countEvents(2));
+    EXPECT_EQ(0u, callback.countEvents(4));
+    // 30, 10 and 6 samples are due.
+    EXPECT_GE(callback.countEvents(1), 15u);
+    EXPECT_GE(callback.countEvents(3), 5u);
+    EXPECT_GE(callback.countEvents(5), 3u);
+}
+
+TEST(SensorSchedulerTest, PostsDueSensorsOncePerCallbackAndWakeupClass) {
+    RecordingCallback callback;
+    RecordingCallback otherCallback;
+    TestSensor sensor1(1, &callback);
+    TestSensor sensor2(2, &callback);
+    TestSensor wakeupSensor(3, &callback, true /* wakeup */);
+    TestSensor otherSensor(4, &otherCallback);
+    for (TestSensor* sensor : {&sensor1, &sensor2, &wakeupSensor, &otherSensor}) {
+        sensor->start(kFastPeriodNs);
+    }
+    // After their first sample, all of them fall due at the same time.
+    std::this_thread::sleep_for(50ms);
+    callback.takePosts();
+    otherCallback.takePosts();
+    std::this_thread::sleep_for(100ms);
+
+    size_t nonWakeupPosts = 0;
+    size_t wakeupPosts = 0;
+    for (const RecordingCallback::Post& post : callback.takePosts()) {
+        std::set<int32_t> handles;
+        for (const Event& event : post.events) {
+            handles.insert(event.sensorHandle);
+            EXPECT_EQ(post.events[0].timestamp, event.timestamp);
+        }
+        if (post.wakeup) {
+            wakeupPosts++;
+            EXPECT_EQ(std::set<int32_t>({3}), handles);
+        } else {
+            nonWakeupPosts++;
+            EXPECT_EQ(std::set<int32_t>({1, 2}), handles);
+            EXPECT_EQ(2u, post.events.size());
+        }
+    }
+    EXPECT_GE(nonWakeupPosts, 5u);
+    EXPECT_GE(wakeupPosts, 5u);
+    for (const RecordingCallback::Post& post : otherCallback.takePosts()) {
+        EXPECT_FALSE(post.wakeup);
+        ASSERT_EQ(1u, post.events.size());
+        EXPECT_EQ(4, post.events[0].sensorHandle);
+    }
+}
+
+TEST(SensorSchedulerTest, UnscheduleWaitsForPostInFlight) {
+    RecordingCallback callback;
+    callback.block();
+    TestSensor sensor(1, &callback);
+    sensor.start(kFastPeriodNs);
+    bool posting = callback.waitForPost();
+    if (!posting) {
+        callback.release();
+    }
+    ASSERT_TRUE(posting);
+
+    std::atomic<bool> deactivated = false;
+    std::thread deactivate([&] {
+        sensor.activate(false);
+        deactivated = true;
+    });
+    std::this_thread::sleep_for(50ms);
+    EXPECT_FALSE(deactivated);
+
+    callback.release();
+    deactivate.join();
+    EXPECT_TRUE(deactivated);
+    size_t count = callback.countEvents(1);
+    std::this_thread::sleep_for(50ms);
+    EXPECT_EQ(count, callback.countEvents(1));
+}
+
+}  // namespace implementation
+}  // namespace V2_X
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
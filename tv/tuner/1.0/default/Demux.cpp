@@ -85,6 +85,7 @@ Return<void> Demux::openFilter(const DemuxFilterType& type, uint32_t bufferSize,
         if (mDvrPlayback != nullptr) {
             result = mDvrPlayback->addPlaybackFilter(filterId, filter);
         }
+        updatePidTable();
     }
 
     _hidl_cb(result ? Result::SUCCESS : Result::INVALID_ARGUMENT, filter);
@@ -163,6 +164,7 @@ Return<Result> Demux::close() {
     mRecordFilterIds.clear();
     mFilters.clear();
     mLastUsedFilterId = -1;
+    updatePidTable();
 
     return Result::SUCCESS;
 }
@@ -234,30 +236,51 @@ Result Demux::removeFilter(uint32_t filterId) {
     mPlaybackFilterIds.erase(filterId);
     mRecordFilterIds.erase(filterId);
     mFilters.erase(filterId);
+    updatePidTable();
 
     return Result::SUCCESS;
 }
 
-void Demux::startBroadcastTsFilter(vector<uint8_t> data) {
+void Demux::updatePidTable() {
+    std::lock_guard<std::mutex> lock(mPidTableLock);
+    mPidTable.resize(kTsPidCount);
+    for (auto& filters : mPidTable) {
+        filters.clear();
+    }
     set<uint32_t>::iterator it;
-    uint16_t pid = ((data[1] & 0x1f) << 8) | ((data[2] & 0xff));
+    for (it = mPlaybackFilterIds.begin(); it != mPlaybackFilterIds.end(); it++) {
+        auto filter = mFilters.find(*it);
+        if (filter == mFilters.end() || filter->second->getTpid() >= kTsPidCount) {
+            continue;
+        }
+        mPidTable[filter->second->getTpid()].push_back(filter->second);
+    }
+}
+
+void Demux::startBroadcastTsFilter(const uint8_t* packet, size_t size) {
+    if (size < 3) {
+        return;
+    }
+    uint16_t pid = ((packet[1] & 0x1f) << 8) | ((packet[2] & 0xff));
     if (DEBUG_DEMUX) {
         ALOGW("[Demux] start ts filter pid: %d", pid);
     }
-    for (it = mPlaybackFilterIds.begin(); it != mPlaybackFilterIds.end(); it++) {
-        if (pid == mFilters[*it]->getTpid()) {
-            mFilters[*it]->updateFilterOutput(data);
-        }
+    std::lock_guard<std::mutex> lock(mPidTableLock);
+    if (mPidTable.empty()) {
+        return;
+    }
+    for (const sp<Filter>& filter : mPidTable[pid]) {
+        filter->updateFilterOutput(packet, size);
     }
 }
 
-void Demux::sendFrontendInputToRecord(vector<uint8_t> data) {
+void Demux::sendFrontendInputToRecord(const uint8_t* packet, size_t size) {
     set<uint32_t>::iterator it;
     if (DEBUG_DEMUX) {
         ALOGW("[Demux] update record filter output");
     }
     for (it = mRecordFilterIds.begin(); it != mRecordFilterIds.end(); it++) {
-        mFilters[*it]->updateRecordOutput(data);
+        mFilters[*it]->updateRecordOutput(packet, size);
     }
 }
 
@@ -290,14 +313,6 @@ Result Demux::startFilterHandler(uint32_t filterId) {
     return mFilters[filterId]->startFilterHandler();
 }
 
-void Demux::updateFilterOutput(uint16_t filterId, vector<uint8_t> data) {
-    mFilters[filterId]->updateFilterOutput(data);
-}
-
-uint16_t Demux::getFilterTpid(uint32_t filterId) {
-    return mFilters[filterId]->getTpid();
-}
-
 void Demux::startFrontendInputLoop() {
     pthread_create(&mFrontendInputThread, NULL, __threadLoopFrontend, this);
     pthread_setname_np(mFrontendInputThread, "frontend_input_thread");
@@ -86,8 +86,11 @@ class Demux : public IDemux {
     bool attachRecordFilter(int filterId);
     bool detachRecordFilter(int filterId);
     Result startFilterHandler(uint32_t filterId);
-    void updateFilterOutput(uint16_t filterId, vector<uint8_t> data);
-    uint16_t getFilterTpid(uint32_t filterId);
+    /**
+     * Rebuild the PID table from the playback filters and their TPIDs.
+     * Must be called whenever either of them changes.
+     */
+    void updatePidTable();
     void setIsRecording(bool isRecording);
     void startFrontendInputLoop();
 
@@ -97,9 +100,13 @@ class Demux : public IDemux {
      * Note that recording filters are not included.
      */
     bool startBroadcastFilterDispatcher();
-    void startBroadcastTsFilter(vector<uint8_t> data);
+    /**
+     * Append a TS packet to the output of every playback filter whose TPID matches its PID.
+     * The packet is only referenced for the duration of the call.
+     */
+    void startBroadcastTsFilter(const uint8_t* packet, size_t size);
 
-    void sendFrontendInputToRecord(vector<uint8_t> data);
+    void sendFrontendInputToRecord(const uint8_t* packet, size_t size);
     bool startRecordFilterDispatcher();
 
   private:
@@ -151,6 +158,17 @@ class Demux : public IDemux {
      * The array number is the filter ID.
      */
     std::map<uint32_t, sp<Filter>> mFilters;
+    /**
+     * The playback filters that take each of the 8192 TS PIDs, so that a packet is only handed
+     * to the filters it matches instead of being compared with every filter.
+     */
+    static constexpr size_t kTsPidCount = 1 << 13;
+    vector<vector<sp<Filter>>> mPidTable;
+    /**
+     * Lock to protect the PID table, which is rebuilt on the binder threads and read on the
+     * input threads.
+     */
+    std::mutex mPidTableLock;
 
     /**
      * Local reference to the opened Timer Filter instance.
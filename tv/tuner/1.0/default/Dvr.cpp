@@ -239,40 +239,52 @@ PlaybackStatus Dvr::checkPlaybackStatusChange(uint32_t availableToWrite, uint32_
 }
 
 bool Dvr::readPlaybackFMQ(bool isVirtualFrontend, bool isRecording) {
-    // Read playback data from the input FMQ
-    int size = mDvrMQ->availableToRead();
-    int playbackPacketSize = mDvrSettings.playback().packetSize;
-    vector<uint8_t> dataOutputBuffer;
-    dataOutputBuffer.resize(playbackPacketSize);
-    // Dispatch the packet to the PID matching filter output buffer
-    for (int i = 0; i < size / playbackPacketSize; i++) {
-        if (!mDvrMQ->read(dataOutputBuffer.data(), playbackPacketSize)) {
-            return false;
-        }
-        if (isVirtualFrontend) {
-            if (isRecording) {
-                mDemux->sendFrontendInputToRecord(dataOutputBuffer);
-            } else {
-                mDemux->startBroadcastTsFilter(dataOutputBuffer);
-            }
+    // Read all the whole packets available in the input FMQ at once
+    size_t playbackPacketSize = mDvrSettings.playback().packetSize;
+    if (playbackPacketSize == 0) {
+        return false;
+    }
+    size_t size = mDvrMQ->availableToRead() / playbackPacketSize * playbackPacketSize;
+    if (size == 0) {
+        return true;
+    }
+    DvrMQ::MemTransaction tx;
+    if (!mDvrMQ->beginRead(size, &tx)) {
+        return false;
+    }
+    // Dispatch the packets to the PID matching filter output buffers straight from the FMQ
+    const auto& first = tx.getFirstRegion();
+    const auto& second = tx.getSecondRegion();
+    for (size_t offset = 0; offset < size; offset += playbackPacketSize) {
+        const uint8_t* packet;
+        if (offset + playbackPacketSize <= first.getLength()) {
+            packet = first.getAddress() + offset;
+        } else if (offset >= first.getLength()) {
+            packet = second.getAddress() + (offset - first.getLength());
         } else {
-            startTpidFilter(dataOutputBuffer);
+            // Only the packet that wraps around the end of the FMQ needs to be copied
+            mWrappedPacket.resize(playbackPacketSize);
+            if (!tx.copyFrom(mWrappedPacket.data(), offset, playbackPacketSize)) {
+                return false;
+            }
+            packet = mWrappedPacket.data();
         }
+        startTpidFilter(packet, playbackPacketSize, isVirtualFrontend, isRecording);
     }
 
-    return true;
+    return mDvrMQ->commitRead(size);
 }
 
-void Dvr::startTpidFilter(vector<uint8_t> data) {
-    std::map<uint32_t, sp<IFilter>>::iterator it;
-    for (it = mFilters.begin(); it != mFilters.end(); it++) {
-        uint16_t pid = ((data[1] & 0x1f) << 8) | ((data[2] & 0xff));
-        if (DEBUG_DVR) {
-            ALOGW("[Dvr] start ts filter pid: %d", pid);
-        }
-        if (pid == mDemux->getFilterTpid(it->first)) {
-            mDemux->updateFilterOutput(it->first, data);
-        }
+void Dvr::startTpidFilter(const uint8_t* packet, size_t size, bool isVirtualFrontend,
+                          bool isRecording) {
+    if (DEBUG_DVR) {
+        ALOGW("[Dvr] start ts filter pid: %d", ((packet[1] & 0x1f) << 8) | packet[2]);
+    }
+    if (isVirtualFrontend && isRecording) {
+        mDemux->sendFrontendInputToRecord(packet, size);
+    } else {
+        // The playback filters attached to this dvr are the ones in the demux PID table
+        mDemux->startBroadcastTsFilter(packet, size);
     }
 }
 
@@ -107,14 +107,21 @@ class Dvr : public IDvr {
     /**
      * A dispatcher to read and dispatch input data to all the started filters.
      * Each filter handler handles the data filtering/output writing/filterEvent updating.
+     * The packet is only referenced for the duration of the call.
      */
-    void startTpidFilter(vector<uint8_t> data);
+    void startTpidFilter(const uint8_t* packet, size_t size, bool isVirtualFrontend,
+                         bool isRecording);
     static void* __threadLoopPlayback(void* user);
     static void* __threadLoopRecord(void* user);
     void playbackThreadLoop();
     void recordThreadLoop();
 
     unique_ptr<DvrMQ> mDvrMQ;
+    /**
+     * Copy of the playback packet that wraps around the end of the FMQ, if any.
+     * Every other packet is dispatched straight from the FMQ memory.
+     */
+    vector<uint8_t> mWrappedPacket;
     EventFlag* mDvrEventFlag;
     /**
      * Demux callbacks used on filter events or IO buffer status
@@ -107,6 +107,8 @@ Return<Result> Filter::configure(const DemuxFilterSettings& settings) {
     switch (mType.mainType) {
         case DemuxFilterMainType::TS:
             mTpid = settings.ts().tpid;
+            mDemux->updatePidTable();
+            configureReassembler(settings.ts());
             break;
         case DemuxFilterMainType::MMTP:
             break;
@@ -123,6 +125,32 @@ Return<Result> Filter::configure(const DemuxFilterSettings& settings) {
     return Result::SUCCESS;
 }
 
+void Filter::configureReassembler(const DemuxTsFilterSettings& settings) {
+    std::lock_guard<std::mutex> lock(mFilterOutputLock);
+    switch (mType.subType.tsFilterType()) {
+        case DemuxTsFilterType::SECTION: {
+            using FilterSettings = DemuxTsFilterSettings::FilterSettings;
+            bool checkCrc = settings.filterSettings.getDiscriminator() ==
+                                    FilterSettings::hidl_discriminator::section &&
+                            settings.filterSettings.section().isCheckCrc;
+            mReassembler = std::make_unique<TsReassembler>(TsReassembler::Mode::SECTION,
+                                                           mFilterMQ.get(), checkCrc);
+            break;
+        }
+        case DemuxTsFilterType::PES:
+            mReassembler = std::make_unique<TsReassembler>(TsReassembler::Mode::PES,
+                                                           mFilterMQ.get(), false);
+            break;
+        case DemuxTsFilterType::TS:
+            mReassembler = std::make_unique<TsReassembler>(TsReassembler::Mode::TS,
+                                                           mFilterMQ.get(), false);
+            break;
+        default:
+            mReassembler = nullptr;
+            break;
+    }
+}
+
 Return<Result> Filter::start() {
     ALOGV("%s", __FUNCTION__);
 
@@ -149,6 +177,11 @@ Return<Result> Filter::flush() {
     delete[] buffer;
     mFilterStatus = DemuxFilterStatus::DATA_READY;
 
+    std::lock_guard<std::mutex> lock(mFilterOutputLock);
+    if (mReassembler != nullptr) {
+        mReassembler->reset();
+    }
+
     return Result::SUCCESS;
 }
 
@@ -314,18 +347,17 @@ uint16_t Filter::getTpid() {
     return mTpid;
 }
 
-void Filter::updateFilterOutput(vector<uint8_t> data) {
+void Filter::updateFilterOutput(const uint8_t* data, size_t size) {
     std::lock_guard<std::mutex> lock(mFilterOutputLock);
-    mFilterOutput.insert(mFilterOutput.end(), data.begin(), data.end());
+    mFilterOutput.insert(mFilterOutput.end(), data, data + size);
 }
 
-void Filter::updateRecordOutput(vector<uint8_t> data) {
+void Filter::updateRecordOutput(const uint8_t* data, size_t size) {
     std::lock_guard<std::mutex> lock(mRecordFilterOutputLock);
-    mRecordFilterOutput.insert(mRecordFilterOutput.end(), data.begin(), data.end());
+    mRecordFilterOutput.insert(mRecordFilterOutput.end(), data, data + size);
 }
 
 Result Filter::startFilterHandler() {
-    std::lock_guard<std::mutex> lock(mFilterOutputLock);
     switch (mType.mainType) {
         case DemuxFilterMainType::TS:
             switch (mType.subType.tsFilterType()) {
@@ -373,69 +405,37 @@ Result Filter::startFilterHandler() {
 }
 
 Result Filter::startSectionFilterHandler() {
-    if (mFilterOutput.empty()) {
-        return Result::SUCCESS;
-    }
-    if (!writeSectionsAndCreateEvent(mFilterOutput)) {
-        ALOGD("[Filter] filter %d fails to write into FMQ. Ending thread", mFilterId);
-        return Result::UNKNOWN_ERROR;
-    }
+    std::lock_guard<std::mutex> lock(mFilterEventLock);
+    reassembleFilterOutput();
+    for (const TsReassembler::Unit& unit : mUnits) {
+        DemuxFilterSectionEvent secEvent;
+        secEvent = {
+                .tableId = unit.id,
+                .version = unit.version,
+                .sectionNum = unit.sectionNum,
+                .dataLength = static_cast<uint16_t>(unit.size),
+        };
+        if (DEBUG_FILTER) {
+            ALOGD("[Filter] assembled section data length %d", secEvent.dataLength);
+        }
 
-    mFilterOutput.clear();
+        int size = mFilterEvent.events.size();
+        mFilterEvent.events.resize(size + 1);
+        mFilterEvent.events[size].section(secEvent);
+    }
+    mUnits.clear();
 
     return Result::SUCCESS;
 }
 
 Result Filter::startPesFilterHandler() {
     std::lock_guard<std::mutex> lock(mFilterEventLock);
-    if (mFilterOutput.empty()) {
-        return Result::SUCCESS;
-    }
-
-    for (int i = 0; i < mFilterOutput.size(); i += 188) {
-        if (mPesSizeLeft == 0) {
-            uint32_t prefix = (mFilterOutput[i + 4] << 16) | (mFilterOutput[i + 5] << 8) |
-                              mFilterOutput[i + 6];
-            if (DEBUG_FILTER) {
-                ALOGD("[Filter] prefix %d", prefix);
-            }
-            if (prefix == 0x000001) {
-                // TODO handle mulptiple Pes filters
-                mPesSizeLeft = (mFilterOutput[i + 8] << 8) | mFilterOutput[i + 9];
-                mPesSizeLeft += 6;
-                if (DEBUG_FILTER) {
-                    ALOGD("[Filter] pes data length %d", mPesSizeLeft);
-                }
-            } else {
-                continue;
-            }
-        }
-
-        int endPoint = min(184, mPesSizeLeft);
-        // append data and check size
-        vector<uint8_t>::const_iterator first = mFilterOutput.begin() + i + 4;
-        vector<uint8_t>::const_iterator last = mFilterOutput.begin() + i + 4 + endPoint;
-        mPesOutput.insert(mPesOutput.end(), first, last);
-        // size does not match then continue
-        mPesSizeLeft -= endPoint;
-        if (DEBUG_FILTER) {
-            ALOGD("[Filter] pes data left %d", mPesSizeLeft);
-        }
-        if (mPesSizeLeft > 0) {
-            continue;
-        }
-        // size match then create event
-        if (!writeDataToFilterMQ(mPesOutput)) {
-            ALOGD("[Filter] pes data write failed");
-            mFilterOutput.clear();
-            return Result::INVALID_STATE;
-        }
-        maySendFilterStatusCallback();
+    reassembleFilterOutput();
+    for (const TsReassembler::Unit& unit : mUnits) {
         DemuxFilterPesEvent pesEvent;
         pesEvent = {
-                // temp dump meta data
-                .streamId = mPesOutput[3],
-                .dataLength = static_cast<uint16_t>(mPesOutput.size()),
+                .streamId = unit.id,
+                .dataLength = static_cast<uint16_t>(unit.size),
         };
         if (DEBUG_FILTER) {
             ALOGD("[Filter] assembled pes data length %d", pesEvent.dataLength);
@@ -444,21 +444,23 @@ Result Filter::startPesFilterHandler() {
         int size = mFilterEvent.events.size();
         mFilterEvent.events.resize(size + 1);
         mFilterEvent.events[size].pes(pesEvent);
-        mPesOutput.clear();
     }
-
-    mFilterOutput.clear();
+    mUnits.clear();
 
     return Result::SUCCESS;
 }
 
 Result Filter::startTsFilterHandler() {
-    // TODO handle starting TS filter
+    std::lock_guard<std::mutex> lock(mFilterEventLock);
+    // The TS packets go to the filter FMQ as they are, without any filter event
+    reassembleFilterOutput();
+    mUnits.clear();
     return Result::SUCCESS;
 }
 
 Result Filter::startMediaFilterHandler() {
     std::lock_guard<std::mutex> lock(mFilterEventLock);
+    std::lock_guard<std::mutex> outputLock(mFilterOutputLock);
     if (mFilterOutput.empty()) {
         return Result::SUCCESS;
     }
@@ -567,33 +569,20 @@ Result Filter::startTemiFilterHandler() {
     return Result::SUCCESS;
 }
 
-bool Filter::writeSectionsAndCreateEvent(vector<uint8_t> data) {
-    // TODO check how many sections has been read
-    ALOGD("[Filter] section handler");
-    std::lock_guard<std::mutex> lock(mFilterEventLock);
-    if (!writeDataToFilterMQ(data)) {
-        return false;
-    }
-    int size = mFilterEvent.events.size();
-    mFilterEvent.events.resize(size + 1);
-    DemuxFilterSectionEvent secEvent;
-    secEvent = {
-            // temp dump meta data
-            .tableId = 0,
-            .version = 1,
-            .sectionNum = 1,
-            .dataLength = static_cast<uint16_t>(data.size()),
-    };
-    mFilterEvent.events[size].section(secEvent);
-    return true;
-}
-
-bool Filter::writeDataToFilterMQ(const std::vector<uint8_t>& data) {
-    std::lock_guard<std::mutex> lock(mWriteLock);
-    if (mFilterMQ->write(data.data(), data.size())) {
-        return true;
+void Filter::reassembleFilterOutput() {
+    {
+        // configure() and flush() replace and reset mReassembler under the same lock
+        std::lock_guard<std::mutex> lock(mFilterOutputLock);
+        if (mFilterOutput.empty()) {
+            return;
+        }
+        if (mReassembler != nullptr) {
+            std::lock_guard<std::mutex> writeLock(mWriteLock);
+            mReassembler->process(mFilterOutput.data(), mFilterOutput.size(), &mUnits);
+        }
+        mFilterOutput.clear();
     }
-    return false;
+    maySendFilterStatusCallback();
 }
 
 void Filter::attachFilterToRecord(const sp<Dvr> dvr) {
@@ -25,6 +25,7 @@
 #include "Demux.h"
 #include "Dvr.h"
 #include "Frontend.h"
+#include "TsReassembler.h"
 
 using namespace std;
 
@@ -82,8 +83,12 @@ class Filter : public IFilter {
      */
     bool createFilterMQ();
     uint16_t getTpid();
-    void updateFilterOutput(vector<uint8_t> data);
-    void updateRecordOutput(vector<uint8_t> data);
+    /**
+     * Append a TS packet to the filter output. The packet is copied, so it only needs to stay
+     * valid for the duration of the call.
+     */
+    void updateFilterOutput(const uint8_t* data, size_t size);
+    void updateRecordOutput(const uint8_t* data, size_t size);
     Result startFilterHandler();
     Result startRecordFilterHandler();
     void attachFilterToRecord(const sp<Dvr> dvr);
@@ -152,11 +157,15 @@ class Filter : public IFilter {
     Result startPcrFilterHandler();
     Result startTemiFilterHandler();
     Result startFilterLoop();
+    void configureReassembler(const DemuxTsFilterSettings& settings);
 
     void deleteEventFlag();
-    bool writeDataToFilterMQ(const std::vector<uint8_t>& data);
     bool readDataFromMQ();
-    bool writeSectionsAndCreateEvent(vector<uint8_t> data);
+    /**
+     * Reassemble the filter output into the filter FMQ and collect the written units into mUnits.
+     * Takes mFilterOutputLock, and must be called with mFilterEventLock held.
+     */
+    void reassembleFilterOutput();
     void maySendFilterStatusCallback();
     DemuxFilterStatus checkFilterStatusChange(uint32_t availableToWrite, uint32_t availableToRead,
                                               uint32_t highThreshold, uint32_t lowThreshold);
@@ -190,6 +199,16 @@ class Filter : public IFilter {
     std::mutex mFilterOutputLock;
     std::mutex mRecordFilterOutputLock;
 
+    /**
+     * Reassembler of the section, PES and TS filter output, created on configure.
+     * Protected by mFilterOutputLock, which is taken after mFilterEventLock.
+     */
+    unique_ptr<TsReassembler> mReassembler;
+    /**
+     * Units reassembled but not yet turned into filter events. Protected by mFilterEventLock.
+     */
+    vector<TsReassembler::Unit> mUnits;
+
     // temp handle single PES filter
     // TODO handle mulptiple Pes filters
     int mPesSizeLeft = 0;
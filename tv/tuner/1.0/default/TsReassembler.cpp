@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TsReassembler.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+namespace V1_0 {
+namespace implementation {
+
+namespace {
+
+constexpr uint8_t kTsSyncByte = 0x47;
+constexpr size_t kSectionHeaderSize = 3;
+constexpr size_t kPesHeaderSize = 6;
+// table_id up to section_number and the CRC32 of a section with the long syntax
+constexpr size_t kMinLongSectionSize = 8 + 4;
+
+struct Crc32Table {
+    uint32_t values[256];
+};
+
+constexpr Crc32Table makeCrc32Table() {
+    Crc32Table table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+        table.values[i] = crc;
+    }
+    return table;
+}
+
+constexpr Crc32Table kCrc32Table = makeCrc32Table();
+
+}  // namespace
+
+TsReassembler::TsReassembler(Mode mode, FilterMQ* filterMQ, bool checkCrc)
+    : mMode(mode),
+      mFilterMQ(filterMQ),
+      mCheckCrc(checkCrc),
+      mHeaderSize(mode == Mode::SECTION ? kSectionHeaderSize : kPesHeaderSize),
+      mIdleState(mode == Mode::SECTION ? State::IDLE : State::WAIT_START) {
+    if (mMode == Mode::PES) {
+        mStorage.reset(new uint8_t[kMaxPesSize]);
+    }
+}
+
+uint32_t TsReassembler::crc32(const uint8_t* data, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ kCrc32Table.values[((crc >> 24) ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+void TsReassembler::process(const uint8_t* data, size_t size, vector<Unit>* units) {
+    if (mMode == Mode::TS) {
+        processTsPackets(data, size);
+        return;
+    }
+    for (size_t offset = 0; offset + kTsPacketSize <= size; offset += kTsPacketSize) {
+        processPacket(data + offset, units);
+    }
+}
+
+void TsReassembler::reset() {
+    mState = State::WAIT_START;
+    mLastCc = -1;
+}
+
+void TsReassembler::processPacket(const uint8_t* packet, vector<Unit>* units) {
+    mStats.packets++;
+    if (packet[0] != kTsSyncByte || (packet[1] & 0x80)) {
+        // The payload of this packet is lost, and so is the unit it belongs to
+        mStats.invalidPackets++;
+        dropUnit();
+        mLastCc = -1;
+        return;
+    }
+    bool unitStart = packet[1] & 0x40;
+    uint8_t adaptationFieldControl = (packet[3] >> 4) & 0x3;
+    int cc = packet[3] & 0x0f;
+
+    size_t offset = 4;
+    bool discontinuity = false;
+    if (adaptationFieldControl & 0x2) {
+        size_t adaptationFieldLength = packet[4];
+        offset += 1 + adaptationFieldLength;
+        if (offset > kTsPacketSize) {
+            mStats.invalidPackets++;
+            dropUnit();
+            mLastCc = -1;
+            return;
+        }
+        discontinuity = adaptationFieldLength > 0 && (packet[5] & 0x80);
+    }
+    if (!(adaptationFieldControl & 0x1)) {
+        // The continuity counter only increments on packets with payload
+        return;
+    }
+
+    if (mLastCc >= 0 && !discontinuity) {
+        if (cc == mLastCc) {
+            mStats.duplicatePackets++;
+            return;
+        }
+        if (cc != ((mLastCc + 1) & 0x0f)) {
+            mStats.ccErrors++;
+            dropUnit();
+        }
+    }
+    mLastCc = cc;
+
+    if (offset == kTsPacketSize) {
+        return;
+    }
+    if (mMode == Mode::SECTION) {
+        processSectionPayload(packet + offset, kTsPacketSize - offset, unitStart, units);
+    } else {
+        processPesPayload(packet + offset, kTsPacketSize - offset, unitStart, units);
+    }
+}
+
+void TsReassembler::processSectionPayload(const uint8_t* payload, size_t size, bool unitStart,
+                                          vector<Unit>* units) {
+    if (unitStart) {
+        size_t pointerField = payload[0];
+        payload++;
+        size--;
+        if (pointerField > size) {
+            mStats.invalidPackets++;
+            dropUnit();
+            return;
+        }
+        // The bytes before the pointed one end the section started in the previous packets
+        if (isUnitInProgress()) {
+            appendToUnit(payload, pointerField, units);
+            if (isUnitInProgress()) {
+                dropUnit();
+            }
+        }
+        payload += pointerField;
+        size -= pointerField;
+        mState = State::IDLE;
+    } else if (!isUnitInProgress()) {
+        // A section can only start in a packet with payload_unit_start_indicator
+        return;
+    }
+
+    while (size > 0) {
+        if (mState == State::IDLE) {
+            if (payload[0] == 0xff || !unitStart) {
+                // Stuffing up to the end of the packet
+                return;
+            }
+            startUnit();
+        }
+        size_t length = appendToUnit(payload, size, units);
+        payload += length;
+        size -= length;
+        if (mState == State::WAIT_START) {
+            return;
+        }
+    }
+}
+
+void TsReassembler::processPesPayload(const uint8_t* payload, size_t size, bool unitStart,
+                                      vector<Unit>* units) {
+    if (unitStart) {
+        // A PES packet of unbounded length ends where the next one starts
+        if (mState == State::UNBOUNDED) {
+            finishUnboundedUnit(units);
+        } else {
+            dropUnit();
+        }
+        startUnit();
+    } else if (!isUnitInProgress()) {
+        return;
+    }
+    // Anything after the end of a PES packet of known length is stuffing
+    appendToUnit(payload, size, units);
+}
+
+void TsReassembler::processTsPackets(const uint8_t* data, size_t size) {
+    size_t count = size / kTsPacketSize;
+    if (count == 0) {
+        return;
+    }
+    mStats.packets += count;
+    if (!mFilterMQ->beginWrite(count * kTsPacketSize, &mTx)) {
+        mStats.overflows += count;
+        return;
+    }
+    mTx.copyTo(data, 0, count * kTsPacketSize);
+    mFilterMQ->commitWrite(count * kTsPacketSize);
+    mStats.units += count;
+}
+
+void TsReassembler::startUnit() {
+    mState = State::HEADER;
+    mUnitSize = 0;
+    mUnitOffset = 0;
+}
+
+size_t TsReassembler::appendToUnit(const uint8_t* data, size_t size, vector<Unit>* units) {
+    size_t consumed = 0;
+    if (mState == State::HEADER) {
+        consumed = std::min(size, mHeaderSize - mUnitOffset);
+        memcpy(mHeader + mUnitOffset, data, consumed);
+        mUnitOffset += consumed;
+        if (mUnitOffset < mHeaderSize) {
+            return consumed;
+        }
+        if (!beginUnitBody()) {
+            // Without a valid header there is no telling where the next unit starts
+            dropUnit();
+            return size;
+        }
+    }
+
+    size_t length;
+    switch (mState) {
+        case State::BODY:
+            length = std::min(size - consumed, mUnitSize - mUnitOffset);
+            mTx.copyTo(data + consumed, mUnitOffset, length);
+            if (mCheckUnitCrc) {
+                mCrc = crc32(data + consumed, length, mCrc);
+            }
+            break;
+        case State::UNBOUNDED:
+            length = size - consumed;
+            if (mUnitOffset + length > kMaxPesSize) {
+                mStats.overflows++;
+                mState = State::WAIT_START;
+                return size;
+            }
+            memcpy(mStorage.get() + mUnitOffset, data + consumed, length);
+            break;
+        case State::DISCARD:
+            length = std::min(size - consumed, mUnitSize - mUnitOffset);
+            break;
+        default:
+            return consumed;
+    }
+    mUnitOffset += length;
+    consumed += length;
+    if (mState != State::UNBOUNDED && mUnitOffset == mUnitSize) {
+        finishUnit(units);
+    }
+    return consumed;
+}
+
+bool TsReassembler::beginUnitBody() {
+    mCheckUnitCrc = false;
+    if (mMode == Mode::SECTION) {
+        mUnitSize = kSectionHeaderSize + (((mHeader[1] & 0x0f) << 8) | mHeader[2]);
+        bool longSyntax = mHeader[1] & 0x80;
+        if (mUnitSize > kMaxSectionSize || (longSyntax && mUnitSize < kMinLongSectionSize)) {
+            return false;
+        }
+        mCheckUnitCrc = mCheckCrc && longSyntax;
+    } else {
+        if (mHeader[0] != 0x00 || mHeader[1] != 0x00 || mHeader[2] != 0x01) {
+            return false;
+        }
+        size_t pesPacketLength = (mHeader[4] << 8) | mHeader[5];
+        if (pesPacketLength == 0) {
+            memcpy(mStorage.get(), mHeader, kPesHeaderSize);
+            mState = State::UNBOUNDED;
+            return true;
+        }
+        mUnitSize = kPesHeaderSize + pesPacketLength;
+        if (mUnitSize > kMaxPesSize) {
+            mStats.overflows++;
+            mState = State::DISCARD;
+            return true;
+        }
+    }
+
+    if (!mFilterMQ->beginWrite(mUnitSize, &mTx)) {
+        mStats.overflows++;
+        mState = State::DISCARD;
+        return true;
+    }
+    mTx.copyTo(mHeader, 0, mHeaderSize);
+    if (mCheckUnitCrc) {
+        mCrc = crc32(mHeader, mHeaderSize);
+    }
+    mState = State::BODY;
+    return true;
+}
+
+void TsReassembler::finishUnit(vector<Unit>* units) {
+    if (mState == State::DISCARD) {
+        mState = mIdleState;
+        return;
+    }
+
+    Unit unit = {
+            .size = static_cast<uint32_t>(mUnitSize),
+            .id = mMode == Mode::SECTION ? mHeader[0] : mHeader[3],
+            .version = 0,
+            .sectionNum = 0,
+    };
+    if (mMode == Mode::SECTION && (mHeader[1] & 0x80)) {
+        if (mCheckUnitCrc && mCrc != 0) {
+            mStats.crcErrors++;
+            mStats.droppedUnits++;
+            mState = mIdleState;
+            return;
+        }
+        uint8_t syntax[2];
+        mTx.copyFrom(syntax, 5, 2);
+        unit.version = (syntax[0] >> 1) & 0x1f;
+        unit.sectionNum = syntax[1];
+    }
+
+    mFilterMQ->commitWrite(mUnitSize);
+    mStats.units++;
+    units->push_back(unit);
+    mState = mIdleState;
+}
+
+void TsReassembler::finishUnboundedUnit(vector<Unit>* units) {
+    mState = mIdleState;
+    if (!mFilterMQ->beginWrite(mUnitOffset, &mTx)) {
+        mStats.overflows++;
+        return;
+    }
+    mTx.copyTo(mStorage.get(), 0, mUnitOffset);
+    mFilterMQ->commitWrite(mUnitOffset);
+    mStats.units++;
+    units->push_back({
+            .size = static_cast<uint32_t>(mUnitOffset),
+            .id = mStorage[3],
+            .version = 0,
+            .sectionNum = 0,
+    });
+}
+
+void TsReassembler::dropUnit() {
+    if (isUnitInProgress() && mState != State::DISCARD) {
+        mStats.droppedUnits++;
+    }
+    mState = State::WAIT_START;
+}
+
+bool TsReassembler::isUnitInProgress() const {
+    return mState == State::HEADER || mState == State::BODY || mState == State::UNBOUNDED ||
+           mState == State::DISCARD;
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_TV_TUNER_V1_0_TSREASSEMBLER_H_
+#define ANDROID_HARDWARE_TV_TUNER_V1_0_TSREASSEMBLER_H_
+
+#include <fmq/MessageQueue.h>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+namespace android {
+namespace hardware {
+namespace tv {
+namespace tuner {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+
+using FilterMQ = MessageQueue<uint8_t, kSynchronizedReadWrite>;
+
+/**
+ * Streaming reassembler of the TS packets of a single PID into the units a filter outputs.
+ *
+ * Packets may be fed in any number of calls; units spanning several calls are carried over.
+ * Once the size of a unit is known, its payload is copied from the TS packets straight into a
+ * write transaction on the filter FMQ, which is only committed when the unit is complete and
+ * valid. PES packets of unbounded length are staged in storage allocated once up front until
+ * the next unit starts.
+ *
+ * Not thread-safe. The caller must serialize the calls and be the only writer of the FMQ.
+ */
+class TsReassembler {
+  public:
+    enum class Mode {
+        /** PSI/SI sections, reassembled using the pointer field. */
+        SECTION,
+        /** PES packets. */
+        PES,
+        /** Whole TS packets, passed through as they are. */
+        TS,
+    };
+
+    /**
+     * A unit that has been committed to the FMQ.
+     */
+    struct Unit {
+        uint32_t size;
+        /** table_id of a section, or stream_id of a PES packet. */
+        uint8_t id;
+        /** version_number and section_number of a section with the long syntax. */
+        uint8_t version;
+        uint8_t sectionNum;
+    };
+
+    struct Stats {
+        uint64_t packets = 0;
+        uint64_t units = 0;
+        /** Packets that were not in sequence, not counting signalled discontinuities. */
+        uint64_t ccErrors = 0;
+        /** Packets repeated with the same continuity counter, which are skipped. */
+        uint64_t duplicatePackets = 0;
+        /** Packets without the sync byte, with transport_error_indicator or a bad header. */
+        uint64_t invalidPackets = 0;
+        /** Units dropped because of missing packets, a bad header or a bad CRC. */
+        uint64_t droppedUnits = 0;
+        uint64_t crcErrors = 0;
+        /**
+         * Units dropped because the FMQ did not have enough space left, or because they are
+         * larger than kMaxPesSize.
+         */
+        uint64_t overflows = 0;
+    };
+
+    static constexpr size_t kTsPacketSize = 188;
+    static constexpr size_t kMaxSectionSize = 4096;
+    /** Filter events report the size of a PES packet in 16 bits. */
+    static constexpr size_t kMaxPesSize = 0xffff;
+
+    /**
+     * @param mode What to reassemble.
+     * @param filterMQ FMQ the units are written into. Must outlive the reassembler.
+     * @param checkCrc Whether to drop sections with the long syntax whose CRC32 does not match.
+     */
+    TsReassembler(Mode mode, FilterMQ* filterMQ, bool checkCrc);
+
+    /**
+     * Reassemble whole TS packets, write the completed units into the FMQ and append them to
+     * units.
+     */
+    void process(const uint8_t* data, size_t size, vector<Unit>* units);
+
+    /**
+     * Drop the unit in progress, e.g. when the filter is flushed.
+     */
+    void reset();
+
+    const Stats& getStats() const { return mStats; }
+
+    /**
+     * CRC32 as used by MPEG-2 sections: polynomial 0x04c11db7, most significant bit first and
+     * no final XOR. A section with a correct CRC32 has a CRC32 of 0 over all its bytes.
+     */
+    static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0xffffffff);
+
+  private:
+    enum class State {
+        /** Waiting for a packet with payload_unit_start_indicator. */
+        WAIT_START,
+        /** Between two sections of the same payload. */
+        IDLE,
+        /** Collecting the header, which tells the size of the unit. */
+        HEADER,
+        /** Copying the unit into the FMQ write transaction. */
+        BODY,
+        /** Copying a PES packet of unbounded length into mStorage. */
+        UNBOUNDED,
+        /** Skipping a unit the FMQ does not have space for. */
+        DISCARD,
+    };
+
+    void processPacket(const uint8_t* packet, vector<Unit>* units);
+    void processSectionPayload(const uint8_t* payload, size_t size, bool unitStart,
+                               vector<Unit>* units);
+    void processPesPayload(const uint8_t* payload, size_t size, bool unitStart,
+                           vector<Unit>* units);
+    void processTsPackets(const uint8_t* data, size_t size);
+
+    void startUnit();
+    /** Returns how many bytes of data belong to the unit in progress. */
+    size_t appendToUnit(const uint8_t* data, size_t size, vector<Unit>* units);
+    /** Returns false if the header is not valid. */
+    bool beginUnitBody();
+    void finishUnit(vector<Unit>* units);
+    void finishUnboundedUnit(vector<Unit>* units);
+    void dropUnit();
+    bool isUnitInProgress() const;
+
+    const Mode mMode;
+    FilterMQ* const mFilterMQ;
+    const bool mCheckCrc;
+    const size_t mHeaderSize;
+    // State to return to after a unit is complete
+    const State mIdleState;
+
+    State mState = State::WAIT_START;
+    int mLastCc = -1;
+    uint8_t mHeader[6];
+    size_t mUnitSize = 0;
+    size_t mUnitOffset = 0;
+    // Whether the unit in progress is a section whose CRC32 is checked
+    bool mCheckUnitCrc = false;
+    uint32_t mCrc = 0;
+    FilterMQ::MemTransaction mTx;
+    // Only allocated in PES mode
+    unique_ptr<uint8_t[]> mStorage;
+
+    Stats mStats;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace tuner
+}  // namespace tv
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_TV_TUNER_V1_0_TSREASSEMBLER_H_
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the throughput of the filter reassembler over recorded TS files:
+//
+//   android.hardware.tv.tuner@1.0-ts_reassembler_benchmark [--benchmark_...] file.ts...
+//
+// Every PID of a file is split out as the demux PID table would, and reassembled into PES
+// packets or sections depending on what its first payload starts with. Without any file, a
+// synthetic stream of video and audio PES packets and PAT sections is used instead.
+
+#include "TsReassembler.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using ::android::hardware::tv::tuner::V1_0::implementation::FilterMQ;
+using ::android::hardware::tv::tuner::V1_0::implementation::TsReassembler;
+
+namespace {
+
+constexpr size_t kPacketSize = TsReassembler::kTsPacketSize;
+constexpr uint8_t kSyncByte = 0x47;
+constexpr uint16_t kNullPid = 0x1fff;
+// Packets handed to a filter handler at once
+constexpr size_t kBatchPackets = 64;
+constexpr size_t kFilterMQSize = 1024 * 1024;
+
+struct PidStream {
+    TsReassembler::Mode mode;
+    std::vector<uint8_t> packets;
+};
+
+uint16_t getPid(const uint8_t* packet) {
+    return ((packet[1] & 0x1f) << 8) | packet[2];
+}
+
+// Returns the offset of the payload, or kPacketSize if the packet does not have any.
+size_t getPayloadOffset(const uint8_t* packet) {
+    size_t offset = 4;
+    if (packet[3] & 0x20) {
+        offset += 1 + packet[4];
+    }
+    return (packet[3] & 0x10) ? std::min(offset, kPacketSize) : kPacketSize;
+}
+
+std::vector<PidStream> splitByPid(const std::vector<uint8_t>& ts) {
+    std::map<uint16_t, PidStream> streams;
+    for (size_t offset = 0; offset + kPacketSize <= ts.size(); offset += kPacketSize) {
+        const uint8_t* packet = ts.data() + offset;
+        uint16_t pid = getPid(packet);
+        if (packet[0] != kSyncByte || pid == kNullPid) {
+            continue;
+        }
+        auto it = streams.find(pid);
+        if (it == streams.end()) {
+            size_t payload = getPayloadOffset(packet);
+            if (!(packet[1] & 0x40) || payload + 4 > kPacketSize) {
+                // Wait for the first unit to start to tell what the PID carries
+                continue;
+            }
+            bool isPes = packet[payload] == 0x00 && packet[payload + 1] == 0x00 &&
+                         packet[payload + 2] == 0x01;
+            it = streams.emplace(pid, PidStream{isPes ? TsReassembler::Mode::PES
+                                                      : TsReassembler::Mode::SECTION,
+                                                {}})
+                         .first;
+        }
+        it->second.packets.insert(it->second.packets.end(), packet, packet + kPacketSize);
+    }
+
+    std::vector<PidStream> result;
+    for (auto& stream : streams) {
+        result.push_back(std::move(stream.second));
+    }
+    return result;
+}
+
+std::vector<uint8_t> readFile(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+    // Skip to the first packet
+    size_t start = 0;
+    while (start < kPacketSize && start < data.size() && data[start] != kSyncByte) {
+        start++;
+    }
+    data.erase(data.begin(), data.begin() + start);
+    return data;
+}
+
+// Splits the units of one PID into TS packets, filling the last packet of each unit with an
+// adaptation field as a multiplexer does.
+class Packetizer {
+  public:
+    explicit Packetizer(uint16_t pid) : mPid(pid) {}
+
+    void write(const std::vector<uint8_t>& unit, std::vector<uint8_t>* ts) {
+        for (size_t offset = 0; offset < unit.size();) {
+            size_t size = std::min(unit.size() - offset, kPacketSize - 4);
+            uint8_t packet[kPacketSize];
+            packet[0] = kSyncByte;
+            packet[1] = (offset == 0 ? 0x40 : 0x00) | (mPid >> 8);
+            packet[2] = mPid & 0xff;
+            size_t adaptationSize = kPacketSize - 4 - size;
+            packet[3] = (adaptationSize > 0 ? 0x30 : 0x10) | mCc;
+            if (adaptationSize > 0) {
+                packet[4] = adaptationSize - 1;
+                std::fill(packet + 5, packet + 4 + adaptationSize, 0xff);
+                if (adaptationSize > 1) {
+                    packet[5] = 0x00;
+                }
+            }
+            std::copy(unit.begin() + offset, unit.begin() + offset + size,
+                      packet + 4 + adaptationSize);
+            ts->insert(ts->end(), packet, packet + kPacketSize);
+            mCc = (mCc + 1) & 0x0f;
+            offset += size;
+        }
+    }
+
+  private:
+    const uint16_t mPid;
+    uint8_t mCc = 0;
+};
+
+std::vector<uint8_t> makePes(uint8_t streamId, size_t size, bool unbounded) {
+    size_t length = unbounded ? 0 : size - 6;
+    std::vector<uint8_t> pes = {0x00, 0x00, 0x01, streamId, static_cast<uint8_t>(length >> 8),
+                                static_cast<uint8_t>(length & 0xff)};
+    for (size_t i = pes.size(); i < size; i++) {
+        pes.push_back(i * 31);
+    }
+    return pes;
+}
+
+std::vector<uint8_t> makePat() {
+    // Section header, then one program, then the CRC32
+    std::vector<uint8_t> pat = {0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+                                0x00, 0x01, 0xe1, 0x00};
+    uint32_t crc = TsReassembler::crc32(pat.data(), pat.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        pat.push_back((crc >> shift) & 0xff);
+    }
+    // pointer_field
+    pat.insert(pat.begin(), 0x00);
+    return pat;
+}
+
+// About one second of a 10 Mbps program.
+std::vector<uint8_t> synthesizeStream() {
+    std::vector<uint8_t> ts;
+    Packetizer video(0x100), audio(0x101), pat(0x000);
+    for (int frame = 0; frame < 30; frame++) {
+        pat.write(makePat(), &ts);
+        video.write(makePes(0xe0, 40000, true /* unbounded */), &ts);
+        audio.write(makePes(0xc0, 1500, false /* unbounded */), &ts);
+    }
+    return ts;
+}
+
+void BM_Reassemble(benchmark::State& state, const std::vector<PidStream>* streams) {
+    std::vector<std::unique_ptr<FilterMQ>> filterMQs;
+    std::vector<std::unique_ptr<TsReassembler>> reassemblers;
+    size_t bytesPerIteration = 0;
+    for (const PidStream& stream : *streams) {
+        filterMQs.push_back(std::make_unique<FilterMQ>(kFilterMQSize, false));
+        reassemblers.push_back(std::make_unique<TsReassembler>(
+                stream.mode, filterMQs.back().get(), true /* checkCrc */));
+        bytesPerIteration += stream.packets.size();
+    }
+
+    std::vector<TsReassembler::Unit> units;
+    for (auto _ : state) {
+        for (size_t i = 0; i < streams->size(); i++) {
+            const std::vector<uint8_t>& packets = (*streams)[i].packets;
+            reassemblers[i]->reset();
+            for (size_t offset = 0; offset < packets.size();
+                 offset += kBatchPackets * kPacketSize) {
+                size_t size = std::min(packets.size() - offset, kBatchPackets * kPacketSize);
+                reassemblers[i]->process(packets.data() + offset, size, &units);
+                units.clear();
+
+                // Consume the units as the client would, without copying them out
+                FilterMQ::MemTransaction tx;
+                size_t available = filterMQs[i]->availableToRead();
+                if (filterMQs[i]->beginRead(available, &tx)) {
+                    filterMQs[i]->commitRead(available);
+                }
+            }
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+    uint64_t numUnits = 0, numDropped = 0;
+    for (const auto& reassembler : reassemblers) {
+        numUnits += reassembler->getStats().units;
+        numDropped += reassembler->getStats().droppedUnits + reassembler->getStats().overflows;
+    }
+    state.counters["units"] = benchmark::Counter(numUnits, benchmark::Counter::kIsRate);
+    state.counters["dropped_units"] = numDropped;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+
+    // What is left after the benchmark flags are the recorded TS files
+    std::vector<std::pair<std::string, std::vector<PidStream>>> inputs;
+    for (int i = 1; i < argc; i++) {
+        inputs.emplace_back(argv[i], splitByPid(readFile(argv[i])));
+    }
+    if (inputs.empty()) {
+        inputs.emplace_back("synthetic", splitByPid(synthesizeStream()));
+    }
+    for (auto& input : inputs) {
+        benchmark::RegisterBenchmark(("BM_Reassemble/" + input.first).c_str(), BM_Reassemble,
+                                     &input.second);
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "TsReassembler.h"
+
+using ::android::hardware::tv::tuner::V1_0::implementation::FilterMQ;
+using ::android::hardware::tv::tuner::V1_0::implementation::TsReassembler;
+using std::vector;
+
+namespace {
+
+constexpr size_t kTsPacketSize = TsReassembler::kTsPacketSize;
+constexpr size_t kTsPayloadSize = kTsPacketSize - 4;
+constexpr size_t kFilterMQSize = 256 * 1024;
+
+/**
+ * Packetizes units into the TS packets of a single PID. Each packet is kept apart so that tests
+ * can drop, repeat or reorder them.
+ */
+class TsWriter {
+  public:
+    /** Appends a packet, padding a short payload with adaptation field stuffing. */
+    void writePacket(const uint8_t* payload, size_t size, bool unitStart) {
+        vector<uint8_t> packet(kTsPacketSize, 0xff);
+        packet[0] = 0x47;
+        packet[1] = unitStart ? 0x40 : 0x00;
+        packet[2] = 0x00;
+        size_t offset = 4;
+        if (size < kTsPayloadSize) {
+            size_t adaptationFieldLength = kTsPayloadSize - size - 1;
+            packet[3] = 0x30 | mCc;
+            packet[4] = adaptationFieldLength;
+            if (adaptationFieldLength > 0) {
+                packet[5] = 0x00;  // No discontinuity_indicator or other flags
+            }
+            offset += 1 + adaptationFieldLength;
+        } else {
+            packet[3] = 0x10 | mCc;
+        }
+        memcpy(packet.data() + offset, payload, size);
+        packets.push_back(packet);
+        mCc = (mCc + 1) & 0x0f;
+    }
+
+    void writePes(const vector<uint8_t>& pes) {
+        for (size_t offset = 0; offset < pes.size(); offset += kTsPayloadSize) {
+            writePacket(pes.data() + offset, std::min(kTsPayloadSize, pes.size() - offset),
+                        offset == 0);
+        }
+    }
+
+    /** Writes sections back to back, with a pointer field in each packet a section starts in. */
+    void writeSections(const vector<vector<uint8_t>>& sections) {
+        vector<uint8_t> stream;
+        vector<size_t> starts;
+        for (const vector<uint8_t>& section : sections) {
+            starts.push_back(stream.size());
+            stream.insert(stream.end(), section.begin(), section.end());
+        }
+        size_t offset = 0;
+        while (offset < stream.size()) {
+            auto start = std::find_if(starts.begin(), starts.end(), [offset](size_t start) {
+                return start >= offset && start < offset + kTsPayloadSize - 1;
+            });
+            uint8_t payload[kTsPayloadSize];
+            size_t size;
+            if (start != starts.end()) {
+                payload[0] = *start - offset;
+                size = std::min(kTsPayloadSize - 1, stream.size() - offset);
+                memcpy(payload + 1, stream.data() + offset, size);
+                writePacket(payload, size + 1, true);
+            } else {
+                size = std::min(kTsPayloadSize, stream.size() - offset);
+                writePacket(stream.data() + offset, size, false);
+            }
+            offset += size;
+        }
+    }
+
+    vector<vector<uint8_t>> packets;
+
+  private:
+    uint8_t mCc = 0;
+};
+
+/** Builds a section with the long syntax and a valid CRC32, unless badCrc is set. */
+vector<uint8_t> makeSection(uint8_t tableId, uint8_t version, uint8_t sectionNum, size_t bodySize,
+                            bool badCrc = false) {
+    // Everything after section_length: 5 bytes of syntax, the body and the CRC32
+    size_t sectionLength = 5 + bodySize + 4;
+    vector<uint8_t> section = {
+            tableId,
+            static_cast<uint8_t>(0xb0 | (sectionLength >> 8)),
+            static_cast<uint8_t>(sectionLength),
+            0x00,
+            0x01,
+            static_cast<uint8_t>(0xc1 | (version << 1)),
+            sectionNum,
+            sectionNum,
+    };
+    for (size_t i = 0; i < bodySize; i++) {
+        section.push_back(i * 7 + tableId);
+    }
+    uint32_t crc = TsReassembler::crc32(section.data(), section.size());
+    if (badCrc) {
+        crc ^= 1;
+    }
+    section.push_back(crc >> 24);
+    section.push_back(crc >> 16);
+    section.push_back(crc >> 8);
+    section.push_back(crc);
+    return section;
+}
+
+/** Builds a PES packet with `size` bytes after its 6 byte header. */
+vector<uint8_t> makePes(uint8_t streamId, size_t size, bool unbounded = false) {
+    size_t pesPacketLength = unbounded ? 0 : size;
+    vector<uint8_t> pes = {
+            0x00,
+            0x00,
+            0x01,
+            streamId,
+            static_cast<uint8_t>(pesPacketLength >> 8),
+            static_cast<uint8_t>(pesPacketLength),
+    };
+    for (size_t i = 0; i < size; i++) {
+        pes.push_back(i * 13 + streamId);
+    }
+    return pes;
+}
+
+}  // namespace
+
+class TsReassemblerTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mFilterMQ = std::make_unique<FilterMQ>(kFilterMQSize, false /* configureEventFlagWord */);
+        ASSERT_TRUE(mFilterMQ->isValid());
+    }
+
+    std::unique_ptr<TsReassembler> createReassembler(TsReassembler::Mode mode,
+                                                     bool checkCrc = false) {
+        return std::make_unique<TsReassembler>(mode, mFilterMQ.get(), checkCrc);
+    }
+
+    /** Feeds the packets one call at a time, so that units span several calls. */
+    vector<TsReassembler::Unit> process(TsReassembler* reassembler,
+                                        const vector<vector<uint8_t>>& packets) {
+        vector<TsReassembler::Unit> units;
+        for (const vector<uint8_t>& packet : packets) {
+            reassembler->process(packet.data(), packet.size(), &units);
+        }
+        return units;
+    }
+
+    vector<uint8_t> readFilterMQ() {
+        vector<uint8_t> data(mFilterMQ->availableToRead());
+        if (!data.empty()) {
+            EXPECT_TRUE(mFilterMQ->read(data.data(), data.size()));
+        }
+        return data;
+    }
+
+    std::unique_ptr<FilterMQ> mFilterMQ;
+};
+
+TEST_F(TsReassemblerTest, Crc32MatchesMpeg2CheckValue) {
+    const char* check = "123456789";
+    EXPECT_EQ(0x0376e6e7u,
+              TsReassembler::crc32(reinterpret_cast<const uint8_t*>(check), strlen(check)));
+}
+
+TEST_F(TsReassemblerTest, ReassemblesSectionSplitAcrossPackets) {
+    auto reassembler = createReassembler(TsReassembler::Mode::SECTION, true /* checkCrc */);
+    vector<uint8_t> section = makeSection(0x42, 3, 7, 500);
+    TsWriter writer;
+    writer.writeSections({section});
+    ASSERT_GT(writer.packets.size(), 2u);
+
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(1u, units.size());
+    EXPECT_EQ(section.size(), units[0].size);
+    EXPECT_EQ(0x42, units[0].id);
+    EXPECT_EQ(3, units[0].version);
+    EXPECT_EQ(7, units[0].sectionNum);
+    EXPECT_EQ(section, readFilterMQ());
+    EXPECT_EQ(0u, reassembler->getStats().droppedUnits);
+}
+
+TEST_F(TsReassemblerTest, ReassemblesSeveralSectionsPerPacket) {
+    auto reassembler = createReassembler(TsReassembler::Mode::SECTION, true /* checkCrc */);
+    vector<vector<uint8_t>> sections = {
+            makeSection(0x00, 1, 0, 20),
+            makeSection(0x02, 2, 1, 30),
+            makeSection(0x4e, 3, 2, 200),
+    };
+    TsWriter writer;
+    writer.writeSections(sections);
+
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(3u, units.size());
+    vector<uint8_t> expected;
+    for (size_t i = 0; i < sections.size(); i++) {
+        EXPECT_EQ(sections[i].size(), units[i].size);
+        EXPECT_EQ(sections[i][0], units[i].id);
+        EXPECT_EQ(i + 1, units[i].version);
+        EXPECT_EQ(i, units[i].sectionNum);
+        expected.insert(expected.end(), sections[i].begin(), sections[i].end());
+    }
+    EXPECT_EQ(expected, readFilterMQ());
+}
+
+TEST_F(TsReassemblerTest, RejectsSectionWithBadCrc) {
+    vector<uint8_t> good = makeSection(0x42, 0, 0, 100);
+    vector<uint8_t> bad = makeSection(0x42, 0, 1, 100, true /* badCrc */);
+    TsWriter writer;
+    writer.writeSections({bad, good});
+
+    auto reassembler = createReassembler(TsReassembler::Mode::SECTION, true /* checkCrc */);
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(1u, units.size());
+    EXPECT_EQ(0, units[0].sectionNum);
+    EXPECT_EQ(good, readFilterMQ());
+    EXPECT_EQ(1u, reassembler->getStats().crcErrors);
+    EXPECT_EQ(1u, reassembler->getStats().droppedUnits);
+
+    // Without isCheckCrc the section goes through
+    reassembler = createReassembler(TsReassembler::Mode::SECTION, false /* checkCrc */);
+    units = process(reassembler.get(), writer.packets);
+
+    EXPECT_EQ(2u, units.size());
+    EXPECT_EQ(0u, reassembler->getStats().crcErrors);
+}
+
+TEST_F(TsReassemblerTest, DropsUnitWithLostPacket) {
+    vector<uint8_t> first = makePes(0xe0, 500);
+    vector<uint8_t> second = makePes(0xe0, 300);
+    TsWriter writer;
+    writer.writePes(first);
+    writer.writePes(second);
+    ASSERT_EQ(5u, writer.packets.size());
+    // Lose the second packet of the first PES packet
+    writer.packets.erase(writer.packets.begin() + 1);
+
+    auto reassembler = createReassembler(TsReassembler::Mode::PES);
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(1u, units.size());
+    EXPECT_EQ(second.size(), units[0].size);
+    EXPECT_EQ(second, readFilterMQ());
+    EXPECT_EQ(1u, reassembler->getStats().ccErrors);
+    EXPECT_EQ(1u, reassembler->getStats().droppedUnits);
+}
+
+TEST_F(TsReassemblerTest, SkipsDuplicatePackets) {
+    vector<uint8_t> pes = makePes(0xc0, 500);
+    TsWriter writer;
+    writer.writePes(pes);
+    writer.packets.insert(writer.packets.begin() + 1, writer.packets[1]);
+
+    auto reassembler = createReassembler(TsReassembler::Mode::PES);
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(1u, units.size());
+    EXPECT_EQ(0xc0, units[0].id);
+    EXPECT_EQ(pes, readFilterMQ());
+    EXPECT_EQ(1u, reassembler->getStats().duplicatePackets);
+    EXPECT_EQ(0u, reassembler->getStats().ccErrors);
+}
+
+TEST_F(TsReassemblerTest, ReassemblesUnboundedPes) {
+    vector<uint8_t> unbounded = makePes(0xe0, 1000, true /* unbounded */);
+    vector<uint8_t> next = makePes(0xe0, 100, true /* unbounded */);
+    TsWriter writer;
+    writer.writePes(unbounded);
+    writer.writePes(next);
+
+    auto reassembler = createReassembler(TsReassembler::Mode::PES);
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    // An unbounded PES packet only ends where the next one starts
+    ASSERT_EQ(1u, units.size());
+    EXPECT_EQ(unbounded.size(), units[0].size);
+    EXPECT_EQ(unbounded, readFilterMQ());
+}
+
+TEST_F(TsReassemblerTest, DropsPesLargerThanFilterEventsReport) {
+    vector<uint8_t> bounded = makePes(0xe0, 0xffff);
+    vector<uint8_t> unbounded = makePes(0xe0, 0x10000, true /* unbounded */);
+    vector<uint8_t> last = makePes(0xe0, 100);
+    TsWriter writer;
+    writer.writePes(bounded);
+    writer.writePes(unbounded);
+    writer.writePes(makePes(0xe0, 0, true /* unbounded */));
+    writer.writePes(last);
+
+    auto reassembler = createReassembler(TsReassembler::Mode::PES);
+    vector<TsReassembler::Unit> units = process(reassembler.get(), writer.packets);
+
+    ASSERT_EQ(2u, units.size());
+    EXPECT_EQ(6u, units[0].size);
+    EXPECT_EQ(last.size(), units[1].size);
+    EXPECT_EQ(2u, reassembler->getStats().overflows);
+}